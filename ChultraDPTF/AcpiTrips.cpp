@@ -0,0 +1,93 @@
+//
+//  AcpiTrips.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "AcpiTrips.hpp"
+
+#include <string.h>
+
+static const char *acpiActiveTripNames[ChultraACPIUtils::AcpiActiveTripCount] = {
+    "_AC0", "_AC1", "_AC2", "_AC3", "_AC4", "_AC5", "_AC6", "_AC7", "_AC8", "_AC9",
+};
+
+void ChultraACPIUtils::acpiParseActiveTrips(ActiveTrips *trips, AcpiIntegerReader read, void *context) {
+    uint32_t temp;
+
+    // Grab Hysteresis value for downgrading state, keeping any override on reload
+    bool overridden = trips->hysteresis != trips->firmwareHysteresis;
+    (void) read(context, "GTSH", &trips->firmwareHysteresis);
+    if (!overridden) trips->hysteresis = trips->firmwareHysteresis;
+
+    // Read all the _ACx methods to get trip points for active policy.
+    // These give us temperatures at which we should increase fan speed.
+    // 0 is the highest fan speed, while 1-9 are increasing slower.
+
+    memset(trips->points, 0, sizeof(trips->points));
+    for (uint32_t i = 0; i < AcpiActiveTripCount; i++) {
+        // Not all 10 methods are guaranteed to be here, stop at the first one that isn't
+        if (!read(context, acpiActiveTripNames[i], &temp)) break;
+
+        trips->points[i] = acpiTempToCelsius(temp) + 130;
+    }
+}
+
+void ChultraACPIUtils::acpiParseLimitTrips(LimitTrips *trips, AcpiIntegerReader read, void *context) {
+    uint32_t temp;
+
+    // Both are optional, a sensor without them just never limits anything
+    trips->passive = read(context, "_PSV", &temp) ? acpiTempToCelsius(temp) : 0;
+    trips->critical = read(context, "_CRT", &temp) ? acpiTempToCelsius(temp) : 0;
+}
+
+bool ChultraACPIUtils::acpiAuxTripWindow(const ActiveTrips *trips, const LimitTrips *limits, celsius_t temp, celsius_t band,
+                                         celsius_t *low, celsius_t *high) {
+    celsius_t coolest = temp + band;
+
+    // Deepest _ACx is the first one a warming sensor crosses
+    for (uint32_t i = 0; i < AcpiActiveTripCount && trips->points[i] != 0; i++) {
+        if (trips->points[i] < coolest) coolest = trips->points[i];
+    }
+
+    if (limits->passive != 0 && limits->passive < coolest) coolest = limits->passive;
+    if (limits->critical != 0 && limits->critical < coolest) coolest = limits->critical;
+
+    if (coolest <= temp) {
+        return false;
+    }
+
+    *low = temp > band ? temp - band : 0;
+    *high = coolest;
+    return true;
+}
+
+uint32_t ChultraACPIUtils::acpiActiveTripLevel(ActiveTrips *trips, celsius_t temp) {
+    uint32_t level = AcpiActiveTripCount;
+
+    // Walk through states from highest temp to lowest temp
+    for (uint32_t i = 0; i < AcpiActiveTripCount; i++) {
+        // Lowest speed, turn off fan
+        if (trips->points[i] == 0) break;
+
+        // When downgrading states, take into account hysteresis, for every cooler trip as well
+        if (i == trips->lastLevel) temp += trips->hysteresis;
+
+        // Highest state where we trip
+        if (temp > trips->points[i]) {
+            level = i;
+            break;
+        }
+    }
+
+    trips->lastLevel = level;
+    return level;
+}
+
+ChultraACPIUtils::celsius_t ChultraACPIUtils::acpiFilterTemp(TempFilter *filter, celsius_t temp) {
+    // Half the new reading each time, settles within a few samples
+    filter->value = filter->primed ? (filter->value + temp + 1) / 2 : temp;
+    filter->primed = true;
+    return filter->value;
+}
@@ -0,0 +1,78 @@
+//
+//  AcpiTrips.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef AcpiTrips_hpp
+#define AcpiTrips_hpp
+
+#include <stdint.h>
+
+//
+// Trip points and the tripped level walk shared by every sensor participant.
+// Methods are read through a callback, the device in the kext and a mocked
+// namespace on a host. No IOKit here, so this can be tested on a host.
+//
+namespace ChultraACPIUtils {
+    typedef uint32_t celsius_t;
+
+    // ACPI reports tenths of degrees Kelvin (xx.x)
+    inline celsius_t acpiTempToCelsius(uint32_t kelvin) {
+        return kelvin - 2732; //273.15 rounded up
+    }
+
+    inline uint32_t acpiCelsiusToTemp(celsius_t celsius) {
+        return celsius + 2732;
+    }
+
+    // Evaluates an integer method by name, e.g. "_AC0". False if it's missing or fails
+    typedef bool (*AcpiIntegerReader)(void *context, const char *method, uint32_t *value);
+
+    //
+    // Active trip points from _ACx, index 0 is the hottest.
+    // Level AcpiActiveTripCount means nothing is tripped.
+    //
+    constexpr uint32_t AcpiActiveTripCount = 10;
+
+    struct ActiveTrips {
+        celsius_t points[AcpiActiveTripCount];
+        celsius_t hysteresis {0};
+        celsius_t firmwareHysteresis {0};
+
+        // Start at lowest state until we first read temp
+        uint32_t lastLevel {AcpiActiveTripCount};
+    };
+
+    void acpiParseActiveTrips(ActiveTrips *trips, AcpiIntegerReader read, void *context);
+    uint32_t acpiActiveTripLevel(ActiveTrips *trips, celsius_t temp);
+
+    // Trips beyond active cooling in tenths of a degree, 0 where firmware has none
+    struct LimitTrips {
+        celsius_t passive {0};
+        celsius_t critical {0};
+    };
+
+    void acpiParseLimitTrips(LimitTrips *trips, AcpiIntegerReader read, void *context);
+
+    //
+    // Aux trips (PAT0 and PAT1) band either side of temp, so firmware's
+    // Notify(0x90) wakes the core before a stretched period would. The
+    // upper one never goes past the coolest trip the sensor has, the lower
+    // one is 0, off, if the band reaches below freezing. False if temp is
+    // already at or past that trip.
+    //
+    bool acpiAuxTripWindow(const ActiveTrips *trips, const LimitTrips *limits, celsius_t temp, celsius_t band,
+                           celsius_t *low, celsius_t *high);
+
+    // Smoothed _TMP for consumers that don't want every spike, trips still use raw readings
+    struct TempFilter {
+        celsius_t value {0};
+        bool primed {false};
+    };
+
+    celsius_t acpiFilterTemp(TempFilter *filter, celsius_t temp);
+}
+
+#endif /* AcpiTrips_hpp */
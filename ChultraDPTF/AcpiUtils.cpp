@@ -10,20 +10,204 @@
 
 //using namespace ChultraACPIUtils;
 
-IOReturn ChultraACPIUtils::acpiGetUInt32(IOACPIPlatformDevice *acpi, const char *methodName, uint32_t *toFill) {
-    OSObject *typeRet;
-    IOReturn ret = acpi->evaluateObject(methodName, &typeRet);
+static const char *acpiMethodNames[ChultraACPIUtils::AcpiMethodMax] = {
+    "_AC0", "_AC1", "_AC2", "_AC3", "_AC4", "_AC5", "_AC6", "_AC7", "_AC8", "_AC9",
+    "_TMP",
+    "GTSH",
+    "PTYP",
+    "_FIF",
+    "_FSL",
+    "IDSP",
+    "_ART",
+    "_TRT",
+    "_OSC",
+    "_FST",
+    "PPCC",
+    "_PSS",
+    "_TSS",
+    "PPSS",
+    "PPPC",
+    "SPPC",
+    "_FPS",
+    "_PSV",
+    "_CRT",
+    "PAT0",
+    "PAT1",
+};
+
+IOReturn ChultraACPIUtils::acpiDeviceInit(AcpiDevice *dev, IOACPIPlatformDevice *acpi) {
+    OSSafeReleaseNULL(dev->path);
+    dev->acpi = acpi;
+    dev->present = 0;
+    
+    for (uint32_t i = 0; i < AcpiMethodMax; i++) {
+        if (acpi->validateObject(acpiMethodNames[i]) == kIOReturnSuccess) {
+            dev->present |= (1ULL << i);
+        }
+    }
+    
+    dev->path = acpiGetPath(acpi);
+    if (dev->path == nullptr) {
+        return kIOReturnNotFound;
+    }
+    
+    IOLogDebug("%s: method mask 0x%llx", dev->path->getCStringNoCopy(), dev->present);
+    return kIOReturnSuccess;
+}
+
+void ChultraACPIUtils::acpiDeviceFree(AcpiDevice *dev) {
+    OSSafeReleaseNULL(dev->path);
+    dev->acpi = nullptr;
+    dev->present = 0;
+}
+
+IOReturn ChultraACPIUtils::acpiEvaluate(const AcpiDevice *dev, acpi_method_t method, OSObject **result, OSObject **params, uint32_t paramCount) {
+    if (!acpiHasMethod(dev, method)) {
+        return kIOReturnNotFound;
+    }
+    
+    return dev->acpi->evaluateObject(acpiMethodNames[method], result, params, paramCount);
+}
+
+IOReturn ChultraACPIUtils::acpiGetUInt32(const AcpiDevice *dev, acpi_method_t method, uint32_t *toFill) {
+    OSObject *typeRet = nullptr;
+    IOReturn ret = acpiEvaluate(dev, method, &typeRet);
     OSNumber *typeNum = OSDynamicCast(OSNumber, typeRet);
     
     if (ret != kIOReturnSuccess){
+        OSSafeReleaseNULL(typeRet);
         return ret;
     }
     
     if (typeRet == nullptr || typeNum == nullptr) {
+        OSSafeReleaseNULL(typeRet);
         return kIOReturnInvalid;
     }
     
     *toFill = typeNum->unsigned32BitValue();
+    OSSafeReleaseNULL(typeRet);
+    return kIOReturnSuccess;
+}
+
+static bool acpiReadInteger(void *context, const char *method, uint32_t *value) {
+    const ChultraACPIUtils::AcpiDevice *dev = static_cast<const ChultraACPIUtils::AcpiDevice *>(context);
+    
+    for (uint32_t i = 0; i < ChultraACPIUtils::AcpiMethodMax; i++) {
+        if (strcmp(acpiMethodNames[i], method) != 0) continue;
+        
+        ChultraACPIUtils::acpi_method_t known = static_cast<ChultraACPIUtils::acpi_method_t>(i);
+        if (!ChultraACPIUtils::acpiHasMethod(dev, known)) return false;
+        
+        if (ChultraACPIUtils::acpiGetUInt32(dev, known, value) != kIOReturnSuccess) {
+            IOLogError("%s: Failed to evaluate %s", dev->path->getCStringNoCopy(), method);
+            return false;
+        }
+        
+        return true;
+    }
+    
+    return false;
+}
+
+IOReturn ChultraACPIUtils::acpiReadActiveTrips(const AcpiDevice *dev, ActiveTrips *trips) {
+    acpiParseActiveTrips(trips, acpiReadInteger, const_cast<AcpiDevice *>(dev));
+    
+    // Always return success for now
+    // There *can* be zero _AC states and no hystersis
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraACPIUtils::acpiReadLimitTrips(const AcpiDevice *dev, LimitTrips *trips) {
+    acpiParseLimitTrips(trips, acpiReadInteger, const_cast<AcpiDevice *>(dev));
+    return kIOReturnSuccess;
+}
+
+static IOReturn acpiSetAuxTrip(const ChultraACPIUtils::AcpiDevice *dev, ChultraACPIUtils::acpi_method_t method, uint32_t value) {
+    OSNumber *acpiValue = OSNumber::withNumber(value, 32);
+    if (acpiValue == nullptr) {
+        return kIOReturnNoMemory;
+    }
+    
+    OSObject *params[1] = {
+        acpiValue,
+    };
+    
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(dev, method, nullptr, params, 1);
+    acpiValue->release();
+    return ret;
+}
+
+IOReturn ChultraACPIUtils::acpiArmAuxTrips(const AcpiDevice *dev, const ActiveTrips *trips, const LimitTrips *limits, celsius_t temp, celsius_t band) {
+    celsius_t low = 0, high = 0;
+    
+    if (!acpiHasMethod(dev, AcpiMethodPAT0) || !acpiHasMethod(dev, AcpiMethodPAT1)) {
+        return kIOReturnUnsupported;
+    }
+    
+    // A trip already crossed can't be armed for, the next evaluation will see it anyway
+    if (band != 0 && !acpiAuxTripWindow(trips, limits, temp, band, &low, &high)) {
+        return kIOReturnNotReady;
+    }
+    
+    // Firmware takes tenths of a Kelvin, 0 turns a trip off
+    IOReturn ret = acpiSetAuxTrip(dev, AcpiMethodPAT0, low != 0 ? acpiCelsiusToTemp(low) : 0);
+    if (ret == kIOReturnSuccess) {
+        ret = acpiSetAuxTrip(dev, AcpiMethodPAT1, high != 0 ? acpiCelsiusToTemp(high) : 0);
+    }
+    
+    if (ret != kIOReturnSuccess) {
+        IOLogError("%s: Failed to program aux trips", dev->path->getCStringNoCopy());
+    }
+    
+    return ret;
+}
+
+OSDictionary *ChultraACPIUtils::acpiCopyTables() {
+    OSDictionary *ret;
+    
+    // The platform expert publishes every table it loaded, keyed by signature
+    IORegistryEntry *expert = IORegistryEntry::fromPath("IOService:/AppleACPIPlatformExpert");
+    if (expert == nullptr) return nullptr;
+    
+    ret = OSDynamicCast(OSDictionary, expert->getProperty("ACPI Tables"));
+    if (ret != nullptr) ret->retain();
+    
+    expert->release();
+    return ret;
+}
+
+OSData *ChultraACPIUtils::acpiCopyTable(const char *signature) {
+    OSData *ret = nullptr;
+    
+    OSDictionary *tables = acpiCopyTables();
+    if (tables == nullptr) return nullptr;
+    
+    ret = OSDynamicCast(OSData, tables->getObject(signature));
+    if (ret != nullptr) ret->retain();
+    
+    tables->release();
+    return ret;
+}
+
+IOReturn ChultraACPIUtils::acpiGetOemTableId(const char *signature, char *toFill, size_t length) {
+    // Standard ACPI header, OEM table ID is 8 bytes at offset 16
+    constexpr size_t oemTableIdOffset = 16;
+    constexpr size_t oemTableIdLength = 8;
+    
+    if (length <= oemTableIdLength) return kIOReturnBadArgument;
+    
+    OSData *table = acpiCopyTable(signature);
+    if (table == nullptr) return kIOReturnNotFound;
+    
+    const void *bytes = table->getBytesNoCopy(oemTableIdOffset, oemTableIdLength);
+    if (bytes == nullptr) {
+        table->release();
+        return kIOReturnInvalid;
+    }
+    
+    memcpy(toFill, bytes, oemTableIdLength);
+    toFill[oemTableIdLength] = '\0';
+    table->release();
     return kIOReturnSuccess;
 }
 
@@ -12,16 +12,75 @@
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <stdint.h>
 
-namespace ChultraACPIUtils {
-    typedef uint32_t celsius_t;
+#include "AcpiTrips.hpp"
 
-    // ACPI reports tenths of degrees Kelvin (xx.x)
-    inline celsius_t acpiTempToCelsius(uint32_t kelvin) {
-        return kelvin - 2732; //273.15 rounded up
+namespace ChultraACPIUtils {
+    // Every method any participant may evaluate
+    enum acpi_method_t {
+        AcpiMethodAC0 = 0,
+        AcpiMethodAC9 = AcpiMethodAC0 + 9,
+        AcpiMethodTMP,
+        AcpiMethodGTSH,
+        AcpiMethodPTYP,
+        AcpiMethodFIF,
+        AcpiMethodFSL,
+        AcpiMethodIDSP,
+        AcpiMethodART,
+        AcpiMethodTRT,
+        AcpiMethodOSC,
+        AcpiMethodFST,
+        AcpiMethodPPCC,
+        AcpiMethodPSS,
+        AcpiMethodTSS,
+        AcpiMethodPPSS,
+        AcpiMethodPPPC,
+        AcpiMethodSPPC,
+        AcpiMethodFPS,
+        AcpiMethodPSV,
+        AcpiMethodCRT,
+        AcpiMethodPAT0,
+        AcpiMethodPAT1,
+        AcpiMethodMax
+    };
+    
+    //
+    // Which methods exist on a device, validated once when the participant
+    // probes, along with the device's interned ACPI path. Lets us skip
+    // blind evaluations that are expected to fail.
+    //
+    struct AcpiDevice {
+        IOACPIPlatformDevice *acpi {nullptr};
+        const OSSymbol *path {nullptr};
+        uint64_t present {0};
+    };
+    
+    static_assert(AcpiMethodMax <= sizeof(AcpiDevice::present) * 8, "Too many methods for presence mask");
+    
+    IOReturn acpiDeviceInit(AcpiDevice *dev, IOACPIPlatformDevice *acpi);
+    void acpiDeviceFree(AcpiDevice *dev);
+    
+    inline bool acpiHasMethod(const AcpiDevice *dev, acpi_method_t method) {
+        return (dev->present & (1ULL << method)) != 0;
     }
-
-    IOReturn acpiGetUInt32(IOACPIPlatformDevice *acpi, const char *methodName, uint32_t *toFill);
+    
+    IOReturn acpiEvaluate(const AcpiDevice *dev, acpi_method_t method, OSObject **result, OSObject **params = nullptr, uint32_t paramCount = 0);
+    IOReturn acpiGetUInt32(const AcpiDevice *dev, acpi_method_t method, uint32_t *toFill);
     const OSSymbol *acpiGetPath(IOACPIPlatformDevice *acpi);
+    
+    // Trips from the device itself, see AcpiTrips.hpp
+    IOReturn acpiReadActiveTrips(const AcpiDevice *dev, ActiveTrips *trips);
+    IOReturn acpiReadLimitTrips(const AcpiDevice *dev, LimitTrips *trips);
+    
+    //
+    // Programs the aux trips band around temp, see acpiAuxTripWindow, or
+    // turns them off with a band of 0. Unsupported if the device has no
+    // PAT0 and PAT1.
+    //
+    IOReturn acpiArmAuxTrips(const AcpiDevice *dev, const ActiveTrips *trips, const LimitTrips *limits, celsius_t temp, celsius_t band);
+    
+    OSDictionary *acpiCopyTables();
+    OSData *acpiCopyTable(const char *signature);
+    IOReturn acpiGetOemTableId(const char *signature, char *toFill, size_t length);
 }
 
 #endif /* AcpiUtils_hpp */
@@ -0,0 +1,58 @@
+//
+//  ActivePolicy.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/10/23.
+//
+
+#include "ActivePolicy.hpp"
+#include "Logger.h"
+
+#define super DPTFPolicyModule
+OSDefineMetaClassAndStructors(DPTFActivePolicyModule, DPTFPolicyModule);
+
+template <typename T>
+static bool reserve(T **buffer, uint32_t *slots, uint32_t count) {
+    if (*slots >= count) return true;
+
+    T *grown = static_cast<T *>(IOMalloc(sizeof(T) * count));
+    if (grown == nullptr) return false;
+
+    if (*buffer != nullptr) IOFree(*buffer, sizeof(T) * *slots);
+    *buffer = grown;
+    *slots = count;
+    return true;
+}
+
+IOReturn DPTFActivePolicyModule::tableChanged(DPTFPolicyTable *table) {
+    if (!reserve(&rules, &ruleSlots, table->ruleCount) ||
+        !reserve(&levels, &levelSlots, table->fanCount) ||
+        !reserve(&sources, &sourceSlots, table->sampleCount)) {
+        return kIOReturnNoMemory;
+    }
+
+    return super::tableChanged(table);
+}
+
+void DPTFActivePolicyModule::free() {
+    if (rules != nullptr) IOFree(rules, sizeof(FanAllocator::Rule) * ruleSlots);
+    if (levels != nullptr) IOFree(levels, sizeof(FanAllocator::Fan) * levelSlots);
+    if (sources != nullptr) IOFree(sources, sizeof(FanAllocator::Source) * sourceSlots);
+    super::free();
+}
+
+uint32_t DPTFActivePolicyModule::samplingPeriodMS(DPTFPolicyTable *table) {
+    // Table already folds in any per rule sampling period
+    return table->pollingPeriodMS;
+}
+
+void DPTFActivePolicyModule::evaluate(DPTFPolicyContext *context) {
+    DPTFPolicyTable *table = context->table;
+
+    Policies::evaluateActive(table->view, context->io(this), { rules, levels, sources });
+
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        IOLogDebug("Zone %s: fan %s %d (alone %d)", table->fans[i].zone->getCStringNoCopy(), table->fans[i].path->getCStringNoCopy(),
+                   levels[i].allocated, levels[i].independent);
+    }
+}
@@ -0,0 +1,37 @@
+//
+//  ActivePolicy.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/10/23.
+//
+
+#ifndef ActivePolicy_hpp
+#define ActivePolicy_hpp
+
+#include "PolicyModule.hpp"
+#include "FanAllocator.hpp"
+
+//
+// Fan curves from _ART, see Policies::evaluateActive. Fans sharing a zone
+// split the cooling by _ART weight, so the fan nearest the heat does the
+// work rather than every fan spinning up.
+//
+class DPTFActivePolicyModule : public DPTFPolicyModule {
+    OSDeclareDefaultStructors(DPTFActivePolicyModule);
+public:
+    IOReturn tableChanged(DPTFPolicyTable *table) override;
+    uint32_t samplingPeriodMS(DPTFPolicyTable *table) override;
+    void evaluate(DPTFPolicyContext *context) override;
+
+    void free() override;
+private:
+    // Scratch sized for the current table, workloop only
+    FanAllocator::Rule *rules {nullptr};
+    uint32_t ruleSlots {0};
+    FanAllocator::Fan *levels {nullptr};
+    uint32_t levelSlots {0};
+    FanAllocator::Source *sources {nullptr};
+    uint32_t sourceSlots {0};
+};
+
+#endif /* ActivePolicy_hpp */
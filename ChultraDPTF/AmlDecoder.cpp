@@ -0,0 +1,656 @@
+//
+//  AmlDecoder.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/9/23.
+//
+
+#include "AmlDecoder.hpp"
+
+#include <string.h>
+
+namespace {
+    constexpr size_t AcpiHeaderLength = 36;
+    constexpr size_t MaxDepth = 16;
+    constexpr size_t MaxSegments = 16;
+    constexpr uint32_t ArtLevelUnused = 0xFFFFFFFF;
+
+    enum : uint8_t {
+        ZeroOp = 0x00,
+        OneOp = 0x01,
+        AliasOp = 0x06,
+        NameOp = 0x08,
+        BytePrefix = 0x0A,
+        WordPrefix = 0x0B,
+        DWordPrefix = 0x0C,
+        StringPrefix = 0x0D,
+        QWordPrefix = 0x0E,
+        ScopeOp = 0x10,
+        BufferOp = 0x11,
+        PackageOp = 0x12,
+        VarPackageOp = 0x13,
+        MethodOp = 0x14,
+        ExternalOp = 0x15,
+        DualNamePrefix = 0x2E,
+        MultiNamePrefix = 0x2F,
+        ExtOpPrefix = 0x5B,
+        RootChar = 0x5C,
+        ParentPrefixChar = 0x5E,
+        IfOp = 0xA0,
+        ElseOp = 0xA1,
+        WhileOp = 0xA2,
+        ReturnOp = 0xA4,
+        OnesOp = 0xFF,
+    };
+
+    enum : uint8_t {
+        MutexOp = 0x01,
+        EventOp = 0x02,
+        RevisionOp = 0x30,
+        OpRegionOp = 0x80,
+        FieldOp = 0x81,
+        DeviceOp = 0x82,
+        ProcessorOp = 0x83,
+        PowerResOp = 0x84,
+        ThermalZoneOp = 0x85,
+        IndexFieldOp = 0x86,
+        BankFieldOp = 0x87,
+    };
+
+    struct Cursor {
+        const uint8_t *p;
+        const uint8_t *end;
+
+        bool has(size_t n) const { return static_cast<size_t>(end - p) >= n; }
+    };
+
+    struct Path {
+        char segs[MaxSegments][4];
+        size_t count;
+
+        bool equals(const Path &other) const {
+            return count == other.count && memcmp(segs, other.segs, count * 4) == 0;
+        }
+    };
+
+    // NameSearch::field
+    enum : uint8_t {
+        ArtFan,
+        ArtSource,
+        TrtSource,
+        TrtTarget,
+    };
+
+    struct Context {
+        Path artPath;
+        Path trtPath;
+        bool resolving;
+        AmlDecoder::Relations *out;
+    };
+
+    bool leadNameChar(uint8_t c) {
+        return (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    bool nameChar(uint8_t c) {
+        return leadNameChar(c) || (c >= '0' && c <= '9');
+    }
+
+    // PkgLength counts from its own first byte
+    bool readPkgLength(Cursor &c, const uint8_t **blockEnd) {
+        const uint8_t *start = c.p;
+        if (!c.has(1)) return false;
+
+        uint8_t lead = *c.p++;
+        uint32_t extra = lead >> 6;
+        uint32_t length;
+
+        if (extra == 0) {
+            length = lead & 0x3F;
+        } else {
+            if (!c.has(extra)) return false;
+            length = lead & 0x0F;
+            for (uint32_t i = 0; i < extra; i++) {
+                length |= static_cast<uint32_t>(*c.p++) << (4 + 8 * i);
+            }
+        }
+
+        if (length < static_cast<size_t>(c.p - start) || length > static_cast<size_t>(c.end - start)) {
+            return false;
+        }
+
+        *blockEnd = start + length;
+        return true;
+    }
+
+    bool appendSegment(Cursor &c, Path *path) {
+        if (!c.has(4) || path->count == MaxSegments) return false;
+        if (!leadNameChar(c.p[0]) || !nameChar(c.p[1]) || !nameChar(c.p[2]) || !nameChar(c.p[3])) return false;
+
+        memcpy(path->segs[path->count++], c.p, 4);
+        c.p += 4;
+        return true;
+    }
+
+    // Relative names resolve against scope, lone NameSegs are searched for later
+    bool readNameString(Cursor &c, const Path &scope, Path *out) {
+        if (!c.has(1)) return false;
+
+        *out = scope;
+        if (*c.p == RootChar) {
+            out->count = 0;
+            c.p++;
+        } else {
+            while (c.has(1) && *c.p == ParentPrefixChar) {
+                if (out->count == 0) return false;
+                out->count--;
+                c.p++;
+            }
+        }
+
+        if (!c.has(1)) return false;
+
+        size_t segments;
+        switch (*c.p) {
+            case ZeroOp:
+                c.p++;
+                return true;
+            case DualNamePrefix:
+                c.p++;
+                segments = 2;
+                break;
+            case MultiNamePrefix:
+                c.p++;
+                if (!c.has(1)) return false;
+                segments = *c.p++;
+                break;
+            default:
+                segments = 1;
+                break;
+        }
+
+        for (size_t i = 0; i < segments; i++) {
+            if (!appendSegment(c, out)) return false;
+        }
+
+        return true;
+    }
+
+    bool isNameStringStart(uint8_t c) {
+        return c == RootChar || c == ParentPrefixChar || c == DualNamePrefix ||
+               c == MultiNamePrefix || leadNameChar(c);
+    }
+
+    // "/_SB/PCI0/TCPU" like acpiGetPath(), trailing '_' padding dropped
+    bool formatPath(const Path &path, char *buffer, size_t length) {
+        size_t used = 0;
+
+        for (size_t i = 0; i < path.count; i++) {
+            size_t segLength = 4;
+            while (segLength > 1 && path.segs[i][segLength - 1] == '_') segLength--;
+
+            if (used + 1 + segLength + 1 > length) return false;
+            buffer[used++] = '/';
+            memcpy(buffer + used, path.segs[i], segLength);
+            used += segLength;
+        }
+
+        if (used == 0) {
+            if (length < 2) return false;
+            buffer[used++] = '/';
+        }
+
+        buffer[used] = '\0';
+        return true;
+    }
+
+    bool parsePath(const char *string, Path *path) {
+        path->count = 0;
+
+        while (*string == '/') {
+            string++;
+            if (*string == '\0') break;
+            if (path->count == MaxSegments) return false;
+
+            char *seg = path->segs[path->count++];
+            size_t i = 0;
+            for (; *string != '\0' && *string != '/'; string++) {
+                if (i == 4) return false;
+                seg[i++] = *string;
+            }
+
+            for (; i < 4; i++) seg[i] = '_';
+        }
+
+        return *string == '\0';
+    }
+
+    bool readInteger(Cursor &c, uint64_t *value) {
+        if (!c.has(1)) return false;
+
+        size_t width;
+        switch (*c.p) {
+            case ZeroOp: c.p++; *value = 0; return true;
+            case OneOp: c.p++; *value = 1; return true;
+            case OnesOp: c.p++; *value = ~0ULL; return true;
+            case BytePrefix: width = 1; break;
+            case WordPrefix: width = 2; break;
+            case DWordPrefix: width = 4; break;
+            case QWordPrefix: width = 8; break;
+            default: return false;
+        }
+
+        if (!c.has(1 + width)) return false;
+        c.p++;
+
+        *value = 0;
+        for (size_t i = 0; i < width; i++) {
+            *value |= static_cast<uint64_t>(*c.p++) << (8 * i);
+        }
+
+        return true;
+    }
+
+    bool readUInt32(Cursor &c, uint32_t *value) {
+        uint64_t wide;
+        if (!readInteger(c, &wide)) return false;
+
+        *value = static_cast<uint32_t>(wide);
+        return true;
+    }
+
+    bool skipDataObject(Cursor &c) {
+        uint64_t ignored;
+        const uint8_t *blockEnd;
+
+        if (!c.has(1)) return false;
+        if (readInteger(c, &ignored)) return true;
+
+        switch (*c.p) {
+            case StringPrefix:
+                c.p++;
+                while (c.has(1) && *c.p != '\0') c.p++;
+                if (!c.has(1)) return false;
+                c.p++;
+                return true;
+            case BufferOp:
+            case PackageOp:
+            case VarPackageOp:
+                c.p++;
+                if (!readPkgLength(c, &blockEnd)) return false;
+                c.p = blockEnd;
+                return true;
+            case ExtOpPrefix:
+                if (c.has(2) && c.p[1] == RevisionOp) {
+                    c.p += 2;
+                    return true;
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // PackageOp PkgLength NumElements, leaves c at the first element
+    bool enterPackage(Cursor &c, Cursor *contents, uint8_t *elements) {
+        if (!c.has(1) || *c.p != PackageOp) return false;
+        c.p++;
+
+        const uint8_t *blockEnd;
+        if (!readPkgLength(c, &blockEnd) || !c.has(1)) return false;
+
+        *elements = *c.p++;
+        contents->p = c.p;
+        contents->end = blockEnd;
+        c.p = blockEnd;
+        return true;
+    }
+
+    char *referenceOf(AmlDecoder::Relations *out, uint8_t field, size_t row) {
+        switch (field) {
+            case ArtFan: return out->art[row].fan;
+            case ArtSource: return out->art[row].source;
+            case TrtSource: return out->trt[row].source;
+            case TrtTarget: return out->trt[row].target;
+            default: return nullptr;
+        }
+    }
+
+    bool readReference(Cursor &c, const Path &scope, uint8_t field, size_t row, AmlDecoder::Relations *out) {
+        Path path;
+        if (!c.has(1) || !isNameStringStart(*c.p)) return false;
+
+        bool lone = leadNameChar(*c.p);
+        if (!readNameString(c, scope, &path)) return false;
+        if (!formatPath(path, referenceOf(out, field, row), AmlDecoder::MaxPath)) return false;
+        if (!lone) return true;
+
+        if (out->searchCount == AmlDecoder::MaxSearches) return false;
+        AmlDecoder::NameSearch *search = &out->searches[out->searchCount];
+        memset(search, 0, sizeof(*search));
+
+        if (!formatPath(scope, search->scope, sizeof(search->scope))) return false;
+        memcpy(search->name, path.segs[path.count - 1], 4);
+        search->field = field;
+        search->row = static_cast<uint8_t>(row);
+
+        out->searchCount++;
+        return true;
+    }
+
+    //
+    // An object was declared, point any search it answers at it. The
+    // nearest match wins, so only a declaration deeper in the search's
+    // scope than what was found before replaces it.
+    //
+    void declare(const Path &object, Context &ctx) {
+        AmlDecoder::Relations *out = ctx.out;
+        if (!ctx.resolving || object.count == 0) return;
+
+        size_t depth = object.count - 1;
+        for (size_t i = 0; i < out->searchCount; i++) {
+            AmlDecoder::NameSearch *search = &out->searches[i];
+            Path scope;
+
+            if (memcmp(object.segs[depth], search->name, 4) != 0) continue;
+            if (search->found && search->depth >= depth) continue;
+            if (!parsePath(search->scope, &scope) || depth > scope.count) continue;
+            if (memcmp(scope.segs, object.segs, depth * 4) != 0) continue;
+
+            if (!formatPath(object, referenceOf(out, search->field, search->row), AmlDecoder::MaxPath)) continue;
+            search->found = true;
+            search->depth = static_cast<uint8_t>(depth);
+        }
+    }
+
+    //
+    // Package () { Revision, Package () { Fan, Source, Weight, AC0 ... AC9 }, ... }
+    //
+    bool decodeArt(Cursor &c, const Path &scope, AmlDecoder::Relations *out) {
+        Cursor contents;
+        uint8_t elements;
+
+        if (!enterPackage(c, &contents, &elements) || elements == 0) return false;
+        if (!readUInt32(contents, &out->artRevision)) return false;
+
+        out->artCount = 0;
+        for (uint8_t i = 1; i < elements && contents.p < contents.end; i++) {
+            Cursor row;
+            uint8_t fields;
+
+            if (out->artCount == AmlDecoder::MaxRelations) return false;
+            if (!enterPackage(contents, &row, &fields) || fields < 3) return false;
+
+            AmlDecoder::ArtEntry *entry = &out->art[out->artCount];
+            memset(entry, 0, sizeof(*entry));
+
+            if (!readReference(row, scope, ArtFan, out->artCount, out)) return false;
+            if (!readReference(row, scope, ArtSource, out->artCount, out)) return false;
+            if (!readUInt32(row, &entry->weight)) return false;
+
+            for (size_t level = 0; level < AmlDecoder::MaxArtLevels && level + 3 < fields; level++) {
+                uint32_t speed;
+                if (!readUInt32(row, &speed)) return false;
+                entry->maxFanSpeeds[level] = speed == ArtLevelUnused ? 0 : speed;
+            }
+
+            out->artCount++;
+        }
+
+        return true;
+    }
+
+    //
+    // Package () { Package () { Source, Target, Influence, Period, Reserved x4 }, ... }
+    //
+    bool decodeTrt(Cursor &c, const Path &scope, AmlDecoder::Relations *out) {
+        Cursor contents;
+        uint8_t elements;
+
+        if (!enterPackage(c, &contents, &elements)) return false;
+
+        out->trtCount = 0;
+        for (uint8_t i = 0; i < elements && contents.p < contents.end; i++) {
+            Cursor row;
+            uint8_t fields;
+
+            if (out->trtCount == AmlDecoder::MaxRelations) return false;
+            if (!enterPackage(contents, &row, &fields) || fields < 4) return false;
+
+            AmlDecoder::TrtEntry *entry = &out->trt[out->trtCount];
+            memset(entry, 0, sizeof(*entry));
+
+            if (!readReference(row, scope, TrtSource, out->trtCount, out)) return false;
+            if (!readReference(row, scope, TrtTarget, out->trtCount, out)) return false;
+            if (!readUInt32(row, &entry->weight)) return false;
+            if (!readUInt32(row, &entry->samplingPeriod)) return false;
+
+            out->trtCount++;
+        }
+
+        return true;
+    }
+
+    // Object path is scope + name, references inside resolve against scope
+    void decodeObject(Cursor c, const Path &object, Context &ctx) {
+        size_t searchCount = ctx.out->searchCount;
+        Path scope = object;
+        scope.count--;
+
+        // A package that fails to decode leaves no searches behind either
+        if (!ctx.out->foundArt && object.equals(ctx.artPath)) {
+            ctx.out->foundArt = decodeArt(c, scope, ctx.out);
+            if (!ctx.out->foundArt) {
+                ctx.out->artCount = 0;
+                ctx.out->searchCount = searchCount;
+            }
+        } else if (!ctx.out->foundTrt && object.equals(ctx.trtPath)) {
+            ctx.out->foundTrt = decodeTrt(c, scope, ctx.out);
+            if (!ctx.out->foundTrt) {
+                ctx.out->trtCount = 0;
+                ctx.out->searchCount = searchCount;
+            }
+        }
+    }
+
+    bool interesting(const Path &object, const Context &ctx) {
+        if (ctx.resolving) return false;
+        return (!ctx.out->foundArt && object.equals(ctx.artPath)) ||
+               (!ctx.out->foundTrt && object.equals(ctx.trtPath));
+    }
+
+    void walkTermList(Cursor c, const Path &scope, Context &ctx, size_t depth);
+
+    bool walkNamedBlock(Cursor &c, const Path &scope, Context &ctx, size_t depth, size_t fixedBytes) {
+        const uint8_t *blockEnd;
+        Path name;
+
+        if (!readPkgLength(c, &blockEnd)) return false;
+        Cursor block {c.p, blockEnd};
+        c.p = blockEnd;
+
+        if (!readNameString(block, scope, &name)) return true;
+        declare(name, ctx);
+
+        if (!block.has(fixedBytes)) return true;
+        block.p += fixedBytes;
+
+        walkTermList(block, name, ctx, depth + 1);
+        return true;
+    }
+
+    bool walkExtOp(Cursor &c, const Path &scope, Context &ctx, size_t depth) {
+        const uint8_t *blockEnd;
+        uint64_t ignored;
+        Path name;
+
+        if (!c.has(2)) return false;
+        uint8_t op = c.p[1];
+        c.p += 2;
+
+        switch (op) {
+            case DeviceOp:
+            case ThermalZoneOp:
+                return walkNamedBlock(c, scope, ctx, depth, 0);
+            case ProcessorOp:
+                // ProcID, PblkAddr, PblkLen
+                return walkNamedBlock(c, scope, ctx, depth, 6);
+            case PowerResOp:
+                // SystemLevel, ResourceOrder
+                return walkNamedBlock(c, scope, ctx, depth, 3);
+            case FieldOp:
+            case IndexFieldOp:
+            case BankFieldOp:
+                if (!readPkgLength(c, &blockEnd)) return false;
+                c.p = blockEnd;
+                return true;
+            case OpRegionOp:
+                // Only constant offsets and lengths, anything else needs a real interpreter
+                if (!readNameString(c, scope, &name) || !c.has(1)) return false;
+                declare(name, ctx);
+                c.p++;
+                return readInteger(c, &ignored) && readInteger(c, &ignored);
+            case MutexOp:
+                if (!readNameString(c, scope, &name) || !c.has(1)) return false;
+                declare(name, ctx);
+                c.p++;
+                return true;
+            case EventOp:
+                if (!readNameString(c, scope, &name)) return false;
+                declare(name, ctx);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void walkTermList(Cursor c, const Path &scope, Context &ctx, size_t depth) {
+        if (depth > MaxDepth) return;
+
+        while (c.p < c.end && (ctx.resolving || !(ctx.out->foundArt && ctx.out->foundTrt))) {
+            const uint8_t *blockEnd;
+            Path name, other;
+            bool ok = false;
+
+            switch (*c.p) {
+                case ScopeOp: {
+                    c.p++;
+                    if (!readPkgLength(c, &blockEnd)) return;
+                    Cursor block {c.p, blockEnd};
+                    c.p = blockEnd;
+
+                    if (readNameString(block, scope, &name)) {
+                        walkTermList(block, name, ctx, depth + 1);
+                    }
+                    ok = true;
+                    break;
+                }
+                case MethodOp: {
+                    c.p++;
+                    if (!readPkgLength(c, &blockEnd)) return;
+                    Cursor block {c.p, blockEnd};
+                    c.p = blockEnd;
+
+                    // MethodFlags, then only Return (Package () {...}) is understood
+                    if (readNameString(block, scope, &name)) {
+                        declare(name, ctx);
+                        if (block.has(2) && interesting(name, ctx)) {
+                            block.p++;
+                            if (*block.p == ReturnOp) {
+                                block.p++;
+                                decodeObject(block, name, ctx);
+                            }
+                        }
+                    }
+                    ok = true;
+                    break;
+                }
+                case NameOp:
+                    c.p++;
+                    if (!readNameString(c, scope, &name)) return;
+                    declare(name, ctx);
+                    if (interesting(name, ctx)) decodeObject(c, name, ctx);
+                    ok = skipDataObject(c);
+                    break;
+                case AliasOp:
+                    c.p++;
+                    ok = readNameString(c, scope, &name) && readNameString(c, scope, &other);
+                    if (ok) declare(other, ctx);
+                    break;
+                case ExternalOp:
+                    // ObjectType, ArgumentCount. Only says the object is declared in another table
+                    c.p++;
+                    ok = readNameString(c, scope, &name) && c.has(2);
+                    if (ok) c.p += 2;
+                    break;
+                case IfOp:
+                case ElseOp:
+                case WhileOp:
+                    // Predicates need a real interpreter, so whatever is declared inside is never seen
+                    c.p++;
+                    if (!readPkgLength(c, &blockEnd)) return;
+                    c.p = blockEnd;
+                    ok = true;
+                    break;
+                case ExtOpPrefix:
+                    ok = walkExtOp(c, scope, ctx, depth);
+                    break;
+                default:
+                    break;
+            }
+
+            // Statements and expressions carry no length, give up on the rest of the scope
+            if (!ok) return;
+        }
+    }
+
+    // Trust the smaller of the header length and what we were given
+    bool tableBody(const uint8_t *table, size_t length, Cursor *body) {
+        if (table == nullptr || length < AcpiHeaderLength) return false;
+
+        uint32_t tableLength = static_cast<uint32_t>(table[4]) | static_cast<uint32_t>(table[5]) << 8 |
+                               static_cast<uint32_t>(table[6]) << 16 | static_cast<uint32_t>(table[7]) << 24;
+        if (tableLength < AcpiHeaderLength) return false;
+        if (tableLength < length) length = tableLength;
+
+        *body = Cursor {table + AcpiHeaderLength, table + length};
+        return true;
+    }
+}
+
+bool AmlDecoder::decodeTable(const uint8_t *table, size_t length, const char *scope, Relations *out) {
+    Context ctx;
+    Cursor body;
+
+    if (out == nullptr || !tableBody(table, length, &body)) return false;
+
+    if (!parsePath(scope, &ctx.artPath) || ctx.artPath.count == MaxSegments) return false;
+    ctx.trtPath = ctx.artPath;
+    memcpy(ctx.artPath.segs[ctx.artPath.count++], "_ART", 4);
+    memcpy(ctx.trtPath.segs[ctx.trtPath.count++], "_TRT", 4);
+    ctx.resolving = false;
+    ctx.out = out;
+
+    Path root;
+    root.count = 0;
+
+    walkTermList(body, root, ctx, 0);
+    return out->foundArt || out->foundTrt;
+}
+
+void AmlDecoder::resolveNames(const uint8_t *table, size_t length, Relations *out) {
+    Context ctx;
+    Cursor body;
+
+    if (out == nullptr || out->searchCount == 0 || !tableBody(table, length, &body)) return;
+
+    ctx.artPath.count = 0;
+    ctx.trtPath.count = 0;
+    ctx.resolving = true;
+    ctx.out = out;
+
+    Path root;
+    root.count = 0;
+
+    walkTermList(body, root, ctx, 0);
+}
@@ -0,0 +1,88 @@
+//
+//  AmlDecoder.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/9/23.
+//
+
+#ifndef AmlDecoder_hpp
+#define AmlDecoder_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// AppleACPI can't return packages holding device references, so _ART and _TRT
+// are read straight out of the DSDT/SSDT bytes instead. Only static packages
+// are understood, either Name (_ART, Package () {...}) or a method that does
+// nothing but Return (Package () {...}).
+//
+// Decoding never allocates and bounds checks every read. If/Else/While blocks
+// are skipped whole by their PkgLength, so conditional declarations are never
+// seen. Any other opcode it doesn't understand inside a scope has no length to
+// skip by and makes it give up on the rest of that scope.
+// No IOKit here, so this can be built and fuzzed on a host.
+//
+namespace AmlDecoder {
+    constexpr size_t MaxPath = 64;
+    constexpr size_t MaxRelations = 32;
+    constexpr size_t MaxArtLevels = 10;
+    constexpr size_t MaxSearches = MaxRelations * 4;
+
+    // Paths are formatted like acpiGetPath(), e.g. "/_SB/DPTF/TFN1"
+    struct ArtEntry {
+        char fan[MaxPath];
+        char source[MaxPath];
+        uint32_t weight;
+        uint32_t maxFanSpeeds[MaxArtLevels];
+    };
+
+    struct TrtEntry {
+        char source[MaxPath];
+        char target[MaxPath];
+        uint32_t weight;
+        uint32_t samplingPeriod;
+    };
+
+    //
+    // A reference that is a lone NameSeg, like TFN1, names the nearest object
+    // called that going up from its scope. Whatever it names can be declared
+    // in any table, so until resolveNames() has seen them all the reference
+    // reads as relative to its scope.
+    //
+    struct NameSearch {
+        char scope[MaxPath];
+        char name[4];
+        uint8_t field;      // Which reference in the row
+        uint8_t row;
+        uint8_t depth;      // Segments of scope kept by the nearest match so far
+        bool found;
+    };
+
+    struct Relations {
+        bool foundArt;
+        bool foundTrt;
+        uint32_t artRevision;
+        size_t artCount;
+        size_t trtCount;
+        size_t searchCount;
+        ArtEntry art[MaxRelations];
+        TrtEntry trt[MaxRelations];
+        NameSearch searches[MaxSearches];
+    };
+
+    //
+    // Look for _ART/_TRT under scope (e.g. "/_SB/DPTF") in one table,
+    // including its ACPI header. Objects already found are left alone,
+    // so this can be called for the DSDT and then each SSDT.
+    //
+    bool decodeTable(const uint8_t *table, size_t length, const char *scope, Relations *out);
+
+    //
+    // Once _ART/_TRT are decoded, pass the DSDT and every SSDT through here
+    // so lone NameSeg references point at what they actually name.
+    //
+    void resolveNames(const uint8_t *table, size_t length, Relations *out);
+}
+
+#endif /* AmlDecoder_hpp */
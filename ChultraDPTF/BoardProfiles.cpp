@@ -0,0 +1,33 @@
+//
+//  BoardProfiles.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/6/23.
+//
+
+#include "BoardProfiles.hpp"
+
+const DPTFBoardProfile *DPTFLookupBoardProfile(const char *board) {
+    char key[32];
+    size_t len;
+    
+    if (board == nullptr) return nullptr;
+    
+    // Profiles are stored upper case, firmware isn't consistent about it
+    for (len = 0; board[len] != '\0'; len++) {
+        if (len == sizeof(key) - 1) return nullptr;
+        char c = board[len];
+        key[len] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+    
+    // OEM table IDs are space padded
+    while (len > 0 && key[len - 1] == ' ') len--;
+    key[len] = '\0';
+    
+    uint32_t slot = DPTFBoardHash::hash(key, DPTFBoardHash::Lookup.seed) & (DPTFBoardHash::Slots - 1);
+    uint8_t index = DPTFBoardHash::Lookup.slots[slot];
+    if (index == DPTFBoardHash::Empty) return nullptr;
+    
+    const DPTFBoardProfile *profile = &DPTFBoardProfiles[index];
+    return DPTFBoardCheck::equal(profile->board, key) ? profile : nullptr;
+}
@@ -0,0 +1,209 @@
+//
+//  BoardProfiles.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/6/23.
+//
+
+#ifndef BoardProfiles_hpp
+#define BoardProfiles_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "DPTFPolicyBlob.h"
+
+//
+// ACPI replacement for boards where AppleACPI is unable to parse device handles.
+// Each profile is checked at compile time and used as-is at probe, nothing is parsed at boot.
+// Levels are sized like the policy blob's, which ChultraThermal.hpp holds to its own.
+// No IOKit here, so profiles can be held against decoded tables on a host.
+//
+
+struct DPTFBoardTrt { const char *heatSource; const char *sensor; uint32_t weight; uint32_t samplingPeriod; };
+struct DPTFBoardArt { const char *fanDev; const char *source; uint32_t weight; uint32_t maxFanSpeed[DPTF_POLICY_BLOB_MAX_TEMPS]; };
+
+struct DPTFBoardProfile {
+    const char *board;      // Upper case DMI board name or ACPI OEM table ID
+    const DPTFBoardArt *art;
+    size_t artCount;
+    const DPTFBoardTrt *trt;
+    size_t trtCount;
+};
+
+// Paths profiles may reference, anything else is a typo
+constexpr const char *DPTFKnownFans[] = {
+    "/_SB/DPTF/TFN1",
+    "/_SB/DPTF/TFN2",
+};
+
+constexpr const char *DPTFKnownSources[] = {
+    "/_SB/PCI0/TCPU",
+    "/_SB/DPTF/TCHG",
+    "/_SB/DPTF/TSR0",
+    "/_SB/DPTF/TSR1",
+    "/_SB/DPTF/TSR2",
+    "/_SB/DPTF/TSR3",
+};
+
+//
+// Boards
+//
+
+constexpr DPTFBoardTrt KLEDTrt[] = {
+    { "/_SB/PCI0/TCPU", "/_SB/PCI0/TCPU", 100, 50 },
+    { "/_SB/PCI0/TCPU", "/_SB/DPTF/TSR0", 100, 60 },
+    { "/_SB/DPTF/TCHG", "/_SB/DPTF/TSR1", 100, 60 },
+    { "/_SB/DPTF/TCHG", "/_SB/DPTF/TSR2", 100, 60 },
+};
+
+constexpr DPTFBoardArt KLEDArt[] = {
+    { "/_SB/DPTF/TFN1", "/_SB/PCI0/TCPU", 100, {0x64, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // CPU Critical
+    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR0", 100, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // Charger
+    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR1", 100, {0x5A, 0x50, 0x46, 0x3C, 0x32, 0x28, 0x1E, 0x00, 0x00, 0x00} }, // CPU Active
+    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR2", 100, {0x64, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // Wifi
+};
+
+#define DPTF_BOARD(name, art, trt) { name, art, sizeof(art) / sizeof(art[0]), trt, sizeof(trt) / sizeof(trt[0]) }
+
+constexpr DPTFBoardProfile DPTFBoardProfiles[] = {
+    DPTF_BOARD("KLED", KLEDArt, KLEDTrt),
+};
+
+// Used when firmware doesn't identify a board we know
+constexpr const DPTFBoardProfile *DPTFDefaultBoardProfile = &DPTFBoardProfiles[0];
+
+const DPTFBoardProfile *DPTFLookupBoardProfile(const char *board);
+
+//
+// Compile time checks
+//
+
+namespace DPTFBoardCheck {
+    constexpr bool equal(const char *a, const char *b) {
+        while (*a != '\0' && *a == *b) {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+
+    template <size_t N>
+    constexpr bool known(const char *path, const char *const (&list)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            if (equal(path, list[i])) return true;
+        }
+        return false;
+    }
+
+    constexpr bool upperCase(const char *s) {
+        for (; *s != '\0'; s++) {
+            if (*s >= 'a' && *s <= 'z') return false;
+        }
+        return true;
+    }
+
+    // Level 0 is the hottest trip, so speeds may only go down from there
+    constexpr bool validArt(const DPTFBoardArt &art) {
+        if (!known(art.fanDev, DPTFKnownFans) || !known(art.source, DPTFKnownSources)) return false;
+        if (art.weight > 100) return false;
+
+        for (size_t i = 0; i < DPTF_POLICY_BLOB_MAX_TEMPS; i++) {
+            if (art.maxFanSpeed[i] > 100) return false;
+            if (i > 0 && art.maxFanSpeed[i] > art.maxFanSpeed[i - 1]) return false;
+        }
+        return true;
+    }
+
+    constexpr bool validTrt(const DPTFBoardTrt &trt) {
+        return known(trt.heatSource, DPTFKnownSources) && known(trt.sensor, DPTFKnownSources) &&
+               trt.weight <= 100 && trt.samplingPeriod != 0;
+    }
+
+    constexpr bool validProfile(const DPTFBoardProfile &profile) {
+        if (!upperCase(profile.board) || profile.artCount == 0) return false;
+
+        for (size_t i = 0; i < profile.artCount; i++) {
+            if (!validArt(profile.art[i])) return false;
+
+            // One row per fan/source pair
+            for (size_t j = 0; j < i; j++) {
+                if (equal(profile.art[i].fanDev, profile.art[j].fanDev) &&
+                    equal(profile.art[i].source, profile.art[j].source)) return false;
+            }
+        }
+
+        for (size_t i = 0; i < profile.trtCount; i++) {
+            if (!validTrt(profile.trt[i])) return false;
+        }
+        return true;
+    }
+
+    constexpr bool validProfiles() {
+        for (const DPTFBoardProfile &profile : DPTFBoardProfiles) {
+            if (!validProfile(profile)) return false;
+        }
+        return true;
+    }
+}
+
+static_assert(DPTFBoardCheck::validProfiles(), "Board profile has unknown paths, unsorted trips or speeds over 100");
+
+//
+// Perfect hash over board names, seed and slots are found at compile time
+//
+
+namespace DPTFBoardHash {
+    constexpr size_t Count = sizeof(DPTFBoardProfiles) / sizeof(DPTFBoardProfiles[0]);
+
+    constexpr size_t slotCount() {
+        size_t size = 1;
+        while (size < Count * 2) size <<= 1;
+        return size;
+    }
+
+    constexpr size_t Slots = slotCount();
+    constexpr uint8_t Empty = 0xFF;
+    static_assert(Count < Empty, "Too many board profiles for slot table");
+
+    // FNV-1a, seeded
+    constexpr uint32_t hash(const char *s, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (; *s != '\0'; s++) {
+            h = (h ^ static_cast<uint8_t>(*s)) * 16777619u;
+        }
+        return h;
+    }
+
+    struct Table {
+        uint32_t seed;
+        uint8_t slots[Slots];
+    };
+
+    constexpr Table build() {
+        for (uint32_t seed = 0; seed < 0x10000; seed++) {
+            Table table {seed, {}};
+            bool collision = false;
+
+            for (size_t i = 0; i < Slots; i++) table.slots[i] = Empty;
+
+            for (size_t i = 0; i < Count && !collision; i++) {
+                size_t slot = hash(DPTFBoardProfiles[i].board, seed) & (Slots - 1);
+                if (table.slots[slot] != Empty) {
+                    collision = true;
+                } else {
+                    table.slots[slot] = static_cast<uint8_t>(i);
+                }
+            }
+
+            if (!collision) return table;
+        }
+
+        return Table {0xFFFFFFFF, {}};
+    }
+
+    constexpr Table Lookup = build();
+    static_assert(Lookup.seed != 0xFFFFFFFF, "No perfect hash seed for board profiles");
+}
+
+#endif /* BoardProfiles_hpp */
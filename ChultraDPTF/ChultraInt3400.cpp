@@ -10,6 +10,7 @@
 #include "Logger.h"
 #include <IOKit/IOLib.h>
 #include <libkern/OSKextLib.h>
+#include <pexpert/pexpert.h>
 #include <Availability.h>
 
 #ifndef __ACIDANTHERA_MAC_SDK
@@ -18,7 +19,6 @@
 
 #define super IOService
 OSDefineMetaClassAndStructors(ChultraInt3400, IOService);
-OSDefineMetaClassAndStructors(DPTFActivePolicyEntry, OSObject);
 
 bool ChultraInt3400::init(OSDictionary *props) {
     if (!super::init(props)) {
@@ -52,10 +52,15 @@ ChultraInt3400 *ChultraInt3400::probe(IOService *provider, SInt32 *score) {
         IOLogError("Nub is not PCI device");
         return nullptr;
     }
+    
+    if (ChultraACPIUtils::acpiDeviceInit(&acpiDev, acpi) != kIOReturnSuccess) {
+        IOLogError("Failed to read ACPI path");
+        return nullptr;
+    }
 
     //
     // Get capabilities from ACPI
-    // For now, we only support active policies
+    // The core loads a policy module for each one it knows
     //
     
     if (acpiGetSupportedPolicies() != kIOReturnSuccess) {
@@ -64,10 +69,27 @@ ChultraInt3400 *ChultraInt3400::probe(IOService *provider, SInt32 *score) {
     }
     
     //
-    // Get active policy data so we know fan curve
+    // Get active policy data so we know fan curve,
+    // and thermal relations for passive policies
     //
     
-    if (acpiReadActivePolicy() != kIOReturnSuccess) {
+    boardProfile = selectBoardProfile();
+    
+    AmlDecoder::Relations *relations = static_cast<AmlDecoder::Relations *>(IOMallocZero(sizeof(AmlDecoder::Relations)));
+    if (relations == nullptr) {
+        return nullptr;
+    }
+    
+    (void) acpiDecodeRelations(relations);
+    
+    IOReturn ret = acpiReadActivePolicy(relations);
+    if (ret == kIOReturnSuccess) {
+        ret = acpiReadThermalRelations(relations);
+    }
+    
+    IOFree(relations, sizeof(AmlDecoder::Relations));
+    
+    if (ret != kIOReturnSuccess) {
         IOLogError("Failed to read active polcy");
         return nullptr;
     }
@@ -76,121 +98,282 @@ ChultraInt3400 *ChultraInt3400::probe(IOService *provider, SInt32 *score) {
 }
 
 bool ChultraInt3400::start(IOService *provider) {
-    const OSSymbol *acpiPath;
-    IOReturn ret;
-    
-    thermal = ChultraThermal::WaitForThermal();
-    acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
+    ownershipLock = IOLockAlloc();
+    if (ownershipLock == nullptr) {
+        return false;
+    }
     
-    if (thermal == nullptr) {
+    // Registration happens once the thermal core is published
+    thermalNotifier = ChultraThermal::NotifyWhenPublished(OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &ChultraInt3400::thermalPublished), this);
+    if (thermalNotifier == nullptr) {
         return false;
     }
     
-    if (acpiPath == nullptr) {
-        goto err;
+    registerService();
+    return super::start(provider);
+}
+
+bool ChultraInt3400::thermalPublished(void *refCon, IOService *newService, IONotifier *notifier) {
+    ChultraThermal *newThermal = OSDynamicCast(ChultraThermal, newService);
+    IOReturn ret;
+    
+    if (newThermal == nullptr || thermal != nullptr) {
+        return false;
     }
-        
-    ret = thermal->callPlatformFunction(gDPTFRegisterZone, true, (void *) acpiPath, this, activePolicies, nullptr);
+    
+    ret = newThermal->callPlatformFunction(gDPTFRegisterZone, true, (void *) acpiDev.path, this, activePolicies, (void *) (uintptr_t) supportedPolicies);
     if (ret != kIOReturnSuccess) {
-        goto err;
+        IOLogError("Failed to register zone with thermal core");
+        return false;
     }
     
-    registerService();
-    return super::start(provider);
-err:
-    stop(provider);
-    return false;
+    newThermal->retain();
+    thermal = newThermal;
+    return true;
 }
 
 void ChultraInt3400::stop(IOService *provider) {
+    if (thermalNotifier != nullptr) {
+        thermalNotifier->remove();
+        thermalNotifier = nullptr;
+    }
+    
     if (thermal != nullptr) {
-        const OSSymbol *acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
-        (void) thermal->callPlatformFunction(gDPTFUnregisterZone, true, (void *) acpiPath, nullptr, nullptr, nullptr);
+        (void) thermal->callPlatformFunction(gDPTFUnregisterZone, true, (void *) acpiDev.path, nullptr, nullptr, nullptr);
         OSSafeReleaseNULL(thermal);
     }
     
+    // Nothing drives the fans anymore, hand them back for good
+    IOLockLock(ownershipLock);
+    stopped = true;
+    IOLockUnlock(ownershipLock);
+    (void) setPlatformControl(false);
+    
     return super::stop(provider);
 }
 
 void ChultraInt3400::free() {
+    if (ownershipLock != nullptr) {
+        IOLockFree(ownershipLock);
+        ownershipLock = nullptr;
+    }
+    
     OSSafeReleaseNULL(activePolicies);
     OSSafeReleaseNULL(thermalRelations);
+    ChultraACPIUtils::acpiDeviceFree(&acpiDev);
     
     super::free();
 }
 
-IOReturn ChultraInt3400::acpiReadActivePolicy() {
+IOReturn ChultraInt3400::acpiDecodeRelations(AmlDecoder::Relations *relations) {
+    OSDictionary *tables = ChultraACPIUtils::acpiCopyTables();
+    if (tables == nullptr) {
+        return kIOReturnNotFound;
+    }
     
-    // TODO: Fix AppleACPI being unable to parse this data
-#if 0
-    OSObject *artReturn;
+    //
+    // AppleACPI can't evaluate _ART/_TRT since they hold device references,
+    // so decode them from the table bytes. DSDT first, then every SSDT.
+    //
     
-    IOReturn ret = acpi->evaluateObject("_ART", &artReturn);
-    if (ret != kIOReturnSuccess) {
-        return ret;
+    OSData *dsdt = OSDynamicCast(OSData, tables->getObject("DSDT"));
+    if (dsdt != nullptr) {
+        (void) AmlDecoder::decodeTable(static_cast<const uint8_t *>(dsdt->getBytesNoCopy()), dsdt->getLength(),
+                                       acpiDev.path->getCStringNoCopy(), relations);
     }
     
-    OSArray *artPolicies = OSDynamicCast(OSArray, artReturn);
-    if (artPolicies == nullptr) {
-        IOLogError("Could not cast _ART return");
-        return kIOReturnInvalid;
+    OSCollectionIterator *tableIter = OSCollectionIterator::withCollection(tables);
+    while (tableIter != nullptr && !(relations->foundArt && relations->foundTrt)) {
+        const OSSymbol *signature = OSDynamicCast(OSSymbol, tableIter->getNextObject());
+        if (signature == nullptr) break;
+        if (strncmp(signature->getCStringNoCopy(), "SSDT", 4) != 0) continue;
+        
+        OSData *ssdt = OSDynamicCast(OSData, tables->getObject(signature));
+        if (ssdt == nullptr) continue;
+        
+        (void) AmlDecoder::decodeTable(static_cast<const uint8_t *>(ssdt->getBytesNoCopy()), ssdt->getLength(),
+                                       acpiDev.path->getCStringNoCopy(), relations);
     }
     
-    // First entry is revision
-    OSNumber *revision = OSDynamicCast(OSNumber, artPolicies->getObject(0));
-    if (revision == nullptr) {
-        IOLogError("Could not get revision");
-        return kIOReturnInvalid;
+    //
+    // Lone names like TFN1 are searched for up from where they were used,
+    // and what they name can be declared in any table
+    //
+    
+    if (relations->searchCount != 0) {
+        if (dsdt != nullptr) {
+            AmlDecoder::resolveNames(static_cast<const uint8_t *>(dsdt->getBytesNoCopy()), dsdt->getLength(), relations);
+        }
+        
+        if (tableIter != nullptr) tableIter->reset();
+        while (tableIter != nullptr) {
+            const OSSymbol *signature = OSDynamicCast(OSSymbol, tableIter->getNextObject());
+            if (signature == nullptr) break;
+            if (strncmp(signature->getCStringNoCopy(), "SSDT", 4) != 0) continue;
+            
+            OSData *ssdt = OSDynamicCast(OSData, tables->getObject(signature));
+            if (ssdt == nullptr) continue;
+            
+            AmlDecoder::resolveNames(static_cast<const uint8_t *>(ssdt->getBytesNoCopy()), ssdt->getLength(), relations);
+        }
     }
     
-    IOLogInfo("Parsing Active Policy revision %d", revision->unsigned32BitValue());
+    OSSafeReleaseNULL(tableIter);
+    OSSafeReleaseNULL(tables);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3400::addActivePolicy(const char *fan, const char *source, uint32_t weight, const uint32_t *maxFanSpeeds) {
+    DPTFActivePolicyEntry *entry = new DPTFActivePolicyEntry();
+    if (entry == nullptr) return kIOReturnNoMemory;
     
-    // All other entries provide fan curves and thermal relations
-    for (size_t i = 1; i < artPolicies->getCount(); i++) {
-        DPTFActivePolicyEntry policy;
-        
-        OSArray *rawPolicy = OSDynamicCast(OSArray, artPolicies->getObject((uint32_t) i));
-        if (rawPolicy == nullptr) {
-            continue;
+    entry->fan = OSSymbol::withCString(fan);
+    entry->source = OSSymbol::withCString(source);
+    entry->weight = weight;
+    
+    if (entry->fan == nullptr || entry->source == nullptr) {
+        entry->release();
+        return kIOReturnNoMemory;
+    }
+    
+    for (size_t i = 0; i < DPTFActivePolicyMaxTemps; i++) {
+        entry->maxFanSpeeds[i] = maxFanSpeeds[i] > 100 ? 100 : maxFanSpeeds[i];
+    }
+    
+    // Sort zone entries by fan
+    OSDictionary *fanDict = OSDynamicCast(OSDictionary, activePolicies->getObject(entry->fan));
+    if (fanDict == nullptr) {
+        fanDict = OSDictionary::withCapacity(1);
+        if (fanDict == nullptr) {
+            entry->release();
+            return kIOReturnNoMemory;
         }
-        
-        IOLogInfo("Type = %s", rawPolicy->getObject(1)->getMetaClass()->getClassName());
+        activePolicies->setObject(entry->fan, fanDict);
+        fanDict->release();
     }
-#endif
     
-    // While ACPI is borked, parse our table into the right structs instead
-    for (int i = 0; i < 4; i++) {
-        DPTFActivePolicyEntry *entry = new DPTFActivePolicyEntry();
-        if (entry == nullptr) return kIOReturnNoMemory;
+    fanDict->setObject(entry->source, entry);
+    entry->release();
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3400::acpiReadActivePolicy(const AmlDecoder::Relations *relations) {
+    IOReturn ret;
+    
+    if (relations->foundArt) {
+        IOLogInfo("Parsing Active Policy revision %d (%d entries)", relations->artRevision, (int) relations->artCount);
         
-        entry->fan = OSSymbol::withCString(KLEDArt[i].fanDev);
-        entry->source = OSSymbol::withCString(KLEDArt[i].source);
-        entry->weight = KLEDArt[i].weight;
-        memcpy(entry->maxFanSpeeds, KLEDArt[i].maxFanSpeed, sizeof(entry->maxFanSpeeds));
+        for (size_t i = 0; i < relations->artCount; i++) {
+            const AmlDecoder::ArtEntry *art = &relations->art[i];
+            ret = addActivePolicy(art->fan, art->source, art->weight, art->maxFanSpeeds);
+            if (ret != kIOReturnSuccess) return ret;
+        }
         
-        // Sort zone entries by fan
-        OSDictionary *fanDict = OSDynamicCast(OSDictionary, activePolicies->getObject(entry->fan));
-        if (fanDict == nullptr) {
-            fanDict = OSDictionary::withCapacity(1);
-            activePolicies->setObject(entry->fan, fanDict);
-            fanDict->release();
+        return kIOReturnSuccess;
+    }
+    
+    // No static _ART we can decode, use the board's profile instead
+    IOLogInfo("No _ART found, using board profile %s", boardProfile->board);
+    
+    for (size_t i = 0; i < boardProfile->artCount; i++) {
+        const DPTFBoardArt *art = &boardProfile->art[i];
+        ret = addActivePolicy(art->fanDev, art->source, art->weight, art->maxFanSpeed);
+        if (ret != kIOReturnSuccess) return ret;
+    }
+    
+    return kIOReturnSuccess;
+}
+
+const DPTFBoardProfile *ChultraInt3400::selectBoardProfile() {
+    const DPTFBoardProfile *profile;
+    char board[32];
+    
+    //
+    // Pick the profile from, in order:
+    // 1. dptf-board= boot-arg, for boards whose firmware IDs are generic
+    // 2. ACPI OEM table ID of the DSDT
+    // 3. The default profile
+    //
+    
+    if (PE_parse_boot_argn("dptf-board", board, sizeof(board))) {
+        profile = DPTFLookupBoardProfile(board);
+        if (profile != nullptr) {
+            IOLogInfo("Using board profile %s (boot-arg)", profile->board);
+            return profile;
         }
         
-        fanDict->setObject(entry->source, entry);
+        IOLogError("Unknown board %s in dptf-board", board);
+    }
+    
+    if (ChultraACPIUtils::acpiGetOemTableId("DSDT", board, sizeof(board)) == kIOReturnSuccess) {
+        profile = DPTFLookupBoardProfile(board);
+        if (profile != nullptr) {
+            IOLogInfo("Using board profile %s (OEM table ID)", profile->board);
+            return profile;
+        }
+    }
+    
+    IOLogInfo("No board profile matched, using default %s", DPTFDefaultBoardProfile->board);
+    return DPTFDefaultBoardProfile;
+}
+
+IOReturn ChultraInt3400::addThermalRelation(const char *source, const char *target, uint32_t weight, uint32_t samplingPeriod) {
+    DPTFThermalRelationEntry *entry = new DPTFThermalRelationEntry();
+    if (entry == nullptr) return kIOReturnNoMemory;
+    
+    entry->source = OSSymbol::withCString(source);
+    entry->target = OSSymbol::withCString(target);
+    entry->weight = weight;
+    entry->samplingPeriod = samplingPeriod;
+    
+    if (entry->source == nullptr || entry->target == nullptr) {
         entry->release();
+        return kIOReturnNoMemory;
     }
     
+    thermalRelations->setObject(entry);
+    entry->release();
     return kIOReturnSuccess;
 }
 
-IOReturn ChultraInt3400::acpiReadThermalRelations() {
+IOReturn ChultraInt3400::acpiReadThermalRelations(const AmlDecoder::Relations *relations) {
+    IOReturn ret;
+    
+    if (relations->foundTrt) {
+        for (size_t i = 0; i < relations->trtCount; i++) {
+            const AmlDecoder::TrtEntry *trt = &relations->trt[i];
+            ret = addThermalRelation(trt->source, trt->target, trt->weight, trt->samplingPeriod);
+            if (ret != kIOReturnSuccess) return ret;
+        }
+        
+        return kIOReturnSuccess;
+    }
+    
+    for (size_t i = 0; i < boardProfile->trtCount; i++) {
+        const DPTFBoardTrt *trt = &boardProfile->trt[i];
+        ret = addThermalRelation(trt->heatSource, trt->sensor, trt->weight, trt->samplingPeriod);
+        if (ret != kIOReturnSuccess) return ret;
+    }
+    
     return kIOReturnSuccess;
 }
 
+// ACPI stores the first three GUID fields little endian, works both ways
+static void swapAcpiGuid(uuid_t guid) {
+    *(reinterpret_cast<uint32_t *>(guid)) = OSSwapInt32(*(reinterpret_cast<uint32_t *>(guid)));
+    *(reinterpret_cast<uint16_t *>(guid) + 2) = OSSwapInt16(*(reinterpret_cast<uint16_t *>(guid) + 2));
+    *(reinterpret_cast<uint16_t *>(guid) + 3) = OSSwapInt16(*(reinterpret_cast<uint16_t *>(guid) + 3));
+}
+
 IOReturn ChultraInt3400::acpiGetSupportedPolicies() {
     OSObject *idspReturn;
     
-    IOReturn ret = acpi->evaluateObject("IDSP", &idspReturn);
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodIDSP)) {
+        IOLogInfo("No IDSP, assuming no supported GUIDs (Not a failure)");
+        return kIOReturnSuccess;
+    }
+    
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodIDSP, &idspReturn);
     if (ret != kIOReturnSuccess) {
         IOLogInfo("Failed to grab supported GUIDs (Not a failure)");
         return kIOReturnSuccess;
@@ -215,9 +398,7 @@ IOReturn ChultraInt3400::acpiGetSupportedPolicies() {
         }
         
         memcpy(guid, entry->getBytesNoCopy(), sizeof(uuid_t));
-        *(reinterpret_cast<uint32_t *>(guid)) = OSSwapInt32(*(reinterpret_cast<uint32_t *>(guid)));
-        *(reinterpret_cast<uint16_t *>(guid) + 2) = OSSwapInt16(*(reinterpret_cast<uint16_t *>(guid) + 2));
-        *(reinterpret_cast<uint16_t *>(guid) + 3) = OSSwapInt16(*(reinterpret_cast<uint16_t *>(guid) + 3));
+        swapAcpiGuid(guid);
         
         for (size_t pol = 0; pol < DPTFPolicyMax; pol++) {
             uuid_t knownGuid;
@@ -236,8 +417,90 @@ IOReturn ChultraInt3400::acpiGetSupportedPolicies() {
     return kIOReturnSuccess;
 }
 
+IOReturn ChultraInt3400::acpiRunOsc(dptf_policies_t policy, bool enable) {
+    uuid_t guid;
+    if (uuid_parse(DPTFPolicyGuids[policy], guid) < 0) {
+        return kIOReturnInvalid;
+    }
+    
+    swapAcpiGuid(guid);
+    
+    // Query flag clear, bit 0 of the support dword turns the policy on
+    uint32_t capabilities[2] = { 0, enable ? 1U : 0U };
+    
+    OSData *uuidArg = OSData::withBytes(guid, sizeof(uuid_t));
+    OSNumber *revisionArg = OSNumber::withNumber(1ULL, 32);
+    OSNumber *countArg = OSNumber::withNumber(2ULL, 32);
+    OSData *capabilitiesArg = OSData::withBytes(capabilities, sizeof(capabilities));
+    OSObject *oscReturn = nullptr;
+    IOReturn ret = kIOReturnNoMemory;
+    
+    if (uuidArg != nullptr && revisionArg != nullptr && countArg != nullptr && capabilitiesArg != nullptr) {
+        OSObject *params[4] = {
+            uuidArg,
+            revisionArg,
+            countArg,
+            capabilitiesArg,
+        };
+        
+        ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodOSC, &oscReturn, params, 4);
+    }
+    
+    // First dword of the returned buffer reports failure, unknown UUID/revision or masked capabilities
+    OSData *status = OSDynamicCast(OSData, oscReturn);
+    if (ret == kIOReturnSuccess && status != nullptr && status->getLength() >= sizeof(uint32_t)) {
+        uint32_t errors = *static_cast<const uint32_t *>(status->getBytesNoCopy()) & 0x1E;
+        if (errors != 0) {
+            IOLogError("_OSC for %s policy failed (0x%x)", DPTFPolicyNames[policy], errors);
+            ret = kIOReturnUnsupported;
+        }
+    }
+    
+    OSSafeReleaseNULL(oscReturn);
+    OSSafeReleaseNULL(capabilitiesArg);
+    OSSafeReleaseNULL(countArg);
+    OSSafeReleaseNULL(revisionArg);
+    OSSafeReleaseNULL(uuidArg);
+    return ret;
+}
+
+IOReturn ChultraInt3400::setPlatformControl(bool take) {
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodOSC)) {
+        return kIOReturnUnsupported;
+    }
+    
+    IOLockLock(ownershipLock);
+    if (take && stopped) {
+        IOLockUnlock(ownershipLock);
+        return kIOReturnOffline;
+    }
+    
+    //
+    // Firmware keeps running its own fan table until _OSC tells it a driver
+    // implements the policy. Only claim policies we actually have modules for.
+    //
+    for (int policy = 0; policy < DPTFPolicyMax; policy++) {
+        uint32_t bit = 1 << policy;
+        if ((supportedPolicies & bit) == 0 || !DPTFPolicyModule::implemented(static_cast<dptf_policies_t>(policy))) continue;
+        if (take == ((ownedPolicies & bit) != 0)) continue;
+        
+        if (acpiRunOsc(static_cast<dptf_policies_t>(policy), take) != kIOReturnSuccess) continue;
+        
+        IOLogInfo("%s %s policy %s firmware", take ? "Took" : "Returned", DPTFPolicyNames[policy], take ? "from" : "to");
+        ownedPolicies ^= bit;
+    }
+    
+    setProperty("OwnedPolicies", ownedPolicies, 32);
+    IOLockUnlock(ownershipLock);
+    return kIOReturnSuccess;
+}
+
 IOReturn ChultraInt3400::message(UInt32 type, IOService *provider, void *args) {
     switch (type) {
+        case kIOMessageDptfZoneTakeControl:
+            return setPlatformControl(true);
+        case kIOMessageDptfZoneReleaseControl:
+            return setPlatformControl(false);
         case kIOACPIMessageDeviceNotification:
             if (thermal != nullptr) {
                 thermal->message(type, provider, args);
@@ -9,48 +9,15 @@
 #define ChultraInt3400_hpp
 
 #include "ChultraThermal.hpp"
+#include "AcpiUtils.hpp"
+#include "BoardProfiles.hpp"
+#include "AmlDecoder.hpp"
+#include "PolicyModule.hpp"
 
 #include <IOKit/IOService.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <IOKit/acpi/IOACPITypes.h>
 
-// ACPI Replacement for now since AppleACPI is unable to parse device handles
-const struct { const char *heatSource; const char *sensor; uint32_t weight; uint32_t samplingPeriod; } KLEDTrt[] = {
-    { "/_SB/PCI0/TCPU", "/_SB/PCI0/TCPU", 100, 50 },
-    { "/_SB/PCI0/TCPU", "/_SB/DPTF/TSR0", 100, 60 },
-    { "/_SB/DPTF/TCHG", "/_SB/DPTF/TSR1", 100, 60 },
-    { "/_SB/DPTF/TCHG", "/_SB/DPTF/TSR2", 100, 60 },
-};
-
-const struct { const char *fanDev; const char *source; uint32_t weight; uint32_t maxFanSpeed[DPTFActivePolicyMaxTemps]; } KLEDArt[] = {
-    { "/_SB/DPTF/TFN1", "/_SB/PCI0/TCPU", 100, {0x64, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // CPU Critical
-    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR0", 100, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // Charger
-    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR1", 100, {0x5A, 0x50, 0x46, 0x3C, 0x32, 0x28, 0x1E, 0x00, 0x00, 0x00} }, // CPU Active
-    { "/_SB/DPTF/TFN1", "/_SB/DPTF/TSR2", 100, {0x64, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00} }, // Wifi
-};
-
-// DPTF Policies
-enum dptf_policies_t {
-    DPTFActivePolicy = 0,
-    DPTFPassivePolicy,
-    DPTFCriticalPolicy,
-    DPTFPolicyMax
-};
-
-const char *DPTFPolicyGuids[DPTFPolicyMax] = {
-    "3A95C389-E4B8-4629-A526-C52C88626BAE",
-    "42a441d6-ae6a-462b-a84b-4a8ce79027d3",
-    "97C68AE7-15FA-499c-B8C9-5DA81D606E0A"
-};
-
-// Passive Policy
-struct DPTFThermalRelationsTable {
-    uint32_t revision;
-    struct DPTFThermalRelationEntry {
-        
-    } entries[];
-};
-
 class ChultraInt3400 : public IOService {
     OSDeclareDefaultStructors(ChultraInt3400);
   
@@ -64,15 +31,34 @@ class ChultraInt3400 : public IOService {
     
 private:
     IOACPIPlatformDevice *acpi {nullptr};
+    ChultraACPIUtils::AcpiDevice acpiDev;
     ChultraThermal *thermal {nullptr};
+    IONotifier *thermalNotifier {nullptr};
+    const DPTFBoardProfile *boardProfile {nullptr};
     
-    IOReturn acpiReadActivePolicy();
-    IOReturn acpiReadThermalRelations();
+    bool thermalPublished(void *refCon, IOService *newService, IONotifier *notifier);
+    const DPTFBoardProfile *selectBoardProfile();
+    IOReturn acpiDecodeRelations(AmlDecoder::Relations *relations);
+    IOReturn acpiReadActivePolicy(const AmlDecoder::Relations *relations);
+    IOReturn acpiReadThermalRelations(const AmlDecoder::Relations *relations);
+    IOReturn addActivePolicy(const char *fan, const char *source, uint32_t weight, const uint32_t *maxFanSpeeds);
+    IOReturn addThermalRelation(const char *source, const char *target, uint32_t weight, uint32_t samplingPeriod);
     IOReturn acpiGetSupportedPolicies();
+    IOReturn acpiRunOsc(dptf_policies_t policy, bool enable);
+    IOReturn setPlatformControl(bool take);
     
     OSDictionary *activePolicies {nullptr};
     OSArray *thermalRelations {nullptr};
     uint32_t supportedPolicies {0};
+    
+    //
+    // Policies firmware has handed over through _OSC. The core's messages
+    // and stop() both change them, ownershipLock keeps _OSC calls from
+    // interleaving and stopped keeps a late take from the core out.
+    //
+    IOLock *ownershipLock {nullptr};
+    uint32_t ownedPolicies {0};
+    bool stopped {false};
 };
 
 
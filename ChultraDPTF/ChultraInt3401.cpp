@@ -0,0 +1,340 @@
+//
+//  ChultraInt3401.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/11/23.
+//
+
+#include "ChultraInt3401.hpp"
+#include "AcpiUtils.hpp"
+#include "Logger.h"
+
+#include <i386/proc_reg.h>
+
+#define super IOService
+OSDefineMetaClassAndStructors(ChultraInt3401, IOService);
+
+ChultraInt3401 *ChultraInt3401::probe(IOService *provider, SInt32 *score) {
+    // The PCI function carries its ACPI companion, INT3401 is the companion itself
+    acpi = OSDynamicCast(IOACPIPlatformDevice, provider);
+    if (acpi == nullptr) {
+        acpi = OSDynamicCast(IOACPIPlatformDevice, provider->getProperty("acpi-device"));
+    }
+    
+    if (acpi == nullptr) {
+        return nullptr;
+    }
+    
+    if (ChultraACPIUtils::acpiDeviceInit(&acpiDev, acpi) != kIOReturnSuccess) {
+        return nullptr;
+    }
+    
+    // Not a DPTF participant without a temperature
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodTMP)) {
+        return nullptr;
+    }
+    
+    return super::probe(provider, score) ? this : nullptr;
+}
+
+bool ChultraInt3401::start(IOService *provider) {
+    if (ChultraACPIUtils::acpiReadActiveTrips(&acpiDev, &activeTrips) != kIOReturnSuccess) {
+        return false;
+    }
+    
+    // Everything below is optional, firmware only lists what it supports
+    if (parsePpcc() == kIOReturnSuccess) {
+        raplUnits = ProcessorPower::decodeUnits(rdmsr64(MSR_IA32_PKG_POWER_SKU_UNIT));
+        firmwarePowerLimit = rdmsr64(MSR_IA32_PKG_POWER_LIMIT);
+        (void) measurePower();
+    }
+    
+    (void) ChultraACPIUtils::acpiReadLimitTrips(&acpiDev, &limitTrips);
+    if (limitTrips.passive != 0) {
+        setProperty("PassiveTrip", limitTrips.passive, 32);
+    }
+    
+    (void) parsePerformanceStates();
+    
+    // Registration happens once the thermal core is published
+    thermalNotifier = ChultraThermal::NotifyWhenPublished(OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &ChultraInt3401::thermalPublished), this);
+    if (thermalNotifier == nullptr) {
+        return false;
+    }
+    
+    registerService();
+    return super::start(provider);
+}
+
+bool ChultraInt3401::thermalPublished(void *refCon, IOService *newService, IONotifier *notifier) {
+    ChultraThermal *newThermal = OSDynamicCast(ChultraThermal, newService);
+    IOReturn ret;
+    
+    if (newThermal == nullptr || thermal != nullptr) {
+        return false;
+    }
+    
+    // Set before registering, message() refuses requests while this is null
+    newThermal->retain();
+    thermal = newThermal;
+    
+    ret = newThermal->callPlatformFunction(gDPTFRegisterSensor, true, (void *) acpiDev.path, this, nullptr, nullptr);
+    if (ret != kIOReturnSuccess) {
+        IOLogError("Failed to register processor with thermal core");
+        OSSafeReleaseNULL(thermal);
+        return false;
+    }
+    
+    // Only worth arbitrating against fans if there is a limit to move
+    if (hasPowerLimit && limitTrips.passive != 0) {
+        ret = newThermal->callPlatformFunction(gDPTFRegisterPassive, true, (void *) acpiDev.path, this, nullptr, nullptr);
+        if (ret != kIOReturnSuccess) {
+            IOLogError("Failed to register processor power limit with thermal core");
+        }
+    }
+    
+    return true;
+}
+
+void ChultraInt3401::stop(IOService *provider) {
+    if (thermalNotifier != nullptr) {
+        thermalNotifier->remove();
+        thermalNotifier = nullptr;
+    }
+    
+    if (thermal != nullptr) {
+        (void) thermal->callPlatformFunction(gDPTFUnregisterSensor, true, (void *) acpiDev.path, nullptr, nullptr, nullptr);
+        (void) thermal->callPlatformFunction(gDPTFUnregisterPassive, true, (void *) acpiDev.path, nullptr, nullptr, nullptr);
+        OSSafeReleaseNULL(thermal);
+    }
+    
+    // Don't leave the package throttled once we're gone
+    (void) setPowerLimit(0);
+    super::stop(provider);
+}
+
+void ChultraInt3401::free() {
+    ChultraACPIUtils::acpiDeviceFree(&acpiDev);
+    super::free();
+}
+
+IOReturn ChultraInt3401::message(uint32_t type, IOService *provider, void *args) {
+    uint32_t *toFill = static_cast<uint32_t *>(args);
+    DPTFAuxTrips *auxTrips;
+    uint32_t temp;
+    IOReturn err;
+    
+    switch (type) {
+        case kIOMessageDptfSensorReadLevel:
+            // The core may still hold a policy snapshot from before we stopped
+            if (thermal == nullptr) return kIOReturnOffline;
+            err = getTemp(&temp);
+            if (err != kIOReturnSuccess) return err;
+            *toFill = ChultraACPIUtils::acpiActiveTripLevel(&activeTrips, temp);
+            return kIOReturnSuccess;
+        case kIOMessageDptfSensorReadTemp:
+            if (thermal == nullptr) return kIOReturnOffline;
+            return getTemp(toFill);
+        case kIOMessageDptfSensorSample:
+            if (thermal == nullptr) return kIOReturnOffline;
+            return getSample(static_cast<DPTFSensorSample *>(args));
+        case kIOMessageDptfSensorSetHysteresis:
+            // Policy overrides may replace GTSH, default puts it back
+            activeTrips.hysteresis = *toFill == DPTF_POLICY_HYSTERESIS_DEFAULT ? activeTrips.firmwareHysteresis : *toFill;
+            return kIOReturnSuccess;
+        case kIOMessageDptfSensorReloadTrips:
+            if (thermal == nullptr) return kIOReturnOffline;
+            // Firmware restores its own limits across sleep, so ours has to be written again
+            appliedPowerLimit = 0;
+            (void) ChultraACPIUtils::acpiReadLimitTrips(&acpiDev, &limitTrips);
+            return ChultraACPIUtils::acpiReadActiveTrips(&acpiDev, &activeTrips);
+        case kIOMessageDptfSensorArmAuxTrips:
+            if (thermal == nullptr) return kIOReturnOffline;
+            auxTrips = static_cast<DPTFAuxTrips *>(args);
+            return ChultraACPIUtils::acpiArmAuxTrips(&acpiDev, &activeTrips, &limitTrips, auxTrips->temperature, auxTrips->band);
+        case kIOMessageDptfProcessorSetPowerLimit:
+            if (thermal == nullptr) return kIOReturnOffline;
+            return setPowerLimit(*toFill);
+        case kIOMessageDptfProcessorGetStatus:
+            if (thermal == nullptr) return kIOReturnOffline;
+            return getStatus(static_cast<DPTFProcessorStatus *>(args));
+        case kIOACPIMessageDeviceNotification:
+            // Notify(0x90) means a programmed aux trip was crossed, same as INT3403
+            if (args == nullptr || *toFill != 0x90) {
+                return super::message(type, provider, args);
+            }
+        
+            if (thermal != nullptr) {
+                thermal->requestEvaluation();
+            }
+            return kIOReturnSuccess;
+        default:
+            return super::message(type, provider, args);
+    }
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3401::getTemp(uint32_t *toFill) {
+    uint32_t acpiRet;
+    IOReturn err = ChultraACPIUtils::acpiGetUInt32(&acpiDev, ChultraACPIUtils::AcpiMethodTMP, &acpiRet);
+    if (err != kIOReturnSuccess) {
+        return err;
+    }
+    
+    *toFill = ChultraACPIUtils::acpiTempToCelsius(acpiRet);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3401::getSample(DPTFSensorSample *sample) {
+    DPTFSensorSample filled {};
+    uint32_t temp;
+    
+    // Everything comes from this one evaluation
+    filled.status = getTemp(&temp);
+    clock_get_uptime(&filled.timestamp);
+    
+    if (filled.status == kIOReturnSuccess) {
+        filled.rawTemperature = temp;
+        filled.temperature = ChultraACPIUtils::acpiFilterTemp(&tempFilter, temp);
+        filled.level = ChultraACPIUtils::acpiActiveTripLevel(&activeTrips, temp);
+        filled.passiveTrip = limitTrips.passive;
+        filled.criticalTrip = limitTrips.critical;
+    }
+    
+    return DPTFSensorSampleCopy(sample, &filled);
+}
+
+IOReturn ChultraInt3401::getStatus(DPTFProcessorStatus *status) {
+    if (!hasPowerLimit || limitTrips.passive == 0) {
+        return kIOReturnUnsupported;
+    }
+    
+    // Temperature is the caller's, from the sample it already took this tick
+    status->passiveTrip = limitTrips.passive;
+    status->power = measurePower();
+    status->minLimit = powerLimit.minPower;
+    status->maxLimit = powerLimit.maxPower;
+    status->appliedLimit = appliedPowerLimit;
+    return kIOReturnSuccess;
+}
+
+uint32_t ChultraInt3401::measurePower() {
+    uint64_t now, nowNs;
+    uint32_t counter = static_cast<uint32_t>(rdmsr64(MSR_IA32_PKG_ENERGY_STATUS));
+    
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now, &nowNs);
+    return ProcessorPower::measure(&energy, counter, nowNs, raplUnits);
+}
+
+static bool readPackage(void *package, uint32_t row, uint32_t column, uint32_t *value) {
+    OSArray *rows = static_cast<OSArray *>(package);
+    if (row == ProcessorPower::Count) {
+        *value = rows->getCount();
+        return true;
+    }
+    
+    OSArray *elements = OSDynamicCast(OSArray, rows->getObject(row));
+    if (elements == nullptr) return false;
+    if (column == ProcessorPower::Count) {
+        *value = elements->getCount();
+        return true;
+    }
+    
+    OSNumber *num = OSDynamicCast(OSNumber, elements->getObject(column));
+    if (num == nullptr) return false;
+    
+    *value = num->unsigned32BitValue();
+    return true;
+}
+
+IOReturn ChultraInt3401::parsePpcc() {
+    OSObject *acpiRet;
+    IOReturn ret;
+    
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodPPCC)) {
+        return kIOReturnNotFound;
+    }
+    
+    ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodPPCC, &acpiRet);
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    
+    OSArray *ppcc = OSDynamicCast(OSArray, acpiRet);
+    hasPowerLimit = ppcc != nullptr && ProcessorPower::parsePpcc(readPackage, ppcc, &powerLimit);
+    OSSafeReleaseNULL(acpiRet);
+    
+    if (!hasPowerLimit) {
+        IOLogError("%s: No usable PL1 range in PPCC", acpiDev.path->getCStringNoCopy());
+        return kIOReturnInvalid;
+    }
+    
+    IOLogInfo("%s: PL1 %d-%d mW, step %d mW", acpiDev.path->getCStringNoCopy(), powerLimit.minPower, powerLimit.maxPower, powerLimit.step);
+    setProperty("PL1MinMW", powerLimit.minPower, 32);
+    setProperty("PL1MaxMW", powerLimit.maxPower, 32);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3401::parsePerformanceStates() {
+    OSObject *acpiRet;
+    
+    //
+    // macOS manages P-states itself, these are only published so passive
+    // policies know how much room there is below the power limit.
+    //
+    
+    if (ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodPSS, &acpiRet) == kIOReturnSuccess) {
+        OSArray *pss = OSDynamicCast(OSArray, acpiRet);
+        if (pss != nullptr) pStateCount = ProcessorPower::countStates(readPackage, pss, 6);
+        OSSafeReleaseNULL(acpiRet);
+    }
+    
+    if (ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodTSS, &acpiRet) == kIOReturnSuccess) {
+        OSArray *tss = OSDynamicCast(OSArray, acpiRet);
+        if (tss != nullptr) tStateCount = ProcessorPower::countStates(readPackage, tss, 5);
+        OSSafeReleaseNULL(acpiRet);
+    }
+    
+    setProperty("PStates", pStateCount, 32);
+    setProperty("TStates", tStateCount, 32);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3401::setPowerLimit(uint32_t milliwatts) {
+    if (!hasPowerLimit) {
+        return kIOReturnUnsupported;
+    }
+    
+    // 0 goes back to whatever firmware programmed
+    if (milliwatts == 0) {
+        if (appliedPowerLimit == 0) return kIOReturnSuccess;
+        
+        wrmsr64(MSR_IA32_PKG_POWER_LIMIT, firmwarePowerLimit);
+        appliedPowerLimit = 0;
+        removeProperty("PL1MW");
+        return kIOReturnSuccess;
+    }
+    
+    // Stay inside the range firmware published, on its step size
+    milliwatts = ProcessorPower::clampLimit(powerLimit, milliwatts);
+    
+    // Called every evaluation, only touch the MSR when something changes
+    if (milliwatts == appliedPowerLimit) {
+        return kIOReturnSuccess;
+    }
+    
+    uint64_t limit = rdmsr64(MSR_IA32_PKG_POWER_LIMIT);
+    if (limit & DPTFPackageLimitLock) {
+        IOLogError("%s: Package power limit is locked by firmware", acpiDev.path->getCStringNoCopy());
+        hasPowerLimit = false;
+        return kIOReturnNotPermitted;
+    }
+    
+    wrmsr64(MSR_IA32_PKG_POWER_LIMIT, ProcessorPower::encodeLimit(limit, milliwatts, raplUnits));
+    
+    appliedPowerLimit = milliwatts;
+    setProperty("PL1MW", milliwatts, 32);
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,67 @@
+//
+//  ChultraInt3401.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/11/23.
+//
+
+#ifndef ChultraInt3401_hpp
+#define ChultraInt3401_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
+
+#include "ChultraThermal.hpp"
+#include "AcpiUtils.hpp"
+#include "ProcessorPower.hpp"
+
+//
+// Processor participant (TCPU). Binds either to INT3401 or to the processor
+// thermal PCI device through its ACPI companion. Registers as a sensor like
+// INT3403 does, and as a passive device so the core can trade its package
+// power limit against fan speed.
+//
+class ChultraInt3401 : public IOService {
+    OSDeclareDefaultStructors(ChultraInt3401);
+    
+    ChultraInt3401 *probe(IOService *provider, SInt32 *score) override;
+    bool start(IOService *provider) override;
+    void stop(IOService *provider) override;
+    void free() override;
+    IOReturn message(uint32_t type, IOService *provider, void *args) override;
+private:
+    IOACPIPlatformDevice *acpi {nullptr};
+    ChultraACPIUtils::AcpiDevice acpiDev;
+    ChultraACPIUtils::ActiveTrips activeTrips;
+    ChultraACPIUtils::TempFilter tempFilter;
+    ChultraThermal *thermal {nullptr};
+    IONotifier *thermalNotifier {nullptr};
+    
+    // PL1 range, the only one we adjust
+    ProcessorPower::PowerLimitRange powerLimit {};
+    bool hasPowerLimit {false};
+    
+    uint32_t pStateCount {0};
+    uint32_t tStateCount {0};
+    
+    ProcessorPower::Units raplUnits {};
+    uint64_t firmwarePowerLimit {0};
+    uint32_t appliedPowerLimit {0};
+    
+    // _PSV and _CRT, re-read with the active trips
+    ChultraACPIUtils::LimitTrips limitTrips;
+    
+    ProcessorPower::EnergyCounter energy {};
+    
+    IOReturn getTemp(uint32_t *toFill);
+    IOReturn getSample(DPTFSensorSample *sample);
+    IOReturn getStatus(DPTFProcessorStatus *status);
+    uint32_t measurePower();
+    IOReturn parsePpcc();
+    IOReturn parsePerformanceStates();
+    IOReturn setPowerLimit(uint32_t milliwatts);
+    
+    bool thermalPublished(void *refCon, IOService *newService, IONotifier *notifier);
+};
+
+#endif /* ChultraInt3401_hpp */
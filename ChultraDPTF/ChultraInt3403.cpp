@@ -18,8 +18,12 @@ ChultraInt3403 *ChultraInt3403::probe(IOService *provider, SInt32 *score) {
         return nullptr;
     }
     
+    if (ChultraACPIUtils::acpiDeviceInit(&acpiDev, acpi) != kIOReturnSuccess) {
+        return nullptr;
+    }
+    
     uint32_t typeRet;
-    IOReturn err = ChultraACPIUtils::acpiGetUInt32(acpi, "PTYP", &typeRet);
+    IOReturn err = ChultraACPIUtils::acpiGetUInt32(&acpiDev, ChultraACPIUtils::AcpiMethodPTYP, &typeRet);
     if (err != kIOReturnSuccess) {
         return nullptr;
     }
@@ -30,68 +34,136 @@ ChultraInt3403 *ChultraInt3403::probe(IOService *provider, SInt32 *score) {
         default: return nullptr;
     }
     
-    // Not needed for fan control
-    // TODO: Enable for passive thermal control!
-    if (type == Charger) return nullptr;
+    // Chargers are only useful if we can lower their current
+    if (type == Charger && (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodPPSS) ||
+                            !ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodSPPC))) {
+        return nullptr;
+    }
     
     return super::probe(provider, score) ? this : nullptr;
 }
 
 bool ChultraInt3403::start(IOService *provider) {
-    const OSSymbol *acpiPath;
     IOReturn ret;
     
-    thermal = ChultraThermal::WaitForThermal();
-    acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
-    
-    if (thermal == nullptr) {
-        return false;
-    }
-    
-    if (acpiPath == nullptr) {
-        goto err;
-    }
-    
     // TODO: Check errors here
     if (type == Sensor) {
-        ret = parseACx();
+        ret = ChultraACPIUtils::acpiReadActiveTrips(&acpiDev, &activeTrips);
         if (ret != kIOReturnSuccess) {
-            goto err;
+            return false;
         }
         
-        ret = thermal->callPlatformFunction(gDPTFRegisterSensor, true, (void *) acpiPath, this, nullptr, nullptr);
+        (void) ChultraACPIUtils::acpiReadLimitTrips(&acpiDev, &limitTrips);
+    } else {
+        ret = parsePpss();
         if (ret != kIOReturnSuccess) {
-            goto err;
+            return false;
         }
-        
-    } else {
-        // TODO: Parse charger power levels for passive policy
+    }
+    
+    // Registration happens once the thermal core is published
+    thermalNotifier = ChultraThermal::NotifyWhenPublished(OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &ChultraInt3403::thermalPublished), this);
+    if (thermalNotifier == nullptr) {
+        return false;
     }
     
     registerService();
     return super::start(provider);
-err:
-    stop(provider);
-    return false;
+}
+
+bool ChultraInt3403::thermalPublished(void *refCon, IOService *newService, IONotifier *notifier) {
+    ChultraThermal *newThermal = OSDynamicCast(ChultraThermal, newService);
+    IOReturn ret;
+    
+    if (newThermal == nullptr || thermal != nullptr) {
+        return false;
+    }
+    
+    // Set before registering, message() refuses requests while this is null
+    newThermal->retain();
+    thermal = newThermal;
+    
+    ret = newThermal->callPlatformFunction(type == Sensor ? gDPTFRegisterSensor : gDPTFRegisterPassive, true, (void *) acpiDev.path, this, nullptr, nullptr);
+    if (ret != kIOReturnSuccess) {
+        IOLogError("Failed to register %s with thermal core", type == Sensor ? "sensor" : "charger");
+        OSSafeReleaseNULL(thermal);
+        return false;
+    }
+    
+    return true;
 }
 
 void ChultraInt3403::stop(IOService *provider) {
+    if (thermalNotifier != nullptr) {
+        thermalNotifier->remove();
+        thermalNotifier = nullptr;
+    }
+    
     if (thermal != nullptr) {
-        const OSSymbol *acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
-        (void) thermal->callPlatformFunction(gDPTFUnregisterSensor, true, (void *) acpiPath, nullptr, nullptr, nullptr);
+        (void) thermal->callPlatformFunction(type == Sensor ? gDPTFUnregisterSensor : gDPTFUnregisterPassive, true, (void *) acpiDev.path, nullptr, nullptr, nullptr);
         OSSafeReleaseNULL(thermal);
     }
+    
+    // Don't leave charging throttled once we're gone
+    if (type == Charger) {
+        (void) setChargeLevel(0);
+    }
     super::stop(provider);
 }
 
+void ChultraInt3403::free() {
+    ChultraACPIUtils::acpiDeviceFree(&acpiDev);
+    super::free();
+}
+
 IOReturn ChultraInt3403::message(uint32_t type, IOService *provider, void *args) {
     uint32_t *toFill = static_cast<uint32_t *>(args);
+    DPTFAuxTrips *auxTrips;
     
     switch (type) {
         case kIOMessageDptfSensorReadLevel:
+            // The core may still hold a policy snapshot from before we stopped
+            if (thermal == nullptr) return kIOReturnOffline;
             return getThermalState(toFill);
         case kIOMessageDptfSensorReadTemp:
+            if (thermal == nullptr) return kIOReturnOffline;
             return getTemp(toFill);
+        case kIOMessageDptfSensorSample:
+            if (thermal == nullptr) return kIOReturnOffline;
+            return getSample(static_cast<DPTFSensorSample *>(args));
+        case kIOMessageDptfSensorSetHysteresis:
+            // Policy overrides may replace GTSH, default puts it back
+            activeTrips.hysteresis = *toFill == DPTF_POLICY_HYSTERESIS_DEFAULT ? activeTrips.firmwareHysteresis : *toFill;
+            return kIOReturnSuccess;
+        case kIOMessageDptfSensorReloadTrips:
+            // Firmware may move trip points across sleep
+            if (thermal == nullptr) return kIOReturnOffline;
+            if (this->type != Sensor) return kIOReturnSuccess;
+            (void) ChultraACPIUtils::acpiReadLimitTrips(&acpiDev, &limitTrips);
+            return ChultraACPIUtils::acpiReadActiveTrips(&acpiDev, &activeTrips);
+        case kIOMessageDptfSensorArmAuxTrips:
+            if (thermal == nullptr) return kIOReturnOffline;
+            if (this->type != Sensor) return kIOReturnUnsupported;
+            auxTrips = static_cast<DPTFAuxTrips *>(args);
+            return ChultraACPIUtils::acpiArmAuxTrips(&acpiDev, &activeTrips, &limitTrips, auxTrips->temperature, auxTrips->band);
+        case kIOMessageDptfPassiveGetLevels:
+            if (this->type != Charger) return kIOReturnUnsupported;
+            *toFill = chargeStateCount;
+            return kIOReturnSuccess;
+        case kIOMessageDptfPassiveSetLevel:
+            if (thermal == nullptr) return kIOReturnOffline;
+            if (this->type != Charger) return kIOReturnUnsupported;
+            return setChargeLevel(*toFill);
+        case kIOACPIMessageDeviceNotification:
+            // Notify(0x90) means a programmed threshold was crossed, don't wait for the next period
+            if (this->type != Sensor || args == nullptr || *toFill != 0x90) {
+                return super::message(type, provider, args);
+            }
+        
+            if (thermal != nullptr) {
+                thermal->requestEvaluation();
+            }
+            return kIOReturnSuccess;
         default:
             return super::message(type, provider, args);
     }
@@ -101,7 +173,7 @@ IOReturn ChultraInt3403::message(uint32_t type, IOService *provider, void *args)
 
 IOReturn ChultraInt3403::getTemp(uint32_t *toFill) {
     uint32_t acpiRet;
-    IOReturn err = ChultraACPIUtils::acpiGetUInt32(acpi, "_TMP", &acpiRet);
+    IOReturn err = ChultraACPIUtils::acpiGetUInt32(&acpiDev, ChultraACPIUtils::AcpiMethodTMP, &acpiRet);
     ChultraACPIUtils::celsius_t temp = ChultraACPIUtils::acpiTempToCelsius(acpiRet);
     
     if (err == kIOReturnSuccess) {
@@ -117,54 +189,95 @@ IOReturn ChultraInt3403::getThermalState(uint32_t *toFill) {
     IOReturn err = getTemp(&temp);
     if (err != kIOReturnSuccess) return err;
     
-    // Walk through states from highest temp to lowest temp
-    for (size_t i = ACParseHighestTemp; i < ACParseLowestTemp; i++) {
-        // Lowest speed, turn off fan
-        if (activeTripPoints[i] == 0) {
-            *toFill = ACParseLowestTemp;
-            break;
-        }
-        
-        // When downgrading states, take into account hysteresis
-        if (i == lastState) temp += hysteresis;
-        
-        // Highest state where we trip
-        if (temp > activeTripPoints[i]) {
-            *toFill = (uint32_t) i;
-            break;
-        }
-    }
-    
-    lastState = *toFill;
+    *toFill = ChultraACPIUtils::acpiActiveTripLevel(&activeTrips, temp);
     return kIOReturnSuccess;
 }
 
-IOReturn ChultraInt3403::parseACx() {
-    IOReturn err;
+IOReturn ChultraInt3403::getSample(DPTFSensorSample *sample) {
+    DPTFSensorSample filled {};
     uint32_t temp;
-    char methodName[5] = "_AC0";
     
-    // Grab Hysteresis value for downgrading state
-    (void) ChultraACPIUtils::acpiGetUInt32(acpi, "GTSH", &hysteresis);
+    // Everything comes from this one evaluation
+    filled.status = getTemp(&temp);
+    clock_get_uptime(&filled.timestamp);
     
-    // Read all the _ACx methods to get trip points for active policy.
-    // These give us temperatures at which we should increase fan speed.
-    // 0 is the highest fan speed, while 1-9 are increasing slower.
+    if (filled.status == kIOReturnSuccess) {
+        filled.rawTemperature = temp;
+        filled.temperature = ChultraACPIUtils::acpiFilterTemp(&tempFilter, temp);
+        filled.level = ChultraACPIUtils::acpiActiveTripLevel(&activeTrips, temp);
+        filled.passiveTrip = limitTrips.passive;
+        filled.criticalTrip = limitTrips.critical;
+    }
+    
+    return DPTFSensorSampleCopy(sample, &filled);
+}
 
-    bzero(activeTripPoints, sizeof(activeTripPoints));
-    for (size_t i = ACParseHighestTemp; i < ACParseLowestTemp; i++) {
-        methodName[3] = '0' + i;
-        err = ChultraACPIUtils::acpiGetUInt32(acpi, methodName, &temp);
-        
-        // Not all 10 methods are guaranteed to be here.
-        // Can't really differentiate between no method and other errors,
-        // So hopefully everything is ok!
-        if (err != kIOReturnSuccess) break;
+IOReturn ChultraInt3403::parsePpss() {
+    OSObject *acpiRet;
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodPPSS, &acpiRet);
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    
+    //
+    // Package { Package { Performance, Power, Latency, Linear, Control, RawPerformance, RawUnit, Reserved }, ... }
+    // Ordered from fastest to slowest charging
+    //
+    
+    OSArray *ppss = OSDynamicCast(OSArray, acpiRet);
+    for (unsigned int i = 0; ppss != nullptr && i < ppss->getCount() && chargeStateCount < MaxChargeStates; i++) {
+        OSArray *state = OSDynamicCast(OSArray, ppss->getObject(i));
+        OSNumber *raw = state != nullptr ? OSDynamicCast(OSNumber, state->getObject(5)) : nullptr;
+        if (raw == nullptr) break;
         
-        activeTripPoints[i] = ChultraACPIUtils::acpiTempToCelsius(temp) + 130;
+        chargeLimits[chargeStateCount++] = raw->unsigned32BitValue();
+    }
+    
+    OSSafeReleaseNULL(acpiRet);
+    
+    if (chargeStateCount == 0) {
+        IOLogError("%s: No charger states in PPSS", acpiDev.path->getCStringNoCopy());
+        return kIOReturnInvalid;
+    }
+    
+    IOLogInfo("%s: %d charger states, %d-%d", acpiDev.path->getCStringNoCopy(), chargeStateCount,
+              chargeLimits[chargeStateCount - 1], chargeLimits[0]);
+    setProperty("ChargeStates", chargeStateCount, 32);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3403::setChargeLevel(uint32_t level) {
+    uint32_t allowed = 0;
+    
+    if (level >= chargeStateCount) level = chargeStateCount - 1;
+    
+    // Never ask for more than firmware currently allows
+    if (ChultraACPIUtils::acpiGetUInt32(&acpiDev, ChultraACPIUtils::AcpiMethodPPPC, &allowed) == kIOReturnSuccess &&
+        allowed < chargeStateCount && level < allowed) {
+        level = allowed;
+    }
+    
+    if (level == chargeLevel) {
+        return kIOReturnSuccess;
+    }
+    
+    OSNumber *acpiLevel = OSNumber::withNumber(level, 32);
+    if (acpiLevel == nullptr) {
+        return kIOReturnNoMemory;
+    }
+    
+    OSObject *params[1] = {
+        acpiLevel,
+    };
+    
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodSPPC, nullptr, params, 1);
+    OSSafeReleaseNULL(acpiLevel);
+    if (ret != kIOReturnSuccess) {
+        return ret;
     }
     
-    // Always return success for now
-    // There *can* be zero _AC states and no hystersis
+    IOLogInfo("%s: Charge limit set to %d", acpiDev.path->getCStringNoCopy(), chargeLimits[level]);
+    chargeLevel = level;
+    setProperty("ChargeLevel", level, 32);
     return kIOReturnSuccess;
 }
@@ -10,23 +10,20 @@
 
 #include <IOKit/IOService.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
+#include <IOKit/acpi/IOACPITypes.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOTimerEventSource.h>
 
 #include "ChultraThermal.hpp"
 #include "AcpiUtils.hpp"
 
-enum ACParseState_t {
-    ACParseHighestTemp = 0,
-    ACParseLowestTemp = 10,
-};
-
 class ChultraInt3403 : public IOService {
     OSDeclareDefaultStructors(ChultraInt3403);
-
+    
     ChultraInt3403 *probe(IOService *provider, SInt32 *score) override;
     bool start(IOService *provider) override;
     void stop(IOService *provider) override;
+    void free() override;
     IOReturn message(uint32_t type, IOService *provider, void *args) override;
 private:
     
@@ -37,16 +34,29 @@ private:
     
     ChultraInt3403Type type;
     IOACPIPlatformDevice *acpi {nullptr};
-    ChultraACPIUtils::celsius_t activeTripPoints[ACParseLowestTemp];
-    ChultraACPIUtils::celsius_t hysteresis {0};
+    ChultraACPIUtils::AcpiDevice acpiDev;
+    ChultraACPIUtils::ActiveTrips activeTrips;
+    ChultraACPIUtils::TempFilter tempFilter;
+    ChultraACPIUtils::LimitTrips limitTrips;
     ChultraThermal *thermal {nullptr};
+    IONotifier *thermalNotifier {nullptr};
     
-    // Start at lowest state until we first read temp
-    uint32_t lastState {ACParseLowestTemp};
+    //
+    // Charger performance states from PPSS, index 0 charges fastest.
+    // PPPC is the fastest state firmware currently allows.
+    //
+    static constexpr uint32_t MaxChargeStates = 16;
+    uint32_t chargeLimits[MaxChargeStates];     // RawPerformance, usually mA
+    uint32_t chargeStateCount {0};
+    uint32_t chargeLevel {0};
     
     IOReturn getTemp(uint32_t *);
     IOReturn getThermalState(uint32_t *);
-    IOReturn parseACx();
+    IOReturn getSample(DPTFSensorSample *sample);
+    IOReturn parsePpss();
+    IOReturn setChargeLevel(uint32_t level);
+    
+    bool thermalPublished(void *refCon, IOService *newService, IONotifier *notifier);
 };
 
 #endif /* ChultraInt3403_hpp */
@@ -22,6 +22,10 @@ ChultraInt3404 *ChultraInt3404::probe(IOService *provider, SInt32 *score) {
         return nullptr;
     }
     
+    if (ChultraACPIUtils::acpiDeviceInit(&acpiDev, acpi) != kIOReturnSuccess) {
+        return nullptr;
+    }
+    
     //
     // Check for fine grained control
     // If it exists, then we have 100 states
@@ -44,47 +48,97 @@ ChultraInt3404 *ChultraInt3404::probe(IOService *provider, SInt32 *score) {
 }
 
 bool ChultraInt3404::start(IOService *provider) {
-    const OSSymbol *acpiPath;
-    IOReturn ret;
+    // Optional, without it we still see the speed but can't tell if it's short
+    (void) parseFps();
     
-    thermal = ChultraThermal::WaitForThermal();
-    acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
+    // Levels closer than this to the last one are ignored, the core allocates in these steps
+    setProperty(DPTF_FAN_STEP_SIZE, minStepSize != 0 ? minStepSize : 1, 32);
     
-    if (thermal == nullptr) {
+    // Registration happens once the thermal core is published
+    thermalNotifier = ChultraThermal::NotifyWhenPublished(OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &ChultraInt3404::thermalPublished), this);
+    if (thermalNotifier == nullptr) {
         return false;
     }
     
-    if (acpiPath == nullptr) {
-        goto err;
+    PMinit();
+    provider->joinPMtree(this);
+    registerPowerDriver(this, DPTFPowerStates, DPTFPowerStateCount);
+    
+    registerService();
+    return super::start(provider);
+}
+
+bool ChultraInt3404::thermalPublished(void *refCon, IOService *newService, IONotifier *notifier) {
+    ChultraThermal *newThermal = OSDynamicCast(ChultraThermal, newService);
+    IOReturn ret;
+    
+    if (newThermal == nullptr || thermal != nullptr) {
+        return false;
     }
     
-    ret = thermal->callPlatformFunction(gDPTFRegisterFan, true, (void *) acpiPath, this, nullptr, nullptr);
+    // Set before registering, message() refuses requests while this is null
+    newThermal->retain();
+    thermal = newThermal;
+    
+    ret = newThermal->callPlatformFunction(gDPTFRegisterFan, true, (void *) acpiDev.path, this, nullptr, nullptr);
     if (ret != kIOReturnSuccess) {
-        goto err;
+        IOLogError("Failed to register fan with thermal core");
+        OSSafeReleaseNULL(thermal);
+        return false;
     }
     
-    registerService();
-    return super::start(provider);
-err:
-    stop(provider);
-    return false;
+    return true;
 }
 
 void ChultraInt3404::stop(IOService *provider) {
+    PMstop();
+    
+    if (thermalNotifier != nullptr) {
+        thermalNotifier->remove();
+        thermalNotifier = nullptr;
+    }
+    
     if (thermal != nullptr) {
-        const OSSymbol *acpiPath = ChultraACPIUtils::acpiGetPath(acpi);
-        (void) thermal->callPlatformFunction(gDPTFUnregisterFan, true, (void *) acpiPath, nullptr, nullptr, nullptr);
+        (void) thermal->callPlatformFunction(gDPTFUnregisterFan, true, (void *) acpiDev.path, nullptr, nullptr, nullptr);
         OSSafeReleaseNULL(thermal);
     }
     super::stop(provider);
 }
 
+void ChultraInt3404::free() {
+    ChultraACPIUtils::acpiDeviceFree(&acpiDev);
+    super::free();
+}
+
 IOReturn ChultraInt3404::message(uint32_t type, IOService *provider, void *args) {
     uint32_t *newLevel = static_cast<uint32_t *>(args);
+    DPTFFanStatus *status = static_cast<DPTFFanStatus *>(args);
     
     switch (type) {
         case kIOMessageDptfFanSetLvl:
+            // The core may still hold a policy snapshot from before we stopped
+            if (thermal == nullptr || asleep) return kIOReturnOffline;
             return setFanLevel(*newLevel);
+        case kIOMessageDptfFanGetStatus:
+            if (thermal == nullptr || asleep) return kIOReturnOffline;
+            sampleFanStatus(false);
+            *status = FanFeedback::status(feedback, speedPoints, speedPointCount);
+            return kIOReturnSuccess;
+        case kIOACPIMessageDeviceNotification:
+            // Notify(0x80) is the low speed notification _FIF advertises
+            if (!underperformNotifs || args == nullptr || *newLevel != 0x80) {
+                return super::message(type, provider, args);
+            }
+        
+            IOLogInfo("%s: firmware reports fan underperforming", acpiDev.path->getCStringNoCopy());
+            feedback.notified = true;
+            sampleFanStatus(true);
+        
+            // Don't wait out the period, the core should compensate now
+            if (thermal != nullptr && !asleep) {
+                thermal->requestEvaluation();
+            }
+            break;
         default:
             return super::message(type, provider, args);
     }
@@ -92,12 +146,34 @@ IOReturn ChultraInt3404::message(uint32_t type, IOService *provider, void *args)
     return kIOReturnSuccess;
 }
 
+IOReturn ChultraInt3404::setPowerState(unsigned long powerState, IOService *whatDevice) {
+    if (powerState == DPTFPowerStateOff) {
+        asleep = true;
+    } else if (asleep) {
+        // The EC may have reset the fan while we were asleep, so the cached level means nothing
+        feedback.lastState = FanFeedback::Unknown;
+        clock_get_uptime(&wakeTime);
+        asleep = false;
+        
+        // The core may have woken first and been refused, have it try again now
+        if (thermal != nullptr) {
+            thermal->requestEvaluation();
+        }
+    }
+    
+    return kIOPMAckImplied;
+}
+
 IOReturn ChultraInt3404::parseFif() {
     OSObject *acpiRet;
     OSArray *_fifArray;
     IOReturn ret;
     
-    ret = acpi->evaluateObject("_FIF", &acpiRet);
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodFIF)) {
+        return kIOReturnNoDevice;
+    }
+    
+    ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodFIF, &acpiRet);
     if (ret != kIOReturnSuccess) {
         return kIOReturnNoDevice;
     }
@@ -105,6 +181,7 @@ IOReturn ChultraInt3404::parseFif() {
     _fifArray = OSDynamicCast(OSArray, acpiRet);
     if (_fifArray == nullptr || _fifArray->getCount() != 4) {
         IOLogError("Invalid _FIF package!");
+        OSSafeReleaseNULL(acpiRet);
         return kIOReturnInvalid;
     }
     
@@ -120,12 +197,144 @@ IOReturn ChultraInt3404::parseFif() {
         underperformNotifs = num->unsigned32BitValue() != 0;
     }
     
+    OSSafeReleaseNULL(acpiRet);
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraInt3404::parseFps() {
+    OSObject *acpiRet;
+    IOReturn ret;
+    
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodFPS)) {
+        return kIOReturnNotFound;
+    }
+    
+    ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodFPS, &acpiRet);
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    
+    //
+    // Package { Revision, Package { Control, TripPoint, Speed, NoiseLevel, Power }, ... }
+    // Kept sorted by control so expected speeds can be interpolated.
+    //
+    
+    OSArray *_fpsArray = OSDynamicCast(OSArray, acpiRet);
+    for (unsigned int i = 1; _fpsArray != nullptr && i < _fpsArray->getCount() && speedPointCount < DPTFFanMaxSpeedPoints; i++) {
+        OSArray *state = OSDynamicCast(OSArray, _fpsArray->getObject(i));
+        OSNumber *controlNum = state != nullptr ? OSDynamicCast(OSNumber, state->getObject(0)) : nullptr;
+        OSNumber *speedNum = state != nullptr ? OSDynamicCast(OSNumber, state->getObject(2)) : nullptr;
+        OSNumber *powerNum = state != nullptr ? OSDynamicCast(OSNumber, state->getObject(4)) : nullptr;
+        if (controlNum == nullptr || speedNum == nullptr) continue;
+        
+        // Power is optional, all ones means firmware doesn't know
+        if (powerNum != nullptr && powerNum->unsigned32BitValue() != 0xFFFFFFFF && powerNum->unsigned32BitValue() > maxPower) {
+            maxPower = powerNum->unsigned32BitValue();
+        }
+        
+        SpeedPoint point = { controlNum->unsigned32BitValue(), speedNum->unsigned32BitValue() };
+        uint32_t at = speedPointCount++;
+        while (at > 0 && speedPoints[at - 1].control > point.control) {
+            speedPoints[at] = speedPoints[at - 1];
+            at--;
+        }
+        speedPoints[at] = point;
+    }
+    
+    OSSafeReleaseNULL(acpiRet);
+    
+    if (speedPointCount == 0) {
+        IOLogError("%s: No usable _FPS entries", acpiDev.path->getCStringNoCopy());
+        return kIOReturnInvalid;
+    }
+    
+    setProperty("FanSpeedPoints", speedPointCount, 32);
+    if (maxPower != 0) {
+        setProperty(DPTF_FAN_MAX_POWER, maxPower, 32);
+    }
+    
+    // Firmware lists nothing slower than its lowest running state, nor faster than its highest
+    for (uint32_t i = 0; i < speedPointCount; i++) {
+        if (speedPoints[i].control == 0) continue;
+        
+        setProperty(DPTF_FAN_MIN_LEVEL, speedPoints[i].control, 32);
+        break;
+    }
+    setProperty(DPTF_FAN_MAX_LEVEL, speedPoints[speedPointCount - 1].control, 32);
     return kIOReturnSuccess;
 }
 
+IOReturn ChultraInt3404::acpiReadFanStatus(uint32_t *control, uint32_t *speed) {
+    OSObject *acpiRet;
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodFST, &acpiRet);
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    
+    // Package { Revision, Control, Speed }
+    OSArray *_fstArray = OSDynamicCast(OSArray, acpiRet);
+    OSNumber *controlNum = _fstArray != nullptr ? OSDynamicCast(OSNumber, _fstArray->getObject(1)) : nullptr;
+    OSNumber *speedNum = _fstArray != nullptr ? OSDynamicCast(OSNumber, _fstArray->getObject(2)) : nullptr;
+    
+    if (controlNum == nullptr || speedNum == nullptr) {
+        OSSafeReleaseNULL(acpiRet);
+        return kIOReturnInvalid;
+    }
+    
+    *control = controlNum->unsigned32BitValue();
+    *speed = speedNum->unsigned32BitValue();
+    OSSafeReleaseNULL(acpiRet);
+    return kIOReturnSuccess;
+}
+
+void ChultraInt3404::sampleFanStatus(bool force) {
+    uint32_t control, speed;
+    uint64_t now, elapsedNs;
+    
+    if (!ChultraACPIUtils::acpiHasMethod(&acpiDev, ChultraACPIUtils::AcpiMethodFST)) {
+        feedback.underperforming = feedback.notified;
+        return;
+    }
+    
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - lastSampleTime, &elapsedNs);
+    if (!force && lastSampleTime != 0 && elapsedNs / NSEC_PER_MSEC < DPTFFanSampleMS) {
+        return;
+    }
+    
+    lastSampleTime = now;
+    
+    if (acpiReadFanStatus(&control, &speed) != kIOReturnSuccess) {
+        return;
+    }
+    
+    //
+    // Firmware or the EC moved the fan since our last _FSL. Count it so
+    // a fight over the fan shows up in ioreg, and make sure we write again.
+    //
+    uint32_t lastState = feedback.lastState;
+    bool wasUnderperforming = feedback.underperforming;
+    
+    if (!FanFeedback::sample(&feedback, speedPoints, speedPointCount, control, speed, force)) {
+        IOLogInfo("%s: level changed underneath us (%d -> %d), %d times", acpiDev.path->getCStringNoCopy(), lastState, control, feedback.externalChanges);
+        setProperty("ExternalLevelChanges", feedback.externalChanges, 32);
+    }
+    
+    if (feedback.underperforming != wasUnderperforming) {
+        IOLogInfo("%s: %s (%d of %d RPM)", acpiDev.path->getCStringNoCopy(), feedback.underperforming ? "underperforming" : "keeping up", speed, feedback.expected);
+    }
+    
+    setProperty("MeasuredRPM", feedback.speed, 32);
+    setProperty("ExpectedRPM", feedback.expected, 32);
+    setProperty("Underperforming", feedback.underperforming);
+}
+
 IOReturn ChultraInt3404::setFanLevel(uint32_t level) {
-    if (fineGrainCtrl) {
-        if (abs(lastState - level) < minStepSize) {
+    sampleFanStatus(false);
+    
+    // Step size only applies between two known levels, after wake or an EC override the next _FSL always goes out
+    if (fineGrainCtrl && feedback.lastState != FanFeedback::Unknown) {
+        if (abs(static_cast<int32_t>(feedback.lastState - level)) < minStepSize) {
             return kIOReturnSuccess;
         }
     }
@@ -139,5 +348,24 @@ IOReturn ChultraInt3404::setFanLevel(uint32_t level) {
         acpiLevel,
     };
     
-    return acpi->evaluateObject("_FSL", nullptr, params, 1);
+    IOReturn ret = ChultraACPIUtils::acpiEvaluate(&acpiDev, ChultraACPIUtils::AcpiMethodFSL, nullptr, params, 1);
+    OSSafeReleaseNULL(acpiLevel);
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    
+    feedback.lastState = level;
+    setProperty("CommandedLevel", feedback.lastState, 32);
+    
+    if (wakeTime != 0) {
+        uint64_t now, elapsedNs;
+        clock_get_uptime(&now);
+        absolutetime_to_nanoseconds(now - wakeTime, &elapsedNs);
+        wakeTime = 0;
+        
+        IOLogInfo("Fan set to %d %llu us after wake", level, elapsedNs / NSEC_PER_USEC);
+        setProperty("WakeToFanLevelUS", elapsedNs / NSEC_PER_USEC, 64);
+    }
+    
+    return kIOReturnSuccess;
 }
@@ -11,29 +11,60 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOService.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
+#include <IOKit/acpi/IOACPITypes.h>
 
 #include "ChultraThermal.hpp"
+#include "AcpiUtils.hpp"
+#include "FanFeedback.hpp"
+
+// _FST is an EC round trip, feedback doesn't need to be fresher than this
+constexpr uint32_t DPTFFanSampleMS = 5000;
+
+constexpr uint32_t DPTFFanMaxSpeedPoints = 16;
 
 class ChultraInt3404 : public IOService {
     OSDeclareDefaultStructors(ChultraInt3404);
-
+    
     ChultraInt3404 *probe(IOService *provider, SInt32 *score) override;
     bool start(IOService *provider) override;
     void stop(IOService *provider) override;
+    void free() override;
     
     IOReturn message(uint32_t type, IOService *provider, void *args) override;
+    IOReturn setPowerState(unsigned long powerState, IOService *whatDevice) override;
 private:
+    // One _FPS entry, sorted by control
+    typedef FanFeedback::SpeedPoint SpeedPoint;
+    
     IOACPIPlatformDevice *acpi {nullptr};
+    ChultraACPIUtils::AcpiDevice acpiDev;
     ChultraThermal *thermal {nullptr};
+    IONotifier *thermalNotifier {nullptr};
     
     bool fineGrainCtrl {false};
     bool underperformNotifs {false};
     
     uint32_t minStepSize {0};
-    uint32_t lastState {0xFFFFFFFF};
+    
+    // Set levels are refused while asleep, wakeTime is cleared by the first one after
+    bool asleep {false};
+    uint64_t wakeTime {0};
+    
+    SpeedPoint speedPoints[DPTFFanMaxSpeedPoints];
+    uint32_t speedPointCount {0};
+    uint32_t maxPower {0};      // Highest _FPS power in mW, 0 if unknown
+    
+    // Latest _FST feedback against the last level set
+    uint64_t lastSampleTime {0};
+    FanFeedback::Sensor feedback {FanFeedback::Unknown, 0, 0, false, false, 0};
     
     IOReturn parseFif();
+    IOReturn parseFps();
+    IOReturn acpiReadFanStatus(uint32_t *control, uint32_t *speed);
+    void sampleFanStatus(bool force);
     IOReturn setFanLevel(uint32_t level);
+    
+    bool thermalPublished(void *refCon, IOService *newService, IONotifier *notifier);
 };
 
 #endif /* ChultraInt3404_hpp */
@@ -6,20 +6,37 @@
 //
 
 #include "ChultraThermal.hpp"
+#include "PolicyTable.hpp"
+#include "PolicyModule.hpp"
+#include "Telemetry.hpp"
+#include "ThermalModel.hpp"
+#include "ChultraThermalUserClient.hpp"
 #include "Logger.h"
+#include <IOKit/acpi/IOACPITypes.h>
+#include <libkern/OSAtomic.h>
 
 #define super IOService
 OSDefineMetaClassAndStructors(ChultraThermal, IOService);
+OSDefineMetaClassAndStructors(DPTFActivePolicyEntry, OSObject);
+OSDefineMetaClassAndStructors(DPTFThermalRelationEntry, OSObject);
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
 const OSSymbol *gDPTFRegisterZone = nullptr;
 const OSSymbol *gDPTFRegisterFan = nullptr;
 const OSSymbol *gDPTFRegisterSensor = nullptr;
+const OSSymbol *gDPTFRegisterPassive = nullptr;
 
 const OSSymbol *gDPTFUnregisterZone = nullptr;
 const OSSymbol *gDPTFUnregisterFan = nullptr;
 const OSSymbol *gDPTFUnregisterSensor = nullptr;
+const OSSymbol *gDPTFUnregisterPassive = nullptr;
+
+IOPMPowerState DPTFPowerStates[DPTFPowerStateCount] = {
+    {kIOPMPowerStateVersion1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {kIOPMPowerStateVersion1, kIOPMPowerOn | kIOPMDeviceUsable, kIOPMPowerOn, kIOPMPowerOn, 0, 0, 0, 0, 0, 0, 0, 0},
+};
 
 bool ChultraThermal::init(OSDictionary *props) {
     if (!super::init(props)) {
@@ -29,15 +46,31 @@ bool ChultraThermal::init(OSDictionary *props) {
     gDPTFRegisterZone = OSSymbol::withCString(DPTF_REGISTER_ZONE);
     gDPTFRegisterFan = OSSymbol::withCString(DPTF_REGISTER_FAN);
     gDPTFRegisterSensor = OSSymbol::withCString(DPTF_REGISTER_SENSOR);
+    gDPTFRegisterPassive = OSSymbol::withCString(DPTF_REGISTER_PASSIVE);
     
     gDPTFUnregisterZone = OSSymbol::withCString(DPTF_UNREGISTER_ZONE);
     gDPTFUnregisterFan = OSSymbol::withCString(DPTF_UNREGISTER_FAN);
     gDPTFUnregisterSensor = OSSymbol::withCString(DPTF_UNREGISTER_SENSOR);
+    gDPTFUnregisterPassive = OSSymbol::withCString(DPTF_UNREGISTER_PASSIVE);
     
     fans = OSDictionary::withCapacity(1);
     thermalZones = OSDictionary::withCapacity(1);
     sensors = OSDictionary::withCapacity(1);
+    passiveDevices = OSDictionary::withCapacity(1);
     activePolicies = OSDictionary::withCapacity(1);
+    zoneSupport = OSDictionary::withCapacity(1);
+    policyModules = OSArray::withCapacity(DPTFPolicyMax);
+    telemetry = DPTFTelemetry::withCapacity(DPTFTelemetryBufferSize);
+    thermalModels = OSDictionary::withCapacity(4);
+    registrationLock = IOLockAlloc();
+    ownershipLock = IOLockAlloc();
+    
+    if (fans == nullptr || thermalZones == nullptr || sensors == nullptr || passiveDevices == nullptr ||
+        activePolicies == nullptr || registrationLock == nullptr || ownershipLock == nullptr ||
+        zoneSupport == nullptr || policyModules == nullptr ||
+        telemetry == nullptr || thermalModels == nullptr) {
+        return false;
+    }
     
     return true ;
 }
@@ -57,13 +90,24 @@ bool ChultraThermal::start(IOService *provider) {
     workloop->addEventSource(timer);
     timer->setAction(OSMemberFunctionCast(IOEventSourceAction, this, &ChultraThermal::timerHandler));
     timer->enable();
-    timer->setTimeoutMS(10000);
+    armTimer(DPTFPollingPeriodMS);
     
+    PMinit();
+    provider->joinPMtree(this);
+    registerPowerDriver(this, DPTFPowerStates, DPTFPowerStateCount);
+    
+    // Personality may trade some processor power for a quieter machine
+    if (OSNumber *ceiling = OSDynamicCast(OSNumber, getProperty("AcousticCeiling"))) {
+        acousticCeiling = min(ceiling->unsigned32BitValue(), 100);
+    }
+    
+    clock_get_uptime(&startTime);
     registerService();
     return true;
 }
 
 void ChultraThermal::stop(IOService *provider) {
+    PMstop();
     timer->cancelTimeout();
     timer->disable();
     
@@ -74,7 +118,46 @@ void ChultraThermal::free() {
     OSSafeReleaseNULL(fans);
     OSSafeReleaseNULL(thermalZones);
     OSSafeReleaseNULL(sensors);
+    OSSafeReleaseNULL(passiveDevices);
     OSSafeReleaseNULL(activePolicies);
+    OSSafeReleaseNULL(policyOverride);
+    OSSafeReleaseNULL(zoneSupport);
+    OSSafeReleaseNULL(policyModules);
+    OSSafeReleaseNULL(telemetry);
+    OSSafeReleaseNULL(thermalModels);
+    OSSafeReleaseNULL(ruleModels);
+    
+    if (samples != nullptr) {
+        IOFree(samples, sizeof(DPTFSensorSample) * sampleSlots);
+        samples = nullptr;
+    }
+    
+    if (fanControl != nullptr) {
+        IOFree(fanControl, sizeof(FanControl) * fanControlSlots);
+        fanControl = nullptr;
+    }
+    
+    if (trends != nullptr) {
+        IOFree(trends, sizeof(SampleTrend) * trendSlots);
+        trends = nullptr;
+    }
+    
+    if (zoneHeadroom != nullptr) {
+        IOFree(zoneHeadroom, sizeof(ZoneHeadroom) * zoneHeadroomSlots);
+        zoneHeadroom = nullptr;
+    }
+    
+    policyTable.clear();
+    
+    if (registrationLock != nullptr) {
+        IOLockFree(registrationLock);
+        registrationLock = nullptr;
+    }
+    
+    if (ownershipLock != nullptr) {
+        IOLockFree(ownershipLock);
+        ownershipLock = nullptr;
+    }
     
     if (workloop && timer) {
         workloop->removeEventSource(timer);
@@ -89,114 +172,113 @@ void ChultraThermal::free() {
 IOReturn ChultraThermal::callPlatformFunction(const OSSymbol *functionName, bool waitForFunction, void *param1, void *param2, void *param3, void *param4) {
     const OSSymbol *acpiPath = static_cast<const OSSymbol *>(param1);
     IOService *service = static_cast<IOService *>(param2);
+    bool removal = false;
+    
+    if (functionName != gDPTFRegisterZone && functionName != gDPTFUnregisterZone &&
+        functionName != gDPTFRegisterFan && functionName != gDPTFUnregisterFan &&
+        functionName != gDPTFRegisterSensor && functionName != gDPTFUnregisterSensor &&
+        functionName != gDPTFRegisterPassive && functionName != gDPTFUnregisterPassive) {
+        return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+    }
+    
+    IOLockLock(registrationLock);
     
     // Thermal Zones
     if (functionName == gDPTFRegisterZone) {
         // Fan Dev -> Source -> Active Policies
         OSDictionary *zonePolicies = static_cast<OSDictionary *>(param3);
+        OSNumber *supported = OSNumber::withNumber(reinterpret_cast<uintptr_t>(param4), 32);
         thermalZones->setObject(acpiPath, service);
         activePolicies->setObject(acpiPath, zonePolicies);
+        if (supported != nullptr) {
+            zoneSupport->setObject(acpiPath, supported);
+            supported->release();
+        }
     } else if (functionName == gDPTFUnregisterZone) {
         thermalZones->removeObject(acpiPath);
         activePolicies->removeObject(acpiPath);
+        zoneSupport->removeObject(acpiPath);
+        removal = true;
     // Fans
     } else if (functionName == gDPTFRegisterFan) {
         fans->setObject(acpiPath, service);
     } else if (functionName == gDPTFUnregisterFan) {
         fans->removeObject(acpiPath);
+        removal = true;
     // Sensors
     } else if (functionName == gDPTFRegisterSensor) {
         sensors->setObject(acpiPath, service);
     } else if (functionName == gDPTFUnregisterSensor) {
         sensors->removeObject(acpiPath);
-    } else {
-        return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+        removal = true;
+    // Passive devices
+    } else if (functionName == gDPTFRegisterPassive) {
+        passiveDevices->setObject(acpiPath, service);
+    } else if (functionName == gDPTFUnregisterPassive) {
+        passiveDevices->removeObject(acpiPath);
+        removal = true;
+    }
+    
+    participantsChanged(removal);
+    
+    OSArray *take = OSArray::withCapacity(1);
+    OSArray *release = OSArray::withCapacity(1);
+    uint32_t decision = take != nullptr && release != nullptr ? decideZoneOwnership(take, release) : 0;
+    IOLockUnlock(registrationLock);
+    
+    if (decision != 0) {
+        sendZoneOwnership(take, release, decision);
     }
     
+    OSSafeReleaseNULL(take);
+    OSSafeReleaseNULL(release);
     return kIOReturnSuccess;
 }
 
-IOReturn ChultraThermal::newState() {
-    //
-    // Per zone:
-    // 1. Get tripped active cooling levels
-    // 2. Convert cooling levels to fan percentaages
-    // 3. Get max fan level
-    // 4. Set new fan level
-    //
-    
-    IOLogDebug("Setting thermal states:");
+bool ChultraThermal::allParticipantsRegistered() {
+    bool ret = true;
     
     //
-    // Iterate over Thermal Zones
+    // Every fan and source named by a zone's policies is expected to register
     //
     OSCollectionIterator *zoneIter = OSCollectionIterator::withCollection(activePolicies);
-    while (OSObject *zoneObj = zoneIter->getNextObject()) {
-        
+    if (zoneIter == nullptr) return false;
+    
+    while (OSObject *zoneObj = ret ? zoneIter->getNextObject() : nullptr) {
         OSSymbol *zoneKey = OSDynamicCast(OSSymbol, zoneObj);
         if (zoneKey == nullptr) continue;
         OSDictionary *zoneDict = OSDynamicCast(OSDictionary, activePolicies->getObject(zoneKey));
         if (zoneDict == nullptr) continue;
         
-        IOLogInfo("\tZone %s:", zoneKey->getCStringNoCopy());
-        
-        //
-        // Iterate over fans within this zone
-        //
         OSCollectionIterator *fanIter = OSCollectionIterator::withCollection(zoneDict);
-        while (OSObject *fanObj = fanIter->getNextObject()) {
-            
+        if (fanIter == nullptr) continue;
+        
+        while (OSObject *fanObj = ret ? fanIter->getNextObject() : nullptr) {
             OSSymbol *fanKey = OSDynamicCast(OSSymbol, fanObj);
             if (fanKey == nullptr) continue;
             OSDictionary *fanDict = OSDynamicCast(OSDictionary, zoneDict->getObject(fanKey));
             if (fanDict == nullptr) continue;
             
-            IOLogInfo("\t\tFan %s:", fanKey->getCStringNoCopy());
-            
-            uint32_t maxFanSpeed = 0;
-            IOService *fanService = OSDynamicCast(IOService, fans->getObject(fanKey));
-            if (fanService == nullptr) continue;
-            
-            //
-            // Iterate over sensors and get their requested fan speeds
-            //
+            if (fans->getObject(fanKey) == nullptr) {
+                ret = false;
+                break;
+            }
             
             OSCollectionIterator *policyIter = OSCollectionIterator::withCollection(fanDict);
-            while (OSObject *sensorPolicyObj = policyIter->getNextObject()) {
-                
-                OSSymbol *policyKey = OSDynamicCast(OSSymbol, sensorPolicyObj);
+            if (policyIter == nullptr) continue;
+            
+            while (OSObject *policyObj = policyIter->getNextObject()) {
+                OSSymbol *policyKey = OSDynamicCast(OSSymbol, policyObj);
                 if (policyKey == nullptr) continue;
                 DPTFActivePolicyEntry *policy = OSDynamicCast(DPTFActivePolicyEntry, fanDict->getObject(policyKey));
                 if (policy == nullptr) continue;
                 
-                //
-                // Get active policy tripped level
-                //
-                
-                OSObject *sensorObj = sensors->getObject(policy->source);
-                IOService *sensorService = OSDynamicCast(IOService, sensorObj);
-                if (sensorService == nullptr) continue;
-                
-                uint32_t trippedLevel;
-                IOReturn ret = messageClient(kIOMessageDptfSensorReadLevel, sensorService, (void *) &trippedLevel);
-                
-                IOLogInfo("\t\t\tSensor %s: %d", policyKey->getCStringNoCopy(), trippedLevel);
-                
-                //
-                // Turn tripped level into fan speed/command
-                //
-                
-                uint32_t requestedSpeed = 0;
-                if (trippedLevel < 10) {
-                    requestedSpeed = policy->maxFanSpeeds[trippedLevel];
-                    IOLogInfo("Requested Speed: %d", requestedSpeed);
+                if (sensors->getObject(policy->source) == nullptr) {
+                    ret = false;
+                    break;
                 }
-                
-                maxFanSpeed = max(requestedSpeed, maxFanSpeed);
             }
             
-            IOLogInfo("Fan set to %d", maxFanSpeed);
-            IOReturn ret = messageClient(kIOMessageDptfFanSetLvl, fanService, (void *) &maxFanSpeed);
             OSSafeReleaseNULL(policyIter);
         }
         
@@ -204,11 +286,1171 @@ IOReturn ChultraThermal::newState() {
     }
     
     OSSafeReleaseNULL(zoneIter);
+    return ret;
+}
+
+void ChultraThermal::participantsChanged(bool removal) {
+    //
+    // Participants that go away must drop out of the table right away.
+    // New ones are published as soon as the last expected participant
+    // shows up, otherwise we wait for registrations to settle since some
+    // sources (e.g. TCPU) may never get a driver.
+    //
+    if (removal) {
+        (void) publishPolicyTable();
+    } else if (allParticipantsRegistered()) {
+        if (publishPolicyTable() == kIOReturnSuccess) {
+            timer->setTimeoutMS(0);
+        }
+    } else {
+        policyTableDirty = true;
+        timer->setTimeoutMS(DPTFRegistrationSettleMS);
+    }
+}
+
+uint32_t ChultraThermal::decideZoneOwnership(OSArray *take, OSArray *release) {
+    //
+    // Must hold registrationLock
+    // Zones only take their policies from firmware once every fan they
+    // drive has registered, otherwise nobody would be driving the rest.
+    //
+    OSCollectionIterator *zoneIter = OSCollectionIterator::withCollection(thermalZones);
+    if (zoneIter == nullptr) return 0;
+    
+    while (OSObject *zoneObj = zoneIter->getNextObject()) {
+        OSSymbol *zoneKey = OSDynamicCast(OSSymbol, zoneObj);
+        if (zoneKey == nullptr) continue;
+        IOService *zone = OSDynamicCast(IOService, thermalZones->getObject(zoneKey));
+        OSDictionary *zoneDict = OSDynamicCast(OSDictionary, activePolicies->getObject(zoneKey));
+        if (zone == nullptr) continue;
+        
+        bool ready = zoneDict != nullptr && zoneDict->getCount() != 0;
+        OSCollectionIterator *fanIter = ready ? OSCollectionIterator::withCollection(zoneDict) : nullptr;
+        
+        while (OSObject *fanObj = fanIter != nullptr ? fanIter->getNextObject() : nullptr) {
+            if (fans->getObject(OSDynamicCast(OSSymbol, fanObj)) == nullptr) {
+                ready = false;
+                break;
+            }
+        }
+        
+        OSSafeReleaseNULL(fanIter);
+        (void) (ready ? take : release)->setObject(zone);
+    }
+    
+    OSSafeReleaseNULL(zoneIter);
+    return ++ownershipDecided;
+}
+
+void ChultraThermal::sendZoneOwnership(OSArray *take, OSArray *release, uint32_t decision) {
+    IOLockLock(ownershipLock);
+    
+    // A registration that raced us already sent what it saw, which is newer
+    if (decision > ownershipSent) {
+        ownershipSent = decision;
+        
+        for (unsigned int i = 0; i < release->getCount(); i++) {
+            (void) messageClient(kIOMessageDptfZoneReleaseControl, static_cast<IOService *>(release->getObject(i)));
+        }
+        
+        for (unsigned int i = 0; i < take->getCount(); i++) {
+            (void) messageClient(kIOMessageDptfZoneTakeControl, static_cast<IOService *>(take->getObject(i)));
+        }
+    }
+    
+    IOLockUnlock(ownershipLock);
+}
+
+IOReturn ChultraThermal::publishPolicyTable() {
+    // Must hold registrationLock
+    OSDictionary *policies = policyOverride != nullptr ? policyOverride : activePolicies;
+    DPTFPolicyTable *newTable = DPTFPolicyTable::withParticipants(policies, fans, sensors, passiveDevices);
+    if (newTable == nullptr) {
+        policyTableDirty = true;
+        return kIOReturnNoMemory;
+    }
+    
+    // Union of what every zone's IDSP lists
+    OSCollectionIterator *supportIter = OSCollectionIterator::withCollection(zoneSupport);
+    while (OSObject *zoneObj = supportIter != nullptr ? supportIter->getNextObject() : nullptr) {
+        OSNumber *supported = OSDynamicCast(OSNumber, zoneSupport->getObject(OSDynamicCast(OSSymbol, zoneObj)));
+        if (supported != nullptr) newTable->supportedPolicies |= supported->unsigned32BitValue();
+    }
+    OSSafeReleaseNULL(supportIter);
+    
+    // Firmware without IDSP still gets its fans driven and PL1 arbitrated, same as before modules existed
+    if (newTable->supportedPolicies == 0) {
+        newTable->supportedPolicies = 1 << DPTFActivePolicy | 1 << DPTFPassivePolicy;
+    }
+    
+    newTable->generation = ++tableGeneration;
+    
+    // Writers are serialized by the lock, the slot keeps the old table until the next tick
+    DPTFPolicyTable *oldTable = policyTable.publish(newTable);
+    
+    policyTableDirty = false;
+    applySensorHysteresis(newTable);
+    
+    if (oldTable == nullptr) {
+        uint64_t now, elapsedNs;
+        clock_get_uptime(&now);
+        absolutetime_to_nanoseconds(now - startTime, &elapsedNs);
+        
+        IOLogInfo("Policy table ready %llu ms after start (%d fans, %d rules)",
+                  elapsedNs / NSEC_PER_MSEC, newTable->fanCount, newTable->ruleCount);
+        setProperty("PolicyTableReadyMS", elapsedNs / NSEC_PER_MSEC, 64);
+    }
+    
+    return kIOReturnSuccess;
+}
+
+void DPTFPolicyTableOps::barrier() {
+    // The table's contents must be visible before the pointer to it
+    OSMemoryBarrier();
+}
+
+void DPTFPolicyTableOps::release(DPTFPolicyTable *table) {
+    table->release();
+}
+
+void ChultraThermal::applySensorHysteresis(DPTFPolicyTable *table) {
+    // Sensors go back to their own GTSH unless an override asks otherwise
+    for (uint32_t r = 0; r < table->ruleCount; r++) {
+        DPTFPolicyTable::Rule *rule = &table->rules[r];
+        uint32_t hysteresis = rule->policy->hysteresis;
+        (void) messageClient(kIOMessageDptfSensorSetHysteresis, rule->sensor, (void *) &hysteresis);
+    }
+}
+
+bool ChultraThermal::reclaimPolicyTables() {
+    //
+    // Ticks are serialized on the workloop and load the table once, so anything
+    // retired before this tick began can no longer be referenced.
+    // Never block the tick on a registration, the caller tries again shortly.
+    //
+    if (!IOLockTryLock(registrationLock)) {
+        return false;
+    }
+    
+    policyTable.reclaim();
+    
+    if (policyTableDirty) {
+        (void) publishPolicyTable();
+    }
+    
+    IOLockUnlock(registrationLock);
+    return true;
+}
+
+IOReturn ChultraThermal::syncPolicyModules(DPTFPolicyTable *table) {
+    //
+    // One module per supported policy. Modules survive table changes so
+    // policies with state keep it, they are only told about the new table.
+    //
+    for (int policy = 0; policy < DPTFPolicyMax; policy++) {
+        bool supported = (table->supportedPolicies & (1 << policy)) != 0;
+        int found = -1;
+        
+        for (unsigned int i = 0; i < policyModules->getCount(); i++) {
+            DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(i));
+            if (module->policy == policy) found = i;
+        }
+        
+        if (!supported && found >= 0) {
+            IOLogInfo("Unloading %s policy", DPTFPolicyNames[policy]);
+            policyModules->removeObject(found);
+        } else if (supported && found < 0) {
+            DPTFPolicyModule *module = DPTFPolicyModule::withPolicy(static_cast<dptf_policies_t>(policy));
+            if (module == nullptr) {
+                IOLogInfo("No module for %s policy, ignoring", DPTFPolicyNames[policy]);
+                continue;
+            }
+            
+            IOLogInfo("Loading %s policy", DPTFPolicyNames[policy]);
+            policyModules->setObject(module);
+            module->release();
+        }
+    }
+    
+    if (sampleSlots < table->sampleCount) {
+        DPTFSensorSample *newSamples = static_cast<DPTFSensorSample *>(IOMalloc(sizeof(DPTFSensorSample) * table->sampleCount));
+        if (newSamples == nullptr) return kIOReturnNoMemory;
+        
+        if (samples != nullptr) IOFree(samples, sizeof(DPTFSensorSample) * sampleSlots);
+        samples = newSamples;
+        sampleSlots = table->sampleCount;
+    }
+    
+    // Sample indices change with the table, trends start over
+    if (trendSlots < table->sampleCount) {
+        SampleTrend *newTrends = static_cast<SampleTrend *>(IOMalloc(sizeof(SampleTrend) * table->sampleCount));
+        if (newTrends == nullptr) return kIOReturnNoMemory;
+        
+        if (trends != nullptr) IOFree(trends, sizeof(SampleTrend) * trendSlots);
+        trends = newTrends;
+        trendSlots = table->sampleCount;
+    }
+    
+    for (uint32_t i = 0; i < trendSlots; i++) {
+        trends[i] = { 0, 0, 0, 0, 0 };
+    }
+    
+    // At most one zone per fan
+    if (zoneHeadroomSlots < table->fanCount) {
+        ZoneHeadroom *newHeadroom = static_cast<ZoneHeadroom *>(IOMalloc(sizeof(ZoneHeadroom) * table->fanCount));
+        if (newHeadroom == nullptr) return kIOReturnNoMemory;
+        
+        if (zoneHeadroom != nullptr) IOFree(zoneHeadroom, sizeof(ZoneHeadroom) * zoneHeadroomSlots);
+        zoneHeadroom = newHeadroom;
+        zoneHeadroomSlots = table->fanCount;
+    }
+    
+    zoneHeadroomCount = 0;
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        if (i == 0 || table->fans[i].zone != table->fans[i - 1].zone) {
+            zoneHeadroom[zoneHeadroomCount++] = { table->fans[i].zone, nullptr, 0, 0, false, nullptr, 0, false };
+        }
+    }
+    
+    // Clients hear about the new zones on the next evaluation
+    headroomPublishedMS = 0;
+    
+    // Fan indices are per table, boosts start over
+    if (fanControlSlots < table->fanCount) {
+        FanControl *newControl = static_cast<FanControl *>(IOMalloc(sizeof(FanControl) * table->fanCount));
+        if (newControl == nullptr) return kIOReturnNoMemory;
+        
+        if (fanControl != nullptr) IOFree(fanControl, sizeof(FanControl) * fanControlSlots);
+        fanControl = newControl;
+        fanControlSlots = table->fanCount;
+    }
+    
+    for (uint32_t i = 0; i < fanControlSlots; i++) {
+        fanControl[i] = { 0, DPTFNoRequest, 0, false };
+    }
+    
+    for (unsigned int i = 0; i < policyModules->getCount(); i++) {
+        DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(i));
+        IOReturn ret = module->tableChanged(table);
+        if (ret != kIOReturnSuccess) return ret;
+    }
+    
+    //
+    // Models are keyed by fan and sensor, so a pair that survives
+    // the table change keeps what it has learned.
+    //
+    OSArray *newModels = OSArray::withCapacity(table->ruleCount);
+    if (newModels == nullptr) return kIOReturnNoMemory;
+    
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        DPTFPolicyTable::Fan *fan = &table->fans[i];
+        for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+            char name[128];
+            snprintf(name, sizeof(name), "%s/%s", fan->path->getCStringNoCopy(), table->rules[r].source->getCStringNoCopy());
+            
+            const OSSymbol *key = OSSymbol::withCString(name);
+            DPTFThermalModel *model = key != nullptr ? modelFor(key) : nullptr;
+            OSSafeReleaseNULL(key);
+            
+            if (model == nullptr || !newModels->setObject(model)) {
+                newModels->release();
+                return kIOReturnNoMemory;
+            }
+        }
+    }
+    
+    OSSafeReleaseNULL(ruleModels);
+    ruleModels = newModels;
+    tunedPeriodMS = 0;
+    
+    telemetry->setChannels(table);
+    return kIOReturnSuccess;
+}
+
+uint32_t ChultraThermal::evaluatePolicies(DPTFPolicyTable *table, bool force) {
+    uint64_t now, nowNs;
+    uint64_t nextDueMS = UINT64_MAX;
+    uint32_t ran = 0;
+    
+    if (table->generation != evaluatedGeneration) {
+        if (syncPolicyModules(table) != kIOReturnSuccess) {
+            IOLogError("Failed to load policy modules");
+            return DPTFPollingPeriodMS;
+        }
+        
+        evaluatedGeneration = table->generation;
+        force = true;
+    }
+    
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now, &nowNs);
+    uint64_t nowMS = nowNs / NSEC_PER_MSEC;
+    
+    for (uint32_t i = 0; i < table->sampleCount; i++) {
+        samples[i].version = 0;
+    }
+    
+    //
+    // Every module runs on its own period, the timer fires for whichever is due next.
+    // Modules due in the same tick share sensor reads through the context.
+    //
+    
+    IOLogDebug("Setting thermal states:");
+    DPTFPolicyContext context(this, table, samples);
+    
+    for (unsigned int i = 0; i < policyModules->getCount(); i++) {
+        DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(i));
+        
+        if (force || module->nextDueMS <= nowMS) {
+            module->evaluate(&context);
+            ran |= 1 << i;
+        }
+    }
+    
+    if (ran != 0) {
+        applyRequests(table);
+        
+        // Sensors nobody was due to read keep their last value
+        for (uint32_t i = 0; i < table->sampleCount; i++) {
+            if (samples[i].version == 0 || samples[i].status != kIOReturnSuccess) continue;
+            telemetry->setSample(i, DPTFTelemetryFieldLevel, samples[i].level);
+            telemetry->setSample(i, DPTFTelemetryFieldTemperature, samples[i].temperature);
+        }
+        
+        telemetry->commit(nowMS);
+        updateThermalModels(table, nowMS);
+        updateHeadroom(table, nowMS);
+        
+        //
+        // Stretch the period while the machine sits cold, and drop straight back
+        // to the normal rate once anything trips. Forced evaluations come from
+        // wake, table changes and Notify, so they start over too. Stretching
+        // past a couple of periods needs every sensor able to wake us early.
+        //
+        bool cold = !force && coldIdle(table);
+        bool armed = cold && armAuxTrips(table, DPTFAuxTripBand);
+        uint32_t backoff = IdleBackoff::next(idleBackoff, force, cold, armed);
+        
+        if (!cold && auxTripsArmed) {
+            (void) armAuxTrips(table, 0);
+        }
+        
+        if (backoff != idleBackoff) {
+            IOLogDebug("Idle backoff %d -> %d", idleBackoff, backoff);
+            setProperty("IdleBackoff", backoff, 32);
+        }
+        
+        // Modules that weren't due may still be waiting out a stretched period
+        bool snapBack = backoff < idleBackoff;
+        idleBackoff = backoff;
+        
+        for (unsigned int i = 0; i < policyModules->getCount(); i++) {
+            DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(i));
+            uint64_t due = nowMS + periodFor(module, table) * idleBackoff;
+            
+            if ((ran & (1 << i)) != 0 || (snapBack && module->nextDueMS > due)) {
+                module->nextDueMS = due;
+            }
+        }
+    }
+    
+    for (unsigned int i = 0; i < policyModules->getCount(); i++) {
+        DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(i));
+        nextDueMS = min(nextDueMS, module->nextDueMS);
+    }
+    
+    if (nextDueMS == UINT64_MAX) {
+        return DPTFPollingPeriodMS;
+    }
+    
+    return static_cast<uint32_t>(nextDueMS - nowMS);
+}
+
+void ChultraThermal::applyRequests(DPTFPolicyTable *table) {
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        DPTFPolicyTable::Fan *fan = &table->fans[i];
+        FanControl *control = &fanControl[i];
+        uint32_t level = DPTFNoRequest;
+        PowerPlan::Plan plan { 0, 100, 0, false };
+        bool planned = false;
+        
+        // More cooling always wins, and a processor's share of the fan gets the tightest plan
+        for (unsigned int m = 0; m < policyModules->getCount(); m++) {
+            DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(m));
+            uint32_t request = module->request(Policies::RequestFanLevel, i);
+            uint32_t floor = module->request(Policies::RequestFanFloor, i);
+            uint32_t ceiling = module->request(Policies::RequestFanCeiling, i);
+            
+            if (request != DPTFNoRequest && (level == DPTFNoRequest || request > level)) {
+                level = request;
+            }
+            
+            if (floor != DPTFNoRequest && ceiling != DPTFNoRequest) {
+                plan.fanFloor = max(plan.fanFloor, floor);
+                plan.fanCeiling = min(plan.fanCeiling, ceiling);
+                planned = true;
+            }
+        }
+        
+        if (level == DPTFNoRequest) {
+            control->command = level;
+            control->starved = false;
+            continue;
+        }
+        
+        //
+        // Compare what the fan was last told with what it is doing. A fan
+        // that falls short gets pushed harder; one that is already at full
+        // speed can't do more, so the rest has to come from passive cooling.
+        //
+        DPTFFanStatus status;
+        bool answered = messageClient(kIOMessageDptfFanGetStatus, fan->service, (void *) &status) == kIOReturnSuccess;
+        
+        if (answered) {
+            IOLogDebug("Fan %s commanded %d, %d of %d RPM", fan->path->getCStringNoCopy(), status.commanded, status.speed, status.expectedSpeed);
+            telemetry->setFan(i, DPTFTelemetryFieldFanSpeed, status.speed);
+        }
+        
+        (void) FanFeedback::apply(control, level, answered ? &status : nullptr);
+        
+        //
+        // The ceiling is the processor's, so it only bounds what the processor
+        // asks of a fan. What the fan's other sources want still goes through.
+        //
+        if (planned) {
+            uint32_t others = 0;
+            
+            for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+                if (table->view.rules[r].passive != Policies::NoPassive) continue;
+                
+                for (unsigned int m = 0; m < policyModules->getCount(); m++) {
+                    uint32_t request = static_cast<DPTFPolicyModule *>(policyModules->getObject(m))->request(Policies::RequestRuleLevel, r);
+                    if (request != DPTFNoRequest && request > others) others = request;
+                }
+            }
+            
+            // Boost went onto the whole command, the other sources' share included
+            if (others != 0) others = min(others + control->boost, 100);
+            control->command = PowerPlan::fanLevel(plan, control->command, others);
+        }
+        
+        IOLogDebug("Fan %s set to %d (boost %d)", fan->path->getCStringNoCopy(), control->command, control->boost);
+        (void) messageClient(kIOMessageDptfFanSetLvl, fan->service, (void *) &control->command);
+        telemetry->setFan(i, DPTFTelemetryFieldFanCommand, control->command);
+    }
+    
+    uint32_t deepest = 0;
+    for (uint32_t p = 0; p < table->passiveCount; p++) {
+        DPTFPolicyTable::Passive *passive = &table->passives[p];
+        uint32_t limit = DPTFNoRequest;
+        uint32_t throttle = DPTFNoRequest;
+        
+        // The lowest PL1 anyone asks for, 0 is firmware's and the highest. Throttle the deepest
+        for (unsigned int m = 0; m < policyModules->getCount(); m++) {
+            DPTFPolicyModule *module = static_cast<DPTFPolicyModule *>(policyModules->getObject(m));
+            uint32_t requestedLimit = module->request(Policies::RequestPowerLimit, p);
+            uint32_t requestedThrottle = module->request(Policies::RequestThrottle, p);
+            
+            if (requestedLimit != DPTFNoRequest && (limit == DPTFNoRequest || limit == 0 || (requestedLimit != 0 && requestedLimit < limit))) {
+                limit = requestedLimit;
+            }
+            
+            if (requestedThrottle != DPTFNoRequest && (throttle == DPTFNoRequest || requestedThrottle > throttle)) {
+                throttle = requestedThrottle;
+            }
+        }
+        
+        // Nobody planning for a processor any more, e.g. the passive policy unloaded, hands it back to firmware
+        if (limit != DPTFNoRequest) {
+            telemetry->setPassive(p, DPTFTelemetryFieldPowerLimit, limit);
+        }
+        
+        limit = limit != DPTFNoRequest ? limit : 0;
+        (void) messageClient(kIOMessageDptfProcessorSetPowerLimit, passive->service, (void *) &limit);
+        
+        // Only talk to chargers while something is or was throttled
+        if (throttle == DPTFNoRequest) throttle = 0;
+        if (throttle == 0 && passiveThrottle == 0) continue;
+        
+        if (throttle != 0) {
+            IOLogInfo("Passive %s throttled to %d", passive->path->getCStringNoCopy(), throttle);
+        }
+        
+        (void) messageClient(kIOMessageDptfPassiveSetLevel, passive->service, (void *) &throttle);
+        telemetry->setPassive(p, DPTFTelemetryFieldThrottle, throttle);
+        deepest = max(deepest, throttle);
+    }
+    
+    if (deepest != passiveThrottle) {
+        passiveThrottle = deepest;
+        setProperty("PassiveThrottle", passiveThrottle, 32);
+    }
+}
+
+bool ChultraThermal::readProcessor(DPTFPolicyTable *table, uint32_t p, const Policies::Sample *sample, Policies::Processor *processor) {
+    DPTFPolicyTable::Passive *passive = &table->passives[p];
+    DPTFProcessorStatus cpu {};
+    uint64_t timestampMS;
+    
+    // The policies already read the package this tick, don't evaluate _TMP again
+    if (sample != nullptr) {
+        cpu.temperature = sample->temperature;
+    }
+    
+    if (messageClient(kIOMessageDptfProcessorGetStatus, passive->service, (void *) &cpu) != kIOReturnSuccess) {
+        return false;
+    }
+    
+    if (sample != nullptr) {
+        telemetry->setPassive(p, DPTFTelemetryFieldTemperature, cpu.temperature);
+        timestampMS = sample->timestampMS;
+    } else {
+        uint64_t now, nowNs;
+        clock_get_uptime(&now);
+        absolutetime_to_nanoseconds(now, &nowNs);
+        timestampMS = nowNs / NSEC_PER_MSEC;
+    }
+    telemetry->setPassive(p, DPTFTelemetryFieldPower, cpu.power);
+    
+    // Package power against the smoothed reading the policies already took
+    DPTFThermalModel *model = modelFor(passive->path);
+    DPTFThermalModel::Fit fit {};
+    if (model != nullptr && sample != nullptr && cpu.maxLimit != 0) {
+        model->update(sample->temperature, static_cast<uint32_t>(min(static_cast<uint64_t>(cpu.power) * 100 / cpu.maxLimit, 100)), timestampMS);
+    }
+    
+    // How fast the package settles tells the plan where a reading is heading
+    if (model == nullptr || !model->fit(&fit)) {
+        fit.timeConstantMS = 0;
+    }
+    
+    *processor = {
+        { cpu.temperature, cpu.passiveTrip, cpu.power, cpu.minLimit, cpu.maxLimit, cpu.appliedLimit },
+        fit.timeConstantMS, timestampMS,
+    };
+    return true;
+}
+
+void ChultraThermal::readFan(uint32_t fan, Policies::FanState *state) {
+    // As of the last evaluation, this one's requests haven't been applied yet
+    if (fan >= fanControlSlots) {
+        *state = { DPTFNoRequest, 0, false };
+        return;
+    }
+    
+    *state = { fanControl[fan].command, fanControl[fan].achieved, fanControl[fan].starved };
+}
+
+IOReturn ChultraThermal::setPowerState(unsigned long powerState, IOService *whatDevice) {
+    // Gated, so a tick that is already reading sensors finishes before we go to sleep
+    workloop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &ChultraThermal::setPowerStateGated), this, (void *) powerState);
+    return kIOPMAckImplied;
+}
+
+IOReturn ChultraThermal::setPowerStateGated(void *powerState, void *, void *, void *) {
+    if (reinterpret_cast<uintptr_t>(powerState) == DPTFPowerStateOff) {
+        IOLogInfo("Sleeping, pausing evaluation");
+        sleeping = true;
+        timer->cancelTimeout();
+    } else if (sleeping) {
+        //
+        // The EC may have reset the fan and firmware may have moved trip points,
+        // so don't wait out the rest of the period before correcting it.
+        //
+        IOLogInfo("Woke up, re-evaluating");
+        sleeping = false;
+        wakePending = true;
+        timer->setTimeoutMS(0);
+    }
+    
     return kIOReturnSuccess;
 }
 
+void ChultraThermal::requestEvaluation() {
+    // Run every module, not just the ones that happen to be due
+    evaluateNow = true;
+    timer->setTimeoutMS(0);
+}
+
+void ChultraThermal::reloadTripPoints(DPTFPolicyTable *table) {
+    for (uint32_t r = 0; r < table->ruleCount; r++) {
+        DPTFPolicyTable::Rule *rule = &table->rules[r];
+        
+        // Sensors shared by several fans only need one reload
+        bool seen = false;
+        for (uint32_t prev = 0; prev < r && !seen; prev++) {
+            seen = table->rules[prev].sensor == rule->sensor;
+        }
+        
+        if (!seen) {
+            (void) messageClient(kIOMessageDptfSensorReloadTrips, rule->sensor);
+        }
+    }
+}
+
 IOReturn ChultraThermal::timerHandler(OSObject *, void *, void *, void *, void *) {
-    newState();
-    timer->setTimeoutMS(10000);
+    // Registrations and overrides may still poke the timer while asleep
+    if (sleeping) {
+        return kIOReturnSuccess;
+    }
+    
+    // A registration holding the lock may be about to publish, e.g. when the settle timer fires
+    bool reclaimed = reclaimPolicyTables();
+    
+    // Single load, the table stays alive until the next tick reclaims it
+    countWakeup();
+    
+    DPTFPolicyTable *table = policyTable.load();
+    if (table == nullptr) {
+        armTimer(reclaimed ? DPTFPollingPeriodMS : DPTFRegistrationRetryMS);
+        return kIOReturnSuccess;
+    }
+    
+    bool force = evaluateNow || wakePending;
+    evaluateNow = false;
+    
+    if (wakePending) {
+        reloadTripPoints(table);
+        wakePending = false;
+    }
+    
+    uint32_t next = evaluatePolicies(table, force);
+    armTimer(reclaimed ? next : min(next, DPTFRegistrationRetryMS));
+    return kIOReturnSuccess;
+}
+
+DPTFThermalModel *ChultraThermal::modelFor(const OSSymbol *key) {
+    DPTFThermalModel *model = OSDynamicCast(DPTFThermalModel, thermalModels->getObject(key));
+    if (model != nullptr) return model;
+    
+    model = new DPTFThermalModel;
+    if (model == nullptr || !model->init() || !thermalModels->setObject(key, model)) {
+        OSSafeReleaseNULL(model);
+        return nullptr;
+    }
+    
+    model->release();
+    return model;
+}
+
+void ChultraThermal::updateThermalModels(DPTFPolicyTable *table, uint64_t nowMS) {
+    uint32_t tuned = 0;
+    
+    //
+    // Each fan's input over the last interval is the level it actually
+    // managed. Sensors that weren't read this tick just skip an update,
+    // the model handles uneven intervals.
+    //
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        DPTFPolicyTable::Fan *fan = &table->fans[i];
+        for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+            DPTFThermalModel *model = static_cast<DPTFThermalModel *>(ruleModels->getObject(r));
+            DPTFSensorSample *sample = &samples[table->rules[r].sample];
+            DPTFThermalModel::Fit fit;
+            
+            if (model == nullptr) continue;
+            
+            if (sample->version != 0 && sample->status == kIOReturnSuccess) {
+                uint64_t timestamp;
+                absolutetime_to_nanoseconds(sample->timestamp, &timestamp);
+                model->update(sample->temperature, fanControl[i].achieved, timestamp / NSEC_PER_MSEC);
+            }
+            
+            // The fastest plant sets the pace
+            if (model->fit(&fit) && (tuned == 0 || fit.samplingPeriodMS < tuned)) {
+                tuned = fit.samplingPeriodMS;
+            }
+        }
+    }
+    
+    if (tuned != tunedPeriodMS) {
+        IOLogInfo("Fitted sampling period %d ms", tuned);
+        tunedPeriodMS = tuned;
+    }
+    
+    if (nowMS - modelsPublishedMS >= DPTFModelPublishMS) {
+        publishThermalModels();
+        modelsPublishedMS = nowMS;
+    }
+}
+
+static void setNumber(OSDictionary *dict, const char *key, uint32_t value) {
+    OSNumber *number = OSNumber::withNumber(value, 32);
+    if (number == nullptr) return;
+    
+    dict->setObject(key, number);
+    number->release();
+}
+
+void ChultraThermal::publishThermalModels() {
+    OSDictionary *published = OSDictionary::withCapacity(thermalModels->getCount());
+    OSCollectionIterator *iter = OSCollectionIterator::withCollection(thermalModels);
+    
+    if (published == nullptr || iter == nullptr) {
+        OSSafeReleaseNULL(published);
+        OSSafeReleaseNULL(iter);
+        return;
+    }
+    
+    while (const OSSymbol *key = OSDynamicCast(OSSymbol, iter->getNextObject())) {
+        DPTFThermalModel *model = OSDynamicCast(DPTFThermalModel, thermalModels->getObject(key));
+        OSDictionary *entry = OSDictionary::withCapacity(8);
+        DPTFThermalModel::Fit fit;
+        
+        if (model == nullptr || entry == nullptr) {
+            OSSafeReleaseNULL(entry);
+            continue;
+        }
+        
+        setNumber(entry, "Updates", model->state.updates);
+        
+        // Signs don't survive the registry, so gain is a magnitude and Cooling says which way it goes
+        if (model->fit(&fit)) {
+            setNumber(entry, "TimeConstantMS", fit.timeConstantMS);
+            setNumber(entry, "Gain", fit.gain < 0 ? -fit.gain : fit.gain);
+            setNumber(entry, "Offset", fit.offset < 0 ? 0 : fit.offset);
+            setNumber(entry, "SamplingPeriodMS", fit.samplingPeriodMS);
+            setNumber(entry, "ProportionalGain", fit.proportionalGain);
+            setNumber(entry, "IntegralTimeMS", fit.integralTimeMS);
+            entry->setObject("Cooling", fit.gain < 0 ? kOSBooleanTrue : kOSBooleanFalse);
+        }
+        
+        published->setObject(key, entry);
+        entry->release();
+    }
+    
+    iter->release();
+    setProperty("ThermalModels", published);
+    published->release();
+}
+
+uint32_t ChultraThermal::periodFor(DPTFPolicyModule *module, DPTFPolicyTable *table) {
+    // Fitted periods only stand in for the default, never for one firmware or an override asked for
+    if (module->policy == DPTFActivePolicy && tunedPeriodMS != 0 && table->pollingPeriodMS == DPTFPollingPeriodMS) {
+        return tunedPeriodMS;
+    }
+    
+    return module->samplingPeriodMS(table);
+}
+
+// Past the trip reads as no headroom at all, approaching is the only direction that matters
+static int32_t publishedHeadroom(int32_t headroom) {
+    return headroom > 0 ? headroom : 0;
+}
+
+void ChultraThermal::updateHeadroom(DPTFPolicyTable *table, uint64_t nowMS) {
+    // Only what the policies read this tick, headroom never costs an ACPI call of its own
+    for (uint32_t s = 0; s < table->sampleCount; s++) {
+        DPTFSensorSample *sample = &samples[s];
+        SampleTrend *trend = &trends[s];
+        uint64_t timestamp;
+        
+        if (sample->version < 2 || sample->status != kIOReturnSuccess) continue;
+        
+        absolutetime_to_nanoseconds(sample->timestamp, &timestamp);
+        timestamp /= NSEC_PER_MSEC;
+        
+        if (trend->timestampMS != 0 && timestamp > trend->timestampMS && timestamp - trend->timestampMS <= DPTFModelMaxGapMS) {
+            int32_t rate = static_cast<int32_t>((static_cast<int64_t>(sample->temperature) - trend->temperature) * 60000 /
+                                                static_cast<int64_t>(timestamp - trend->timestampMS));
+            trend->rate = (trend->rate + rate) / 2;
+        }
+        
+        trend->temperature = sample->temperature;
+        trend->passiveTrip = sample->passiveTrip;
+        trend->criticalTrip = sample->criticalTrip;
+        trend->timestampMS = timestamp;
+    }
+    
+    //
+    // A zone's headroom is its sensor closest to a trip. Fans of a zone
+    // are next to each other in the table, and so are their rules.
+    // Changes are against what was last published, so a slow drift still
+    // adds up to a notification however small each tick's step is.
+    //
+    bool changed = false;
+    int32_t lowest = INT32_MAX;
+    
+    for (uint32_t z = 0, i = 0; z < zoneHeadroomCount; z++) {
+        ZoneHeadroom *zone = &zoneHeadroom[z];
+        zone->sensor = nullptr;
+        
+        for (; i < table->fanCount && table->fans[i].zone == zone->zone; i++) {
+            DPTFPolicyTable::Fan *fan = &table->fans[i];
+            
+            for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+                SampleTrend *trend = &trends[table->rules[r].sample];
+                if (trend->timestampMS == 0) continue;
+                
+                uint32_t trips[2] = { trend->passiveTrip, trend->criticalTrip };
+                for (int t = 0; t < 2; t++) {
+                    int32_t headroom = static_cast<int32_t>(trips[t]) - static_cast<int32_t>(trend->temperature);
+                    if (trips[t] == 0 || (zone->sensor != nullptr && headroom >= zone->headroom)) continue;
+                    
+                    zone->sensor = table->rules[r].source;
+                    zone->headroom = headroom;
+                    zone->rate = trend->rate;
+                    zone->critical = t == 1;
+                }
+            }
+        }
+        
+        changed = changed || zone->sensor != zone->publishedSensor;
+        if (zone->sensor == nullptr) continue;
+        
+        int32_t moved = publishedHeadroom(zone->headroom) - zone->published;
+        changed = changed || zone->critical != zone->publishedCritical || moved >= DPTFHeadroomChange || moved <= -DPTFHeadroomChange;
+        lowest = min(lowest, zone->headroom);
+    }
+    
+    if (lowest != INT32_MAX) {
+        int32_t moved = publishedHeadroom(lowest) - headroomPublishedLowest;
+        changed = changed || moved >= DPTFHeadroomChange || moved <= -DPTFHeadroomChange;
+    }
+    
+    //
+    // Schedulers only need to hear about real changes, and never more than
+    // every few seconds however fast the policies are sampling. Properties
+    // are still refreshed now and then so the rate stays current.
+    //
+    uint64_t sincePublished = nowMS - headroomPublishedMS;
+    if (headroomPublishedMS == 0 || (changed && sincePublished >= DPTFHeadroomMinIntervalMS) || sincePublished >= DPTFHeadroomRefreshMS) {
+        publishHeadroom(changed || headroomPublishedMS == 0);
+        headroomPublishedMS = nowMS;
+    }
+}
+
+void ChultraThermal::publishHeadroom(bool notify) {
+    OSDictionary *published = OSDictionary::withCapacity(zoneHeadroomCount);
+    int32_t lowest = INT32_MAX;
+    
+    if (published == nullptr) {
+        return;
+    }
+    
+    for (uint32_t z = 0; z < zoneHeadroomCount; z++) {
+        ZoneHeadroom *zone = &zoneHeadroom[z];
+        zone->publishedSensor = nullptr;
+        if (zone->sensor == nullptr) continue;
+        
+        OSDictionary *entry = OSDictionary::withCapacity(6);
+        if (entry == nullptr) continue;
+        
+        setNumber(entry, "Headroom", publishedHeadroom(zone->headroom));
+        setNumber(entry, "ApproachRate", zone->rate > 0 ? zone->rate : 0);
+        if (zone->rate > 0 && zone->headroom > 0) {
+            setNumber(entry, "SecondsToTrip", static_cast<uint32_t>(static_cast<int64_t>(zone->headroom) * 60 / zone->rate));
+        }
+        
+        if (const OSSymbol *trip = OSSymbol::withCString(zone->critical ? "Critical" : "Passive")) {
+            entry->setObject("Trip", trip);
+            trip->release();
+        }
+        
+        entry->setObject("Sensor", zone->sensor);
+        published->setObject(zone->zone, entry);
+        entry->release();
+        
+        zone->publishedSensor = zone->sensor;
+        zone->published = publishedHeadroom(zone->headroom);
+        zone->publishedCritical = zone->critical;
+        lowest = min(lowest, zone->headroom);
+    }
+    
+    setProperty("Headroom", published);
+    published->release();
+    
+    if (lowest == INT32_MAX) {
+        return;
+    }
+    
+    headroomPublishedLowest = publishedHeadroom(lowest);
+    setProperty("LowestHeadroom", headroomPublishedLowest, 32);
+    if (notify) {
+        messageClients(kIOMessageDptfHeadroomChanged, reinterpret_cast<void *>(static_cast<uintptr_t>(headroomPublishedLowest)));
+    }
+}
+
+bool ChultraThermal::coldIdle(DPTFPolicyTable *table) {
+    // Every sensor read this tick and below its lowest trip
+    for (uint32_t i = 0; i < table->sampleCount; i++) {
+        if (samples[i].version == 0 || samples[i].status != kIOReturnSuccess ||
+            samples[i].level < DPTFActivePolicyMaxTemps) {
+            return false;
+        }
+    }
+    
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        if (fanControl[i].command != 0 && fanControl[i].command != DPTFNoRequest) {
+            return false;
+        }
+    }
+    
+    return table->sampleCount != 0 && passiveThrottle == 0;
+}
+
+bool ChultraThermal::armAuxTrips(DPTFPolicyTable *table, uint32_t band) {
+    bool armed = true;
+    
+    // Each sensor once, around what it read this tick
+    for (uint32_t s = 0; s < table->sampleCount; s++) {
+        DPTFAuxTrips trips { samples[s].rawTemperature, band };
+        IOService *sensor = nullptr;
+        
+        for (uint32_t r = 0; r < table->ruleCount && sensor == nullptr; r++) {
+            if (table->rules[r].sample == s) sensor = table->rules[r].sensor;
+        }
+        
+        if (sensor == nullptr || messageClient(kIOMessageDptfSensorArmAuxTrips, sensor, (void *) &trips) != kIOReturnSuccess) {
+            armed = false;
+        }
+    }
+    
+    auxTripsArmed = band != 0;
+    setProperty("AuxTripsArmed", band != 0 && armed);
+    return armed;
+}
+
+void ChultraThermal::armTimer(uint32_t ms) {
+    uint64_t interval, leeway;
+    
+    // Anything urgent keeps a hard deadline
+    if (ms == 0) {
+        timer->setTimeoutMS(0);
+        return;
+    }
+    
+    nanoseconds_to_absolutetime(static_cast<uint64_t>(ms) * NSEC_PER_MSEC, &interval);
+    nanoseconds_to_absolutetime(static_cast<uint64_t>(ms) * NSEC_PER_MSEC * DPTFTimerLeewayPercent / 100, &leeway);
+    timer->setTimeout(kIOTimeOptionsWithLeeway, interval, leeway);
+}
+
+void ChultraThermal::countWakeup() {
+    uint64_t now, elapsedNs;
+    clock_get_uptime(&now);
+    
+    timerWakeups++;
+    wakeupWindowCount++;
+    setProperty("TimerWakeups", timerWakeups, 64);
+    
+    if (wakeupWindowStart == 0) {
+        wakeupWindowStart = now;
+        return;
+    }
+    
+    // Uptime stops during sleep, so this is the rate while awake
+    absolutetime_to_nanoseconds(now - wakeupWindowStart, &elapsedNs);
+    if (elapsedNs < 3600 * NSEC_PER_SEC) {
+        return;
+    }
+    
+    setProperty("WakeupsPerHour", wakeupWindowCount * 3600 * NSEC_PER_SEC / elapsedNs, 32);
+    wakeupWindowStart = now;
+    wakeupWindowCount = 0;
+}
+
+void DPTFActivePolicyEntry::free() {
+    OSSafeReleaseNULL(fan);
+    OSSafeReleaseNULL(source);
+    OSObject::free();
+}
+
+void DPTFThermalRelationEntry::free() {
+    OSSafeReleaseNULL(source);
+    OSSafeReleaseNULL(target);
+    OSObject::free();
+}
+
+IOReturn ChultraThermal::newUserClient(task_t owningTask, void *securityID, UInt32 type, OSDictionary *properties, IOUserClient **handler) {
+    ChultraThermalUserClient *client = new ChultraThermalUserClient;
+    if (client == nullptr) {
+        return kIOReturnNoMemory;
+    }
+    
+    if (!client->initWithTask(owningTask, securityID, type, properties)) {
+        client->release();
+        return kIOReturnBadArgument;
+    }
+    
+    if (!client->attach(this)) {
+        client->release();
+        return kIOReturnError;
+    }
+    
+    if (!client->start(this)) {
+        client->detach(this);
+        client->release();
+        return kIOReturnError;
+    }
+    
+    *handler = client;
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraThermal::message(UInt32 type, IOService *provider, void *argument) {
+    // Zones forward their Notify, firmware saw something change
+    if (type == kIOACPIMessageDeviceNotification) {
+        requestEvaluation();
+        return kIOReturnSuccess;
+    }
+    
+    return super::message(type, provider, argument);
+}
+
+IOReturn ChultraThermal::setPolicyOverride(const void *blob, size_t length) {
+    uint32_t badEntry;
+    DPTFPolicyBlobError err = DPTFPolicyBlobValidate(blob, length, &badEntry);
+    if (err != DPTFPolicyBlobOK) {
+        IOLogError("Rejected policy override (error %d, entry %d)", err, badEntry);
+        return kIOReturnBadArgument;
+    }
+    
+    const DPTFPolicyBlobHeader *header = static_cast<const DPTFPolicyBlobHeader *>(blob);
+    const DPTFPolicyBlobEntry *entries = DPTFPolicyBlobEntries(blob);
+    
+    //
+    // Compile the blob into the same Zone -> Fan -> Source shape
+    // the zone driver registers, then publish it like any other change.
+    //
+    
+    const OSSymbol *zoneKey = OSSymbol::withCString(DPTF_OVERRIDE_ZONE);
+    OSDictionary *zoneDict = OSDictionary::withCapacity(1);
+    OSDictionary *newOverride = OSDictionary::withCapacity(1);
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (zoneKey == nullptr || zoneDict == nullptr || newOverride == nullptr) {
+        ret = kIOReturnNoMemory;
+        goto done;
+    }
+    
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        DPTFActivePolicyEntry *entry = new DPTFActivePolicyEntry();
+        if (entry == nullptr) {
+            ret = kIOReturnNoMemory;
+            goto done;
+        }
+        
+        entry->fan = OSSymbol::withCString(entries[i].fan);
+        entry->source = OSSymbol::withCString(entries[i].source);
+        entry->weight = entries[i].weight;
+        entry->samplingPeriod = entries[i].samplingPeriod;
+        entry->hysteresis = entries[i].hysteresis;
+        memcpy(entry->maxFanSpeeds, entries[i].maxFanSpeeds, sizeof(entry->maxFanSpeeds));
+        
+        if (entry->fan == nullptr || entry->source == nullptr) {
+            entry->release();
+            ret = kIOReturnNoMemory;
+            goto done;
+        }
+        
+        OSDictionary *fanDict = OSDynamicCast(OSDictionary, zoneDict->getObject(entry->fan));
+        if (fanDict == nullptr) {
+            fanDict = OSDictionary::withCapacity(1);
+            if (fanDict == nullptr) {
+                entry->release();
+                ret = kIOReturnNoMemory;
+                goto done;
+            }
+            zoneDict->setObject(entry->fan, fanDict);
+            fanDict->release();
+        }
+        
+        fanDict->setObject(entry->source, entry);
+        entry->release();
+    }
+    
+    newOverride->setObject(zoneKey, zoneDict);
+    
+    IOLockLock(registrationLock);
+    OSSafeReleaseNULL(policyOverride);
+    policyOverride = newOverride;
+    newOverride = nullptr;
+    ret = publishPolicyTable();
+    IOLockUnlock(registrationLock);
+    
+    if (ret == kIOReturnSuccess) {
+        IOLogInfo("Applied policy override with %d entries", header->entryCount);
+        setProperty("PolicyOverride", true);
+        timer->setTimeoutMS(0);
+    }
+    
+done:
+    OSSafeReleaseNULL(newOverride);
+    OSSafeReleaseNULL(zoneDict);
+    OSSafeReleaseNULL(zoneKey);
+    return ret;
+}
+
+IOReturn ChultraThermal::copyActivePolicy(void *blob, size_t *length) {
+    IOReturn ret = kIOReturnSuccess;
+    
+    // Holding the lock keeps the current table from being retired under us
+    IOLockLock(registrationLock);
+    
+    DPTFPolicyTable *table = policyTable.load();
+    uint32_t count = table != nullptr ? table->ruleCount : 0;
+    uint32_t size = DPTFPolicyBlobSize(count);
+    DPTFPolicyBlobEntry *entries = reinterpret_cast<DPTFPolicyBlobEntry *>(static_cast<uint8_t *>(blob) + sizeof(DPTFPolicyBlobHeader));
+    uint32_t written = 0;
+    
+    if (count > DPTF_POLICY_BLOB_MAX_ENTRIES) {
+        ret = kIOReturnOverrun;
+        goto done;
+    }
+    
+    if (*length < size) {
+        ret = kIOReturnNoSpace;
+        goto done;
+    }
+    
+    bzero(blob, size);
+    for (uint32_t i = 0; table != nullptr && i < table->fanCount; i++) {
+        DPTFPolicyTable::Fan *fan = &table->fans[i];
+        
+        for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+            DPTFPolicyTable::Rule *rule = &table->rules[r];
+            DPTFPolicyBlobEntry *entry = &entries[written++];
+            
+            strlcpy(entry->fan, fan->path->getCStringNoCopy(), sizeof(entry->fan));
+            strlcpy(entry->source, rule->source->getCStringNoCopy(), sizeof(entry->source));
+            entry->weight = rule->policy->weight;
+            entry->samplingPeriod = rule->policy->samplingPeriod;
+            entry->hysteresis = rule->policy->hysteresis;
+            memcpy(entry->maxFanSpeeds, rule->policy->maxFanSpeeds, sizeof(entry->maxFanSpeeds));
+        }
+    }
+    
+    DPTFPolicyBlobFinalize(blob, written);
+    *length = DPTFPolicyBlobSize(written);
+    
+done:
+    IOLockUnlock(registrationLock);
+    return ret;
+}
+
+IOReturn ChultraThermal::copyTelemetry(void *buf, size_t *length) {
+    // Every frame fits in a single read, so a short buffer is the caller's mistake
+    if (*length < DPTF_TELEMETRY_MAX_FRAME) {
+        return kIOReturnNoSpace;
+    }
+    
+    *length = telemetry->copyOut(buf, static_cast<uint32_t>(min(*length, DPTF_TELEMETRY_MAX_READ)));
     return kIOReturnSuccess;
 }
+
+IOReturn ChultraThermal::revertPolicyOverride() {
+    IOReturn ret;
+    
+    IOLockLock(registrationLock);
+    OSSafeReleaseNULL(policyOverride);
+    ret = publishPolicyTable();
+    IOLockUnlock(registrationLock);
+    
+    if (ret == kIOReturnSuccess) {
+        IOLogInfo("Reverted policy override");
+        removeProperty("PolicyOverride");
+        timer->setTimeoutMS(0);
+    }
+    
+    return ret;
+}
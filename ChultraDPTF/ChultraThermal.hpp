@@ -12,31 +12,163 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOUserClient.h>
+
+#include "DPTFPolicyBlob.h"
+#include "FanFeedback.hpp"
+#include "IdleBackoff.hpp"
+#include "Policies.hpp"
+#include "TableSlot.hpp"
 
 #define DPTF_REGISTER_ZONE "DPTFRegisterZone"
 #define DPTF_REGISTER_FAN "DPTFRegisterFan"
 #define DPTF_REGISTER_SENSOR "DPTFRegisterSensor"
+#define DPTF_REGISTER_PASSIVE "DPTFRegisterPassive"
 
 #define DPTF_UNREGISTER_ZONE "DPTFUnregisterZone"
 #define DPTF_UNREGISTER_FAN "DPTFUnregisterFan"
 #define DPTF_UNREGISTER_SENSOR "DPTFUnregisterSensor"
+#define DPTF_UNREGISTER_PASSIVE "DPTFUnregisterPassive"
+
+// Fan properties the zone allocator reads when building the policy table
+#define DPTF_FAN_STEP_SIZE "FanStepSize"
+#define DPTF_FAN_MAX_POWER "FanMaxPowerMW"
+#define DPTF_FAN_MIN_LEVEL "FanMinLevel"
+#define DPTF_FAN_MAX_LEVEL "FanMaxLevel"
+
+// Pseudo zone that user client overrides are filed under
+#define DPTF_OVERRIDE_ZONE "UserOverride"
 
 extern const OSSymbol *gDPTFRegisterZone;
 extern const OSSymbol *gDPTFRegisterFan;
 extern const OSSymbol *gDPTFRegisterSensor;
+extern const OSSymbol *gDPTFRegisterPassive;
 
 extern const OSSymbol *gDPTFUnregisterZone;
 extern const OSSymbol *gDPTFUnregisterFan;
 extern const OSSymbol *gDPTFUnregisterSensor;
+extern const OSSymbol *gDPTFUnregisterPassive;
 
 enum {
     kIOMessageDptfSensorReadTemp = iokit_vendor_specific_msg(300),
     kIOMessageDptfSensorReadLevel = iokit_vendor_specific_msg(301),
     kIOMessageDptfFanSetLvl = iokit_vendor_specific_msg(302),
+    kIOMessageDptfSensorSetHysteresis = iokit_vendor_specific_msg(303),
+    kIOMessageDptfSensorReloadTrips = iokit_vendor_specific_msg(304),
+    kIOMessageDptfZoneTakeControl = iokit_vendor_specific_msg(305),
+    kIOMessageDptfZoneReleaseControl = iokit_vendor_specific_msg(306),
+    kIOMessageDptfProcessorSetPowerLimit = iokit_vendor_specific_msg(307),   // PL1 in mW, 0 restores firmware's
+    kIOMessageDptfPassiveGetLevels = iokit_vendor_specific_msg(308),         // Number of throttle levels
+    kIOMessageDptfPassiveSetLevel = iokit_vendor_specific_msg(309),          // 0 is unthrottled
+    kIOMessageDptfFanGetStatus = iokit_vendor_specific_msg(310),             // Fills DPTFFanStatus
+    kIOMessageDptfProcessorGetStatus = iokit_vendor_specific_msg(311),       // Fills DPTFProcessorStatus, all but temperature
+    kIOMessageDptfSensorSample = iokit_vendor_specific_msg(312),             // Fills DPTFSensorSample
+    kIOMessageDptfHeadroomChanged = iokit_vendor_specific_msg(313),          // To interested clients, argument is the lowest headroom in tenths of a degree
+    kIOMessageDptfSensorArmAuxTrips = iokit_vendor_specific_msg(314),        // Takes DPTFAuxTrips, unsupported if the sensor can't notify
+};
+
+#define DPTF_SENSOR_SAMPLE_VERSION 2
+
+//
+// One _TMP evaluation, everything derived from it and when it happened.
+// Callers set version and size to what they were built with, participants
+// fill no more than that and report the version both sides understand,
+// so fields can be appended without breaking either side.
+//
+struct DPTFSensorSample {
+    uint32_t version;
+    uint32_t size;
+    IOReturn status;            // Result of the _TMP evaluation, nothing below is valid otherwise
+    uint32_t temperature;       // Smoothed, tenths of a degree C
+    uint32_t rawTemperature;    // As read, tenths of a degree C
+    uint32_t level;             // Tripped active cooling level
+    uint64_t timestamp;         // Absolute time of the evaluation
+    
+    // Version 2, cached from the last trip reload, tenths of a degree, 0 if the sensor has none
+    uint32_t passiveTrip;
+    uint32_t criticalTrip;
+};
+
+// Version 1 layout, the least a caller may ask for
+constexpr uint32_t DPTFSensorSampleMinSize = 32;
+static_assert(sizeof(DPTFSensorSample) >= DPTFSensorSampleMinSize, "Sensor samples only ever grow");
+
+// Participant side, copies filled into the caller's struct as far as both understand
+static inline IOReturn DPTFSensorSampleCopy(DPTFSensorSample *out, DPTFSensorSample *filled) {
+    if (out->version == 0 || out->size < DPTFSensorSampleMinSize) {
+        return kIOReturnBadArgument;
+    }
+    
+    filled->version = out->version < DPTF_SENSOR_SAMPLE_VERSION ? out->version : DPTF_SENSOR_SAMPLE_VERSION;
+    filled->size = out->size < sizeof(*filled) ? out->size : sizeof(*filled);
+    memcpy(out, filled, filled->size);
+    return filled->status;
+}
+
+// What a fan was told versus what it is doing
+typedef FanFeedback::Status DPTFFanStatus;
+
+// Aux trips band either side of a temperature from the sensor's sample, tenths of a degree. A band of 0 turns them off
+struct DPTFAuxTrips {
+    uint32_t temperature;
+    uint32_t band;
+};
+
+// Everything the power arbiter needs from a processor in one call
+struct DPTFProcessorStatus {
+    uint32_t temperature;       // Tenths of a degree C, set by the caller from its sample, 0 if none
+    uint32_t passiveTrip;       // Tenths of a degree C, from _PSV
+    uint32_t power;             // Average package power since the last call, mW
+    uint32_t minLimit;          // PL1 range from PPCC, mW
+    uint32_t maxLimit;
+    uint32_t appliedLimit;      // 0 while firmware's limit is in place
 };
 
+// Core and fan only need to know whether the system is awake
+enum {
+    DPTFPowerStateOff = 0,
+    DPTFPowerStateOn,
+    DPTFPowerStateCount
+};
+
+extern IOPMPowerState DPTFPowerStates[DPTFPowerStateCount];
+
 constexpr size_t DPTFActivePolicyMaxTemps = 10;
 
+// Evaluation period, and how long to wait for more participants before building the policy table anyway
+constexpr uint32_t DPTFPollingPeriodMS = 10000;
+constexpr uint32_t DPTFRegistrationSettleMS = 1000;
+
+// How soon a tick that lost the registration lock tries again
+constexpr uint32_t DPTFRegistrationRetryMS = 20;
+
+// How late a periodic evaluation may run so the kernel can batch it with other wakeups
+constexpr uint32_t DPTFTimerLeewayPercent = 10;
+
+// Evaluation history kept for the user client, a couple of hours at the normal rate
+constexpr uint32_t DPTFTelemetryBufferSize = 16384;
+
+// How often fitted thermal models are republished to the registry
+constexpr uint32_t DPTFModelPublishMS = 60000;
+
+// Headroom is republished no more often than the first, and at least as often as the second
+constexpr uint32_t DPTFHeadroomMinIntervalMS = 5000;
+constexpr uint32_t DPTFHeadroomRefreshMS = 60000;
+
+// Headroom change that's worth a notification, tenths of a degree
+constexpr int32_t DPTFHeadroomChange = 10;
+
+class DPTFPolicyTable;
+class DPTFPolicyModule;
+class DPTFTelemetry;
+class DPTFThermalModel;
+
+// How the core's DPTFTableSlot publishes and frees policy tables
+struct DPTFPolicyTableOps {
+    static void barrier();
+    static void release(DPTFPolicyTable *table);
+};
+
 // Active Policy
 struct DPTFActivePolicyEntry : public OSObject {
     OSDeclareDefaultStructors(DPTFActivePolicyEntry);
@@ -45,8 +177,28 @@ public:
     const OSSymbol *source {nullptr};
     uint32_t weight;
     uint32_t maxFanSpeeds[DPTFActivePolicyMaxTemps];
+    
+    // Only set by user client overrides, zero/default otherwise
+    uint32_t samplingPeriod {0};
+    uint32_t hysteresis {DPTF_POLICY_HYSTERESIS_DEFAULT};
+    
+    void free() override;
 };
 
+// Passive Policy
+struct DPTFThermalRelationEntry : public OSObject {
+    OSDeclareDefaultStructors(DPTFThermalRelationEntry);
+public:
+    const OSSymbol *source {nullptr};
+    const OSSymbol *target {nullptr};
+    uint32_t weight;
+    uint32_t samplingPeriod;
+    
+    void free() override;
+};
+
+static_assert(DPTFActivePolicyMaxTemps == DPTF_POLICY_BLOB_MAX_TEMPS, "Policy blob must match active policy entries");
+
 class ChultraThermal : public IOService {
     OSDeclareDefaultStructors(ChultraThermal);
 public:
@@ -56,30 +208,179 @@ public:
     void free() override;
     
     IOReturn callPlatformFunction(const OSSymbol *, bool, void *, void *, void *, void *) override;
+    IOReturn setPowerState(unsigned long powerState, IOService *whatDevice) override;
+    IOReturn newUserClient(task_t owningTask, void *securityID, UInt32 type, OSDictionary *properties, IOUserClient **handler) override;
+    IOReturn message(UInt32 type, IOService *provider, void *argument) override;
+    
+    // User client policy overrides
+    IOReturn setPolicyOverride(const void *blob, size_t length);
+    IOReturn copyActivePolicy(void *blob, size_t *length);
+    IOReturn revertPolicyOverride();
+    IOReturn copyTelemetry(void *buf, size_t *length);
     
-    static LIBKERN_RETURNS_RETAINED ChultraThermal *WaitForThermal() {
+    // Participants coming back from sleep ask for an early evaluation
+    void requestEvaluation();
+    
+    //
+    // Participants register with the core from a publish notification
+    // instead of blocking their own start() until the core shows up.
+    // The handler fires right away if the core is already published.
+    //
+    static IONotifier *NotifyWhenPublished(IOServiceMatchingNotificationHandler handler, void *target) {
         OSDictionary *matching = serviceMatching("ChultraThermal");
         if (matching == nullptr) return nullptr;
         
-        IOService *service = waitForMatchingService(matching, 20000000000);
-        ChultraThermal *ret = OSDynamicCast(ChultraThermal, service);
-        if (ret == nullptr) {
-            OSSafeReleaseNULL(service);
-            return nullptr;
-        }
-        
-        return ret;
+        IONotifier *notifier = addMatchingNotification(gIOFirstPublishNotification, matching, handler, target);
+        matching->release();
+        return notifier;
     };
 private:
+    // The policies' Io reads processors and fans through the core
+    friend class DPTFPolicyContext;
+    
     OSDictionary *fans {nullptr};
     OSDictionary *thermalZones {nullptr};
     OSDictionary *activePolicies {nullptr};
     OSDictionary *sensors {nullptr};
     
+    // Participants that accept a throttle level, e.g. chargers
+    OSDictionary *passiveDevices {nullptr};
+    
+    // Zone -> Fan -> Source -> Entry, same shape as activePolicies
+    OSDictionary *policyOverride {nullptr};
+    
     IOWorkLoop *workloop {nullptr};
     IOTimerEventSource *timer {nullptr};
     
-    IOReturn newState();
+    //
+    // Registration dictionaries are only touched under registrationLock.
+    // Every change builds a new immutable DPTFPolicyTable which is published
+    // with a single pointer store, so evaluation reads it without locking.
+    // Replaced tables are kept alive until the next tick starts.
+    //
+    IOLock *registrationLock {nullptr};
+    
+    //
+    // Zones are told to take or release control after registrationLock is
+    // dropped, since that runs their _OSC. ownershipLock keeps the messages
+    // in the order they were decided, and one older than what was already
+    // sent is dropped.
+    //
+    IOLock *ownershipLock {nullptr};
+    uint32_t ownershipDecided {0};
+    uint32_t ownershipSent {0};
+    
+    DPTFTableSlot<DPTFPolicyTable, DPTFPolicyTableOps> policyTable;
+    bool policyTableDirty {false};
+    uint64_t startTime {0};
+    
+    // Supported policy bitmask per zone, from IDSP
+    OSDictionary *zoneSupport {nullptr};
+    uint32_t tableGeneration {0};
+    
+    // Only changed on the workloop, so a tick never sees a half finished transition
+    bool sleeping {false};
+    bool wakePending {false};
+    
+    // Policy modules and the sample buffer they share, workloop only
+    OSArray *policyModules {nullptr};
+    uint32_t evaluatedGeneration {0};
+    DPTFSensorSample *samples {nullptr};
+    uint32_t sampleSlots {0};
+    volatile bool evaluateNow {false};
+    
+    //
+    // Closed loop fan compensation, workloop only. Fans that fall short of
+    // the arbitrated level get a boost on top of it, fans that are already
+    // maxed out escalate to passive cooling instead.
+    //
+    typedef FanFeedback::Control FanControl;
+    
+    FanControl *fanControl {nullptr};
+    uint32_t fanControlSlots {0};
+    
+    // Deepest throttle the chargers were last set to
+    uint32_t passiveThrottle {0};
+    
+    // Fan level nobody may exceed for a processor
+    uint32_t acousticCeiling {100};
+    
+    DPTFTelemetry *telemetry {nullptr};
+    
+    //
+    // Fitted plant per fan and sensor pair, and per processor for package
+    // power, keyed so they outlive table changes. ruleModels follows the
+    // current table's rules. Workloop only.
+    //
+    OSDictionary *thermalModels {nullptr};
+    OSArray *ruleModels {nullptr};
+    uint32_t tunedPeriodMS {0};
+    uint64_t modelsPublishedMS {0};
+    
+    // Period multiplier while the system sits cold, and how often the timer woke us, workloop only
+    uint32_t idleBackoff {1};
+    bool auxTripsArmed {false};
+    uint64_t timerWakeups {0};
+    uint64_t wakeupWindowStart {0};
+    uint32_t wakeupWindowCount {0};
+    
+    //
+    // Distance to the nearest passive or critical trip per zone, worked out
+    // from the samples the policies already took. Workloop only.
+    //
+    struct SampleTrend {
+        uint32_t temperature;
+        uint32_t passiveTrip;
+        uint32_t criticalTrip;
+        int32_t rate;           // Tenths of a degree per minute, smoothed
+        uint64_t timestampMS;   // 0 until the sensor has been read
+    };
+    
+    struct ZoneHeadroom {
+        const OSSymbol *zone;
+        const OSSymbol *sensor; // Closest to its trip, nullptr if no sensor has one
+        int32_t headroom;       // Tenths of a degree, negative past the trip
+        int32_t rate;           // Tenths of a degree per minute towards the trip
+        bool critical;          // Limited by _CRT rather than _PSV
+        
+        // What clients last heard about, nullptr sensor if nothing
+        const OSSymbol *publishedSensor;
+        int32_t published;
+        bool publishedCritical;
+    };
+    
+    SampleTrend *trends {nullptr};
+    uint32_t trendSlots {0};
+    ZoneHeadroom *zoneHeadroom {nullptr};
+    uint32_t zoneHeadroomSlots {0};
+    uint32_t zoneHeadroomCount {0};
+    uint64_t headroomPublishedMS {0};
+    int32_t headroomPublishedLowest {0};    // LowestHeadroom as clients last heard it
+    
+    bool allParticipantsRegistered();
+    void participantsChanged(bool removal);
+    uint32_t decideZoneOwnership(OSArray *take, OSArray *release);
+    void sendZoneOwnership(OSArray *take, OSArray *release, uint32_t decision);
+    IOReturn publishPolicyTable();
+    void applySensorHysteresis(DPTFPolicyTable *table);
+    bool reclaimPolicyTables();
+    void reloadTripPoints(DPTFPolicyTable *table);
+    IOReturn syncPolicyModules(DPTFPolicyTable *table);
+    uint32_t evaluatePolicies(DPTFPolicyTable *table, bool force);
+    void applyRequests(DPTFPolicyTable *table);
+    bool readProcessor(DPTFPolicyTable *table, uint32_t passive, const Policies::Sample *sample, Policies::Processor *processor);
+    void readFan(uint32_t fan, Policies::FanState *state);
+    bool coldIdle(DPTFPolicyTable *table);
+    bool armAuxTrips(DPTFPolicyTable *table, uint32_t band);
+    void updateHeadroom(DPTFPolicyTable *table, uint64_t nowMS);
+    void publishHeadroom(bool notify);
+    DPTFThermalModel *modelFor(const OSSymbol *key);
+    void updateThermalModels(DPTFPolicyTable *table, uint64_t nowMS);
+    void publishThermalModels();
+    uint32_t periodFor(DPTFPolicyModule *module, DPTFPolicyTable *table);
+    void armTimer(uint32_t ms);
+    void countWakeup();
+    IOReturn setPowerStateGated(void *powerState, void *, void *, void *);
     IOReturn timerHandler(OSObject *, void *, void *, void *, void *);
 };
 
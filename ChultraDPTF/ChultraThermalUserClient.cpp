@@ -0,0 +1,117 @@
+//
+//  ChultraThermalUserClient.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/4/23.
+//
+
+#include "ChultraThermalUserClient.hpp"
+#include "Logger.h"
+
+#define super IOUserClient
+OSDefineMetaClassAndStructors(ChultraThermalUserClient, IOUserClient);
+
+const IOExternalMethodDispatch ChultraThermalUserClient::methods[kDPTFUserClientMethodCount] = {
+    // kDPTFUserClientSetPolicy
+    { &ChultraThermalUserClient::sSetPolicy, 0, kIOUCVariableStructureSize, 0, 0 },
+    // kDPTFUserClientGetPolicy
+    { &ChultraThermalUserClient::sGetPolicy, 0, 0, 0, kIOUCVariableStructureSize },
+    // kDPTFUserClientRevertPolicy
+    { &ChultraThermalUserClient::sRevertPolicy, 0, 0, 0, 0 },
+    // kDPTFUserClientReadTelemetry
+    { &ChultraThermalUserClient::sReadTelemetry, 0, 0, 0, kIOUCVariableStructureSize },
+};
+
+bool ChultraThermalUserClient::initWithTask(task_t owningTask, void *securityID, UInt32 type, OSDictionary *properties) {
+    if (!super::initWithTask(owningTask, securityID, type, properties)) {
+        return false;
+    }
+    
+    privileged = clientHasPrivilege(securityID, kIOClientPrivilegeAdministrator) == kIOReturnSuccess;
+    return true;
+}
+
+bool ChultraThermalUserClient::start(IOService *provider) {
+    thermal = OSDynamicCast(ChultraThermal, provider);
+    if (thermal == nullptr) {
+        return false;
+    }
+    
+    return super::start(provider);
+}
+
+void ChultraThermalUserClient::stop(IOService *provider) {
+    thermal = nullptr;
+    super::stop(provider);
+}
+
+IOReturn ChultraThermalUserClient::clientClose() {
+    // Overrides outlive the client on purpose, use revert to drop them
+    terminate();
+    return kIOReturnSuccess;
+}
+
+IOReturn ChultraThermalUserClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                                                  IOExternalMethodDispatch *dispatch, OSObject *target, void *reference) {
+    if (selector >= kDPTFUserClientMethodCount) {
+        return kIOReturnUnsupported;
+    }
+    
+    dispatch = const_cast<IOExternalMethodDispatch *>(&methods[selector]);
+    return super::externalMethod(selector, arguments, dispatch, this, reference);
+}
+
+IOReturn ChultraThermalUserClient::sSetPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments) {
+    ChultraThermalUserClient *client = OSDynamicCast(ChultraThermalUserClient, target);
+    if (client == nullptr || client->thermal == nullptr) return kIOReturnNotAttached;
+    if (!client->privileged) return kIOReturnNotPermitted;
+    
+    // Blobs always fit inline, so there is never a descriptor to map
+    if (arguments->structureInput == nullptr || arguments->structureInputDescriptor != nullptr) {
+        return kIOReturnBadArgument;
+    }
+    
+    return client->thermal->setPolicyOverride(arguments->structureInput, arguments->structureInputSize);
+}
+
+IOReturn ChultraThermalUserClient::sGetPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments) {
+    ChultraThermalUserClient *client = OSDynamicCast(ChultraThermalUserClient, target);
+    if (client == nullptr || client->thermal == nullptr) return kIOReturnNotAttached;
+    
+    if (arguments->structureOutput == nullptr || arguments->structureOutputDescriptor != nullptr) {
+        return kIOReturnBadArgument;
+    }
+    
+    size_t length = arguments->structureOutputSize;
+    IOReturn ret = client->thermal->copyActivePolicy(arguments->structureOutput, &length);
+    if (ret == kIOReturnSuccess) {
+        arguments->structureOutputSize = (uint32_t) length;
+    }
+    
+    return ret;
+}
+
+IOReturn ChultraThermalUserClient::sRevertPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments) {
+    ChultraThermalUserClient *client = OSDynamicCast(ChultraThermalUserClient, target);
+    if (client == nullptr || client->thermal == nullptr) return kIOReturnNotAttached;
+    if (!client->privileged) return kIOReturnNotPermitted;
+    
+    return client->thermal->revertPolicyOverride();
+}
+
+IOReturn ChultraThermalUserClient::sReadTelemetry(OSObject *target, void *reference, IOExternalMethodArguments *arguments) {
+    ChultraThermalUserClient *client = OSDynamicCast(ChultraThermalUserClient, target);
+    if (client == nullptr || client->thermal == nullptr) return kIOReturnNotAttached;
+    
+    if (arguments->structureOutput == nullptr || arguments->structureOutputDescriptor != nullptr) {
+        return kIOReturnBadArgument;
+    }
+    
+    size_t length = arguments->structureOutputSize;
+    IOReturn ret = client->thermal->copyTelemetry(arguments->structureOutput, &length);
+    if (ret == kIOReturnSuccess) {
+        arguments->structureOutputSize = (uint32_t) length;
+    }
+    
+    return ret;
+}
@@ -0,0 +1,44 @@
+//
+//  ChultraThermalUserClient.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/4/23.
+//
+
+#ifndef ChultraThermalUserClient_hpp
+#define ChultraThermalUserClient_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOUserClient.h>
+
+#include "ChultraThermal.hpp"
+#include "DPTFPolicyBlob.h"
+
+//
+// Lets user space swap the active policy live without rebuilding the kext.
+// Reading back the policy and telemetry is open to anyone, changing the
+// policy requires admin.
+//
+class ChultraThermalUserClient : public IOUserClient {
+    OSDeclareDefaultStructors(ChultraThermalUserClient);
+public:
+    bool initWithTask(task_t owningTask, void *securityID, UInt32 type, OSDictionary *properties) override;
+    bool start(IOService *provider) override;
+    void stop(IOService *provider) override;
+    IOReturn clientClose() override;
+    
+    IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                            IOExternalMethodDispatch *dispatch, OSObject *target, void *reference) override;
+private:
+    ChultraThermal *thermal {nullptr};
+    bool privileged {false};
+    
+    static IOReturn sSetPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments);
+    static IOReturn sGetPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments);
+    static IOReturn sRevertPolicy(OSObject *target, void *reference, IOExternalMethodArguments *arguments);
+    static IOReturn sReadTelemetry(OSObject *target, void *reference, IOExternalMethodArguments *arguments);
+    
+    static const IOExternalMethodDispatch methods[kDPTFUserClientMethodCount];
+};
+
+#endif /* ChultraThermalUserClient_hpp */
@@ -0,0 +1,131 @@
+//
+//  FanAllocator.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "FanAllocator.hpp"
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+uint32_t FanAllocator::clamp(const Fan &fan, uint32_t level) {
+    if (level == 0) return 0;
+    return min(max(level, fan.floor), fan.ceiling);
+}
+
+static uint64_t weightOf(const FanAllocator::Rule &rule, const FanAllocator::Source *sources) {
+    return sources[rule.source].weights == 0 ? 1 : rule.weight;
+}
+
+// Weighted cooling one source gets, from the allocation or from each fan on its own
+static int64_t coolingOf(const FanAllocator::Fan *fans, uint32_t fanCount, const FanAllocator::Rule *rules, const FanAllocator::Source *sources,
+                         uint32_t source, bool independent) {
+    int64_t cooling = 0;
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        uint32_t level = independent ? FanAllocator::clamp(fans[i], fans[i].independent) : fans[i].allocated;
+        for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) {
+            if (rules[r].source == source) cooling += static_cast<int64_t>(weightOf(rules[r], sources)) * level;
+        }
+    }
+
+    return cooling;
+}
+
+void FanAllocator::allocate(Fan *fans, uint32_t fanCount, const Rule *rules, Source *sources) {
+    bool knownPower = true;
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) sources[rules[r].source] = { 0, 0, 0 };
+    }
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) sources[rules[r].source].weights += rules[r].weight;
+    }
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) {
+            Source *source = &sources[rules[r].source];
+            source->demand += static_cast<int64_t>(weightOf(rules[r], sources)) * rules[r].speed;
+            source->deficit = source->demand;
+        }
+    }
+
+    // Without every fan's power, assume they're the same fan
+    for (uint32_t i = 0; i < fanCount; i++) {
+        fans[i].allocated = 0;
+        knownPower = knownPower && fans[i].maxPower != 0;
+    }
+
+    auto power = [&](uint32_t fan, uint64_t level) -> uint64_t {
+        return (knownPower ? fans[fan].maxPower : 1) * level * level * level;
+    };
+
+    // Whole steps only, anything smaller the fan ignores, and a stopped fan starts at its floor
+    auto nextLevel = [&](uint32_t fan) -> uint32_t {
+        return clamp(fans[fan], fans[fan].allocated + fans[fan].stepSize);
+    };
+
+    while (true) {
+        uint32_t best = fanCount;
+        uint64_t bestGain = 0;
+        uint64_t bestCost = 1;
+
+        for (uint32_t i = 0; i < fanCount; i++) {
+            uint32_t level = fans[i].allocated;
+            uint32_t next = nextLevel(i);
+            if (next <= level) continue;
+
+            uint64_t gain = 0;
+            for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) {
+                // Judged by what the step does for sources still short, even if it overshoots one
+                if (sources[rules[r].source].deficit > 0) gain += weightOf(rules[r], sources) * (next - level);
+            }
+
+            if (gain == 0) continue;
+
+            uint64_t cost = power(i, next) - power(i, level);
+            if (best == fanCount || gain * bestCost > bestGain * cost) {
+                best = i;
+                bestGain = gain;
+                bestCost = cost;
+            }
+        }
+
+        if (best == fanCount) break;
+
+        uint32_t next = nextLevel(best);
+        for (uint32_t r = fans[best].firstRule; r < fans[best].firstRule + fans[best].ruleCount; r++) {
+            sources[rules[r].source].deficit -= static_cast<int64_t>(weightOf(rules[r], sources)) * (next - fans[best].allocated);
+        }
+
+        fans[best].allocated = next;
+    }
+
+    //
+    // Rounding up to steps can cost more than it saves, so never do worse
+    // than each fan on its own. That only holds if the fans on their own,
+    // floors and ceilings included, still cool every source as much.
+    //
+    uint64_t independentPower = 0;
+    uint64_t allocatedPower = 0;
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        independentPower += power(i, clamp(fans[i], fans[i].independent));
+        allocatedPower += power(i, fans[i].allocated);
+    }
+
+    if (allocatedPower < independentPower) return;
+
+    for (uint32_t i = 0; i < fanCount; i++) {
+        for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) {
+            uint32_t source = rules[r].source;
+            int64_t allocated = coolingOf(fans, fanCount, rules, sources, source, false);
+            if (coolingOf(fans, fanCount, rules, sources, source, true) < min(sources[source].demand, allocated)) return;
+        }
+    }
+
+    for (uint32_t i = 0; i < fanCount; i++) fans[i].allocated = clamp(fans[i], fans[i].independent);
+}
@@ -0,0 +1,57 @@
+//
+//  FanAllocator.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef FanAllocator_hpp
+#define FanAllocator_hpp
+
+#include <stdint.h>
+
+//
+// Splits the cooling a zone's sources need across the fans that reach
+// them. Each source needs the cooling its own rules ask for, counted as
+// the sum of weight * level over its fans. Fan power grows with the cube
+// of speed, so levels are handed out one step at a time to whichever fan
+// buys the most of the missing cooling per mW.
+//
+// No IOKit here, so allocations can be checked on a host.
+//
+namespace FanAllocator {
+    struct Fan {
+        uint32_t stepSize;      // Smallest level change the fan acts on
+        uint32_t maxPower;      // mW at full speed, 0 if unknown
+        uint32_t floor;         // Lowest level the fan runs at, anything under it is off
+        uint32_t ceiling;       // Highest level the fan runs at
+        uint32_t firstRule;
+        uint32_t ruleCount;
+
+        uint32_t independent;   // Fastest speed any source asks of this fan
+        uint32_t allocated;     // Share of the zone's cooling
+    };
+
+    struct Rule {
+        uint32_t source;        // Index into the sources scratch
+        uint32_t weight;        // _ART weight
+        uint32_t speed;         // Level the source's tripped _ACx asks for
+    };
+
+    struct Source {
+        uint64_t weights;       // Sum of _ART weights in the zone, 0 means treat the fans as equal
+        int64_t demand;         // Weighted cooling the source's rules ask for
+        int64_t deficit;        // Weighted cooling still missing
+    };
+
+    // What the fan actually runs at for a level, off or within its floor and ceiling
+    uint32_t clamp(const Fan &fan, uint32_t level);
+
+    //
+    // Fills in allocated for one zone's fans. Rules are indexed from each
+    // fan's firstRule, sources by the rules and only used as scratch.
+    //
+    void allocate(Fan *fans, uint32_t fanCount, const Rule *rules, Source *sources);
+}
+
+#endif /* FanAllocator_hpp */
@@ -0,0 +1,93 @@
+//
+//  FanFeedback.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "FanFeedback.hpp"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+uint32_t FanFeedback::expectedSpeed(const SpeedPoint *points, uint32_t count, uint32_t level) {
+    if (count == 0 || level == Unknown) return 0;
+
+    if (level <= points[0].control) {
+        return points[0].control == 0 ? points[0].speed : points[0].speed * level / points[0].control;
+    }
+
+    for (uint32_t i = 1; i < count; i++) {
+        const SpeedPoint *lo = &points[i - 1];
+        const SpeedPoint *hi = &points[i];
+        if (level > hi->control) continue;
+        if (hi->control == lo->control) return hi->speed;
+
+        // Speeds may go down between points on odd tables, keep the math signed
+        int64_t slope = static_cast<int64_t>(hi->speed) - lo->speed;
+        return static_cast<uint32_t>(lo->speed + slope * (level - lo->control) / (hi->control - lo->control));
+    }
+
+    return points[count - 1].speed;
+}
+
+bool FanFeedback::sample(Sensor *sensor, const SpeedPoint *points, uint32_t count, uint32_t control, uint32_t speed, bool forced) {
+    bool ours = true;
+
+    // Firmware or the EC moved the fan since our last _FSL. Unknown control is reported as all ones.
+    if (sensor->lastState != Unknown && control != Unknown && control != sensor->lastState) {
+        sensor->externalChanges++;
+        sensor->lastState = Unknown;
+        ours = false;
+    }
+
+    sensor->expected = expectedSpeed(points, count, sensor->lastState);
+    sensor->speed = speed;
+
+    bool slow = sensor->expected != 0 && static_cast<uint64_t>(speed) * 100 < static_cast<uint64_t>(sensor->expected) * DPTFFanUnderperformPercent;
+    sensor->underperforming = slow || sensor->notified;
+    if (!forced) sensor->notified = false;
+
+    return ours;
+}
+
+FanFeedback::Status FanFeedback::status(const Sensor &sensor, const SpeedPoint *points, uint32_t count) {
+    return { sensor.lastState, sensor.speed, expectedSpeed(points, count, sensor.lastState), sensor.underperforming };
+}
+
+bool FanFeedback::apply(Control *control, uint32_t level, const Status *status) {
+    bool starved = false;
+
+    control->achieved = level;
+
+    if (status != nullptr) {
+        if (status->commanded != Unknown) {
+            control->achieved = status->commanded;
+        }
+
+        // A slow fan manages its share of the level, by how far short of the curve it is
+        if (status->underperforming && status->expectedSpeed != 0 && status->commanded != Unknown) {
+            control->achieved = static_cast<uint32_t>(min(static_cast<uint64_t>(status->commanded) * status->speed / status->expectedSpeed, 100));
+        }
+
+        //
+        // Pushed harder only while the fan does less than the policies asked.
+        // One behind its boosted command but managing the level holds the
+        // boost, judging it against its own command would chase a fan that is
+        // still spinning up all the way to 100.
+        //
+        bool behind = status->underperforming && control->achieved < level;
+
+        if (behind && status->commanded != Unknown && status->commanded >= 100) {
+            starved = true;
+        } else if (behind) {
+            control->boost = min(control->boost + DPTFFanBoostStep, 100);
+        } else if (!status->underperforming || level == 0) {
+            control->boost = control->boost > DPTFFanBoostDecay ? control->boost - DPTFFanBoostDecay : 0;
+        }
+    }
+
+    // An idle fan stays idle, boosting only helps one that is meant to spin
+    control->command = level != 0 ? min(level + control->boost, 100) : 0;
+    control->starved = starved;
+    return starved;
+}
@@ -0,0 +1,89 @@
+//
+//  FanFeedback.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef FanFeedback_hpp
+#define FanFeedback_hpp
+
+#include <stdint.h>
+
+// Speed below this percentage of what _FPS lists counts as underperforming
+constexpr uint32_t DPTFFanUnderperformPercent = 80;
+
+// Level added per evaluation while a fan manages less than asked, and taken back once it keeps up
+constexpr uint32_t DPTFFanBoostStep = 10;
+constexpr uint32_t DPTFFanBoostDecay = 5;
+
+//
+// Closes the loop around a fan from its _FST feedback. The fan's driver
+// holds what _FST reads against what it last set and what _FPS says that
+// level should spin at. The core pushes a fan that manages less than the
+// arbitrated level harder, holds the push while the fan makes the level,
+// and takes it back once the fan keeps up with what it is told. A fan
+// already at 100 can't do more, so the rest has to come from passive
+// cooling.
+//
+// No IOKit here, so a degraded fan can be simulated on a host.
+//
+namespace FanFeedback {
+    constexpr uint32_t Unknown = 0xFFFFFFFF;
+
+    // One _FPS entry
+    struct SpeedPoint {
+        uint32_t control;
+        uint32_t speed;
+    };
+
+    // Driver side, what the latest _FST said
+    struct Sensor {
+        uint32_t lastState;         // Last level set, Unknown after wake or an EC override
+        uint32_t speed;             // RPM
+        uint32_t expected;          // RPM _FPS lists for lastState, 0 if unknown
+        bool underperforming;
+        bool notified;              // Firmware said the fan is slow, holds until the next periodic sample
+        uint32_t externalChanges;   // Times the fan was found at a level we didn't set
+    };
+
+    // What a fan was told versus what it is doing, sent to the core as DPTFFanStatus
+    struct Status {
+        uint32_t commanded;         // Last level set, Unknown if unknown
+        uint32_t speed;             // RPM from _FST
+        uint32_t expectedSpeed;     // RPM _FPS lists for commanded, 0 if unknown
+        bool underperforming;
+    };
+
+    // Core side, one per fan in the policy table
+    struct Control {
+        uint32_t boost;
+        uint32_t command;           // This evaluation's level, DPTFNoRequest if nobody asked
+        uint32_t achieved;          // Level the fan is actually managing, from _FST
+        bool starved;               // As apply last returned
+    };
+
+    // RPM for a level, interpolated between points sorted by control, 0 if unknown
+    uint32_t expectedSpeed(const SpeedPoint *points, uint32_t count, uint32_t level);
+
+    //
+    // Folds one _FST read into the sensor. A forced read is one firmware's
+    // notification asked for and leaves the notification standing. False
+    // if the fan was at a level we didn't set, lastState is forgotten then
+    // so the next level goes out whatever the step size.
+    //
+    bool sample(Sensor *sensor, const SpeedPoint *points, uint32_t count, uint32_t control, uint32_t speed, bool forced);
+
+    // What the core is told, expected for the level last set even if not sampled since
+    Status status(const Sensor &sensor, const SpeedPoint *points, uint32_t count);
+
+    //
+    // One evaluation for one fan. level is what the policies settled on,
+    // status what the fan reported, nullptr if it didn't answer. Sets the
+    // command and what the fan achieved, true if the fan is starved: short
+    // of its curve with nothing left to give.
+    //
+    bool apply(Control *control, uint32_t level, const Status *status);
+}
+
+#endif /* FanFeedback_hpp */
@@ -0,0 +1,18 @@
+//
+//  IdleBackoff.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "IdleBackoff.hpp"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+uint32_t IdleBackoff::next(uint32_t current, bool forced, bool cold, bool armed) {
+    if (forced || !cold) {
+        return 1;
+    }
+
+    return min(current * 2, armed ? DPTFIdleBackoffMax : DPTFIdleBackoffBlindMax);
+}
@@ -0,0 +1,40 @@
+//
+//  IdleBackoff.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef IdleBackoff_hpp
+#define IdleBackoff_hpp
+
+#include <stdint.h>
+
+// While nothing is tripped and every fan is off, periods double up to this factor
+constexpr uint32_t DPTFIdleBackoffMax = 8;
+
+// The most a sensor that can't wake the core may be stretched to
+constexpr uint32_t DPTFIdleBackoffBlindMax = 2;
+
+// Aux trips go this far either side of the temperature while backed off, tenths of a degree
+constexpr uint32_t DPTFAuxTripBand = 50;
+
+//
+// How far the evaluation period stretches while the machine sits cold.
+// A stretched period is only safe if something wakes the core early, so
+// the full backoff needs aux trips armed on every sensor. Without them a
+// trip crossed just after an evaluation would go unseen for the whole
+// stretched period.
+//
+// No IOKit here, so wakeups per hour can be simulated on a host.
+//
+namespace IdleBackoff {
+    //
+    // Multiplier for the next period from the current one. Forced
+    // evaluations and anything tripped start over at 1, cold doubles up to
+    // the cap armed allows.
+    //
+    uint32_t next(uint32_t current, bool forced, bool cold, bool armed);
+}
+
+#endif /* IdleBackoff_hpp */
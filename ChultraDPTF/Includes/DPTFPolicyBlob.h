@@ -0,0 +1,165 @@
+//
+//  DPTFPolicyBlob.h
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/4/23.
+//
+//  Binary active policy format accepted by the ChultraThermal user client.
+//  Shared between the kext and user space, so this must not pull in IOKit.
+//
+
+#ifndef DPTFPolicyBlob_h
+#define DPTFPolicyBlob_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define DPTF_POLICY_BLOB_MAGIC          0x46545044 // "DPTF"
+#define DPTF_POLICY_BLOB_VERSION        1
+#define DPTF_POLICY_BLOB_MAX_ENTRIES    32
+#define DPTF_POLICY_BLOB_PATH_LEN       32
+#define DPTF_POLICY_BLOB_MAX_TEMPS      10
+
+// Use the sensor's GTSH instead of overriding hysteresis
+#define DPTF_POLICY_HYSTERESIS_DEFAULT  0xFFFFFFFF
+
+#define DPTF_POLICY_MAX_SPEED           100
+#define DPTF_POLICY_MAX_WEIGHT          100
+#define DPTF_POLICY_MAX_HYSTERESIS      100   // Tenths of a degree
+#define DPTF_POLICY_MIN_PERIOD          5     // Tenths of a second, 0 means default
+#define DPTF_POLICY_MAX_PERIOD          600
+
+// User client selectors
+enum {
+    kDPTFUserClientSetPolicy = 0,   // Struct in: blob
+    kDPTFUserClientGetPolicy,       // Struct out: blob of the table currently evaluated
+    kDPTFUserClientRevertPolicy,    // Drop the override, go back to firmware/board policy
+    kDPTFUserClientReadTelemetry,   // Struct out: complete frames from DPTFTelemetry.h, drained as read
+    kDPTFUserClientMethodCount
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          // Header and all entries
+    uint32_t entryCount;
+    uint32_t checksum;      // CRC32 of the entries
+} DPTFPolicyBlobHeader;
+
+typedef struct {
+    char fan[DPTF_POLICY_BLOB_PATH_LEN];
+    char source[DPTF_POLICY_BLOB_PATH_LEN];
+    uint32_t weight;
+    uint32_t samplingPeriod;    // Tenths of a second, as in _TRT
+    uint32_t hysteresis;        // Tenths of a degree, or DPTF_POLICY_HYSTERESIS_DEFAULT
+    uint32_t maxFanSpeeds[DPTF_POLICY_BLOB_MAX_TEMPS];
+} DPTFPolicyBlobEntry;
+
+#define DPTF_POLICY_BLOB_MAX_SIZE (sizeof(DPTFPolicyBlobHeader) + DPTF_POLICY_BLOB_MAX_ENTRIES * sizeof(DPTFPolicyBlobEntry))
+
+// Must fit in an inline IOUserClient structure argument
+static_assert(DPTF_POLICY_BLOB_MAX_SIZE <= 4096, "Policy blob too large for inline struct");
+
+enum DPTFPolicyBlobError {
+    DPTFPolicyBlobOK = 0,
+    DPTFPolicyBlobTooSmall,
+    DPTFPolicyBlobBadMagic,
+    DPTFPolicyBlobBadVersion,
+    DPTFPolicyBlobBadSize,
+    DPTFPolicyBlobBadChecksum,
+    DPTFPolicyBlobBadPath,
+    DPTFPolicyBlobBadWeight,
+    DPTFPolicyBlobBadPeriod,
+    DPTFPolicyBlobBadHysteresis,
+    DPTFPolicyBlobBadSpeed,
+    DPTFPolicyBlobDuplicate,
+};
+
+static inline uint32_t DPTFPolicyBlobCrc32(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+static inline bool DPTFPolicyBlobPathValid(const char *path) {
+    size_t len = strnlen(path, DPTF_POLICY_BLOB_PATH_LEN);
+    return len > 1 && len < DPTF_POLICY_BLOB_PATH_LEN && path[0] == '/';
+}
+
+static inline uint32_t DPTFPolicyBlobSize(uint32_t entryCount) {
+    return (uint32_t) (sizeof(DPTFPolicyBlobHeader) + entryCount * sizeof(DPTFPolicyBlobEntry));
+}
+
+static inline const DPTFPolicyBlobEntry *DPTFPolicyBlobEntries(const void *blob) {
+    return (const DPTFPolicyBlobEntry *) ((const uint8_t *) blob + sizeof(DPTFPolicyBlobHeader));
+}
+
+// Fill in size and checksum once the entries are written
+static inline void DPTFPolicyBlobFinalize(void *blob, uint32_t entryCount) {
+    DPTFPolicyBlobHeader *header = (DPTFPolicyBlobHeader *) blob;
+    header->magic = DPTF_POLICY_BLOB_MAGIC;
+    header->version = DPTF_POLICY_BLOB_VERSION;
+    header->size = DPTFPolicyBlobSize(entryCount);
+    header->entryCount = entryCount;
+    header->checksum = DPTFPolicyBlobCrc32(DPTFPolicyBlobEntries(blob), entryCount * sizeof(DPTFPolicyBlobEntry));
+}
+
+//
+// Everything the kext relies on is checked here, so a blob that passes
+// can be compiled into a policy table without further checks.
+// On failure, *badEntry (if given) is the offending entry index.
+//
+static inline DPTFPolicyBlobError DPTFPolicyBlobValidate(const void *blob, size_t len, uint32_t *badEntry) {
+    const DPTFPolicyBlobHeader *header = (const DPTFPolicyBlobHeader *) blob;
+
+    if (badEntry != NULL) *badEntry = 0;
+    if (blob == NULL || len < sizeof(DPTFPolicyBlobHeader)) return DPTFPolicyBlobTooSmall;
+    if (header->magic != DPTF_POLICY_BLOB_MAGIC) return DPTFPolicyBlobBadMagic;
+    if (header->version != DPTF_POLICY_BLOB_VERSION) return DPTFPolicyBlobBadVersion;
+    if (header->entryCount == 0 || header->entryCount > DPTF_POLICY_BLOB_MAX_ENTRIES) return DPTFPolicyBlobBadSize;
+    if (header->size != len || header->size != DPTFPolicyBlobSize(header->entryCount)) return DPTFPolicyBlobBadSize;
+
+    const DPTFPolicyBlobEntry *entries = DPTFPolicyBlobEntries(blob);
+    if (header->checksum != DPTFPolicyBlobCrc32(entries, header->entryCount * sizeof(DPTFPolicyBlobEntry))) {
+        return DPTFPolicyBlobBadChecksum;
+    }
+
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        const DPTFPolicyBlobEntry *entry = &entries[i];
+        if (badEntry != NULL) *badEntry = i;
+
+        if (!DPTFPolicyBlobPathValid(entry->fan) || !DPTFPolicyBlobPathValid(entry->source)) return DPTFPolicyBlobBadPath;
+        if (entry->weight > DPTF_POLICY_MAX_WEIGHT) return DPTFPolicyBlobBadWeight;
+        if (entry->samplingPeriod != 0 &&
+            (entry->samplingPeriod < DPTF_POLICY_MIN_PERIOD || entry->samplingPeriod > DPTF_POLICY_MAX_PERIOD)) {
+            return DPTFPolicyBlobBadPeriod;
+        }
+        if (entry->hysteresis != DPTF_POLICY_HYSTERESIS_DEFAULT && entry->hysteresis > DPTF_POLICY_MAX_HYSTERESIS) {
+            return DPTFPolicyBlobBadHysteresis;
+        }
+
+        for (uint32_t t = 0; t < DPTF_POLICY_BLOB_MAX_TEMPS; t++) {
+            if (entry->maxFanSpeeds[t] > DPTF_POLICY_MAX_SPEED) return DPTFPolicyBlobBadSpeed;
+        }
+
+        // One row per fan/source pair, and a source can only have one hysteresis
+        for (uint32_t j = 0; j < i; j++) {
+            bool sameSource = strncmp(entries[j].source, entry->source, DPTF_POLICY_BLOB_PATH_LEN) == 0;
+            if (sameSource && strncmp(entries[j].fan, entry->fan, DPTF_POLICY_BLOB_PATH_LEN) == 0) return DPTFPolicyBlobDuplicate;
+            if (sameSource && entries[j].hysteresis != entry->hysteresis) return DPTFPolicyBlobBadHysteresis;
+        }
+    }
+
+    return DPTFPolicyBlobOK;
+}
+
+#endif /* DPTFPolicyBlob_h */
@@ -0,0 +1,231 @@
+//
+//  DPTFTelemetry.h
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/13/23.
+//
+//  Binary evaluation log produced by ChultraThermal and read through the
+//  user client. Shared between the kext and user space, so this must not
+//  pull in IOKit.
+//
+//  A log file is a DPTFTelemetryFileHeader followed by frames:
+//
+//      varint length, uint8 type, payload[length - 1]
+//
+//  Channels   varint count, then per channel: uint8 field, varint length, path
+//  Keyframe   varint timestamp (ms), then per channel: zigzag value
+//  Delta      varint ms since previous record, then per channel: zigzag delta
+//
+//  A channel table applies to every record after it, and is always followed
+//  by a keyframe. Keyframes come at least every DPTF_TELEMETRY_KEYFRAME_INTERVAL
+//  records, so a reader can start decoding at any of them. Frame lengths
+//  let readers skip frames they don't understand.
+//
+
+#ifndef DPTFTelemetry_h
+#define DPTFTelemetry_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define DPTF_TELEMETRY_MAGIC                0x4C545044 // "DPTL"
+#define DPTF_TELEMETRY_VERSION              1
+#define DPTF_TELEMETRY_MAX_CHANNELS         64
+#define DPTF_TELEMETRY_PATH_LEN             32
+#define DPTF_TELEMETRY_KEYFRAME_INTERVAL    64
+
+// Largest frame the kext writes, a full channel table
+#define DPTF_TELEMETRY_MAX_FRAME            (16 + DPTF_TELEMETRY_MAX_CHANNELS * (2 + DPTF_TELEMETRY_PATH_LEN))
+
+// Largest chunk returned by one kDPTFUserClientReadTelemetry call
+#define DPTF_TELEMETRY_MAX_READ             4096
+
+static_assert(DPTF_TELEMETRY_MAX_FRAME <= DPTF_TELEMETRY_MAX_READ, "Every frame must fit in a single read");
+
+enum DPTFTelemetryFrameType {
+    DPTFTelemetryFrameChannels = 1,
+    DPTFTelemetryFrameKeyframe,
+    DPTFTelemetryFrameDelta,
+};
+
+// What a channel's values mean
+enum DPTFTelemetryField {
+    DPTFTelemetryFieldLevel = 0,        // Tripped active cooling level
+    DPTFTelemetryFieldTemperature,      // Tenths of a degree C
+    DPTFTelemetryFieldFanCommand,       // Level sent with _FSL
+    DPTFTelemetryFieldFanSpeed,         // RPM from _FST
+    DPTFTelemetryFieldPower,            // mW
+    DPTFTelemetryFieldPowerLimit,       // PL1 in mW, 0 for firmware's
+    DPTFTelemetryFieldThrottle,         // Passive throttle level
+    DPTFTelemetryFieldMax
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} DPTFTelemetryFileHeader;
+
+typedef struct {
+    uint8_t field;
+    char path[DPTF_TELEMETRY_PATH_LEN];
+} DPTFTelemetryChannel;
+
+static inline uint64_t DPTFTelemetryZigZag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t DPTFTelemetryUnZigZag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Appends value at *pos, false without moving *pos if it doesn't fit
+static inline bool DPTFTelemetryPutVarint(uint8_t *buf, size_t cap, size_t *pos, uint64_t value) {
+    uint8_t bytes[10];
+    size_t count = 0;
+
+    do {
+        bytes[count] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) bytes[count] |= 0x80;
+        count++;
+    } while (value != 0);
+
+    if (cap - *pos < count) return false;
+
+    memcpy(buf + *pos, bytes, count);
+    *pos += count;
+    return true;
+}
+
+// Reads a value at *pos, false if the buffer ends first or it's longer than 64 bits
+static inline bool DPTFTelemetryGetVarint(const uint8_t *buf, size_t len, size_t *pos, uint64_t *value) {
+    uint64_t result = 0;
+
+    for (unsigned shift = 0; shift < 64 && *pos < len; shift += 7) {
+        uint8_t byte = buf[(*pos)++];
+        result |= (uint64_t) (byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//
+// Streaming decoder. Feed it whatever is buffered; it decodes one frame
+// at a time from the front and says how much it used, so callers can read
+// files of any size through a fixed buffer.
+//
+
+enum DPTFTelemetryResult {
+    DPTFTelemetryRecord = 0,        // values and timestamp hold a new record
+    DPTFTelemetryChannels,          // channels were replaced
+    DPTFTelemetrySkipped,           // Frame of a type this reader doesn't know
+    DPTFTelemetryNeedMore,          // Incomplete frame, nothing consumed
+    DPTFTelemetryBadFrame,
+    DPTFTelemetryNoChannels,        // Record before any channel table
+    DPTFTelemetryNoKeyframe,        // Delta before any keyframe
+};
+
+typedef struct {
+    uint32_t channelCount;
+    DPTFTelemetryChannel channels[DPTF_TELEMETRY_MAX_CHANNELS];
+    int64_t values[DPTF_TELEMETRY_MAX_CHANNELS];
+    uint64_t timestamp;
+    bool haveChannels;
+    bool haveKeyframe;
+    bool keyframe;                  // Last record was a keyframe
+} DPTFTelemetryDecoder;
+
+static inline void DPTFTelemetryDecoderInit(DPTFTelemetryDecoder *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+static inline bool DPTFTelemetryCheckHeader(const void *buf, size_t len) {
+    const DPTFTelemetryFileHeader *header = (const DPTFTelemetryFileHeader *) buf;
+    return len >= sizeof(*header) && header->magic == DPTF_TELEMETRY_MAGIC && header->version == DPTF_TELEMETRY_VERSION;
+}
+
+// Frame boundaries only, for seeking without decoding. *type is 0 if the frame is empty.
+static inline DPTFTelemetryResult DPTFTelemetryPeekFrame(const uint8_t *buf, size_t len, size_t *frameLen, uint8_t *type) {
+    size_t pos = 0;
+    uint64_t length;
+
+    if (!DPTFTelemetryGetVarint(buf, len, &pos, &length)) {
+        return len >= 10 ? DPTFTelemetryBadFrame : DPTFTelemetryNeedMore;
+    }
+
+    if (length > DPTF_TELEMETRY_MAX_FRAME) return DPTFTelemetryBadFrame;
+    if (len - pos < length) return DPTFTelemetryNeedMore;
+
+    *frameLen = pos + (size_t) length;
+    *type = length != 0 ? buf[pos] : 0;
+    return DPTFTelemetryRecord;
+}
+
+static inline DPTFTelemetryResult DPTFTelemetryDecodeFrame(DPTFTelemetryDecoder *decoder, const uint8_t *buf, size_t len, size_t *consumed) {
+    size_t frameLen;
+    uint8_t type;
+
+    DPTFTelemetryResult peek = DPTFTelemetryPeekFrame(buf, len, &frameLen, &type);
+    if (peek != DPTFTelemetryRecord) return peek;
+
+    // Payload starts after the length and type
+    size_t pos = 0;
+    uint64_t value;
+    (void) DPTFTelemetryGetVarint(buf, len, &pos, &value);
+    if (value == 0) return DPTFTelemetryBadFrame;
+    pos++;
+
+    *consumed = frameLen;
+
+    if (type == DPTFTelemetryFrameChannels) {
+        uint64_t count;
+        if (!DPTFTelemetryGetVarint(buf, frameLen, &pos, &count) || count > DPTF_TELEMETRY_MAX_CHANNELS) return DPTFTelemetryBadFrame;
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t pathLen;
+            if (pos >= frameLen) return DPTFTelemetryBadFrame;
+            decoder->channels[i].field = buf[pos++];
+
+            if (!DPTFTelemetryGetVarint(buf, frameLen, &pos, &pathLen) || pathLen >= DPTF_TELEMETRY_PATH_LEN || frameLen - pos < pathLen) {
+                return DPTFTelemetryBadFrame;
+            }
+
+            memcpy(decoder->channels[i].path, buf + pos, (size_t) pathLen);
+            decoder->channels[i].path[pathLen] = '\0';
+            pos += (size_t) pathLen;
+        }
+
+        decoder->channelCount = (uint32_t) count;
+        decoder->haveChannels = true;
+        decoder->haveKeyframe = false;
+        return DPTFTelemetryChannels;
+    }
+
+    if (type != DPTFTelemetryFrameKeyframe && type != DPTFTelemetryFrameDelta) {
+        return DPTFTelemetrySkipped;
+    }
+
+    if (!decoder->haveChannels) return DPTFTelemetryNoChannels;
+    if (type == DPTFTelemetryFrameDelta && !decoder->haveKeyframe) return DPTFTelemetryNoKeyframe;
+
+    bool key = type == DPTFTelemetryFrameKeyframe;
+    if (!DPTFTelemetryGetVarint(buf, frameLen, &pos, &value)) return DPTFTelemetryBadFrame;
+    decoder->timestamp = key ? value : decoder->timestamp + value;
+
+    for (uint32_t i = 0; i < decoder->channelCount; i++) {
+        if (!DPTFTelemetryGetVarint(buf, frameLen, &pos, &value)) return DPTFTelemetryBadFrame;
+        decoder->values[i] = key ? DPTFTelemetryUnZigZag(value) : decoder->values[i] + DPTFTelemetryUnZigZag(value);
+    }
+
+    decoder->haveKeyframe = true;
+    decoder->keyframe = key;
+    return DPTFTelemetryRecord;
+}
+
+#endif /* DPTFTelemetry_h */
@@ -0,0 +1,80 @@
+//
+//  PassivePolicy.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "PassivePolicy.hpp"
+#include "PowerArbiter.hpp"
+#include "Logger.h"
+
+#define super DPTFPolicyModule
+OSDefineMetaClassAndStructors(DPTFPassivePolicyModule, DPTFPolicyModule);
+
+bool DPTFPassivePolicyModule::init() {
+    if (!super::init()) {
+        return false;
+    }
+
+    arbiters = OSDictionary::withCapacity(1);
+    return arbiters != nullptr;
+}
+
+IOReturn DPTFPassivePolicyModule::tableChanged(DPTFPolicyTable *table) {
+    if (modelSlots < table->passiveCount) {
+        PowerPlan::Model **grown = static_cast<PowerPlan::Model **>(IOMalloc(sizeof(PowerPlan::Model *) * table->passiveCount));
+        if (grown == nullptr) return kIOReturnNoMemory;
+
+        if (models != nullptr) IOFree(models, sizeof(PowerPlan::Model *) * modelSlots);
+        models = grown;
+        modelSlots = table->passiveCount;
+    }
+
+    // Chargers get one too, they just never plan
+    for (uint32_t p = 0; p < table->passiveCount; p++) {
+        const OSSymbol *path = table->passives[p].path;
+        DPTFPowerArbiter *arbiter = OSDynamicCast(DPTFPowerArbiter, arbiters->getObject(path));
+
+        if (arbiter == nullptr) {
+            arbiter = new DPTFPowerArbiter;
+            if (arbiter == nullptr || !arbiter->init()) {
+                OSSafeReleaseNULL(arbiter);
+                return kIOReturnNoMemory;
+            }
+
+            arbiters->setObject(path, arbiter);
+            arbiter->release();
+        }
+
+        models[p] = &arbiter->model;
+    }
+
+    return super::tableChanged(table);
+}
+
+uint32_t DPTFPassivePolicyModule::samplingPeriodMS(DPTFPolicyTable *table) {
+    // Reads the same sensors as the fans, no point running more often
+    return table->pollingPeriodMS;
+}
+
+void DPTFPassivePolicyModule::evaluate(DPTFPolicyContext *context) {
+    DPTFPolicyTable *table = context->table;
+
+    state.models = models;
+    Policies::evaluatePassive(table->view, context->io(this), &state);
+
+    for (uint32_t p = 0; p < table->passiveCount; p++) {
+        if (request(Policies::RequestPowerLimit, p) == DPTFNoRequest) continue;
+        IOLogDebug("Processor %s: %d mW demand, R0 %d mC/W, PL1 %d mW", table->passives[p].path->getCStringNoCopy(), models[p]->demand,
+                   models[p]->resistance, request(Policies::RequestPowerLimit, p));
+    }
+
+    IOLogDebug("Chargers %d for starved fans, %d ahead of PL1", state.escalation, state.chargerShed);
+}
+
+void DPTFPassivePolicyModule::free() {
+    if (models != nullptr) IOFree(models, sizeof(PowerPlan::Model *) * modelSlots);
+    OSSafeReleaseNULL(arbiters);
+    super::free();
+}
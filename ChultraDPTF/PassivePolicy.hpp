@@ -0,0 +1,38 @@
+//
+//  PassivePolicy.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef PassivePolicy_hpp
+#define PassivePolicy_hpp
+
+#include "PolicyModule.hpp"
+
+//
+// Processors against their fans and chargers, see Policies::evaluatePassive.
+// Requests PL1, a floor and ceiling for each processor's fans and a throttle
+// level for each charger.
+//
+class DPTFPassivePolicyModule : public DPTFPolicyModule {
+    OSDeclareDefaultStructors(DPTFPassivePolicyModule);
+public:
+    bool init() override;
+    IOReturn tableChanged(DPTFPolicyTable *table) override;
+    uint32_t samplingPeriodMS(DPTFPolicyTable *table) override;
+    void evaluate(DPTFPolicyContext *context) override;
+
+    void free() override;
+private:
+    // Passive device path -> DPTFPowerArbiter, so a processor that survives a table change keeps its model
+    OSDictionary *arbiters {nullptr};
+
+    // The current table's passive devices' models, workloop only
+    PowerPlan::Model **models {nullptr};
+    uint32_t modelSlots {0};
+
+    Policies::PassiveState state {};
+};
+
+#endif /* PassivePolicy_hpp */
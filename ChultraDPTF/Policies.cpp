@@ -0,0 +1,170 @@
+//
+//  Policies.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "Policies.hpp"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+using ChultraACPIUtils::AcpiActiveTripCount;
+
+constexpr uint32_t NoRule = 0xFFFFFFFF;
+
+void Policies::evaluateActive(const Table &table, const Io &io, const ActiveScratch &scratch) {
+    for (uint32_t i = 0; i < table.fanCount; i++) {
+        const Fan *fan = &table.fans[i];
+        uint32_t fastest = 0;
+
+        // Every source's tripped level picks a speed off its curve
+        for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+            const Rule *rule = &table.rules[r];
+            Sample sample;
+            scratch.rules[r] = { rule->sample, rule->weight, 0 };
+
+            if (!io.readSample(io.context, r, &sample)) continue;
+
+            if (sample.level < AcpiActiveTripCount) {
+                scratch.rules[r].speed = rule->speeds[sample.level];
+            }
+
+            fastest = max(fastest, scratch.rules[r].speed);
+        }
+
+        for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+            io.request(io.context, RequestRuleLevel, r, scratch.rules[r].speed);
+        }
+
+        scratch.fans[i] = { fan->stepSize, fan->maxPower, fan->minLevel, fan->maxLevel, fan->firstRule, fan->ruleCount, fastest, fastest };
+    }
+
+    // Fans of a zone are next to each other in the table
+    for (uint32_t first = 0, next; first < table.fanCount; first = next) {
+        for (next = first + 1; next < table.fanCount && table.fans[next].zone == table.fans[first].zone; next++);
+
+        if (next - first == 1) continue;
+
+        FanAllocator::allocate(&scratch.fans[first], next - first, scratch.rules, scratch.sources);
+    }
+
+    for (uint32_t i = 0; i < table.fanCount; i++) {
+        io.request(io.context, RequestFanLevel, i, scratch.fans[i].allocated);
+    }
+}
+
+void Policies::evaluatePassive(const Table &table, const Io &io, PassiveState *state) {
+    uint32_t deepest = 0;
+    bool cutting = false, limited = false, starved = false;
+
+    // A plan only holds for the evaluation that made it
+    for (uint32_t i = 0; i < table.fanCount; i++) {
+        io.request(io.context, RequestFanFloor, i, NoRequest);
+        io.request(io.context, RequestFanCeiling, i, NoRequest);
+    }
+
+    for (uint32_t p = 0; p < table.passiveCount; p++) {
+        uint32_t levels = io.throttleLevels(io.context, p);
+        if (levels != 0) deepest = max(deepest, levels - 1);
+    }
+
+    //
+    // Processors are the passive devices that answer readProcessor. Their
+    // fans are the ones with a rule reading the processor. What the active
+    // policy asks of those fans is only a starting point, the plan decides
+    // how much of the cooling comes from them and how much from PL1.
+    //
+    for (uint32_t p = 0; p < table.passiveCount; p++) {
+        uint32_t achieved = 0;
+        uint32_t reading = NoRule;
+        bool cooled = false;
+
+        for (uint32_t i = 0; i < table.fanCount; i++) {
+            const Fan *fan = &table.fans[i];
+            for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+                if (table.rules[r].passive != p) continue;
+                reading = r;
+
+                FanState fanState;
+                io.readFan(io.context, i, &fanState);
+                if (fanState.command == NoRequest) continue;
+                achieved = max(achieved, fanState.achieved);
+                cooled = true;
+                break;
+            }
+        }
+
+        Sample sample;
+        Processor cpu;
+        bool sampled = reading != NoRule && io.readSample(io.context, reading, &sample);
+
+        if (!io.readProcessor(io.context, p, sampled ? &sample : nullptr, &cpu)) continue;
+
+        // Nothing to trade against, leave the processor to firmware
+        PowerPlan::Model *model = state->models != nullptr ? state->models[p] : nullptr;
+        if (!cooled || model == nullptr) {
+            io.request(io.context, RequestPowerLimit, p, 0);
+            continue;
+        }
+
+        PowerPlan::Plan plan;
+        PowerPlan::plan(model, cpu.status, achieved, io.acousticCeiling, cpu.timeConstantMS, cpu.timestampMS, &plan);
+
+        // No model yet, a prior or a fit, so the plan means nothing
+        if (model->resistance == 0) continue;
+
+        for (uint32_t i = 0; i < table.fanCount; i++) {
+            const Fan *fan = &table.fans[i];
+            for (uint32_t r = fan->firstRule; r < fan->firstRule + fan->ruleCount; r++) {
+                if (table.rules[r].passive != p) continue;
+                io.request(io.context, RequestFanFloor, i, plan.fanFloor);
+                io.request(io.context, RequestFanCeiling, i, plan.fanCeiling);
+                break;
+            }
+        }
+
+        //
+        // Charge current is cheaper to give up than compute, so PL1 stays at
+        // firmware's until the chargers are as slow as they go.
+        //
+        const PowerPlan::Processor &status = cpu.status;
+        bool cut = plan.powerLimit != 0 && plan.powerLimit < status.maxLimit;
+        bool held = status.appliedLimit != 0 && status.appliedLimit < status.maxLimit;
+        cutting = cutting || cut;
+
+        if (cut && !PowerPlan::mayCut(state->chargerShed, deepest, held)) {
+            plan.powerLimit = 0;
+        }
+
+        limited = limited || (plan.powerLimit != 0 && plan.powerLimit < status.maxLimit);
+        io.request(io.context, RequestPowerLimit, p, plan.powerLimit);
+    }
+
+    state->chargerShed = PowerPlan::chargerLevel(state->chargerShed, deepest, cutting, limited);
+
+    for (uint32_t i = 0; i < table.fanCount; i++) {
+        FanState fan;
+        io.readFan(io.context, i, &fan);
+        starved = starved || (fan.command != NoRequest && fan.starved);
+    }
+
+    // One step per evaluation either way, so a single bad reading can't slam the chargers
+    if (starved) {
+        state->escalation++;
+    } else if (state->escalation > 0) {
+        state->escalation--;
+    }
+
+    // Nothing left to throttle with, don't keep counting up
+    state->escalation = min(state->escalation, deepest);
+
+    // Whichever wants the chargers slower, the fans or the processors
+    uint32_t throttle = max(state->escalation, state->chargerShed);
+    for (uint32_t p = 0; p < table.passiveCount; p++) {
+        uint32_t levels = io.throttleLevels(io.context, p);
+        if (levels == 0) continue;
+        io.request(io.context, RequestThrottle, p, min(throttle, levels - 1));
+    }
+}
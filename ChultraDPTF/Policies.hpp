@@ -0,0 +1,141 @@
+//
+//  Policies.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef Policies_hpp
+#define Policies_hpp
+
+#include <stdint.h>
+
+#include "AcpiTrips.hpp"
+#include "FanAllocator.hpp"
+#include "PowerPlan.hpp"
+
+//
+// What each policy decides, apart from where its readings come from and
+// where its requests go. Both go through callbacks, the core's participants
+// in the kext and mocks on a host, the same way AcpiTrips reads methods.
+// A policy never actuates anything itself. It leaves its latest requests,
+// and the core arbitrates between every loaded policy's.
+//
+// No IOKit here, so a policy can be run against mocked samples on a host.
+//
+namespace Policies {
+    constexpr uint32_t NoRequest = 0xFFFFFFFF;
+
+    // Rule reading something that isn't a passive device
+    constexpr uint32_t NoPassive = 0xFFFFFFFF;
+
+    // DPTFPolicyTable without the services behind it
+    struct Rule {
+        uint32_t sample;            // Shared by every rule reading the same sensor
+        uint32_t weight;            // _ART weight
+        const uint32_t *speeds;     // Fan level per tripped _ACx, AcpiActiveTripCount of them
+        uint32_t passive;           // Passive device the rule's sensor is, NoPassive if none
+    };
+
+    struct Fan {
+        uint32_t zone;              // Fans of a zone are next to each other
+        uint32_t firstRule;
+        uint32_t ruleCount;
+        uint32_t stepSize;
+        uint32_t maxPower;
+        uint32_t minLevel;
+        uint32_t maxLevel;
+    };
+
+    struct Table {
+        const Fan *fans;
+        uint32_t fanCount;
+        const Rule *rules;
+        uint32_t ruleCount;
+        uint32_t passiveCount;
+        uint32_t sampleCount;
+        uint32_t pollingPeriodMS;
+    };
+
+    enum Request {
+        RequestFanLevel = 0,        // Per fan, the level wanted
+        RequestRuleLevel,           // Per rule, what its source asks of its fan on its own
+        RequestFanFloor,            // Per fan, bounds on a processor's share of it
+        RequestFanCeiling,
+        RequestPowerLimit,          // Per passive device, PL1 in mW, 0 for firmware's
+        RequestThrottle,            // Per passive device, 0 is unthrottled
+        RequestMax
+    };
+
+    // One _TMP evaluation of a rule's sensor
+    struct Sample {
+        uint32_t level;             // Tripped _ACx, AcpiActiveTripCount if none
+        uint32_t temperature;       // Tenths of a degree C
+        uint64_t timestampMS;
+    };
+
+    // A processor this evaluation, temperature from the sample handed in
+    struct Processor {
+        PowerPlan::Processor status;
+        uint32_t timeConstantMS;    // From the package's thermal fit, 0 while there is none
+        uint64_t timestampMS;       // When the temperature was read
+    };
+
+    // What a fan did with the level it was last given
+    struct FanState {
+        uint32_t command;           // NoRequest if nobody asked for one
+        uint32_t achieved;          // Level it is actually managing
+        bool starved;               // At 100 and still short of its curve
+    };
+
+    struct Io {
+        void *context;
+
+        // A rule's sensor, read at most once per evaluation however many policies ask
+        bool (*readSample)(void *context, uint32_t rule, Sample *sample);
+
+        // PPCC range, power and PL1 of a passive device, false if it isn't a processor
+        bool (*readProcessor)(void *context, uint32_t passive, const Sample *sample, Processor *processor);
+
+        // Throttle levels a passive device has, 0 if it can't be throttled
+        uint32_t (*throttleLevels)(void *context, uint32_t passive);
+
+        void (*readFan)(void *context, uint32_t fan, FanState *state);
+
+        // Replaces the policy's previous request for index
+        void (*request)(void *context, Request request, uint32_t index, uint32_t value);
+
+        // Highest level a processor may ask of its fans
+        uint32_t acousticCeiling;
+    };
+
+    //
+    // Fan curves from _ART: every source's tripped _ACx level picks a speed.
+    // A fan alone in its zone runs at the fastest one. Fans sharing a zone
+    // split the cooling their sources need by _ART weight instead. Scratch
+    // is sized for the table.
+    //
+    struct ActiveScratch {
+        FanAllocator::Rule *rules;
+        FanAllocator::Fan *fans;
+        FanAllocator::Source *sources;
+    };
+
+    void evaluateActive(const Table &table, const Io &io, const ActiveScratch &scratch);
+
+    //
+    // Processors trade their fans against PL1 through PowerPlan, chargers
+    // give up charge current before PL1 goes below firmware's limit, and
+    // fans that are starved at 100 escalate onto the chargers one level
+    // per evaluation.
+    //
+    struct PassiveState {
+        PowerPlan::Model **models;  // Per passive device, nullptr where there is none
+        uint32_t escalation;        // Levels the chargers are throttled for starved fans
+        uint32_t chargerShed;       // Levels they gave up ahead of PL1
+    };
+
+    void evaluatePassive(const Table &table, const Io &io, PassiveState *state);
+}
+
+#endif /* Policies_hpp */
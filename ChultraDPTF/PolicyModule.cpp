@@ -0,0 +1,156 @@
+//
+//  PolicyModule.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/10/23.
+//
+
+#include "PolicyModule.hpp"
+#include "ActivePolicy.hpp"
+#include "PassivePolicy.hpp"
+#include "Logger.h"
+
+#define super OSObject
+OSDefineMetaClassAndAbstractStructors(DPTFPolicyModule, OSObject);
+
+DPTFPolicyModule *DPTFPolicyModule::withPolicy(dptf_policies_t policy) {
+    DPTFPolicyModule *module = nullptr;
+
+    switch (policy) {
+        case DPTFActivePolicy: module = new DPTFActivePolicyModule; break;
+        case DPTFPassivePolicy: module = new DPTFPassivePolicyModule; break;
+        default: return nullptr;
+    }
+
+    if (module == nullptr) return nullptr;
+
+    if (!module->init()) {
+        OSSafeReleaseNULL(module);
+        return nullptr;
+    }
+
+    module->policy = policy;
+    return module;
+}
+
+bool DPTFPolicyModule::implemented(dptf_policies_t policy) {
+    switch (policy) {
+        case DPTFActivePolicy: return true;
+        case DPTFPassivePolicy: return true;
+        default: return false;
+    }
+}
+
+static bool resetRequests(uint32_t **requests, uint32_t *slots, uint32_t count) {
+    if (*slots < count) {
+        uint32_t *grown = static_cast<uint32_t *>(IOMalloc(sizeof(uint32_t) * count));
+        if (grown == nullptr) return false;
+
+        if (*requests != nullptr) IOFree(*requests, sizeof(uint32_t) * *slots);
+        *requests = grown;
+        *slots = count;
+    }
+
+    for (uint32_t i = 0; i < *slots; i++) {
+        (*requests)[i] = DPTFNoRequest;
+    }
+
+    return true;
+}
+
+IOReturn DPTFPolicyModule::tableChanged(DPTFPolicyTable *table) {
+    // Indices are per table, so old requests mean nothing now
+    for (int kind = 0; kind < Policies::RequestMax; kind++) {
+        uint32_t count;
+        switch (kind) {
+            case Policies::RequestRuleLevel: count = table->ruleCount; break;
+            case Policies::RequestPowerLimit:
+            case Policies::RequestThrottle: count = table->passiveCount; break;
+            default: count = table->fanCount; break;
+        }
+
+        if (!resetRequests(&requests[kind], &requestSlots[kind], count)) {
+            return kIOReturnNoMemory;
+        }
+    }
+
+    return kIOReturnSuccess;
+}
+
+void DPTFPolicyModule::free() {
+    for (int kind = 0; kind < Policies::RequestMax; kind++) {
+        if (requests[kind] != nullptr) {
+            IOFree(requests[kind], sizeof(uint32_t) * requestSlots[kind]);
+            requests[kind] = nullptr;
+        }
+    }
+
+    super::free();
+}
+
+IOReturn DPTFPolicyContext::readSample(uint32_t rule, const DPTFSensorSample **sample) {
+    if (rule >= table->ruleCount) return kIOReturnBadArgument;
+
+    DPTFSensorSample *cached = &samples[table->rules[rule].sample];
+
+    if (cached->version == 0) {
+        cached->version = DPTF_SENSOR_SAMPLE_VERSION;
+        cached->size = sizeof(*cached);
+
+        IOReturn ret = core->messageClient(kIOMessageDptfSensorSample, table->rules[rule].sensor, (void *) cached);
+        if (ret != kIOReturnSuccess) {
+            // Keep it marked as read, one failure per tick is enough
+            cached->version = DPTF_SENSOR_SAMPLE_VERSION;
+            cached->status = ret;
+        }
+    }
+
+    *sample = cached;
+    return cached->status == kIOReturnSuccess ? kIOReturnSuccess : kIOReturnNotReadable;
+}
+
+Policies::Io DPTFPolicyContext::io(DPTFPolicyModule *requester) {
+    module = requester;
+    return { this, ioSample, ioProcessor, ioThrottleLevels, ioFan, ioRequest, core->acousticCeiling };
+}
+
+bool DPTFPolicyContext::ioSample(void *context, uint32_t rule, Policies::Sample *sample) {
+    DPTFPolicyContext *self = static_cast<DPTFPolicyContext *>(context);
+    const DPTFSensorSample *cached;
+    uint64_t timestamp;
+
+    if (self->readSample(rule, &cached) != kIOReturnSuccess) return false;
+
+    absolutetime_to_nanoseconds(cached->timestamp, &timestamp);
+    *sample = { cached->level, cached->temperature, timestamp / NSEC_PER_MSEC };
+    return true;
+}
+
+bool DPTFPolicyContext::ioProcessor(void *context, uint32_t passive, const Policies::Sample *sample, Policies::Processor *processor) {
+    DPTFPolicyContext *self = static_cast<DPTFPolicyContext *>(context);
+    if (passive >= self->table->passiveCount) return false;
+
+    return self->core->readProcessor(self->table, passive, sample, processor);
+}
+
+uint32_t DPTFPolicyContext::ioThrottleLevels(void *context, uint32_t passive) {
+    DPTFPolicyContext *self = static_cast<DPTFPolicyContext *>(context);
+    uint32_t levels;
+
+    if (passive >= self->table->passiveCount ||
+        self->core->messageClient(kIOMessageDptfPassiveGetLevels, self->table->passives[passive].service, (void *) &levels) != kIOReturnSuccess) {
+        return 0;
+    }
+
+    return levels;
+}
+
+void DPTFPolicyContext::ioFan(void *context, uint32_t fan, Policies::FanState *state) {
+    DPTFPolicyContext *self = static_cast<DPTFPolicyContext *>(context);
+    self->core->readFan(fan, state);
+}
+
+void DPTFPolicyContext::ioRequest(void *context, Policies::Request request, uint32_t index, uint32_t value) {
+    DPTFPolicyContext *self = static_cast<DPTFPolicyContext *>(context);
+    self->module->setRequest(request, index, value);
+}
@@ -0,0 +1,110 @@
+//
+//  PolicyModule.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/10/23.
+//
+
+#ifndef PolicyModule_hpp
+#define PolicyModule_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOLib.h>
+
+#include "PolicyTable.hpp"
+#include "Policies.hpp"
+
+// DPTF Policies
+enum dptf_policies_t {
+    DPTFActivePolicy = 0,
+    DPTFPassivePolicy,
+    DPTFCriticalPolicy,
+    DPTFPolicyMax
+};
+
+constexpr const char *DPTFPolicyGuids[DPTFPolicyMax] = {
+    "3A95C389-E4B8-4629-A526-C52C88626BAE",
+    "42a441d6-ae6a-462b-a84b-4a8ce79027d3",
+    "97C68AE7-15FA-499c-B8C9-5DA81D606E0A"
+};
+
+constexpr const char *DPTFPolicyNames[DPTFPolicyMax] = {
+    "Active",
+    "Passive",
+    "Critical"
+};
+
+constexpr uint32_t DPTFNoRequest = Policies::NoRequest;
+
+class DPTFPolicyModule;
+
+//
+// Everything a policy may touch while evaluating, handed to the policies
+// as a Policies::Io. Sensors are read through here so a sensor shared by
+// several policies is only read once per tick. The rest comes from the core.
+//
+class DPTFPolicyContext {
+public:
+    // Samples with version 0 haven't been read this tick
+    DPTFPolicyContext(ChultraThermal *core, DPTFPolicyTable *table, DPTFSensorSample *samples) :
+        table(table), core(core), samples(samples) {}
+
+    DPTFPolicyTable *table;
+
+    // Latest sample of the rule's sensor, read at most once per tick
+    IOReturn readSample(uint32_t rule, const DPTFSensorSample **sample);
+
+    // Callbacks for module, its requests are kept on it
+    Policies::Io io(DPTFPolicyModule *module);
+private:
+    ChultraThermal *core;
+    DPTFSensorSample *samples;
+    DPTFPolicyModule *module {nullptr};
+
+    static bool ioSample(void *context, uint32_t rule, Policies::Sample *sample);
+    static bool ioProcessor(void *context, uint32_t passive, const Policies::Sample *sample, Policies::Processor *processor);
+    static uint32_t ioThrottleLevels(void *context, uint32_t passive);
+    static void ioFan(void *context, uint32_t fan, Policies::FanState *state);
+    static void ioRequest(void *context, Policies::Request request, uint32_t index, uint32_t value);
+};
+
+//
+// One module per policy GUID the platform lists in IDSP. The policy
+// itself is in Policies, a module holds its state and requests. Modules
+// only live on the core's workloop. They never actuate anything
+// themselves; they keep their latest requests, which the core arbitrates.
+//
+class DPTFPolicyModule : public OSObject {
+    OSDeclareAbstractStructors(DPTFPolicyModule);
+public:
+    static DPTFPolicyModule *withPolicy(dptf_policies_t policy);
+
+    // Whether withPolicy can build this one, zones only claim these from firmware
+    static bool implemented(dptf_policies_t policy);
+
+    // Participants changed, table replaces whatever was seen before
+    virtual IOReturn tableChanged(DPTFPolicyTable *table);
+
+    // How often this policy wants to be evaluated against table
+    virtual uint32_t samplingPeriodMS(DPTFPolicyTable *table) = 0;
+    virtual void evaluate(DPTFPolicyContext *context) = 0;
+
+    // Latest request for a table fan, rule or passive device, DPTFNoRequest if this policy doesn't care
+    uint32_t request(Policies::Request kind, uint32_t index) const {
+        return index < requestSlots[kind] ? requests[kind][index] : DPTFNoRequest;
+    }
+
+    void setRequest(Policies::Request kind, uint32_t index, uint32_t value) {
+        if (index < requestSlots[kind]) requests[kind][index] = value;
+    }
+
+    dptf_policies_t policy;
+    uint64_t nextDueMS {0};
+
+    void free() override;
+private:
+    uint32_t *requests[Policies::RequestMax] {};
+    uint32_t requestSlots[Policies::RequestMax] {};
+};
+
+#endif /* PolicyModule_hpp */
@@ -0,0 +1,241 @@
+//
+//  PolicyTable.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/2/23.
+//
+
+#include "PolicyTable.hpp"
+#include "Logger.h"
+
+#define super OSObject
+OSDefineMetaClassAndStructors(DPTFPolicyTable, OSObject);
+
+DPTFPolicyTable *DPTFPolicyTable::withParticipants(OSDictionary *activePolicies, OSDictionary *fanServices, OSDictionary *sensorServices, OSDictionary *passiveServices) {
+    DPTFPolicyTable *table = new DPTFPolicyTable;
+    if (table == nullptr) return nullptr;
+
+    if (!table->initWithParticipants(activePolicies, fanServices, sensorServices, passiveServices)) {
+        OSSafeReleaseNULL(table);
+    }
+
+    return table;
+}
+
+bool DPTFPolicyTable::initWithParticipants(OSDictionary *activePolicies, OSDictionary *fanServices, OSDictionary *sensorServices, OSDictionary *passiveServices) {
+    if (!super::init()) {
+        return false;
+    }
+
+    retained = OSArray::withCapacity(8);
+    if (retained == nullptr) {
+        return false;
+    }
+
+    //
+    // Two passes over the zone policies:
+    // 1. Count fans and rules whose participants are registered
+    // 2. Allocate flat arrays and fill them in
+    //
+
+    for (int pass = 0; pass < 2; pass++) {
+        bool fill = pass == 1;
+
+        if (fill) {
+            if (fanSlots != 0) {
+                fans = static_cast<Fan *>(IOMallocZero(sizeof(Fan) * fanSlots));
+                if (fans == nullptr) return false;
+            }
+
+            if (ruleSlots != 0) {
+                rules = static_cast<Rule *>(IOMallocZero(sizeof(Rule) * ruleSlots));
+                if (rules == nullptr) return false;
+            }
+        }
+
+        OSCollectionIterator *zoneIter = OSCollectionIterator::withCollection(activePolicies);
+        if (zoneIter == nullptr) return false;
+
+        while (OSObject *zoneObj = zoneIter->getNextObject()) {
+            const OSSymbol *zoneKey = OSDynamicCast(OSSymbol, zoneObj);
+            if (zoneKey == nullptr) continue;
+            OSDictionary *zoneDict = OSDynamicCast(OSDictionary, activePolicies->getObject(zoneKey));
+            if (zoneDict == nullptr) continue;
+
+            OSCollectionIterator *fanIter = OSCollectionIterator::withCollection(zoneDict);
+            if (fanIter == nullptr) continue;
+
+            while (OSObject *fanObj = fanIter->getNextObject()) {
+                const OSSymbol *fanKey = OSDynamicCast(OSSymbol, fanObj);
+                if (fanKey == nullptr) continue;
+                OSDictionary *fanDict = OSDynamicCast(OSDictionary, zoneDict->getObject(fanKey));
+                if (fanDict == nullptr) continue;
+                IOService *fanService = OSDynamicCast(IOService, fanServices->getObject(fanKey));
+                if (fanService == nullptr) continue;
+
+                Fan *fan = nullptr;
+                if (fill) {
+                    if (fanCount == fanSlots) continue;
+
+                    fan = &fans[fanCount++];
+                    fan->zone = zoneKey;
+                    fan->path = fanKey;
+                    fan->service = fanService;
+                    fan->firstRule = ruleCount;
+
+                    // Published by the fan before it registers
+                    OSNumber *stepSize = OSDynamicCast(OSNumber, fanService->getProperty(DPTF_FAN_STEP_SIZE));
+                    OSNumber *maxPower = OSDynamicCast(OSNumber, fanService->getProperty(DPTF_FAN_MAX_POWER));
+                    OSNumber *minLevel = OSDynamicCast(OSNumber, fanService->getProperty(DPTF_FAN_MIN_LEVEL));
+                    OSNumber *maxLevel = OSDynamicCast(OSNumber, fanService->getProperty(DPTF_FAN_MAX_LEVEL));
+                    fan->stepSize = stepSize != nullptr && stepSize->unsigned32BitValue() != 0 ? stepSize->unsigned32BitValue() : 1;
+                    fan->maxPower = maxPower != nullptr ? maxPower->unsigned32BitValue() : 0;
+                    fan->minLevel = minLevel != nullptr && minLevel->unsigned32BitValue() <= 100 ? minLevel->unsigned32BitValue() : 0;
+                    fan->maxLevel = maxLevel != nullptr && maxLevel->unsigned32BitValue() != 0 && maxLevel->unsigned32BitValue() <= 100 ? maxLevel->unsigned32BitValue() : 100;
+                    retained->setObject(zoneKey);
+                    retained->setObject(fanKey);
+                    retained->setObject(fanService);
+                } else {
+                    fanSlots++;
+                }
+
+                OSCollectionIterator *policyIter = OSCollectionIterator::withCollection(fanDict);
+                if (policyIter == nullptr) continue;
+
+                while (OSObject *policyObj = policyIter->getNextObject()) {
+                    const OSSymbol *policyKey = OSDynamicCast(OSSymbol, policyObj);
+                    if (policyKey == nullptr) continue;
+                    DPTFActivePolicyEntry *policy = OSDynamicCast(DPTFActivePolicyEntry, fanDict->getObject(policyKey));
+                    if (policy == nullptr) continue;
+                    IOService *sensorService = OSDynamicCast(IOService, sensorServices->getObject(policy->source));
+                    if (sensorService == nullptr) continue;
+
+                    if (fill) {
+                        if (ruleCount == ruleSlots) continue;
+                        Rule *rule = &rules[ruleCount++];
+                        rule->source = policy->source;
+                        rule->sensor = sensorService;
+                        rule->policy = policy;
+                        fan->ruleCount++;
+                        
+                        // _TRT style tenths of a second
+                        if (policy->samplingPeriod != 0 && policy->samplingPeriod * 100 < pollingPeriodMS) {
+                            pollingPeriodMS = policy->samplingPeriod * 100;
+                        }
+                        retained->setObject(policy);
+                        retained->setObject(sensorService);
+                    } else {
+                        ruleSlots++;
+                    }
+                }
+
+                OSSafeReleaseNULL(policyIter);
+            }
+
+            OSSafeReleaseNULL(fanIter);
+        }
+
+        OSSafeReleaseNULL(zoneIter);
+    }
+
+    for (uint32_t r = 0; r < ruleCount; r++) {
+        rules[r].sample = sampleCount;
+        for (uint32_t prev = 0; prev < r; prev++) {
+            if (rules[prev].sensor == rules[r].sensor) {
+                rules[r].sample = rules[prev].sample;
+                break;
+            }
+        }
+
+        if (rules[r].sample == sampleCount) sampleCount++;
+    }
+
+    return addPassives(passiveServices) && buildView();
+}
+
+bool DPTFPolicyTable::addPassives(OSDictionary *passiveServices) {
+    passiveSlots = passiveServices->getCount();
+    if (passiveSlots == 0) return true;
+
+    passives = static_cast<Passive *>(IOMallocZero(sizeof(Passive) * passiveSlots));
+    if (passives == nullptr) return false;
+
+    OSCollectionIterator *passiveIter = OSCollectionIterator::withCollection(passiveServices);
+    if (passiveIter == nullptr) return false;
+
+    while (OSObject *passiveObj = passiveIter->getNextObject()) {
+        const OSSymbol *passiveKey = OSDynamicCast(OSSymbol, passiveObj);
+        if (passiveKey == nullptr || passiveCount == passiveSlots) continue;
+        IOService *passiveService = OSDynamicCast(IOService, passiveServices->getObject(passiveKey));
+        if (passiveService == nullptr) continue;
+
+        Passive *passive = &passives[passiveCount++];
+        passive->path = passiveKey;
+        passive->service = passiveService;
+        retained->setObject(passiveKey);
+        retained->setObject(passiveService);
+    }
+
+    OSSafeReleaseNULL(passiveIter);
+    return true;
+}
+
+bool DPTFPolicyTable::buildView() {
+    if (fanSlots != 0) {
+        viewFans = static_cast<Policies::Fan *>(IOMallocZero(sizeof(Policies::Fan) * fanSlots));
+        if (viewFans == nullptr) return false;
+    }
+
+    if (ruleSlots != 0) {
+        viewRules = static_cast<Policies::Rule *>(IOMallocZero(sizeof(Policies::Rule) * ruleSlots));
+        if (viewRules == nullptr) return false;
+    }
+
+    // Zones become indices, fans of one are already next to each other
+    for (uint32_t i = 0, zone = 0; i < fanCount; i++) {
+        if (i != 0 && fans[i].zone != fans[i - 1].zone) zone++;
+        viewFans[i] = { zone, fans[i].firstRule, fans[i].ruleCount, fans[i].stepSize, fans[i].maxPower, fans[i].minLevel, fans[i].maxLevel };
+    }
+
+    for (uint32_t r = 0; r < ruleCount; r++) {
+        uint32_t passive = Policies::NoPassive;
+        for (uint32_t p = 0; p < passiveCount && passive == Policies::NoPassive; p++) {
+            if (passives[p].service == rules[r].sensor) passive = p;
+        }
+
+        viewRules[r] = { rules[r].sample, rules[r].policy->weight, rules[r].policy->maxFanSpeeds, passive };
+    }
+
+    view = { viewFans, fanCount, viewRules, ruleCount, passiveCount, sampleCount, pollingPeriodMS };
+    return true;
+}
+
+void DPTFPolicyTable::free() {
+    if (fans != nullptr) {
+        IOFree(fans, sizeof(Fan) * fanSlots);
+        fans = nullptr;
+    }
+
+    if (rules != nullptr) {
+        IOFree(rules, sizeof(Rule) * ruleSlots);
+        rules = nullptr;
+    }
+
+    if (passives != nullptr) {
+        IOFree(passives, sizeof(Passive) * passiveSlots);
+        passives = nullptr;
+    }
+
+    if (viewFans != nullptr) {
+        IOFree(viewFans, sizeof(Policies::Fan) * fanSlots);
+        viewFans = nullptr;
+    }
+
+    if (viewRules != nullptr) {
+        IOFree(viewRules, sizeof(Policies::Rule) * ruleSlots);
+        viewRules = nullptr;
+    }
+
+    OSSafeReleaseNULL(retained);
+    super::free();
+}
@@ -0,0 +1,94 @@
+//
+//  PolicyTable.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/2/23.
+//
+
+#ifndef PolicyTable_hpp
+#define PolicyTable_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOLib.h>
+
+#include "ChultraThermal.hpp"
+#include "Policies.hpp"
+
+//
+// Flattened view of every zone's active policies, resolved against the
+// participants that are currently registered. Built on the workloop whenever
+// the set of participants changes, so evaluation never has to walk the
+// registration dictionaries or look anything up by path.
+//
+class DPTFPolicyTable : public OSObject {
+    OSDeclareDefaultStructors(DPTFPolicyTable);
+public:
+    struct Rule {
+        const OSSymbol *source;
+        IOService *sensor;
+        const DPTFActivePolicyEntry *policy;
+        uint32_t sample;        // Shared by every rule reading the same sensor
+    };
+
+    struct Fan {
+        const OSSymbol *zone;
+        const OSSymbol *path;
+        IOService *service;
+        uint32_t firstRule;
+        uint32_t ruleCount;
+        uint32_t stepSize;      // Smallest level change the fan acts on
+        uint32_t maxPower;      // mW at full speed, 0 if unknown
+        uint32_t minLevel;      // Lowest level it runs at, 0 if any
+        uint32_t maxLevel;      // Highest level it runs at
+    };
+
+    // Throttleable participants, e.g. chargers
+    struct Passive {
+        const OSSymbol *path;
+        IOService *service;
+    };
+
+    static DPTFPolicyTable *withParticipants(OSDictionary *activePolicies, OSDictionary *fanServices, OSDictionary *sensorServices, OSDictionary *passiveServices);
+    void free() override;
+
+    Fan *fans {nullptr};
+    uint32_t fanCount {0};
+
+    Rule *rules {nullptr};
+    uint32_t ruleCount {0};
+
+    Passive *passives {nullptr};
+    uint32_t passiveCount {0};
+    
+    // Distinct sensors, so a tick can read each one once
+    uint32_t sampleCount {0};
+    
+    // Shortest sampling period requested by any rule
+    uint32_t pollingPeriodMS {DPTFPollingPeriodMS};
+    
+    // Same fans and rules as the policies see them, indexed the same way
+    Policies::Table view {};
+    
+    // Set by the core before publishing
+    uint32_t generation {0};
+    uint32_t supportedPolicies {0};
+
+    // Owned by the core's DPTFTableSlot once replaced
+    DPTFPolicyTable *retiredNext {nullptr};
+private:
+    // Keeps every service, path and policy referenced above alive
+    OSArray *retained {nullptr};
+
+    uint32_t fanSlots {0};
+    uint32_t ruleSlots {0};
+    uint32_t passiveSlots {0};
+
+    Policies::Fan *viewFans {nullptr};
+    Policies::Rule *viewRules {nullptr};
+
+    bool initWithParticipants(OSDictionary *activePolicies, OSDictionary *fanServices, OSDictionary *sensorServices, OSDictionary *passiveServices);
+    bool addPassives(OSDictionary *passiveServices);
+    bool buildView();
+};
+
+#endif /* PolicyTable_hpp */
@@ -0,0 +1,12 @@
+//
+//  PowerArbiter.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/12/23.
+//
+
+#include "PowerArbiter.hpp"
+#include "Logger.h"
+
+#define super OSObject
+OSDefineMetaClassAndStructors(DPTFPowerArbiter, OSObject);
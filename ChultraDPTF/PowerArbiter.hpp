@@ -0,0 +1,26 @@
+//
+//  PowerArbiter.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/12/23.
+//
+
+#ifndef PowerArbiter_hpp
+#define PowerArbiter_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOLib.h>
+
+#include "PowerPlan.hpp"
+
+//
+// One processor's PowerPlan model, kept in the passive policy's arbiters
+// dictionary so it lives as long as the processor does.
+//
+class DPTFPowerArbiter : public OSObject {
+    OSDeclareDefaultStructors(DPTFPowerArbiter);
+public:
+    PowerPlan::Model model {};
+};
+
+#endif /* PowerArbiter_hpp */
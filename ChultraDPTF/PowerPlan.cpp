@@ -0,0 +1,120 @@
+//
+//  PowerPlan.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "PowerPlan.hpp"
+
+void PowerPlan::plan(Model *model, const Processor &cpu, uint32_t fanLevel, uint32_t ceiling,
+                     uint32_t timeConstantMS, uint64_t timestampMS, Plan *out) {
+    *out = { 0, 100, 0, false };
+
+    if (cpu.passiveTrip <= DPTFArbiterAmbient) return;
+
+    // Temperature rise the package may have at _PSV, milli degrees
+    uint64_t budget = static_cast<uint64_t>(cpu.passiveTrip - DPTFArbiterAmbient) * 100;
+
+    if (model->resistance == 0 && cpu.minLimit != 0) {
+        uint64_t prior = budget * 1000 / cpu.minLimit;
+        model->resistance = prior > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(prior);
+    }
+
+    // Tenths of a degree per minute since the last reading
+    int64_t slope = 0;
+    bool sloped = false;
+
+    if (cpu.temperature != 0) {
+        if (model->lastTimestamp != 0 && timestampMS > model->lastTimestamp &&
+            timestampMS - model->lastTimestamp <= DPTFArbiterMaxGapMS) {
+            slope = (static_cast<int64_t>(cpu.temperature) - model->lastTemperature) * 60000 /
+                    static_cast<int64_t>(timestampMS - model->lastTimestamp);
+            sloped = true;
+        }
+
+        model->lastTemperature = cpu.temperature;
+        model->lastTimestamp = timestampMS;
+    }
+
+    //
+    // Fit R0 against where the package is heading, smoothed so a single
+    // burst doesn't swing the whole plan. The slope is over the whole
+    // interval, so while warming it overstates where the rise ends up.
+    //
+    if (sloped && cpu.power >= DPTFArbiterMinPowerMW && cpu.temperature > DPTFArbiterAmbient) {
+        int64_t rise = static_cast<int64_t>(cpu.temperature - DPTFArbiterAmbient);
+
+        if (timeConstantMS != 0) {
+            rise += slope * timeConstantMS / 60000;
+        } else if (slope > DPTFArbiterSettledSlope || slope < -static_cast<int64_t>(DPTFArbiterSettledSlope)) {
+            rise = 0;
+        }
+
+        if (rise > 0) {
+            uint64_t measured = static_cast<uint64_t>(rise) * 100 * 1000 * (100 + fanLevel) / (static_cast<uint64_t>(cpu.power) * 100);
+            if (measured > UINT32_MAX) measured = UINT32_MAX;
+
+            model->resistance = model->resistance == 0 ? static_cast<uint32_t>(measured) :
+                                static_cast<uint32_t>((static_cast<uint64_t>(model->resistance) * 3 + measured) / 4);
+        }
+    }
+
+    //
+    // A package held at its limit would use more if it could, so assume
+    // it wants everything PPCC allows until it backs off. That was never
+    // a reading, so the first one after it replaces it outright.
+    //
+    if (cpu.appliedLimit != 0 && static_cast<uint64_t>(cpu.power) * 100 >= static_cast<uint64_t>(cpu.appliedLimit) * 95) {
+        model->demand = cpu.maxLimit;
+        model->held = true;
+    } else {
+        model->demand = model->demand == 0 || model->held ? cpu.power :
+                        static_cast<uint32_t>((static_cast<uint64_t>(model->demand) * 3 + cpu.power) / 4);
+        model->held = false;
+    }
+
+    if (model->demand > cpu.maxLimit) model->demand = cpu.maxLimit;
+    if (model->resistance == 0) return;
+
+    out->fanCeiling = ceiling;
+
+    // Smallest f with R0 * 100 / (100 + f) * demand <= budget, rounded up
+    uint64_t divisor = budget * 1000;
+    uint64_t needed = (static_cast<uint64_t>(model->resistance) * 100 * model->demand + divisor - 1) / divisor;
+    uint32_t fanNeeded = needed > 100 ? static_cast<uint32_t>(needed - 100) : 0;
+
+    if (fanNeeded <= ceiling) {
+        out->fanFloor = fanNeeded;
+        return;
+    }
+
+    // Fan can't do it quietly, run it at the ceiling and give up the rest as power
+    uint64_t sustainable = budget * 1000 * (100 + ceiling) / (static_cast<uint64_t>(model->resistance) * 100);
+    if (sustainable < cpu.minLimit) sustainable = cpu.minLimit;
+    if (sustainable > cpu.maxLimit) sustainable = cpu.maxLimit;
+
+    out->fanFloor = ceiling;
+    out->powerLimit = static_cast<uint32_t>(sustainable);
+    out->throttling = true;
+}
+
+uint32_t PowerPlan::fanLevel(const Plan &plan, uint32_t command, uint32_t others) {
+    uint32_t level = command > plan.fanFloor ? command : plan.fanFloor;
+    if (level > plan.fanCeiling) level = plan.fanCeiling;
+
+    // Another source may still want more than the ceiling, up to what the policies gave it
+    uint32_t other = others < command ? others : command;
+    return level > other ? level : other;
+}
+
+bool PowerPlan::mayCut(uint32_t chargers, uint32_t deepest, bool limited) {
+    return limited || chargers >= deepest;
+}
+
+uint32_t PowerPlan::chargerLevel(uint32_t chargers, uint32_t deepest, bool cutting, bool limited) {
+    if (cutting) return chargers < deepest ? chargers + 1 : deepest;
+    if (limited) return chargers < deepest ? chargers : deepest;
+
+    return chargers > 0 ? chargers - 1 : 0;
+}
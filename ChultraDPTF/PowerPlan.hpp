@@ -0,0 +1,102 @@
+//
+//  PowerPlan.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef PowerPlan_hpp
+#define PowerPlan_hpp
+
+#include <stdint.h>
+
+// Assumed air temperature around the heatsink, tenths of a degree
+constexpr uint32_t DPTFArbiterAmbient = 350;
+
+// Below this the package is idling and says nothing about the heatsink
+constexpr uint32_t DPTFArbiterMinPowerMW = 2000;
+
+// Without a time constant, the package has settled once it moves slower than this, tenths of a degree per minute
+constexpr uint32_t DPTFArbiterSettledSlope = 30;
+
+// Readings further apart than this say nothing about the slope
+constexpr uint32_t DPTFArbiterMaxGapMS = 120000;
+
+//
+// Trades fan speed against a processor's PL1. Models the package as
+//
+//     T = ambient + P * R(f),    R(f) = R0 * 100 / (100 + f)
+//
+// so a fan at 100% halves the thermal resistance. The workload's demand is
+// fitted from every evaluation. R0 starts out pessimistic, as if the package
+// only just held _PSV at its lowest PL1 with the fan off, and is fitted
+// against the rise the package is heading for, T + tau * dT/dt. A reading
+// taken while the heatsink is still warming would otherwise read R0 low and
+// let the package run past _PSV. Without tau from the thermal fit only
+// settled readings count.
+//
+// Fan first while the fan can keep the demand under _PSV within the acoustic
+// ceiling, throttle first once it can't. All integer math, R0 is in milli
+// degrees per W.
+//
+// No IOKit here, so this can be built and simulated on a host.
+//
+namespace PowerPlan {
+    // Same fields as DPTFProcessorStatus
+    struct Processor {
+        uint32_t temperature;       // Tenths of a degree C, 0 if unknown
+        uint32_t passiveTrip;
+        uint32_t power;             // mW
+        uint32_t minLimit;
+        uint32_t maxLimit;
+        uint32_t appliedLimit;      // 0 while firmware's limit is in place
+    };
+
+    struct Model {
+        uint32_t resistance;
+        uint32_t demand;
+        bool held;                  // demand is a guess for a package held at its limit
+        uint32_t lastTemperature;
+        uint64_t lastTimestamp;     // ms, 0 before the first reading
+    };
+
+    struct Plan {
+        uint32_t fanFloor;      // Lowest level the processor's fans may run at
+        uint32_t fanCeiling;    // Highest level the processor may ask of them
+        uint32_t powerLimit;    // PL1 in mW, 0 for firmware's
+        bool throttling;
+    };
+
+    //
+    // fanLevel is what the fans actually achieved, ceiling is the acoustic
+    // limit. timeConstantMS is the package's from the thermal fit, 0 while
+    // there is none, and timestampMS when cpu.temperature was read.
+    //
+    void plan(Model *model, const Processor &cpu, uint32_t fanLevel, uint32_t ceiling,
+              uint32_t timeConstantMS, uint64_t timestampMS, Plan *out);
+
+    //
+    // Level for a fan that cools the processor. command is what the policies
+    // settled on, others the part of it the fan's other sources asked for.
+    // Only the processor's share is held to the plan.
+    //
+    uint32_t fanLevel(const Plan &plan, uint32_t command, uint32_t others);
+
+    //
+    // Chargers give up charge current before a processor gives up PL1.
+    // chargers is the level they are throttled to for the processors,
+    // deepest the furthest they go. A processor already held below
+    // firmware's limit stays there whatever the chargers do.
+    //
+    bool mayCut(uint32_t chargers, uint32_t deepest, bool limited);
+
+    //
+    // Where the chargers go next, one level per evaluation. cutting says a
+    // processor's plan wants PL1 below firmware's limit, limited that one
+    // is held there. They only come back up once every PL1 is back at
+    // firmware's, the reverse of how they went down.
+    //
+    uint32_t chargerLevel(uint32_t chargers, uint32_t deepest, bool cutting, bool limited);
+}
+
+#endif /* PowerPlan_hpp */
@@ -0,0 +1,93 @@
+//
+//  ProcessorPower.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "ProcessorPower.hpp"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+constexpr uint64_t NanosecondsPerSecond = 1000000000ULL;
+
+bool ProcessorPower::parsePpcc(PackageReader read, void *package, PowerLimitRange *range) {
+    uint32_t rows;
+    if (!read(package, Count, 0, &rows)) return false;
+
+    //
+    // Package { Revision, Package { Index, Min, Max, Window Min, Window Max, Step }, ... }
+    // Index 0 is PL1, which is what we trade against temperature.
+    //
+    for (uint32_t i = 1; i < rows; i++) {
+        uint32_t count;
+        if (!read(package, i, Count, &count) || count < 6) continue;
+
+        uint32_t values[6];
+        bool valid = true;
+        for (uint32_t v = 0; v < 6 && valid; v++) valid = read(package, i, v, &values[v]);
+
+        if (!valid || values[0] != 0 || values[1] > values[2]) continue;
+
+        *range = { values[0], values[1], values[2], values[3], values[4], values[5] };
+        return true;
+    }
+
+    return false;
+}
+
+uint32_t ProcessorPower::countStates(PackageReader read, void *package, uint32_t fields) {
+    uint32_t rows, states = 0;
+    if (!read(package, Count, 0, &rows)) return 0;
+
+    // Firmware pads these with junk often enough, only count what looks like a state
+    for (uint32_t i = 0; i < rows; i++) {
+        uint32_t count, value;
+        if (!read(package, i, Count, &count) || count < fields) continue;
+
+        bool valid = true;
+        for (uint32_t v = 0; v < fields && valid; v++) valid = read(package, i, v, &value);
+        if (valid) states++;
+    }
+
+    return states;
+}
+
+uint32_t ProcessorPower::clampLimit(const PowerLimitRange &range, uint32_t milliwatts) {
+    if (milliwatts < range.minPower) milliwatts = range.minPower;
+    if (milliwatts > range.maxPower) milliwatts = range.maxPower;
+
+    // Round down, a step over would be above what was asked
+    if (range.step != 0) {
+        milliwatts = range.minPower + ((milliwatts - range.minPower) / range.step) * range.step;
+    }
+
+    return milliwatts;
+}
+
+ProcessorPower::Units ProcessorPower::decodeUnits(uint64_t msr) {
+    return { static_cast<uint32_t>(msr & 0xF), static_cast<uint32_t>((msr >> 8) & 0x1F) };
+}
+
+uint64_t ProcessorPower::encodeLimit(uint64_t msr, uint32_t milliwatts, const Units &units) {
+    uint64_t value = (static_cast<uint64_t>(milliwatts) << units.powerShift) / 1000;
+    value = min(value, DPTFPackagePL1Mask);
+
+    return (msr & ~DPTFPackagePL1Mask) | value | DPTFPackagePL1Enable;
+}
+
+uint32_t ProcessorPower::measure(EnergyCounter *counter, uint32_t energy, uint64_t nowNs, const Units &units) {
+    // Unsigned subtraction takes care of the counter wrapping
+    uint64_t millijoules = (static_cast<uint64_t>(energy - counter->lastEnergy) * 1000) >> units.energyShift;
+    bool first = counter->lastTimeNs == 0;
+    uint64_t elapsedNs = nowNs - counter->lastTimeNs;
+
+    counter->lastEnergy = energy;
+    counter->lastTimeNs = nowNs;
+
+    if (first || elapsedNs == 0) {
+        return 0;
+    }
+
+    return static_cast<uint32_t>(millijoules * NanosecondsPerSecond / elapsedNs);
+}
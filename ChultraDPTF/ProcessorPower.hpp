@@ -0,0 +1,81 @@
+//
+//  ProcessorPower.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef ProcessorPower_hpp
+#define ProcessorPower_hpp
+
+#include <stdint.h>
+
+// MSR_PKG_POWER_LIMIT
+constexpr uint64_t DPTFPackagePL1Mask = 0x7FFF;
+constexpr uint64_t DPTFPackagePL1Enable = 1ULL << 15;
+constexpr uint64_t DPTFPackageLimitLock = 1ULL << 63;
+
+//
+// What the processor participant makes of PPCC, _PSS and _TSS, and of the
+// RAPL MSRs. The kext evaluates the methods and reads the MSRs, everything
+// done with the values is here. Packages are read through a callback, the
+// evaluated OSArray in the kext and a mocked table on a host.
+//
+// No IOKit here, so the limits can be checked against mocked firmware on a
+// host.
+//
+namespace ProcessorPower {
+    // Passed as a row or column to count elements instead of reading one
+    constexpr uint32_t Count = 0xFFFFFFFF;
+
+    //
+    // Reads package[row][column] as an integer. With column Count, the
+    // number of elements in package[row], with row Count, the number of
+    // rows. False if it's missing, or not an integer or a package.
+    //
+    typedef bool (*PackageReader)(void *package, uint32_t row, uint32_t column, uint32_t *value);
+
+    // One PPCC range, power in mW and time windows in ms
+    struct PowerLimitRange {
+        uint32_t index;
+        uint32_t minPower;
+        uint32_t maxPower;
+        uint32_t minWindow;
+        uint32_t maxWindow;
+        uint32_t step;
+    };
+
+    //
+    // PL1 from PPCC, the only range we adjust. False if firmware doesn't
+    // list a usable one.
+    //
+    bool parsePpcc(PackageReader read, void *package, PowerLimitRange *range);
+
+    // Well formed entries in _PSS (6 fields) or _TSS (5 fields)
+    uint32_t countStates(PackageReader read, void *package, uint32_t fields);
+
+    // A request inside the range firmware published, on its step size
+    uint32_t clampLimit(const PowerLimitRange &range, uint32_t milliwatts);
+
+    // RAPL units from MSR_RAPL_POWER_UNIT, 1 / 2^shift W and J
+    struct Units {
+        uint32_t powerShift;
+        uint32_t energyShift;
+    };
+
+    Units decodeUnits(uint64_t msr);
+
+    // MSR_PKG_POWER_LIMIT with PL1 set to milliwatts and enabled, the rest kept
+    uint64_t encodeLimit(uint64_t msr, uint32_t milliwatts, const Units &units);
+
+    // Package power from MSR_PKG_ENERGY_STATUS, which wraps at 32 bits
+    struct EnergyCounter {
+        uint32_t lastEnergy;
+        uint64_t lastTimeNs;        // 0 until the first read
+    };
+
+    // mW since the last read, 0 on the first
+    uint32_t measure(EnergyCounter *counter, uint32_t energy, uint64_t nowNs, const Units &units);
+}
+
+#endif /* ProcessorPower_hpp */
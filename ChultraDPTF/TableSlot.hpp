@@ -0,0 +1,69 @@
+//
+//  TableSlot.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef TableSlot_hpp
+#define TableSlot_hpp
+
+//
+// Holds the current immutable table for one reader, the evaluation tick.
+// Writers are serialized by the caller's lock and publish with a plain
+// store behind a barrier, so the reader never sees a table before its
+// contents. Tables they replace go on a list threaded through the tables
+// themselves, so retiring one can't fail, and the reader releases them at
+// the start of its next tick, once it can't be holding them any more.
+//
+// Table needs a Table *retiredNext member. Ops supplies barrier() and
+// release(Table *). No IOKit here, so this can be stressed on a host.
+//
+template <typename Table, typename Ops>
+class DPTFTableSlot {
+public:
+    // Writer, under the lock. Takes the caller's reference, returns what was replaced
+    Table *publish(Table *table) {
+        Table *old = current;
+
+        Ops::barrier();
+        current = table;
+
+        if (old != nullptr) {
+            old->retiredNext = retired;
+            retired = old;
+        }
+
+        return old;
+    }
+
+    // Reader, once per tick. Writers under the lock may also look
+    Table *load() const {
+        return current;
+    }
+
+    // Reader, under the lock, before it loads the table for this tick
+    void reclaim() {
+        while (retired != nullptr) {
+            Table *table = retired;
+            retired = table->retiredNext;
+            table->retiredNext = nullptr;
+            Ops::release(table);
+        }
+    }
+
+    // Nobody reads any more
+    void clear() {
+        reclaim();
+
+        if (current != nullptr) {
+            Ops::release(current);
+            current = nullptr;
+        }
+    }
+private:
+    Table * volatile current {nullptr};
+    Table *retired {nullptr};
+};
+
+#endif /* TableSlot_hpp */
@@ -0,0 +1,225 @@
+//
+//  Telemetry.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/13/23.
+//
+
+#include "Telemetry.hpp"
+#include "Logger.h"
+
+#define super OSObject
+OSDefineMetaClassAndStructors(DPTFTelemetry, OSObject);
+
+DPTFTelemetry *DPTFTelemetry::withCapacity(uint32_t bytes) {
+    DPTFTelemetry *telemetry = new DPTFTelemetry;
+    if (telemetry == nullptr) return nullptr;
+
+    if (!telemetry->init() || bytes < DPTF_TELEMETRY_MAX_FRAME * 2) {
+        OSSafeReleaseNULL(telemetry);
+        return nullptr;
+    }
+
+    telemetry->lock = IOLockAlloc();
+    telemetry->buffer = static_cast<uint8_t *>(IOMalloc(bytes));
+    if (telemetry->lock == nullptr || telemetry->buffer == nullptr) {
+        OSSafeReleaseNULL(telemetry);
+        return nullptr;
+    }
+
+    telemetry->capacity = bytes;
+    return telemetry;
+}
+
+void DPTFTelemetry::free() {
+    if (buffer != nullptr) {
+        IOFree(buffer, capacity);
+        buffer = nullptr;
+    }
+
+    if (lock != nullptr) {
+        IOLockFree(lock);
+        lock = nullptr;
+    }
+
+    super::free();
+}
+
+void DPTFTelemetry::addChannel(const OSSymbol *path, DPTFTelemetryField field) {
+    // Positions are fixed by the table, anything past the limit just isn't recorded
+    uint32_t channel = channelCount++;
+    if (channel >= DPTF_TELEMETRY_MAX_CHANNELS) return;
+
+    channels[channel].field = field;
+    strlcpy(channels[channel].path, path->getCStringNoCopy(), sizeof(channels[channel].path));
+    values[channel] = 0;
+}
+
+void DPTFTelemetry::setChannels(DPTFPolicyTable *table) {
+    IOLockLock(lock);
+    channelCount = 0;
+
+    // Samples are numbered in rule order, so the first rule with each one names it
+    for (uint32_t r = 0, sample = 0; r < table->ruleCount; r++) {
+        if (table->rules[r].sample != sample) continue;
+        addChannel(table->rules[r].source, DPTFTelemetryFieldLevel);
+        addChannel(table->rules[r].source, DPTFTelemetryFieldTemperature);
+        sample++;
+    }
+
+    fanBase = channelCount;
+    for (uint32_t i = 0; i < table->fanCount; i++) {
+        addChannel(table->fans[i].path, DPTFTelemetryFieldFanCommand);
+        addChannel(table->fans[i].path, DPTFTelemetryFieldFanSpeed);
+    }
+
+    passiveBase = channelCount;
+    for (uint32_t p = 0; p < table->passiveCount; p++) {
+        addChannel(table->passives[p].path, DPTFTelemetryFieldTemperature);
+        addChannel(table->passives[p].path, DPTFTelemetryFieldPower);
+        addChannel(table->passives[p].path, DPTFTelemetryFieldPowerLimit);
+        addChannel(table->passives[p].path, DPTFTelemetryFieldThrottle);
+    }
+
+    if (channelCount > DPTF_TELEMETRY_MAX_CHANNELS) {
+        IOLogError("Telemetry only covers %d of %d channels", DPTF_TELEMETRY_MAX_CHANNELS, channelCount);
+        channelCount = DPTF_TELEMETRY_MAX_CHANNELS;
+    }
+
+    needChannels = true;
+    IOLockUnlock(lock);
+}
+
+void DPTFTelemetry::setSample(uint32_t sample, DPTFTelemetryField field, int64_t value) {
+    switch (field) {
+        case DPTFTelemetryFieldLevel: set(sample * 2, value); break;
+        case DPTFTelemetryFieldTemperature: set(sample * 2 + 1, value); break;
+        default: break;
+    }
+}
+
+void DPTFTelemetry::setFan(uint32_t fan, DPTFTelemetryField field, int64_t value) {
+    switch (field) {
+        case DPTFTelemetryFieldFanCommand: set(fanBase + fan * 2, value); break;
+        case DPTFTelemetryFieldFanSpeed: set(fanBase + fan * 2 + 1, value); break;
+        default: break;
+    }
+}
+
+void DPTFTelemetry::setPassive(uint32_t passive, DPTFTelemetryField field, int64_t value) {
+    switch (field) {
+        case DPTFTelemetryFieldTemperature: set(passiveBase + passive * 4, value); break;
+        case DPTFTelemetryFieldPower: set(passiveBase + passive * 4 + 1, value); break;
+        case DPTFTelemetryFieldPowerLimit: set(passiveBase + passive * 4 + 2, value); break;
+        case DPTFTelemetryFieldThrottle: set(passiveBase + passive * 4 + 3, value); break;
+        default: break;
+    }
+}
+
+size_t DPTFTelemetry::encodeChannels() {
+    // Length is written last, leave room for the longest varint a frame can need
+    size_t pos = 2;
+    frame[pos++] = DPTFTelemetryFrameChannels;
+    (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, channelCount);
+
+    for (uint32_t i = 0; i < channelCount; i++) {
+        size_t pathLen = strnlen(channels[i].path, sizeof(channels[i].path));
+        frame[pos++] = channels[i].field;
+        (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, pathLen);
+        memcpy(frame + pos, channels[i].path, pathLen);
+        pos += pathLen;
+    }
+
+    return pos;
+}
+
+size_t DPTFTelemetry::encodeRecord(uint64_t timestampMS, bool key) {
+    size_t pos = 2;
+    frame[pos++] = key ? DPTFTelemetryFrameKeyframe : DPTFTelemetryFrameDelta;
+    (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, key ? timestampMS : timestampMS - recordedTime);
+
+    for (uint32_t i = 0; i < channelCount; i++) {
+        int64_t value = key ? values[i] : values[i] - recorded[i];
+        (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, DPTFTelemetryZigZag(value));
+        recorded[i] = values[i];
+    }
+
+    recordedTime = timestampMS;
+    sinceKeyframe = key ? 0 : sinceKeyframe + 1;
+    return pos;
+}
+
+bool DPTFTelemetry::append(size_t length) {
+    //
+    // Frames are encoded after two spare bytes so the length can go in front
+    // without moving the payload. Every frame fits in two varint bytes.
+    //
+    size_t payload = length - 2;
+    size_t start = payload < 0x80 ? 1 : 0;
+    size_t pos = start;
+    (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, payload);
+
+    size_t total = length - start;
+    if (capacity - used < total) return false;
+
+    memcpy(buffer + used, frame + start, total);
+    used += total;
+    return true;
+}
+
+void DPTFTelemetry::commit(uint64_t timestampMS) {
+    IOLockLock(lock);
+
+    bool key = needChannels || sinceKeyframe + 1 >= DPTF_TELEMETRY_KEYFRAME_INTERVAL;
+
+    if (needChannels && append(encodeChannels())) {
+        needChannels = false;
+    }
+
+    //
+    // Snapshot the values first, a failed append must not lose the deltas.
+    // Out of room means nobody is reading, restart from scratch so the
+    // buffer always decodes on its own.
+    //
+    int64_t previous[DPTF_TELEMETRY_MAX_CHANNELS];
+    memcpy(previous, recorded, sizeof(previous));
+    uint64_t previousTime = recordedTime;
+    uint32_t previousSince = sinceKeyframe;
+
+    if (needChannels || !append(encodeRecord(timestampMS, key))) {
+        memcpy(recorded, previous, sizeof(recorded));
+        recordedTime = previousTime;
+        sinceKeyframe = previousSince;
+
+        used = 0;
+        dropped++;
+        IOLogDebug("Telemetry buffer full, dropped history (%d times)", dropped);
+
+        needChannels = !append(encodeChannels());
+        if (!needChannels) (void) append(encodeRecord(timestampMS, true));
+    }
+
+    IOLockUnlock(lock);
+}
+
+uint32_t DPTFTelemetry::copyOut(void *buf, uint32_t length) {
+    uint32_t copied = 0;
+
+    IOLockLock(lock);
+
+    // Whole frames only, a reader never has to stitch one together across reads
+    while (copied < used) {
+        size_t frameLen;
+        uint8_t type;
+        if (DPTFTelemetryPeekFrame(buffer + copied, used - copied, &frameLen, &type) != DPTFTelemetryRecord) break;
+        if (copied + frameLen > length) break;
+        copied += frameLen;
+    }
+
+    memcpy(buf, buffer, copied);
+    memmove(buffer, buffer + copied, used - copied);
+    used -= copied;
+
+    IOLockUnlock(lock);
+    return copied;
+}
@@ -0,0 +1,80 @@
+//
+//  Telemetry.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/13/23.
+//
+
+#ifndef Telemetry_hpp
+#define Telemetry_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOLib.h>
+
+#include "DPTFTelemetry.h"
+#include "PolicyTable.hpp"
+
+//
+// Encodes one record per evaluation into a bounded buffer of complete
+// frames that the user client drains. Values are written by the core on
+// the workloop, reads come from user client threads, so the buffer is
+// behind its own lock. When nobody drains it, the oldest history is
+// dropped and the log restarts with a channel table and keyframe.
+//
+// Channel layout follows the policy table:
+//     Level + Temperature per sensor sample, FanCommand + FanSpeed per fan,
+//     Temperature + Power + PowerLimit + Throttle per passive device
+//
+class DPTFTelemetry : public OSObject {
+    OSDeclareDefaultStructors(DPTFTelemetry);
+public:
+    static DPTFTelemetry *withCapacity(uint32_t bytes);
+
+    // Table changed, following records use its channels
+    void setChannels(DPTFPolicyTable *table);
+
+    // Values left alone keep what they had last record
+    void setSample(uint32_t sample, DPTFTelemetryField field, int64_t value);
+    void setFan(uint32_t fan, DPTFTelemetryField field, int64_t value);
+    void setPassive(uint32_t passive, DPTFTelemetryField field, int64_t value);
+
+    // Encode the values set since the last record
+    void commit(uint64_t timestampMS);
+
+    // Moves as many complete frames as fit into buf, returns bytes copied
+    uint32_t copyOut(void *buf, uint32_t length);
+
+    void free() override;
+private:
+    IOLock *lock {nullptr};
+    uint8_t *buffer {nullptr};
+    uint32_t capacity {0};
+    uint32_t used {0};
+
+    DPTFTelemetryChannel channels[DPTF_TELEMETRY_MAX_CHANNELS];
+    uint32_t channelCount {0};
+    uint32_t fanBase {0};
+    uint32_t passiveBase {0};
+
+    int64_t values[DPTF_TELEMETRY_MAX_CHANNELS];
+    int64_t recorded[DPTF_TELEMETRY_MAX_CHANNELS];
+    uint64_t recordedTime {0};
+    uint32_t sinceKeyframe {0};
+    bool needChannels {true};
+
+    // Times history was thrown away because nobody read it
+    uint32_t dropped {0};
+
+    uint8_t frame[DPTF_TELEMETRY_MAX_FRAME];
+
+    void set(uint32_t channel, int64_t value) {
+        if (channel < channelCount) values[channel] = value;
+    }
+
+    void addChannel(const OSSymbol *path, DPTFTelemetryField field);
+    size_t encodeChannels();
+    size_t encodeRecord(uint64_t timestampMS, bool key);
+    bool append(size_t length);
+};
+
+#endif /* Telemetry_hpp */
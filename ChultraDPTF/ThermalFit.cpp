@@ -0,0 +1,116 @@
+//
+//  ThermalFit.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#include "ThermalFit.hpp"
+
+static void resetCovariance(ThermalFit::Model *model) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) model->covariance[i][j] = i == j ? DPTFModelCovariance : 0;
+    }
+}
+
+void ThermalFit::reset(Model *model) {
+    *model = {};
+    resetCovariance(model);
+}
+
+void ThermalFit::update(Model *model, uint32_t temperature, uint32_t input, uint64_t timestampMS) {
+    uint64_t elapsed = timestampMS - model->lastTimestamp;
+    bool usable = model->lastTimestamp != 0 && timestampMS > model->lastTimestamp && elapsed <= DPTFModelMaxGapMS;
+    uint32_t previous = model->lastTemperature;
+
+    model->lastTemperature = temperature;
+    model->lastTimestamp = timestampMS;
+    if (!usable) return;
+
+    model->interval = model->interval == 0 ? static_cast<uint32_t>(elapsed) : static_cast<uint32_t>((static_cast<uint64_t>(model->interval) * 3 + elapsed) / 4);
+
+    //
+    // Regressors scaled to about one: the previous temperature in hundreds
+    // of degrees, the input as a fraction and a constant. The target is the
+    // slope over the interval in tenths of a degree per second.
+    //
+    int64_t x[3] = {
+        static_cast<int64_t>(previous) * DPTFModelOne / 1000,
+        static_cast<int64_t>(input > 100 ? 100 : input) * DPTFModelOne / 100,
+        DPTFModelOne,
+    };
+    int64_t y = (static_cast<int64_t>(temperature) - previous) * DPTFModelOne * 1000 / static_cast<int64_t>(elapsed);
+
+    int64_t px[3];
+    int64_t xpx = 0;
+    int64_t predicted = 0;
+
+    for (int i = 0; i < 3; i++) {
+        px[i] = 0;
+        for (int j = 0; j < 3; j++) px[i] += model->covariance[i][j] * x[j] / DPTFModelOne;
+        xpx += x[i] * px[i] / DPTFModelOne;
+        predicted += model->theta[i] * x[i] / DPTFModelOne;
+    }
+
+    int64_t denominator = DPTFModelForget + xpx;
+    int64_t error = y - predicted;
+    int64_t gain[3];
+
+    for (int i = 0; i < 3; i++) {
+        gain[i] = px[i] * DPTFModelOne / denominator;
+        model->theta[i] += gain[i] * error / DPTFModelOne;
+    }
+
+    //
+    // P = (P - K x'P) / forget. Directions the data doesn't excite would grow
+    // without bound, so stop forgetting once the covariance is back at its
+    // starting size, and start over if rounding ever breaks it.
+    //
+    int64_t trace = 0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) model->covariance[i][j] -= gain[i] * px[j] / DPTFModelOne;
+        trace += model->covariance[i][i];
+    }
+
+    bool forget = trace < DPTFModelCovariance * 3;
+    for (int i = 0; i < 3; i++) {
+        if (model->covariance[i][i] <= 0) {
+            resetCovariance(model);
+            break;
+        }
+
+        for (int j = i; j < 3; j++) {
+            int64_t value = (model->covariance[i][j] + model->covariance[j][i]) / 2;
+            if (forget) value = value * DPTFModelOne / DPTFModelForget;
+            model->covariance[i][j] = model->covariance[j][i] = value;
+        }
+    }
+
+    model->updates++;
+}
+
+bool ThermalFit::fit(const Model &model, uint32_t maxPeriodMS, Fit *out) {
+    // A stable plant cools back towards its offset, so the slope must fall with temperature
+    if (model.updates < DPTFModelMinUpdates || model.theta[0] >= 0) return false;
+
+    // Smoothing delays the readings by about one interval, which the fit sees as a slower plant
+    int64_t tau = -1000LL * 1000 * DPTFModelOne / model.theta[0] - model.interval;
+    if (tau < DPTFModelMinTauMS || tau > DPTFModelMaxTauMS) return false;
+
+    int64_t gain = -1000 * model.theta[1] / model.theta[0];
+    int64_t magnitude = gain < 0 ? -gain : gain;
+    int64_t period = tau / 10;
+
+    out->timeConstantMS = static_cast<uint32_t>(tau);
+    out->gain = static_cast<int32_t>(gain);
+    out->offset = static_cast<int32_t>(-1000 * model.theta[2] / model.theta[0]);
+    out->samplingPeriodMS = static_cast<uint32_t>(period < DPTFModelMinPeriodMS ? DPTFModelMinPeriodMS : period > maxPeriodMS ? maxPeriodMS : period);
+
+    //
+    // Lambda tuned PI with the closed loop as fast as the plant itself,
+    // which reduces to Kp = 1 / K and Ti = tau for a first order plant.
+    //
+    out->proportionalGain = magnitude != 0 ? static_cast<uint32_t>(100000 / magnitude) : 0;
+    out->integralTimeMS = static_cast<uint32_t>(tau);
+    return true;
+}
@@ -0,0 +1,75 @@
+//
+//  ThermalFit.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+
+#ifndef ThermalFit_hpp
+#define ThermalFit_hpp
+
+#include <stdint.h>
+
+// Fixed point used by the fit, Q16
+constexpr int DPTFModelShift = 16;
+constexpr int64_t DPTFModelOne = 1LL << DPTFModelShift;
+
+// Forgetting factor, 0.99 remembers roughly the last hundred updates
+constexpr int64_t DPTFModelForget = 64880;
+
+// Starting covariance, also the cap that stops it winding up while nothing changes
+constexpr int64_t DPTFModelCovariance = 1000 * DPTFModelOne;
+
+// Updates before a fit is trusted, and the time constants a fit may claim
+constexpr uint32_t DPTFModelMinUpdates = 30;
+constexpr uint32_t DPTFModelMinTauMS = 5000;
+constexpr uint32_t DPTFModelMaxTauMS = 3600000;
+
+// Gaps longer than this say nothing about the plant, e.g. across sleep
+constexpr uint32_t DPTFModelMaxGapMS = 300000;
+
+// Sampling periods derived from a fit stay within these
+constexpr uint32_t DPTFModelMinPeriodMS = 2000;
+
+//
+// First order model of one heat source and sensor pair,
+//
+//     dT/dt = (K * u + T0 - T) / tau
+//
+// with u the source's input as a percentage of its range, e.g. a fan level
+// or package power against PL1 max. Fitted online with recursive least
+// squares over the regressors [T, u, 1]. Everything is integer, parameters
+// are Q16 and memory is fixed regardless of how long the model runs.
+//
+// No IOKit here, so fits can be checked against known plants on a host.
+//
+namespace ThermalFit {
+    struct Fit {
+        uint32_t timeConstantMS;
+        int32_t gain;               // Steady state change for the full input range, tenths of a degree
+        int32_t offset;             // Steady state temperature with no input, tenths of a degree
+        uint32_t samplingPeriodMS;  // A tenth of tau, within DPTFModelMinPeriodMS and the caller's maximum
+        uint32_t proportionalGain;  // Input percent per degree of error, x100
+        uint32_t integralTimeMS;
+    };
+
+    struct Model {
+        int64_t theta[3];
+        int64_t covariance[3][3];
+
+        uint32_t lastTemperature;
+        uint64_t lastTimestamp;
+        uint32_t interval;
+        uint32_t updates;
+    };
+
+    void reset(Model *model);
+
+    // Smoothed temperature in tenths of a degree, input 0-100, timestamps in ms
+    void update(Model *model, uint32_t temperature, uint32_t input, uint64_t timestampMS);
+
+    // False until the fit is trustworthy
+    bool fit(const Model &model, uint32_t maxPeriodMS, Fit *out);
+}
+
+#endif /* ThermalFit_hpp */
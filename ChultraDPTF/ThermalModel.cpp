@@ -0,0 +1,27 @@
+//
+//  ThermalModel.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/14/23.
+//
+
+#include "ThermalModel.hpp"
+#include "Logger.h"
+
+#define super OSObject
+OSDefineMetaClassAndStructors(DPTFThermalModel, OSObject);
+
+bool DPTFThermalModel::init() {
+    if (!super::init()) return false;
+
+    ThermalFit::reset(&state);
+    return true;
+}
+
+void DPTFThermalModel::update(uint32_t temperature, uint32_t input, uint64_t timestampMS) {
+    ThermalFit::update(&state, temperature, input, timestampMS);
+}
+
+bool DPTFThermalModel::fit(Fit *out) const {
+    return ThermalFit::fit(state, DPTFPollingPeriodMS, out);
+}
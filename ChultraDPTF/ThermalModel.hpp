@@ -0,0 +1,37 @@
+//
+//  ThermalModel.hpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/14/23.
+//
+
+#ifndef ThermalModel_hpp
+#define ThermalModel_hpp
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOLib.h>
+
+#include "ChultraThermal.hpp"
+#include "ThermalFit.hpp"
+
+//
+// One heat source and sensor pair's ThermalFit, kept in the core's
+// model dictionaries so it lives as long as the pair does.
+//
+class DPTFThermalModel : public OSObject {
+    OSDeclareDefaultStructors(DPTFThermalModel);
+public:
+    typedef ThermalFit::Fit Fit;
+
+    bool init() override;
+
+    // Smoothed temperature in tenths of a degree, input 0-100, timestamps in ms
+    void update(uint32_t temperature, uint32_t input, uint64_t timestampMS);
+
+    // False until the fit is trustworthy, sampling periods stay within DPTFPollingPeriodMS
+    bool fit(Fit *out) const;
+
+    ThermalFit::Model state;
+};
+
+#endif /* ThermalModel_hpp */
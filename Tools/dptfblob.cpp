@@ -0,0 +1,216 @@
+//
+//  dptfblob.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/4/23.
+//
+//  Builds, validates and dumps policy blobs for the ChultraThermal user client.
+//  Plain C++, builds anywhere:
+//      c++ -std=c++17 -IChultraDPTF/Includes -o dptfblob Tools/dptfblob.cpp
+//
+//  Text format, one row per fan/source pair, '#' starts a comment:
+//      <fan> <source> <weight> <period> <hysteresis|default> <speed0> ... <speed9>
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "DPTFPolicyBlob.h"
+
+static const char *errorString(DPTFPolicyBlobError err) {
+    switch (err) {
+        case DPTFPolicyBlobOK: return "ok";
+        case DPTFPolicyBlobTooSmall: return "blob too small";
+        case DPTFPolicyBlobBadMagic: return "bad magic";
+        case DPTFPolicyBlobBadVersion: return "unsupported version";
+        case DPTFPolicyBlobBadSize: return "bad size or entry count";
+        case DPTFPolicyBlobBadChecksum: return "checksum mismatch";
+        case DPTFPolicyBlobBadPath: return "bad device path";
+        case DPTFPolicyBlobBadWeight: return "weight out of range";
+        case DPTFPolicyBlobBadPeriod: return "sampling period out of range";
+        case DPTFPolicyBlobBadHysteresis: return "bad or inconsistent hysteresis";
+        case DPTFPolicyBlobBadSpeed: return "fan speed above 100";
+        case DPTFPolicyBlobDuplicate: return "duplicate fan/source pair";
+    }
+
+    return "unknown error";
+}
+
+static bool parseNumber(const char *token, uint32_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(token, &end, 0);
+    if (errno != 0 || *end != '\0' || value > UINT32_MAX) return false;
+
+    *out = (uint32_t) value;
+    return true;
+}
+
+static int build(const char *inPath, const char *outPath) {
+    uint8_t blob[DPTF_POLICY_BLOB_MAX_SIZE] = {};
+    DPTFPolicyBlobEntry *entries = (DPTFPolicyBlobEntry *) (blob + sizeof(DPTFPolicyBlobHeader));
+    uint32_t count = 0;
+    char line[512];
+    int lineNo = 0;
+
+    FILE *in = strcmp(inPath, "-") == 0 ? stdin : fopen(inPath, "r");
+    if (in == nullptr) {
+        fprintf(stderr, "%s: %s\n", inPath, strerror(errno));
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), in) != nullptr) {
+        lineNo++;
+
+        char *comment = strchr(line, '#');
+        if (comment != nullptr) *comment = '\0';
+
+        const char *tokens[5 + DPTF_POLICY_BLOB_MAX_TEMPS];
+        size_t tokenCount = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok != nullptr; tok = strtok(nullptr, " \t\r\n")) {
+            if (tokenCount == sizeof(tokens) / sizeof(tokens[0])) {
+                tokenCount++;
+                break;
+            }
+            tokens[tokenCount++] = tok;
+        }
+
+        if (tokenCount == 0) continue;
+        if (tokenCount != sizeof(tokens) / sizeof(tokens[0])) {
+            fprintf(stderr, "%s:%d: expected %zu fields\n", inPath, lineNo, sizeof(tokens) / sizeof(tokens[0]));
+            return 1;
+        }
+
+        if (count == DPTF_POLICY_BLOB_MAX_ENTRIES) {
+            fprintf(stderr, "%s:%d: more than %d entries\n", inPath, lineNo, DPTF_POLICY_BLOB_MAX_ENTRIES);
+            return 1;
+        }
+
+        DPTFPolicyBlobEntry *entry = &entries[count];
+        if (strlen(tokens[0]) >= sizeof(entry->fan) || strlen(tokens[1]) >= sizeof(entry->source)) {
+            fprintf(stderr, "%s:%d: device path too long\n", inPath, lineNo);
+            return 1;
+        }
+
+        strncpy(entry->fan, tokens[0], sizeof(entry->fan) - 1);
+        strncpy(entry->source, tokens[1], sizeof(entry->source) - 1);
+
+        bool ok = parseNumber(tokens[2], &entry->weight) && parseNumber(tokens[3], &entry->samplingPeriod);
+        if (strcmp(tokens[4], "default") == 0) {
+            entry->hysteresis = DPTF_POLICY_HYSTERESIS_DEFAULT;
+        } else {
+            ok = ok && parseNumber(tokens[4], &entry->hysteresis);
+        }
+
+        for (size_t t = 0; t < DPTF_POLICY_BLOB_MAX_TEMPS; t++) {
+            ok = ok && parseNumber(tokens[5 + t], &entry->maxFanSpeeds[t]);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%d: invalid number\n", inPath, lineNo);
+            return 1;
+        }
+
+        count++;
+    }
+
+    if (in != stdin) fclose(in);
+
+    DPTFPolicyBlobFinalize(blob, count);
+
+    uint32_t badEntry;
+    DPTFPolicyBlobError err = DPTFPolicyBlobValidate(blob, DPTFPolicyBlobSize(count), &badEntry);
+    if (err != DPTFPolicyBlobOK) {
+        fprintf(stderr, "%s: entry %u: %s\n", inPath, badEntry, errorString(err));
+        return 1;
+    }
+
+    FILE *out = fopen(outPath, "wb");
+    if (out == nullptr || fwrite(blob, DPTFPolicyBlobSize(count), 1, out) != 1) {
+        fprintf(stderr, "%s: %s\n", outPath, strerror(errno));
+        return 1;
+    }
+
+    fclose(out);
+    printf("Wrote %u entries (%u bytes) to %s\n", count, DPTFPolicyBlobSize(count), outPath);
+    return 0;
+}
+
+static int readBlob(const char *path, uint8_t *blob, size_t *length) {
+    FILE *in = fopen(path, "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Read one byte past the limit so oversized files are rejected
+    *length = fread(blob, 1, DPTF_POLICY_BLOB_MAX_SIZE + 1, in);
+    fclose(in);
+
+    if (*length > DPTF_POLICY_BLOB_MAX_SIZE) {
+        fprintf(stderr, "%s: larger than %zu bytes\n", path, DPTF_POLICY_BLOB_MAX_SIZE);
+        return 1;
+    }
+
+    uint32_t badEntry;
+    DPTFPolicyBlobError err = DPTFPolicyBlobValidate(blob, *length, &badEntry);
+    if (err != DPTFPolicyBlobOK) {
+        fprintf(stderr, "%s: entry %u: %s\n", path, badEntry, errorString(err));
+        return 1;
+    }
+
+    return 0;
+}
+
+static int validate(const char *path) {
+    uint8_t blob[DPTF_POLICY_BLOB_MAX_SIZE + 1];
+    size_t length;
+
+    if (readBlob(path, blob, &length) != 0) return 1;
+
+    printf("%s: ok\n", path);
+    return 0;
+}
+
+static int dump(const char *path) {
+    uint8_t blob[DPTF_POLICY_BLOB_MAX_SIZE + 1];
+    size_t length;
+
+    if (readBlob(path, blob, &length) != 0) return 1;
+
+    // Output is valid input for build
+    const DPTFPolicyBlobHeader *header = (const DPTFPolicyBlobHeader *) blob;
+    const DPTFPolicyBlobEntry *entries = DPTFPolicyBlobEntries(blob);
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        const DPTFPolicyBlobEntry *entry = &entries[i];
+        printf("%s %s %u %u ", entry->fan, entry->source, entry->weight, entry->samplingPeriod);
+
+        if (entry->hysteresis == DPTF_POLICY_HYSTERESIS_DEFAULT) {
+            printf("default");
+        } else {
+            printf("%u", entry->hysteresis);
+        }
+
+        for (size_t t = 0; t < DPTF_POLICY_BLOB_MAX_TEMPS; t++) {
+            printf(" %u", entry->maxFanSpeeds[t]);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 4 && strcmp(argv[1], "build") == 0) return build(argv[2], argv[3]);
+    if (argc == 3 && strcmp(argv[1], "validate") == 0) return validate(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) return dump(argv[2]);
+
+    fprintf(stderr,
+            "usage: %s build <policy.txt|-> <policy.bin>\n"
+            "       %s validate <policy.bin>\n"
+            "       %s dump <policy.bin>\n", argv[0], argv[0], argv[0]);
+    return 2;
+}
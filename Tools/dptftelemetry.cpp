@@ -0,0 +1,593 @@
+//
+//  dptftelemetry.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/13/23.
+//
+//  Reads evaluation logs written in the DPTFTelemetry.h format, and writes
+//  simulated ones to measure the format without the kext. Plain C++, builds
+//  anywhere:
+//      c++ -std=c++17 -IChultraDPTF/Includes -o dptftelemetry Tools/dptftelemetry.cpp
+//  On macOS, capture also pulls a log from the running kext:
+//      c++ -std=c++17 -IChultraDPTF/Includes -framework IOKit -o dptftelemetry Tools/dptftelemetry.cpp
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "DPTFTelemetry.h"
+#include "DPTFPolicyBlob.h"
+
+#ifdef __APPLE__
+#include <signal.h>
+#include <unistd.h>
+#include <IOKit/IOKitLib.h>
+#endif
+
+static const char *fieldNames[DPTFTelemetryFieldMax] = {
+    "level",
+    "temp",
+    "fan",
+    "rpm",
+    "power",
+    "pl1",
+    "throttle",
+};
+
+static const char *resultString(DPTFTelemetryResult result) {
+    switch (result) {
+        case DPTFTelemetryRecord: return "ok";
+        case DPTFTelemetryChannels: return "ok";
+        case DPTFTelemetrySkipped: return "unknown frame";
+        case DPTFTelemetryNeedMore: return "truncated frame";
+        case DPTFTelemetryBadFrame: return "corrupt frame";
+        case DPTFTelemetryNoChannels: return "record before channel table";
+        case DPTFTelemetryNoKeyframe: return "delta before keyframe";
+    }
+
+    return "unknown error";
+}
+
+static const char *fieldName(uint8_t field) {
+    return field < DPTFTelemetryFieldMax ? fieldNames[field] : "?";
+}
+
+// A keyframe's timestamp without decoding its values
+static bool keyframeTimestamp(const uint8_t *buf, size_t frameLen, uint64_t *timestamp) {
+    size_t pos = 0;
+    uint64_t length;
+
+    if (!DPTFTelemetryGetVarint(buf, frameLen, &pos, &length)) return false;
+    pos++;
+    return DPTFTelemetryGetVarint(buf, frameLen, &pos, timestamp);
+}
+
+//
+// Steps over frames by their length until the first keyframe at or after
+// from, which is decoded and ends the seek. Channel tables still have to
+// be decoded on the way, the records after them need them.
+//
+static DPTFTelemetryResult seekFrame(DPTFTelemetryDecoder *decoder, const uint8_t *buf, size_t len, uint64_t from, size_t *consumed, bool *seeking) {
+    size_t frameLen;
+    uint8_t type;
+    uint64_t timestamp;
+
+    DPTFTelemetryResult result = DPTFTelemetryPeekFrame(buf, len, &frameLen, &type);
+    if (result != DPTFTelemetryRecord) return result;
+
+    if (type == DPTFTelemetryFrameChannels) return DPTFTelemetryDecodeFrame(decoder, buf, len, consumed);
+
+    // A keyframe too short for a timestamp is left to the decoder to report
+    if (type == DPTFTelemetryFrameKeyframe && (!keyframeTimestamp(buf, frameLen, &timestamp) || timestamp >= from)) {
+        *seeking = false;
+        return DPTFTelemetryDecodeFrame(decoder, buf, len, consumed);
+    }
+
+    *consumed = frameLen;
+    return DPTFTelemetrySkipped;
+}
+
+//
+// Reads a log through a fixed buffer and hands every decoded frame to a
+// callback, starting at the first keyframe at or after from. Returns
+// non-zero on I/O or format errors.
+//
+typedef bool (*FrameCallback)(const DPTFTelemetryDecoder *decoder, DPTFTelemetryResult result, size_t frameLen, void *context);
+
+static int decodeFile(const char *path, uint64_t from, FrameCallback callback, void *context) {
+    static uint8_t buf[1 << 16];
+    DPTFTelemetryDecoder decoder;
+    size_t have = 0, offset = sizeof(DPTFTelemetryFileHeader);
+    bool eof = false;
+
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    DPTFTelemetryDecoderInit(&decoder);
+    have = fread(buf, 1, sizeof(buf), in);
+
+    if (!DPTFTelemetryCheckHeader(buf, have)) {
+        fprintf(stderr, "%s: not a version %d telemetry log\n", path, DPTF_TELEMETRY_VERSION);
+        if (in != stdin) fclose(in);
+        return 1;
+    }
+
+    size_t pos = sizeof(DPTFTelemetryFileHeader);
+    bool seeking = from != 0;
+    int ret = 0;
+
+    for (;;) {
+        size_t consumed = 0;
+        bool skipping = seeking;
+        DPTFTelemetryResult result = seeking ? seekFrame(&decoder, buf + pos, have - pos, from, &consumed, &seeking)
+                                             : DPTFTelemetryDecodeFrame(&decoder, buf + pos, have - pos, &consumed);
+
+        if (result == DPTFTelemetryNeedMore) {
+            if (eof) {
+                if (have != pos) {
+                    fprintf(stderr, "%s: offset %zu: %s\n", path, offset, resultString(result));
+                    ret = 1;
+                }
+                break;
+            }
+
+            // Slide what's left to the front and refill
+            memmove(buf, buf + pos, have - pos);
+            have -= pos;
+            pos = 0;
+
+            size_t got = fread(buf + have, 1, sizeof(buf) - have, in);
+            have += got;
+            eof = got == 0;
+            continue;
+        }
+
+        if (result == DPTFTelemetryBadFrame || result == DPTFTelemetryNoChannels || result == DPTFTelemetryNoKeyframe) {
+            fprintf(stderr, "%s: offset %zu: %s\n", path, offset, resultString(result));
+            ret = 1;
+            break;
+        }
+
+        pos += consumed;
+        offset += consumed;
+
+        // Frames stepped over while seeking were never decoded
+        if (skipping && result == DPTFTelemetrySkipped) continue;
+
+        if (!callback(&decoder, result, consumed, context)) break;
+    }
+
+    if (in != stdin) fclose(in);
+    return ret;
+}
+
+//
+// dump: one line per record, the same information IOLogInfo prints each tick
+//
+
+struct DumpState {
+    FILE *out;
+    size_t textBytes;
+};
+
+static bool dumpFrame(const DPTFTelemetryDecoder *decoder, DPTFTelemetryResult result, size_t, void *context) {
+    DumpState *state = (DumpState *) context;
+    if (result != DPTFTelemetryRecord) return true;
+
+    int written = fprintf(state->out, "%llu.%03llu", (unsigned long long) decoder->timestamp / 1000, (unsigned long long) decoder->timestamp % 1000);
+    state->textBytes += written > 0 ? written : 0;
+
+    for (uint32_t i = 0; i < decoder->channelCount; i++) {
+        written = fprintf(state->out, " %s.%s=%lld", decoder->channels[i].path, fieldName(decoder->channels[i].field), (long long) decoder->values[i]);
+        state->textBytes += written > 0 ? written : 0;
+    }
+
+    fputc('\n', state->out);
+    state->textBytes++;
+    return true;
+}
+
+static int dump(const char *path, uint64_t from) {
+    DumpState state = { stdout, 0 };
+    return decodeFile(path, from, dumpFrame, &state);
+}
+
+//
+// stats: frame mix and size against the text dump
+//
+
+// Zone the old core logged everything under, INT3400 is IETM in Intel's firmware
+static const char *BaselineZone = "\\_SB.IETM";
+
+// Level a sensor reports with no trip crossed, AcpiActiveTripCount
+constexpr int64_t BaselineNoTrip = 10;
+
+static size_t infoLine(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+
+    // IOLogInfo wraps every line in "DPTF - Info: " and "\n"
+    return (length > 0 ? length : 0) + strlen("DPTF - Info: ") + 1;
+}
+
+//
+// What the core printed with IOLogInfo for the same evaluation before it
+// kept this log. It listed every rule under its fan, and rules aren't in
+// the log, so each sensor is counted once under the first fan. That makes
+// this a lower bound.
+//
+static size_t baselineTextBytes(const DPTFTelemetryDecoder *decoder) {
+    size_t bytes = infoLine("\tZone %s:", BaselineZone);
+    bool first = true;
+
+    for (uint32_t f = 0; f < decoder->channelCount; f++) {
+        if (decoder->channels[f].field != DPTFTelemetryFieldFanCommand) continue;
+
+        long long command = decoder->values[f];
+        bytes += infoLine("\t\tFan %s:", decoder->channels[f].path);
+
+        for (uint32_t s = 0; first && s < decoder->channelCount; s++) {
+            if (decoder->channels[s].field != DPTFTelemetryFieldLevel) continue;
+
+            bytes += infoLine("\t\t\tSensor %s: %lld", decoder->channels[s].path, (long long) decoder->values[s]);
+            if (decoder->values[s] < BaselineNoTrip) bytes += infoLine("Requested Speed: %lld", command);
+        }
+
+        bytes += infoLine("Fan set to %lld", command);
+        first = false;
+    }
+
+    return bytes;
+}
+
+struct StatsState {
+    DumpState text;
+    size_t baselineBytes;
+    size_t binaryBytes;
+    uint64_t records;
+    uint64_t keyframes;
+    uint64_t channelTables;
+    uint64_t skipped;
+    uint64_t first;
+    uint64_t last;
+};
+
+static bool statsFrame(const DPTFTelemetryDecoder *decoder, DPTFTelemetryResult result, size_t frameLen, void *context) {
+    StatsState *state = (StatsState *) context;
+    state->binaryBytes += frameLen;
+
+    switch (result) {
+        case DPTFTelemetryChannels: state->channelTables++; return true;
+        case DPTFTelemetrySkipped: state->skipped++; return true;
+        default: break;
+    }
+
+    if (state->records == 0) state->first = decoder->timestamp;
+    state->last = decoder->timestamp;
+    state->records++;
+    if (decoder->keyframe) state->keyframes++;
+    state->baselineBytes += baselineTextBytes(decoder);
+
+    return dumpFrame(decoder, result, frameLen, &state->text);
+}
+
+static int stats(const char *path) {
+    StatsState state = {};
+    state.text.out = fopen("/dev/null", "w");
+    state.binaryBytes = sizeof(DPTFTelemetryFileHeader);
+
+    if (state.text.out == nullptr) {
+        fprintf(stderr, "/dev/null: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int ret = decodeFile(path, 0, statsFrame, &state);
+    fclose(state.text.out);
+    if (ret != 0) return ret;
+
+    printf("records:        %llu (%llu keyframes)\n", (unsigned long long) state.records, (unsigned long long) state.keyframes);
+    printf("channel tables: %llu\n", (unsigned long long) state.channelTables);
+    if (state.skipped != 0) printf("unknown frames: %llu\n", (unsigned long long) state.skipped);
+    printf("span:           %.1f s\n", (state.last - state.first) / 1000.0);
+    // One record per evaluation, so this is how often the core woke up to do work
+    if (state.last > state.first) printf("evaluations:    %.0f per hour\n", (state.records - 1) * 3600000.0 / (state.last - state.first));
+    printf("binary:         %zu bytes (%.1f per record)\n", state.binaryBytes, state.records ? (double) state.binaryBytes / state.records : 0.0);
+    printf("as text:        %zu bytes (%.1fx larger)\n", state.text.textBytes, state.binaryBytes ? (double) state.text.textBytes / state.binaryBytes : 0.0);
+    printf("old Info log:   %zu bytes (%.1fx larger)\n", state.baselineBytes, state.binaryBytes ? (double) state.baselineBytes / state.binaryBytes : 0.0);
+    return 0;
+}
+
+//
+// bench: decode throughput
+//
+
+struct BenchState {
+    uint64_t records;
+    int64_t checksum;
+};
+
+static bool benchFrame(const DPTFTelemetryDecoder *decoder, DPTFTelemetryResult result, size_t, void *context) {
+    BenchState *state = (BenchState *) context;
+    if (result != DPTFTelemetryRecord) return true;
+
+    // Touch the values so the decode can't be optimized away
+    state->records++;
+    for (uint32_t i = 0; i < decoder->channelCount; i++) state->checksum += decoder->values[i];
+    return true;
+}
+
+static int bench(const char *path, uint32_t iterations) {
+    BenchState state = {};
+    struct timespec start, end;
+
+    FILE *in = fopen(path, "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fclose(in);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (decodeFile(path, 0, benchFrame, &state) != 0) return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+
+    printf("%u passes, %llu records in %.3f s\n", iterations, (unsigned long long) state.records, seconds);
+    printf("%.1f MB/s, %.0f records/s (checksum %lld)\n", size * (double) iterations / seconds / 1e6, state.records / seconds, (long long) state.checksum);
+    return 0;
+}
+
+//
+// synth: a simulated machine's log, written the way DPTFTelemetry::commit
+// writes the kext's. CPU, skin and charger sensors, one fan and the
+// processor, evaluated every DPTFPollingPeriodMS through bursts of load.
+//
+
+constexpr uint64_t SynthPeriodMS = 10000;
+
+static const DPTFTelemetryChannel synthChannels[] = {
+    { DPTFTelemetryFieldLevel, "\\_SB.PC00.LPCB.EC0.SEN1" },
+    { DPTFTelemetryFieldTemperature, "\\_SB.PC00.LPCB.EC0.SEN1" },
+    { DPTFTelemetryFieldLevel, "\\_SB.PC00.LPCB.EC0.SEN2" },
+    { DPTFTelemetryFieldTemperature, "\\_SB.PC00.LPCB.EC0.SEN2" },
+    { DPTFTelemetryFieldLevel, "\\_SB.PC00.LPCB.EC0.SEN3" },
+    { DPTFTelemetryFieldTemperature, "\\_SB.PC00.LPCB.EC0.SEN3" },
+    { DPTFTelemetryFieldFanCommand, "\\_SB.PC00.LPCB.EC0.TFN1" },
+    { DPTFTelemetryFieldFanSpeed, "\\_SB.PC00.LPCB.EC0.TFN1" },
+    { DPTFTelemetryFieldTemperature, "\\_SB.PC00.TCPU" },
+    { DPTFTelemetryFieldPower, "\\_SB.PC00.TCPU" },
+    { DPTFTelemetryFieldPowerLimit, "\\_SB.PC00.TCPU" },
+    { DPTFTelemetryFieldThrottle, "\\_SB.PC00.TCPU" },
+};
+
+constexpr uint32_t SynthChannelCount = sizeof(synthChannels) / sizeof(synthChannels[0]);
+
+// _AC0 through _AC3 and what the fan runs at for each
+static const int64_t synthTrips[] = { 800, 700, 600, 500 };
+static const int64_t synthSpeeds[] = { 100, 75, 50, 30 };
+
+static bool writeFrame(FILE *out, const uint8_t *payload, size_t length) {
+    uint8_t prefix[10];
+    size_t pos = 0;
+    (void) DPTFTelemetryPutVarint(prefix, sizeof(prefix), &pos, length);
+
+    return fwrite(prefix, 1, pos, out) == pos && fwrite(payload, 1, length, out) == length;
+}
+
+static int64_t synthLevel(int64_t temperature) {
+    for (int64_t level = 0; level < 4; level++) {
+        if (temperature >= synthTrips[level]) return level;
+    }
+
+    return BaselineNoTrip;
+}
+
+static int synth(const char *path, uint32_t hours) {
+    uint8_t frame[DPTF_TELEMETRY_MAX_FRAME];
+    int64_t recorded[SynthChannelCount] = {};
+    uint64_t recordedTime = 0;
+    uint32_t sinceKeyframe = 0;
+    uint32_t seed = 0x2545F491, load = 0;
+    int64_t cpu = 420;
+    bool ok;
+
+    FILE *out = fopen(path, "wb");
+    DPTFTelemetryFileHeader header = { DPTF_TELEMETRY_MAGIC, DPTF_TELEMETRY_VERSION };
+    if (out == nullptr || fwrite(&header, sizeof(header), 1, out) != 1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (out != nullptr) fclose(out);
+        return 1;
+    }
+
+    size_t pos = 0;
+    frame[pos++] = DPTFTelemetryFrameChannels;
+    (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, SynthChannelCount);
+    for (uint32_t i = 0; i < SynthChannelCount; i++) {
+        size_t pathLen = strlen(synthChannels[i].path);
+        frame[pos++] = synthChannels[i].field;
+        (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, pathLen);
+        memcpy(frame + pos, synthChannels[i].path, pathLen);
+        pos += pathLen;
+    }
+    ok = writeFrame(out, frame, pos);
+
+    uint64_t evaluations = hours * 3600000ULL / SynthPeriodMS;
+    for (uint64_t n = 0; n < evaluations && ok; n++) {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t noise = seed >> 28;
+
+        // A new load every few minutes, idle more often than not
+        if (n % 20 == 0) load = (seed >> 16) % 100 < 60 ? 5 : (seed >> 8) % 100;
+
+        int64_t power = 2000 + load * 130 + noise * 20;
+        int64_t target = 400 + power * 3 / 100;
+        cpu += (target - cpu) / 4;
+        int64_t skin = 300 + (cpu - 300) / 2 + noise % 3;
+        int64_t charger = 350 + noise % 5;
+        int64_t level = synthLevel(cpu);
+        int64_t command = level < BaselineNoTrip ? synthSpeeds[level] : 0;
+
+        int64_t values[SynthChannelCount] = {
+            level, cpu, synthLevel(skin), skin, synthLevel(charger), charger,
+            command, command ? command * 52 + noise * 7 : 0,
+            cpu, power, cpu >= 900 ? 9000 : 0, 0,
+        };
+
+        bool key = n == 0 || sinceKeyframe + 1 >= DPTF_TELEMETRY_KEYFRAME_INTERVAL;
+        uint64_t timestamp = n * SynthPeriodMS;
+
+        pos = 0;
+        frame[pos++] = key ? DPTFTelemetryFrameKeyframe : DPTFTelemetryFrameDelta;
+        (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, key ? timestamp : timestamp - recordedTime);
+        for (uint32_t i = 0; i < SynthChannelCount; i++) {
+            int64_t value = key ? values[i] : values[i] - recorded[i];
+            (void) DPTFTelemetryPutVarint(frame, sizeof(frame), &pos, DPTFTelemetryZigZag(value));
+            recorded[i] = values[i];
+        }
+
+        recordedTime = timestamp;
+        sinceKeyframe = key ? 0 : sinceKeyframe + 1;
+        ok = writeFrame(out, frame, pos);
+    }
+
+    if (fclose(out) != 0 || !ok) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    printf("Wrote %llu evaluations to %s\n", (unsigned long long) evaluations, path);
+    return 0;
+}
+
+#ifdef __APPLE__
+static volatile sig_atomic_t stopCapture = 0;
+
+static void onSignal(int) {
+    stopCapture = 1;
+}
+
+//
+// capture: drains the kext's buffer into a log until interrupted
+//
+static int capture(const char *outPath, uint32_t intervalSeconds) {
+    io_service_t service = IOServiceGetMatchingService(kIOMainPortDefault, IOServiceMatching("ChultraThermal"));
+    io_connect_t connect;
+    uint8_t buf[DPTF_TELEMETRY_MAX_READ];
+
+    if (service == IO_OBJECT_NULL) {
+        fprintf(stderr, "ChultraThermal is not loaded\n");
+        return 1;
+    }
+
+    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, &connect);
+    IOObjectRelease(service);
+    if (kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOServiceOpen: 0x%x\n", kr);
+        return 1;
+    }
+
+    FILE *out = fopen(outPath, "wb");
+    DPTFTelemetryFileHeader header = { DPTF_TELEMETRY_MAGIC, DPTF_TELEMETRY_VERSION };
+    if (out == nullptr || fwrite(&header, sizeof(header), 1, out) != 1) {
+        fprintf(stderr, "%s: %s\n", outPath, strerror(errno));
+        IOServiceClose(connect);
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    size_t total = 0;
+    while (!stopCapture) {
+        // Drain everything buffered, then wait for more
+        for (;;) {
+            size_t length = sizeof(buf);
+            kr = IOConnectCallStructMethod(connect, kDPTFUserClientReadTelemetry, nullptr, 0, buf, &length);
+            if (kr != KERN_SUCCESS) {
+                fprintf(stderr, "read telemetry: 0x%x\n", kr);
+                stopCapture = 1;
+                break;
+            }
+
+            if (length == 0) break;
+            fwrite(buf, 1, length, out);
+            total += length;
+        }
+
+        fflush(out);
+        if (!stopCapture) sleep(intervalSeconds);
+    }
+
+    fclose(out);
+    IOServiceClose(connect);
+    printf("Wrote %zu bytes to %s\n", total + sizeof(header), outPath);
+    return 0;
+}
+#endif
+
+static bool parseNumber(const char *token, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(token, &end, 0);
+    if (errno != 0 || *end != '\0') return false;
+
+    *out = value;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint64_t number = 0;
+
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "dump") == 0) {
+        if (argc == 4 && !parseNumber(argv[3], &number)) goto usage;
+        return dump(argv[2], number);
+    }
+
+    if (argc == 3 && strcmp(argv[1], "stats") == 0) return stats(argv[2]);
+
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "bench") == 0) {
+        number = 100;
+        if (argc == 4 && (!parseNumber(argv[3], &number) || number == 0 || number > UINT32_MAX)) goto usage;
+        return bench(argv[2], (uint32_t) number);
+    }
+
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "synth") == 0) {
+        number = 24;
+        if (argc == 4 && (!parseNumber(argv[3], &number) || number == 0 || number > 24 * 365)) goto usage;
+        return synth(argv[2], (uint32_t) number);
+    }
+
+#ifdef __APPLE__
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "capture") == 0) {
+        number = 60;
+        if (argc == 4 && (!parseNumber(argv[3], &number) || number == 0 || number > UINT32_MAX)) goto usage;
+        return capture(argv[2], (uint32_t) number);
+    }
+#endif
+
+usage:
+    fprintf(stderr,
+            "usage: %s dump <log|-> [from_ms]\n"
+            "       %s stats <log|->\n"
+            "       %s bench <log> [passes]\n"
+            "       %s synth <log> [hours]\n", argv[0], argv[0], argv[0], argv[0]);
+#ifdef __APPLE__
+    fprintf(stderr, "       %s capture <log> [interval_s]\n", argv[0]);
+#endif
+    return 2;
+}
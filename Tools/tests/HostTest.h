@@ -0,0 +1,35 @@
+//
+//  HostTest.h
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Shared by the host tests under Tools/tests. CHECK notes a failure and
+//  carries on so one run reports everything, finish gives main its result.
+//
+
+#ifndef HostTest_h
+#define HostTest_h
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static inline int finish(const char *name) {
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif /* HostTest_h */
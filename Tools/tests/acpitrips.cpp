@@ -0,0 +1,236 @@
+//
+//  acpitrips.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for the _ACx/GTSH parsing and tripped level walk that INT3401
+//  and INT3403 share, against a mocked ACPI namespace:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o acpitrips_test Tools/tests/acpitrips.cpp ChultraDPTF/AcpiTrips.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AcpiTrips.hpp"
+#include "HostTest.h"
+
+using namespace ChultraACPIUtils;
+
+// One device's integer methods, values as firmware returns them
+struct MockMethod {
+    const char *name;
+    uint32_t value;
+    bool fails;
+};
+
+struct MockDevice {
+    MockMethod methods[16];
+    size_t count;
+    uint32_t evaluations;
+
+    void set(const char *name, uint32_t value, bool fails = false) {
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(methods[i].name, name) == 0) {
+                methods[i] = {name, value, fails};
+                return;
+            }
+        }
+
+        methods[count++] = {name, value, fails};
+    }
+
+    void remove(const char *name) {
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(methods[i].name, name) == 0) {
+                methods[i] = methods[--count];
+                return;
+            }
+        }
+    }
+};
+
+static bool mockRead(void *context, const char *method, uint32_t *value) {
+    MockDevice *device = static_cast<MockDevice *>(context);
+
+    for (size_t i = 0; i < device->count; i++) {
+        if (strcmp(device->methods[i].name, method) != 0) continue;
+
+        device->evaluations++;
+        if (device->methods[i].fails) return false;
+
+        *value = device->methods[i].value;
+        return true;
+    }
+
+    return false;
+}
+
+// Degrees C to what _ACx returns
+static uint32_t kelvin(uint32_t celsius) {
+    return celsius * 10 + 2732;
+}
+
+// How the walk stores a trip, including the offset it has always added
+static celsius_t trip(uint32_t celsius) {
+    return acpiTempToCelsius(kelvin(celsius)) + 130;
+}
+
+static MockDevice typicalSensor() {
+    MockDevice device {};
+    device.set("_AC0", kelvin(80));
+    device.set("_AC1", kelvin(70));
+    device.set("_AC2", kelvin(60));
+    device.set("_AC3", kelvin(50));
+    device.set("GTSH", 30);
+    device.set("_PSV", kelvin(90));
+    device.set("_CRT", kelvin(105));
+    return device;
+}
+
+static void testParse() {
+    MockDevice device = typicalSensor();
+    ActiveTrips trips;
+
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.points[0] == trip(80));
+    CHECK(trips.points[3] == trip(50));
+    CHECK(trips.points[4] == 0);
+    CHECK(trips.hysteresis == 30 && trips.firmwareHysteresis == 30);
+    CHECK(trips.lastLevel == AcpiActiveTripCount);
+
+    LimitTrips limits;
+    acpiParseLimitTrips(&limits, mockRead, &device);
+    CHECK(limits.passive == 900);
+    CHECK(limits.critical == 1050);
+
+    // Nothing at all is fine, the sensor just never trips
+    MockDevice empty {};
+    ActiveTrips none;
+    LimitTrips noLimits;
+    acpiParseActiveTrips(&none, mockRead, &empty);
+    acpiParseLimitTrips(&noLimits, mockRead, &empty);
+    CHECK(none.points[0] == 0 && none.hysteresis == 0);
+    CHECK(noLimits.passive == 0 && noLimits.critical == 0);
+    CHECK(acpiActiveTripLevel(&none, 1200) == AcpiActiveTripCount);
+}
+
+// Trips stop at the first method that is missing or fails, later ones are never evaluated
+static void testParseStops() {
+    MockDevice device = typicalSensor();
+    ActiveTrips trips;
+
+    device.remove("_AC1");
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.points[0] == trip(80));
+    CHECK(trips.points[1] == 0 && trips.points[2] == 0);
+
+    device = typicalSensor();
+    device.set("_AC2", 0, true);
+    device.evaluations = 0;
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.points[1] == trip(70));
+    CHECK(trips.points[2] == 0 && trips.points[3] == 0);
+    CHECK(device.evaluations == 4);
+}
+
+// An override survives reloads, firmware's value only applies while there is none
+static void testHysteresisReload() {
+    MockDevice device = typicalSensor();
+    ActiveTrips trips;
+
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    trips.hysteresis = 50;
+
+    device.set("GTSH", 40);
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.hysteresis == 50);
+    CHECK(trips.firmwareHysteresis == 40);
+
+    trips.hysteresis = trips.firmwareHysteresis;
+    device.set("GTSH", 20);
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.hysteresis == 20);
+
+    // A failing GTSH keeps what was there
+    device.set("GTSH", 0, true);
+    acpiParseActiveTrips(&trips, mockRead, &device);
+    CHECK(trips.hysteresis == 20 && trips.firmwareHysteresis == 20);
+}
+
+static void testWalkRising() {
+    MockDevice device = typicalSensor();
+    ActiveTrips trips;
+    acpiParseActiveTrips(&trips, mockRead, &device);
+
+    CHECK(acpiActiveTripLevel(&trips, trip(40)) == AcpiActiveTripCount);
+    CHECK(acpiActiveTripLevel(&trips, trip(50)) == AcpiActiveTripCount);
+    CHECK(acpiActiveTripLevel(&trips, trip(50) + 1) == 3);
+    CHECK(acpiActiveTripLevel(&trips, trip(65)) == 2);
+    CHECK(acpiActiveTripLevel(&trips, trip(85)) == 0);
+    CHECK(trips.lastLevel == 0);
+}
+
+static void testWalkFalling() {
+    MockDevice device = typicalSensor();
+    ActiveTrips trips;
+    acpiParseActiveTrips(&trips, mockRead, &device);
+
+    // Level 1 holds until the temperature is a full hysteresis below its trip
+    CHECK(acpiActiveTripLevel(&trips, trip(71)) == 1);
+    CHECK(acpiActiveTripLevel(&trips, trip(70) - 10) == 1);
+    CHECK(acpiActiveTripLevel(&trips, trip(70) - 29) == 1);
+    CHECK(acpiActiveTripLevel(&trips, trip(70) - 30) == 2);
+
+    //
+    // The hysteresis added at the last level carries on to every cooler
+    // trip, so dropping just under _AC2 from level 1 still only steps down
+    // once rather than falling through to level 3.
+    //
+    CHECK(acpiActiveTripLevel(&trips, trip(71)) == 1);
+    CHECK(acpiActiveTripLevel(&trips, trip(60) - 10) == 2);
+    CHECK(acpiActiveTripLevel(&trips, trip(60) - 20) == 2);
+    CHECK(acpiActiveTripLevel(&trips, trip(60) - 31) == 3);
+
+    // Well below everything turns the fan off
+    CHECK(acpiActiveTripLevel(&trips, trip(30)) == AcpiActiveTripCount);
+    CHECK(acpiActiveTripLevel(&trips, trip(50) - 10) == AcpiActiveTripCount);
+}
+
+// No hysteresis, every level follows the temperature exactly
+static void testWalkNoHysteresis() {
+    MockDevice device = typicalSensor();
+    device.remove("GTSH");
+    ActiveTrips trips;
+    acpiParseActiveTrips(&trips, mockRead, &device);
+
+    CHECK(acpiActiveTripLevel(&trips, trip(71)) == 1);
+    CHECK(acpiActiveTripLevel(&trips, trip(70)) == 2);
+    CHECK(acpiActiveTripLevel(&trips, trip(60)) == 3);
+}
+
+static void testFilter() {
+    TempFilter filter;
+
+    CHECK(acpiFilterTemp(&filter, 500) == 500);
+    CHECK(acpiFilterTemp(&filter, 600) == 550);
+    CHECK(acpiFilterTemp(&filter, 600) == 575);
+
+    celsius_t value = 0;
+    for (int i = 0; i < 10; i++) value = acpiFilterTemp(&filter, 600);
+    CHECK(value == 600);
+}
+
+int main() {
+    testParse();
+    testParseStops();
+    testHysteresisReload();
+    testWalkRising();
+    testWalkFalling();
+    testWalkNoHysteresis();
+    testFilter();
+
+    return finish("acpitrips");
+}
@@ -0,0 +1,522 @@
+//
+//  amldecoder.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for AmlDecoder. Tables are mostly assembled here, then decoded
+//  whole, truncated at every length and with every byte mutated. Boards with
+//  a profile also have their tables under acpi/, which must decode to the
+//  profile's rows. Best run under the sanitizers:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF -IChultraDPTF/Includes
+//          -o amldecoder_test Tools/tests/amldecoder.cpp ChultraDPTF/AmlDecoder.cpp ChultraDPTF/BoardProfiles.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "AmlDecoder.hpp"
+#include "BoardProfiles.hpp"
+#include "HostTest.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes cat(std::initializer_list<Bytes> parts) {
+    Bytes out;
+    for (const Bytes &part : parts) out.insert(out.end(), part.begin(), part.end());
+    return out;
+}
+
+// PkgLength counts its own bytes, pick the shortest encoding that fits
+static Bytes pkg(const Bytes &body) {
+    size_t length = body.size() + 1;
+    Bytes out;
+
+    if (length <= 0x3F) {
+        out.push_back(static_cast<uint8_t>(length));
+    } else {
+        size_t extra = 1;
+        while (body.size() + 1 + extra >= (static_cast<size_t>(1) << (4 + 8 * extra))) extra++;
+        length = body.size() + 1 + extra;
+
+        out.push_back(static_cast<uint8_t>(extra << 6 | (length & 0x0F)));
+        for (size_t i = 0; i < extra; i++) out.push_back(static_cast<uint8_t>(length >> (4 + 8 * i)));
+    }
+
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+}
+
+// "\\_SB.DPTF.TFN1", "^TCPU" or "FAN_", segments padded with '_'
+static Bytes name(const char *string) {
+    Bytes prefix;
+    std::vector<Bytes> segs;
+
+    while (*string == '\\' || *string == '^') prefix.push_back(static_cast<uint8_t>(*string++));
+
+    while (*string != '\0') {
+        Bytes seg;
+        while (*string != '\0' && *string != '.') seg.push_back(static_cast<uint8_t>(*string++));
+        while (seg.size() < 4) seg.push_back('_');
+        segs.push_back(seg);
+        if (*string == '.') string++;
+    }
+
+    Bytes out = prefix;
+    if (segs.size() == 2) {
+        out.push_back(0x2E);
+    } else if (segs.size() > 2) {
+        out.push_back(0x2F);
+        out.push_back(static_cast<uint8_t>(segs.size()));
+    }
+
+    for (const Bytes &seg : segs) out.insert(out.end(), seg.begin(), seg.end());
+    return out;
+}
+
+static Bytes integer(uint64_t value) {
+    if (value == 0) return {0x00};
+    if (value == 1) return {0x01};
+    if (value == 0xFFFFFFFF) return {0x0C, 0xFF, 0xFF, 0xFF, 0xFF};
+    if (value <= 0xFF) return {0x0A, static_cast<uint8_t>(value)};
+    if (value <= 0xFFFF) return {0x0B, static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8)};
+    return {0x0C, static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+            static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)};
+}
+
+static Bytes package(const std::vector<Bytes> &elements) {
+    Bytes body {static_cast<uint8_t>(elements.size())};
+    for (const Bytes &element : elements) body.insert(body.end(), element.begin(), element.end());
+    return cat({{0x12}, pkg(body)});
+}
+
+static Bytes scope(const char *path, const Bytes &terms) {
+    return cat({{0x10}, pkg(cat({name(path), terms}))});
+}
+
+static Bytes device(const char *path, const Bytes &terms) {
+    return cat({{0x5B, 0x82}, pkg(cat({name(path), terms}))});
+}
+
+static Bytes nameObject(const char *path, const Bytes &value) {
+    return cat({{0x08}, name(path), value});
+}
+
+static Bytes method(const char *path, const Bytes &body) {
+    return cat({{0x14}, pkg(cat({name(path), {0x00}, body}))});
+}
+
+static Bytes alias(const char *source, const char *path) {
+    return cat({{0x06}, name(source), name(path)});
+}
+
+static Bytes external(const char *path) {
+    return cat({{0x15}, name(path), {0x06, 0x00}});
+}
+
+static Bytes returnValue(const Bytes &value) {
+    return cat({{0xA4}, value});
+}
+
+static Bytes table(const Bytes &terms) {
+    Bytes out(36, 0);
+    memcpy(out.data(), "SSDT", 4);
+    out.insert(out.end(), terms.begin(), terms.end());
+
+    uint32_t length = static_cast<uint32_t>(out.size());
+    for (int i = 0; i < 4; i++) out[4 + i] = static_cast<uint8_t>(length >> (8 * i));
+    return out;
+}
+
+static Bytes artRow(const char *fan, const char *source, uint32_t weight, std::initializer_list<uint32_t> speeds) {
+    std::vector<Bytes> fields {name(fan), name(source), integer(weight)};
+    for (uint32_t speed : speeds) fields.push_back(integer(speed));
+    return package(fields);
+}
+
+static Bytes trtRow(const char *source, const char *target, uint32_t weight, uint32_t period) {
+    return package({name(source), name(target), integer(weight), integer(period),
+                    integer(0), integer(0), integer(0), integer(0)});
+}
+
+// Like a vendor DPTF SSDT: a conditional block, a region, then the tables
+static Bytes sampleTable() {
+    Bytes art = package({
+        integer(0),
+        artRow("\\_SB.DPTF.TFN1", "\\_SB.PCI0.TCPU", 100, {90, 70, 50, 30, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}),
+        artRow("TFN1", "SEN1", 60, {100, 80, 60, 40, 20, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}),
+        artRow("TFN2", "^PCI0.TCPU", 40, {50}),
+    });
+
+    Bytes trt = package({
+        trtRow("\\_SB.PCI0.TCPU", "SEN1", 10, 100),
+        trtRow("TCHG", "SEN2", 20, 600),
+    });
+
+    Bytes region = cat({{0x5B, 0x80}, name("DRGN"), {0x00}, integer(0xFE000000), integer(0x100)});
+    Bytes conditional = cat({{0xA0}, pkg(cat({{0x5B, 0x12}, name("\\_SB.PCI0"), nameObject("DFLG", integer(1))}))});
+    Bytes otherwise = cat({{0xA1}, pkg(nameObject("DFLG", integer(0)))});
+
+    return table(cat({
+        {0x15}, name("\\_SB.PCI0.TCPU"), {0x06, 0x00},
+        conditional,
+        otherwise,
+        scope("\\_SB", device("DPTF", cat({
+            region,
+            nameObject("_HID", {0x0D, 'I', 'N', 'T', '3', '4', '0', '0', 0x00}),
+            method("_TRT", returnValue(trt)),
+            nameObject("_ART", art),
+        }))),
+    }));
+}
+
+static void testSample() {
+    Bytes aml = sampleTable();
+    AmlDecoder::Relations out {};
+
+    CHECK(AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/DPTF", &out));
+    CHECK(out.foundArt && out.foundTrt);
+    CHECK(out.artRevision == 0);
+    CHECK(out.artCount == 3);
+    CHECK(out.trtCount == 2);
+    if (out.artCount != 3 || out.trtCount != 2) return;
+
+    CHECK(strcmp(out.art[0].fan, "/_SB/DPTF/TFN1") == 0);
+    CHECK(strcmp(out.art[0].source, "/_SB/PCI0/TCPU") == 0);
+    CHECK(out.art[0].weight == 100);
+    CHECK(out.art[0].maxFanSpeeds[0] == 90 && out.art[0].maxFanSpeeds[3] == 30);
+    CHECK(out.art[0].maxFanSpeeds[4] == 0);
+
+    // Relative names resolve against the scope holding _ART
+    CHECK(strcmp(out.art[1].fan, "/_SB/DPTF/TFN1") == 0);
+    CHECK(strcmp(out.art[1].source, "/_SB/DPTF/SEN1") == 0);
+    CHECK(out.art[1].maxFanSpeeds[4] == 20);
+    CHECK(strcmp(out.art[2].source, "/_SB/PCI0/TCPU") == 0);
+    CHECK(out.art[2].maxFanSpeeds[0] == 50 && out.art[2].maxFanSpeeds[1] == 0);
+
+    CHECK(strcmp(out.trt[0].source, "/_SB/PCI0/TCPU") == 0);
+    CHECK(strcmp(out.trt[0].target, "/_SB/DPTF/SEN1") == 0);
+    CHECK(out.trt[0].weight == 10 && out.trt[0].samplingPeriod == 100);
+    CHECK(strcmp(out.trt[1].source, "/_SB/DPTF/TCHG") == 0);
+    CHECK(out.trt[1].samplingPeriod == 600);
+
+    AmlDecoder::Relations other {};
+    CHECK(!AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/IETM", &other));
+    CHECK(!other.foundArt && !other.foundTrt);
+}
+
+// DSDT then SSDT, the first table to hold an object wins
+static void testSeveralTables() {
+    Bytes first = table(scope("\\_SB.DPTF", nameObject("_TRT", package({trtRow("SEN1", "SEN2", 1, 10)}))));
+    Bytes second = table(scope("\\_SB.DPTF", cat({
+        nameObject("_TRT", package({trtRow("SEN3", "SEN4", 2, 20)})),
+        nameObject("_ART", package({integer(0), artRow("TFN1", "SEN3", 100, {100})})),
+    })));
+    AmlDecoder::Relations out {};
+
+    CHECK(AmlDecoder::decodeTable(first.data(), first.size(), "/_SB/DPTF", &out));
+    CHECK(out.foundTrt && !out.foundArt);
+    CHECK(AmlDecoder::decodeTable(second.data(), second.size(), "/_SB/DPTF", &out));
+    CHECK(out.foundTrt && out.foundArt);
+    CHECK(out.trtCount == 1 && strcmp(out.trt[0].source, "/_SB/DPTF/SEN1") == 0);
+    CHECK(out.artCount == 1 && strcmp(out.art[0].source, "/_SB/DPTF/SEN3") == 0);
+}
+
+static void resolve(const std::vector<Bytes> &tables, AmlDecoder::Relations *out) {
+    for (const Bytes &aml : tables) AmlDecoder::resolveNames(aml.data(), aml.size(), out);
+}
+
+//
+// Lone NameSegs take the nearest declaration going up from the scope, from
+// any table and whichever order the tables come in. Anything else, or a
+// name nothing declares, stays relative to the scope.
+//
+static void testUpwardSearch() {
+    Bytes dsdt = table(scope("\\_SB", cat({
+        device("FAN0", {}),
+        device("FAN1", {}),
+        device("PCI0", device("FAN2", {})),
+        device("IETM", cat({
+            device("SEN1", {}),
+            method("_ART", returnValue(package({
+                integer(0),
+                artRow("FAN0", "SEN1", 100, {100}),
+                artRow("FAN1", "\\_SB.IETM.SEN1", 100, {100}),
+                artRow("FAN2", "SEN1", 100, {100}),
+                artRow("FAN3", "EXTF", 100, {100}),
+            }))),
+            nameObject("_TRT", package({trtRow("^PCI0.FAN2", "SEN1", 100, 10), trtRow("CPU0", "GONE", 100, 10)})),
+        })),
+    })));
+    Bytes ssdt = table(cat({
+        external("\\_SB.EXTF"),
+        scope("\\_SB.IETM", device("FAN1", {})),
+        alias("\\_SB.PCI0.FAN2", "\\FAN3"),
+        method("\\CPU0", returnValue(integer(0))),
+    }));
+
+    for (int order = 0; order < 2; order++) {
+        AmlDecoder::Relations out {};
+
+        CHECK(AmlDecoder::decodeTable(dsdt.data(), dsdt.size(), "/_SB/IETM", &out));
+        CHECK(out.foundArt && out.foundTrt);
+        CHECK(out.searchCount == 10);
+        if (out.artCount != 4 || out.trtCount != 2) return;
+
+        // Until resolved, relative to the scope holding _ART
+        CHECK(strcmp(out.art[0].fan, "/_SB/IETM/FAN0") == 0);
+
+        if (order == 0) {
+            resolve({dsdt, ssdt}, &out);
+        } else {
+            resolve({ssdt, dsdt}, &out);
+        }
+
+        CHECK(strcmp(out.art[0].fan, "/_SB/FAN0") == 0);
+        CHECK(strcmp(out.art[0].source, "/_SB/IETM/SEN1") == 0);
+
+        // Declared in both \_SB and \_SB.IETM, the nearer one wins
+        CHECK(strcmp(out.art[1].fan, "/_SB/IETM/FAN1") == 0);
+        CHECK(strcmp(out.art[1].source, "/_SB/IETM/SEN1") == 0);
+
+        // \_SB.PCI0 isn't on the way up from \_SB.IETM
+        CHECK(strcmp(out.art[2].fan, "/_SB/IETM/FAN2") == 0);
+
+        // Aliases declare, Externals don't
+        CHECK(strcmp(out.art[3].fan, "/FAN3") == 0);
+        CHECK(strcmp(out.art[3].source, "/_SB/IETM/EXTF") == 0);
+
+        CHECK(strcmp(out.trt[0].source, "/_SB/PCI0/FAN2") == 0);
+        CHECK(strcmp(out.trt[1].source, "/CPU0") == 0);
+        CHECK(strcmp(out.trt[1].target, "/_SB/IETM/GONE") == 0);
+    }
+}
+
+// An opcode with no length ends its scope, the enclosing scope carries on
+static void testUnknownOpcode() {
+    Bytes store = {0x70, 0x01, 'X', 'V', 'A', 'L'};
+    Bytes aml = table(cat({
+        scope("\\_SB.DPTF", cat({store, nameObject("_TRT", package({trtRow("SEN1", "SEN2", 1, 10)}))})),
+        scope("\\_SB.DPTF", nameObject("_ART", package({integer(0), artRow("TFN1", "SEN1", 100, {100})}))),
+    }));
+    AmlDecoder::Relations out {};
+
+    CHECK(AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/DPTF", &out));
+    CHECK(!out.foundTrt);
+    CHECK(out.foundArt && out.artCount == 1);
+}
+
+// Only the smaller of the header length and the buffer is read
+static void testHeaderLength() {
+    Bytes aml = sampleTable();
+    AmlDecoder::Relations out {};
+
+    Bytes header(aml.begin(), aml.begin() + 36);
+    CHECK(!AmlDecoder::decodeTable(header.data(), header.size(), "/_SB/DPTF", &out));
+    CHECK(!AmlDecoder::decodeTable(aml.data(), 35, "/_SB/DPTF", &out));
+    CHECK(!AmlDecoder::decodeTable(nullptr, aml.size(), "/_SB/DPTF", &out));
+
+    aml[4] = 36;
+    aml[5] = aml[6] = aml[7] = 0;
+    CHECK(!AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/DPTF", &out));
+}
+
+static bool terminated(const char *string, size_t length) {
+    return memchr(string, '\0', length) != nullptr;
+}
+
+static void checkSane(const AmlDecoder::Relations &out) {
+    CHECK(out.artCount <= AmlDecoder::MaxRelations);
+    CHECK(out.trtCount <= AmlDecoder::MaxRelations);
+    CHECK(out.foundArt || out.artCount == 0);
+    CHECK(out.foundTrt || out.trtCount == 0);
+    CHECK(out.searchCount <= AmlDecoder::MaxSearches);
+
+    for (size_t i = 0; i < out.searchCount && i < AmlDecoder::MaxSearches; i++) {
+        const AmlDecoder::NameSearch &search = out.searches[i];
+        CHECK(terminated(search.scope, AmlDecoder::MaxPath));
+        CHECK(search.row < (search.field < 2 ? out.artCount : out.trtCount));
+    }
+
+    for (size_t i = 0; i < out.artCount && i < AmlDecoder::MaxRelations; i++) {
+        CHECK(terminated(out.art[i].fan, AmlDecoder::MaxPath));
+        CHECK(terminated(out.art[i].source, AmlDecoder::MaxPath));
+    }
+
+    for (size_t i = 0; i < out.trtCount && i < AmlDecoder::MaxRelations; i++) {
+        CHECK(terminated(out.trt[i].source, AmlDecoder::MaxPath));
+        CHECK(terminated(out.trt[i].target, AmlDecoder::MaxPath));
+    }
+}
+
+// Each copy is its own exact sized allocation so the sanitizer sees any overread
+static void decodeCopy(const uint8_t *data, size_t length, bool patchHeader) {
+    uint8_t *copy = static_cast<uint8_t *>(malloc(length == 0 ? 1 : length));
+    memcpy(copy, data, length);
+
+    if (patchHeader && length >= 8) {
+        for (int i = 0; i < 4; i++) copy[4 + i] = static_cast<uint8_t>(length >> (8 * i));
+    }
+
+    AmlDecoder::Relations out {};
+    (void) AmlDecoder::decodeTable(copy, length, "/_SB/DPTF", &out);
+    AmlDecoder::resolveNames(copy, length, &out);
+    checkSane(out);
+    free(copy);
+}
+
+static void testTruncated() {
+    Bytes aml = sampleTable();
+
+    for (size_t length = 0; length <= aml.size(); length++) {
+        decodeCopy(aml.data(), length, false);
+        decodeCopy(aml.data(), length, true);
+    }
+
+    // Cut short by the header alone, decoding must stop at the header length
+    AmlDecoder::Relations out {};
+    Bytes shortened = aml;
+    uint32_t length = static_cast<uint32_t>(aml.size() - 10);
+    for (int i = 0; i < 4; i++) shortened[4 + i] = static_cast<uint8_t>(length >> (8 * i));
+    (void) AmlDecoder::decodeTable(shortened.data(), shortened.size(), "/_SB/DPTF", &out);
+    checkSane(out);
+}
+
+static void testMutated() {
+    const uint8_t values[] = {0x00, 0x01, 0x0C, 0x0E, 0x10, 0x12, 0x2F, 0x3F, 0x5B, 0x5C, 0x5E, 0x7F, 0x80, 0xC0, 0xFF};
+    Bytes aml = sampleTable();
+
+    for (size_t i = 8; i < aml.size(); i++) {
+        Bytes mutated = aml;
+
+        for (uint8_t value : values) {
+            mutated[i] = value;
+            decodeCopy(mutated.data(), mutated.size(), false);
+        }
+
+        mutated[i] = static_cast<uint8_t>(aml[i] ^ 0x40);
+        decodeCopy(mutated.data(), mutated.size(), false);
+    }
+
+    // Random bytes after a valid header, fixed seed so failures reproduce
+    uint32_t state = 0x3404;
+    for (int round = 0; round < 2000; round++) {
+        Bytes noise = aml;
+        for (int j = 0; j < 8; j++) {
+            state = state * 1664525 + 1013904223;
+            size_t at = 36 + (state >> 8) % (aml.size() - 36);
+            state = state * 1664525 + 1013904223;
+            noise[at] = static_cast<uint8_t>(state >> 24);
+        }
+
+        decodeCopy(noise.data(), noise.size(), false);
+    }
+}
+
+// Deep nesting and long paths must hit the limits rather than the stack
+static void testLimits() {
+    Bytes terms = nameObject("_ART", package({integer(0), artRow("TFN1", "SEN1", 100, {100})}));
+    for (int i = 0; i < 40; i++) terms = scope("DPTF", terms);
+
+    Bytes aml = table(terms);
+    AmlDecoder::Relations out {};
+    CHECK(!AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/DPTF", &out));
+    checkSane(out);
+
+    std::vector<Bytes> rows {integer(0)};
+    for (size_t i = 0; i <= AmlDecoder::MaxRelations; i++) rows.push_back(artRow("TFN1", "SEN1", 1, {100}));
+
+    aml = table(scope("\\_SB.DPTF", nameObject("_ART", package(rows))));
+    out = {};
+    CHECK(!AmlDecoder::decodeTable(aml.data(), aml.size(), "/_SB/DPTF", &out));
+    CHECK(!out.foundArt && out.artCount == 0);
+    CHECK(out.searchCount == 0);
+}
+
+static Bytes readTable(const char *board, const char *file) {
+    std::string path = __FILE__;
+    path = path.substr(0, path.find_last_of('/') + 1) + "acpi/" + board + "/" + file;
+
+    Bytes out;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) return out;
+
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), fp)) > 0) out.insert(out.end(), buffer, buffer + length);
+
+    fclose(fp);
+    return out;
+}
+
+//
+// KLED's DSDT and DPTF SSDT, decoded and resolved the way ChultraInt3400
+// does it, must give exactly the rows its board profile carries
+//
+static void testBoardTables() {
+    Bytes dsdt = readTable("KLED", "dsdt.aml");
+    Bytes ssdt = readTable("KLED", "ssdt1.aml");
+    CHECK(dsdt.size() > 36 && ssdt.size() > 36);
+    if (dsdt.size() <= 36 || ssdt.size() <= 36) return;
+
+    // Looked up by OEM table ID like the kext does without DMI
+    char tableId[9] {};
+    memcpy(tableId, dsdt.data() + 16, 8);
+    const DPTFBoardProfile *profile = DPTFLookupBoardProfile(tableId);
+    CHECK(profile != nullptr);
+    if (profile == nullptr) return;
+
+    AmlDecoder::Relations out {};
+    (void) AmlDecoder::decodeTable(dsdt.data(), dsdt.size(), "/_SB/DPTF", &out);
+    CHECK(AmlDecoder::decodeTable(ssdt.data(), ssdt.size(), "/_SB/DPTF", &out));
+    resolve({dsdt, ssdt}, &out);
+
+    CHECK(out.foundArt && out.foundTrt);
+    CHECK(out.searchCount > 0);
+    for (size_t i = 0; i < out.searchCount; i++) CHECK(out.searches[i].found);
+
+    CHECK(out.artCount == profile->artCount);
+    for (size_t i = 0; i < out.artCount && i < profile->artCount; i++) {
+        CHECK(strcmp(out.art[i].fan, profile->art[i].fanDev) == 0);
+        CHECK(strcmp(out.art[i].source, profile->art[i].source) == 0);
+        CHECK(out.art[i].weight == profile->art[i].weight);
+        CHECK(memcmp(out.art[i].maxFanSpeeds, profile->art[i].maxFanSpeed, sizeof(out.art[i].maxFanSpeeds)) == 0);
+    }
+
+    CHECK(out.trtCount == profile->trtCount);
+    for (size_t i = 0; i < out.trtCount && i < profile->trtCount; i++) {
+        CHECK(strcmp(out.trt[i].source, profile->trt[i].heatSource) == 0);
+        CHECK(strcmp(out.trt[i].target, profile->trt[i].sensor) == 0);
+        CHECK(out.trt[i].weight == profile->trt[i].weight);
+        CHECK(out.trt[i].samplingPeriod == profile->trt[i].samplingPeriod);
+    }
+
+    // The real tables get the same truncation and mutation as the assembled ones
+    for (const Bytes *aml : {&dsdt, &ssdt}) {
+        for (size_t length = 0; length <= aml->size(); length++) decodeCopy(aml->data(), length, true);
+        for (size_t i = 8; i < aml->size(); i++) {
+            Bytes mutated = *aml;
+            mutated[i] = static_cast<uint8_t>(mutated[i] ^ 0x40);
+            decodeCopy(mutated.data(), mutated.size(), false);
+        }
+    }
+}
+
+int main() {
+    testSample();
+    testSeveralTables();
+    testUpwardSearch();
+    testUnknownOpcode();
+    testHeaderLength();
+    testTruncated();
+    testMutated();
+    testLimits();
+    testBoardTables();
+
+    return finish("amldecoder");
+}
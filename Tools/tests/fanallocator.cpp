@@ -0,0 +1,363 @@
+//
+//  fanallocator.cpp
+//  ChultraDPTF
+//
+//  Host test for FanAllocator. Splits cooling across two or more fans of
+//  a zone, checks every source still gets the weighted cooling its rules
+//  ask for, that fans stay off or within their floor and ceiling, and
+//  compares fan power and peak temperature against each fan on its own:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o fanallocator_test Tools/tests/fanallocator.cpp ChultraDPTF/FanAllocator.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FanAllocator.hpp"
+#include "HostTest.h"
+
+constexpr uint32_t MaxFans = 4;
+constexpr uint32_t MaxRules = 16;
+constexpr uint32_t MaxSources = 4;
+
+// One zone, each fan's rules next to each other like the policy table has them
+struct Zone {
+    FanAllocator::Fan fans[MaxFans];
+    uint32_t fanCount;
+    FanAllocator::Rule rules[MaxRules];
+    uint32_t ruleCount;
+    FanAllocator::Source sources[MaxSources];
+
+    uint32_t addFan(uint32_t stepSize, uint32_t maxPower, uint32_t floor = 0, uint32_t ceiling = 100) {
+        fans[fanCount] = {stepSize, maxPower, floor, ceiling, ruleCount, 0, 0, 0};
+        return fanCount++;
+    }
+
+    // Rules go on the fan added last
+    void addRule(uint32_t source, uint32_t weight, uint32_t speed) {
+        FanAllocator::Fan *fan = &fans[fanCount - 1];
+        rules[ruleCount++] = {source, weight, speed};
+        fan->ruleCount++;
+        if (speed > fan->independent) fan->independent = speed;
+    }
+
+    void allocate() {
+        FanAllocator::allocate(fans, fanCount, rules, sources);
+    }
+
+    uint64_t weights(uint32_t source) const {
+        uint64_t sum = 0;
+        for (uint32_t r = 0; r < ruleCount; r++) {
+            if (rules[r].source == source) sum += rules[r].weight;
+        }
+        return sum;
+    }
+
+    // Weighted cooling a source asks for, or gets from the given levels
+    uint64_t cooling(uint32_t source, const uint32_t *levels) const {
+        uint64_t all = weights(source);
+        uint64_t sum = 0;
+
+        for (uint32_t i = 0; i < fanCount; i++) {
+            for (uint32_t r = fans[i].firstRule; r < fans[i].firstRule + fans[i].ruleCount; r++) {
+                if (rules[r].source != source) continue;
+                sum += (all == 0 ? 1 : rules[r].weight) * (levels != nullptr ? levels[i] : rules[r].speed);
+            }
+        }
+
+        return sum;
+    }
+
+    void allocated(uint32_t *levels) const {
+        for (uint32_t i = 0; i < fanCount; i++) levels[i] = fans[i].allocated;
+    }
+
+    void ceilings(uint32_t *levels) const {
+        for (uint32_t i = 0; i < fanCount; i++) levels[i] = fans[i].ceiling;
+    }
+
+    void independent(uint32_t *levels) const {
+        for (uint32_t i = 0; i < fanCount; i++) levels[i] = FanAllocator::clamp(fans[i], fans[i].independent);
+    }
+
+    // Cube law, the same the allocator assumes, in mW
+    uint64_t power(const uint32_t *levels) const {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < fanCount; i++) sum += static_cast<uint64_t>(fans[i].maxPower) * levels[i] * levels[i] * levels[i] / 1000000;
+        return sum;
+    }
+};
+
+//
+// Every source gets the cooling its rules ask for, or as much as the fans
+// can give at their ceilings, and no fan runs outside its floor and ceiling
+//
+static void checkInvariants(const Zone &zone) {
+    uint32_t levels[MaxFans], top[MaxFans];
+    zone.allocated(levels);
+    zone.ceilings(top);
+
+    for (uint32_t i = 0; i < zone.fanCount; i++) {
+        const FanAllocator::Fan &fan = zone.fans[i];
+        CHECK(fan.allocated == 0 || fan.allocated >= fan.floor || fan.allocated == fan.ceiling);
+        CHECK(fan.allocated <= fan.ceiling);
+    }
+
+    for (uint32_t s = 0; s < MaxSources; s++) {
+        uint64_t demand = zone.cooling(s, nullptr);
+        uint64_t reachable = zone.cooling(s, top);
+        CHECK(zone.cooling(s, levels) >= (demand < reachable ? demand : reachable));
+    }
+}
+
+// Source 0 is the processor, 1 the skin; a 3 W fan at full speed
+constexpr uint32_t Cpu = 0;
+constexpr uint32_t Skin = 1;
+constexpr uint32_t FanPower = 3000;
+
+//
+// Steady state: each source sits at its temperature with the fans off,
+// less 0.4 degrees for every weighted percent of fan on it
+//
+static uint32_t peak(const Zone &zone, const uint32_t *levels, const uint32_t *unfanned) {
+    uint32_t hottest = 0;
+
+    for (uint32_t s = 0; s < MaxSources; s++) {
+        if (unfanned[s] == 0) continue;
+
+        uint64_t all = zone.weights(s);
+        uint64_t cooled = 0;
+        for (uint32_t i = 0; i < zone.fanCount; i++) {
+            for (uint32_t r = zone.fans[i].firstRule; r < zone.fans[i].firstRule + zone.fans[i].ruleCount; r++) {
+                if (zone.rules[r].source == s) cooled += zone.rules[r].weight * levels[i] * 4 / (all == 0 ? 1 : all);
+            }
+        }
+
+        uint32_t temperature = cooled < unfanned[s] ? unfanned[s] - static_cast<uint32_t>(cooled) : 0;
+        if (temperature > hottest) hottest = temperature;
+    }
+
+    return hottest;
+}
+
+static void report(const char *name, const Zone &zone, const uint32_t *unfanned) {
+    uint32_t alone[MaxFans], shared[MaxFans];
+    zone.independent(alone);
+    zone.allocated(shared);
+
+    printf("%-24s alone %3u/%3u %4llu mW peak %5.1f C, shared %3u/%3u %4llu mW peak %5.1f C\n", name,
+           alone[0], alone[1], static_cast<unsigned long long>(zone.power(alone)), peak(zone, alone, unfanned) / 10.0,
+           shared[0], shared[1], static_cast<unsigned long long>(zone.power(shared)), peak(zone, shared, unfanned) / 10.0);
+}
+
+// TFN1 sits on the processor, TFN2 mostly cools the chassis
+static void testNearFan() {
+    Zone zone {};
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 80, 80);
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 20, 80);
+    zone.allocate();
+
+    uint32_t unfanned[MaxSources] = {950};
+    uint32_t alone[MaxFans], shared[MaxFans];
+    zone.independent(alone);
+    zone.allocated(shared);
+    report("processor 80/20", zone, unfanned);
+
+    checkInvariants(zone);
+    CHECK(shared[0] > shared[1]);
+    CHECK(zone.power(shared) < zone.power(alone));
+    CHECK(peak(zone, shared, unfanned) <= peak(zone, alone, unfanned));
+}
+
+// Two sources pulling opposite ways, both still get their cooling
+static void testTwoSources() {
+    Zone zone {};
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 80, 80);
+    zone.addRule(Skin, 30, 30);
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 20, 80);
+    zone.addRule(Skin, 70, 30);
+    zone.allocate();
+
+    uint32_t unfanned[MaxSources] = {950, 500};
+    uint32_t alone[MaxFans], shared[MaxFans];
+    zone.independent(alone);
+    zone.allocated(shared);
+    report("processor + skin", zone, unfanned);
+
+    checkInvariants(zone);
+    CHECK(zone.power(shared) <= zone.power(alone));
+    CHECK(peak(zone, shared, unfanned) <= peak(zone, alone, unfanned));
+}
+
+// Equal weights give both fans the same job, which is what they did alone
+static void testEqualWeights() {
+    Zone zone {};
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 50, 60);
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 50, 60);
+    zone.allocate();
+
+    checkInvariants(zone);
+    CHECK(zone.fans[0].allocated == 60 && zone.fans[1].allocated == 60);
+
+    // All zero weights count the fans as equal too
+    Zone unweighted {};
+    unweighted.addFan(5, FanPower);
+    unweighted.addRule(Cpu, 0, 40);
+    unweighted.addFan(5, FanPower);
+    unweighted.addRule(Cpu, 0, 40);
+    unweighted.allocate();
+
+    checkInvariants(unweighted);
+    CHECK(unweighted.fans[0].allocated == 40 && unweighted.fans[1].allocated == 40);
+}
+
+// The near fan tops out early, the other one picks up what it can't give
+static void testCeiling() {
+    Zone zone {};
+    zone.addFan(5, FanPower, 0, 60);
+    zone.addRule(Cpu, 80, 80);
+    zone.addFan(5, FanPower);
+    zone.addRule(Cpu, 20, 80);
+    zone.allocate();
+
+    uint32_t unfanned[MaxSources] = {950};
+    report("processor, ceiling 60", zone, unfanned);
+
+    checkInvariants(zone);
+    CHECK(zone.fans[0].allocated == 60);
+    CHECK(zone.fans[1].allocated > 80);
+
+    // Not enough between them, both run flat out rather than giving up
+    Zone starved {};
+    starved.addFan(5, FanPower, 0, 50);
+    starved.addRule(Cpu, 50, 90);
+    starved.addFan(5, FanPower, 0, 70);
+    starved.addRule(Cpu, 50, 90);
+    starved.allocate();
+
+    checkInvariants(starved);
+    CHECK(starved.fans[0].allocated == 50 && starved.fans[1].allocated == 70);
+}
+
+// A fan that can't spin slower than its floor is either off or at least there
+static void testFloor() {
+    Zone zone {};
+    zone.addFan(5, FanPower, 40);
+    zone.addRule(Cpu, 50, 10);
+    zone.addFan(5, FanPower, 40);
+    zone.addRule(Cpu, 50, 10);
+    zone.allocate();
+
+    checkInvariants(zone);
+    CHECK(zone.fans[0].allocated == 0 || zone.fans[0].allocated >= 40);
+    CHECK(zone.fans[1].allocated == 0 || zone.fans[1].allocated >= 40);
+
+    // One fan at its floor covers both requests, the other stays off
+    CHECK((zone.fans[0].allocated == 0) != (zone.fans[1].allocated == 0));
+
+    // Nothing asked, nothing runs, floor or not
+    Zone idle {};
+    idle.addFan(5, FanPower, 40);
+    idle.addRule(Cpu, 50, 0);
+    idle.addFan(5, FanPower, 40);
+    idle.addRule(Cpu, 50, 0);
+    idle.allocate();
+
+    CHECK(idle.fans[0].allocated == 0 && idle.fans[1].allocated == 0);
+}
+
+// Levels only move in whole steps from where the fan starts
+static void testSteps() {
+    Zone zone {};
+    zone.addFan(25, FanPower);
+    zone.addRule(Cpu, 70, 50);
+    zone.addFan(25, FanPower);
+    zone.addRule(Cpu, 30, 50);
+    zone.allocate();
+
+    checkInvariants(zone);
+    for (uint32_t i = 0; i < zone.fanCount; i++) {
+        uint32_t level = zone.fans[i].allocated;
+        CHECK(level % 25 == 0 || level == zone.fans[i].independent);
+    }
+}
+
+struct Random {
+    uint32_t state;
+
+    uint32_t next(uint32_t range) {
+        state = state * 1664525 + 1013904223;
+        return (state >> 8) % range;
+    }
+};
+
+// Any zone the table could hold
+static void testRandomZones() {
+    Random random {0x3404};
+    uint64_t sharedPower = 0;
+    uint64_t alonePower = 0;
+
+    for (int run = 0; run < 5000; run++) {
+        Zone zone {};
+        uint32_t fans = 2 + random.next(MaxFans - 1);
+        bool knownPower = random.next(4) != 0;
+
+        for (uint32_t i = 0; i < fans; i++) {
+            uint32_t floor = random.next(3) == 0 ? random.next(50) : 0;
+            uint32_t ceiling = random.next(3) == 0 ? 40 + random.next(61) : 100;
+            zone.addFan(1 + random.next(20), knownPower ? 1000 + random.next(5000) : 0, floor, ceiling);
+
+            uint32_t rules = 1 + random.next(MaxRules / MaxFans);
+            for (uint32_t r = 0; r < rules; r++) zone.addRule(random.next(MaxSources), random.next(101), random.next(11) * 10);
+        }
+
+        zone.allocate();
+        checkInvariants(zone);
+
+        uint32_t alone[MaxFans], shared[MaxFans];
+        zone.independent(alone);
+        zone.allocated(shared);
+
+        //
+        // Where the fans on their own already cover every source, sharing
+        // never costs more. Where a ceiling stops them, it costs what it
+        // takes. Without every fan's power it can't know either way.
+        //
+        uint32_t top[MaxFans];
+        zone.ceilings(top);
+
+        bool covered = true;
+        for (uint32_t s = 0; s < MaxSources; s++) {
+            uint64_t demand = zone.cooling(s, nullptr);
+            uint64_t reachable = zone.cooling(s, top);
+            covered = covered && zone.cooling(s, alone) >= (demand < reachable ? demand : reachable);
+        }
+
+        if (knownPower && covered) {
+            CHECK(zone.power(shared) <= zone.power(alone) + zone.fanCount);
+            sharedPower += zone.power(shared);
+            alonePower += zone.power(alone);
+        }
+    }
+
+    printf("random zones: %llu mW shared against %llu mW alone\n",
+           static_cast<unsigned long long>(sharedPower), static_cast<unsigned long long>(alonePower));
+}
+
+int main() {
+    testNearFan();
+    testTwoSources();
+    testEqualWeights();
+    testCeiling();
+    testFloor();
+    testSteps();
+    testRandomZones();
+
+    return finish("fanallocator");
+}
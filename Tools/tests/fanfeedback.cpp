@@ -0,0 +1,253 @@
+//
+//  fanfeedback.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for FanFeedback. Drives a simulated fan through the same
+//  GetStatus, apply, SetLvl round the core makes each evaluation, with a
+//  fan that spins up slowly and one that has worn out:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o fanfeedback_test Tools/tests/fanfeedback.cpp ChultraDPTF/FanFeedback.cpp
+//
+
+#include <math.h>
+#include <stdio.h>
+
+#include "FanFeedback.hpp"
+#include "HostTest.h"
+
+using FanFeedback::Unknown;
+
+// Seconds between evaluations, DPTFPollingPeriodMS
+constexpr int EvaluationPeriod = 10;
+
+// Value of DPTFNoRequest
+constexpr uint32_t NoRequest = 0xFFFFFFFF;
+
+// _FPS of a plain laptop fan
+static const FanFeedback::SpeedPoint Curve[] = {
+    {0, 0}, {20, 1800}, {40, 2600}, {60, 3400}, {80, 4200}, {100, 5000},
+};
+constexpr uint32_t CurvePoints = sizeof(Curve) / sizeof(Curve[0]);
+
+//
+// The fan and its driver. _FST reads back the level last set and an RPM
+// that moves towards health times the curve with the fan's spin-up time
+// constant.
+//
+struct Fan {
+    FanFeedback::Sensor sensor {Unknown, 0, 0, false, false, 0};
+    double health {1.0};
+    double tau {0.0};       // Seconds, 0 reaches speed at once
+    double rpm {0.0};
+    uint32_t level {0};     // What the EC runs it at
+
+    void set(uint32_t newLevel) {
+        sensor.lastState = newLevel;
+        level = newLevel;
+    }
+
+    void step(int seconds) {
+        double target = health * FanFeedback::expectedSpeed(Curve, CurvePoints, level);
+        for (int t = 0; t < seconds; t++) {
+            rpm = tau == 0 ? target : rpm + (target - rpm) * (1 - exp(-1 / tau));
+        }
+    }
+
+    FanFeedback::Status read() {
+        (void) FanFeedback::sample(&sensor, Curve, CurvePoints, level, static_cast<uint32_t>(rpm), false);
+        return FanFeedback::status(sensor, Curve, CurvePoints);
+    }
+};
+
+struct Core {
+    FanFeedback::Control control {0, NoRequest, 0, false};
+    FanFeedback::Status status {};
+    bool starved {false};
+
+    void evaluate(Fan &fan, uint32_t level) {
+        status = fan.read();
+        starved = FanFeedback::apply(&control, level, &status);
+        fan.set(control.command);
+        fan.step(EvaluationPeriod);
+    }
+};
+
+static void testCurve() {
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, 0) == 0);
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, 20) == 1800);
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, 30) == 2200);
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, 100) == 5000);
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, 120) == 5000);
+    CHECK(FanFeedback::expectedSpeed(Curve, CurvePoints, Unknown) == 0);
+    CHECK(FanFeedback::expectedSpeed(Curve, 0, 50) == 0);
+
+    // Below the first point scales from zero, odd tables may slow down
+    const FanFeedback::SpeedPoint odd[] = {{40, 2000}, {60, 1500}, {60, 1600}};
+    CHECK(FanFeedback::expectedSpeed(odd, 3, 20) == 1000);
+    CHECK(FanFeedback::expectedSpeed(odd, 3, 50) == 1750);
+    CHECK(FanFeedback::expectedSpeed(odd, 3, 60) == 1500);
+}
+
+//
+// A healthy fan that takes half a minute to spin up, so its RPM lags the
+// curve for a few evaluations after each step. The command rises above
+// the request while it lags, but not to 100, and falls back to the
+// request once it keeps up. It never counts as starved.
+//
+static void testLagging() {
+    Fan fan;
+    Core core;
+    fan.tau = 30;
+
+    const uint32_t requests[] = {20, 60};
+    for (uint32_t request : requests) {
+        uint32_t highest = 0;
+        bool starved = false;
+
+        for (int i = 0; i < 20; i++) {
+            core.evaluate(fan, request);
+            if (core.control.command > highest) highest = core.control.command;
+            starved = starved || core.starved;
+        }
+
+        printf("lagging: command peaked at %u for a request of %u, settled at %u, %.0f of %u RPM\n", highest, request,
+               core.control.command, fan.rpm, FanFeedback::expectedSpeed(Curve, CurvePoints, request));
+
+        CHECK(highest > request && highest < 100);
+        CHECK(!starved);
+        CHECK(core.control.boost == 0);
+        CHECK(core.control.command == request);
+        CHECK(core.control.achieved == request);
+    }
+}
+
+//
+// A fan that only reaches 70% of its curve. Boost walks the command up
+// until the fan makes the level asked and holds it there. A level it
+// can't make even at 100 is starved, but only once it was read at 100.
+// Once nothing needs it, the boost goes back down.
+//
+static void testWorn() {
+    Fan fan;
+    Core core;
+    fan.health = 0.7;
+
+    for (int i = 0; i < 12; i++) {
+        core.evaluate(fan, 60);
+        CHECK(!core.starved);
+    }
+
+    printf("worn at 60: command %u, boost %u, achieved %u\n", core.control.command, core.control.boost, core.control.achieved);
+
+    CHECK(core.control.command > 60 && core.control.command < 100);
+    CHECK(core.control.achieved >= 60);
+
+    uint32_t escalations = 0;
+    for (int i = 0; i < 12; i++) {
+        core.evaluate(fan, 80);
+        CHECK(core.status.underperforming);
+
+        // Starved only once the fan was already running at 100 when it was read
+        CHECK(core.starved == (core.status.commanded == 100));
+        if (core.starved) escalations++;
+    }
+
+    printf("worn at 80: command %u, boost %u, achieved %u, starved %d\n", core.control.command, core.control.boost, core.control.achieved,
+           core.starved);
+
+    CHECK(core.control.command == 100);
+    CHECK(escalations > 0 && escalations < 12);
+    CHECK(core.control.achieved >= 65 && core.control.achieved <= 75);
+
+    // Nothing asks for the fan, it stops and the boost drains
+    for (int i = 0; i < 12; i++) core.evaluate(fan, 0);
+    CHECK(core.control.command == 0);
+    CHECK(core.control.boost == 0);
+    CHECK(!core.starved);
+}
+
+// Starvation needs the fan read at 100, a fresh command of 100 isn't enough
+static void testStarvedOnlyAtFull() {
+    FanFeedback::Control control {0, NoRequest, 0, false};
+    FanFeedback::Status status {90, 2000, 4600, true};
+
+    CHECK(!FanFeedback::apply(&control, 100, &status));
+    CHECK(control.achieved == 39);
+    CHECK(control.command == 100 && control.boost == DPTFFanBoostStep);
+
+    status.commanded = 100;
+    status.expectedSpeed = 5000;
+    CHECK(FanFeedback::apply(&control, 100, &status));
+    CHECK(control.boost == DPTFFanBoostStep);
+
+    // Short of the curve at 100 but making the level asked isn't starved
+    CHECK(!FanFeedback::apply(&control, 40, &status));
+    CHECK(control.boost == DPTFFanBoostStep);
+
+    // Level unknown after an EC override says nothing about being at full speed
+    status.commanded = Unknown;
+    CHECK(!FanFeedback::apply(&control, 100, &status));
+    CHECK(control.achieved == 100);
+
+    // No answer leaves the boost where it was
+    control.boost = 20;
+    CHECK(!FanFeedback::apply(&control, 50, nullptr));
+    CHECK(control.boost == 20 && control.command == 70 && control.achieved == 50);
+}
+
+// The EC moving the fan is counted and the level forgotten
+static void testExternalChange() {
+    Fan fan;
+    fan.set(40);
+    fan.step(EvaluationPeriod);
+
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 40, 2600, false));
+    CHECK(!fan.sensor.underperforming);
+
+    CHECK(!FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 70, 1000, false));
+    CHECK(fan.sensor.externalChanges == 1);
+    CHECK(fan.sensor.lastState == Unknown);
+    CHECK(fan.sensor.expected == 0);
+    CHECK(!fan.sensor.underperforming);
+
+    // Unknown on either side isn't a change
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 70, 1000, false));
+    fan.set(50);
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, Unknown, 3000, false));
+    CHECK(fan.sensor.externalChanges == 1);
+}
+
+// Firmware's notification holds through forced reads until the next periodic one
+static void testNotification() {
+    Fan fan;
+    fan.set(60);
+    fan.sensor.notified = true;
+
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 60, 3400, true));
+    CHECK(fan.sensor.underperforming && fan.sensor.notified);
+
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 60, 3400, false));
+    CHECK(fan.sensor.underperforming && !fan.sensor.notified);
+
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 60, 3400, false));
+    CHECK(!fan.sensor.underperforming);
+
+    // 80% of the curve is still keeping up
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 60, 3400 * DPTFFanUnderperformPercent / 100, false));
+    CHECK(!fan.sensor.underperforming);
+    CHECK(FanFeedback::sample(&fan.sensor, Curve, CurvePoints, 60, 3400 * DPTFFanUnderperformPercent / 100 - 1, false));
+    CHECK(fan.sensor.underperforming);
+}
+
+int main() {
+    testCurve();
+    testLagging();
+    testWorn();
+    testStarvedOnlyAtFull();
+    testExternalChange();
+    testNotification();
+
+    return finish("fanfeedback");
+}
@@ -0,0 +1,202 @@
+//
+//  idlebackoff.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for IdleBackoff and the aux trip window. Simulates an hour of a
+//  cold machine, second by second, to count evaluations and how late a load
+//  that crosses a trip is seen, with and without aux trips:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o idlebackoff_test Tools/tests/idlebackoff.cpp ChultraDPTF/IdleBackoff.cpp ChultraDPTF/AcpiTrips.cpp
+//
+
+#include <stdio.h>
+
+#include "IdleBackoff.hpp"
+#include "AcpiTrips.hpp"
+#include "HostTest.h"
+
+using namespace ChultraACPIUtils;
+
+// Seconds per evaluation at the normal rate, DPTFPollingPeriodMS
+constexpr uint32_t EvaluationPeriod = 10;
+
+constexpr uint32_t Hour = 3600;
+
+// Fan on at 50 C and full at 60 C, throttling at 90 C
+static ActiveTrips sensorTrips() {
+    ActiveTrips trips {};
+    trips.points[0] = 600;
+    trips.points[1] = 500;
+    trips.hysteresis = 20;
+    trips.firmwareHysteresis = 20;
+    return trips;
+}
+
+static const LimitTrips Limits = { 900, 1000 };
+
+//
+// Idles around 42 C, then from loadStart warms half a degree a second
+// until it settles at 70 C.
+//
+static celsius_t temperatureAt(uint32_t second, uint32_t loadStart) {
+    celsius_t idle = 420 + (second * 7919) % 7;
+    if (second < loadStart) return idle;
+
+    uint32_t warmed = (second - loadStart) * 5;
+    return idle + warmed < 700 ? idle + warmed : 700;
+}
+
+struct Run {
+    uint32_t evaluations;
+    uint32_t notifications;
+    uint32_t latency;           // Seconds from crossing the fan's trip to the evaluation that saw it
+    bool seen;
+};
+
+//
+// The core's schedule for one sensor. canNotify says the sensor has PAT0
+// and PAT1, trusted makes the core back off fully whatever the sensor can
+// do, the way it did before the cap.
+//
+static Run simulate(uint32_t length, uint32_t loadStart, bool canNotify, bool trusted) {
+    ActiveTrips trips = sensorTrips();
+    Run run {};
+    uint32_t backoff = 1;
+    uint32_t due = 0;
+    bool forced = true;
+    bool armed = false;
+    celsius_t low = 0, high = 0;
+    uint32_t crossed = UINT32_MAX;
+
+    for (uint32_t second = 0; second < length; second++) {
+        celsius_t temp = temperatureAt(second, loadStart);
+        if (crossed == UINT32_MAX && temp > trips.points[1]) crossed = second;
+
+        // Firmware's Notify(0x90) on leaving the band, the core evaluates right away
+        if (armed && second < due && ((low != 0 && temp <= low) || temp >= high)) {
+            run.notifications++;
+            armed = false;
+            forced = true;
+            due = second;
+        }
+
+        if (second < due) continue;
+
+        run.evaluations++;
+        bool cold = !forced && acpiActiveTripLevel(&trips, temp) == AcpiActiveTripCount;
+        if (!cold && crossed != UINT32_MAX && !run.seen) {
+            run.latency = second - crossed;
+            run.seen = true;
+        }
+
+        armed = cold && canNotify && acpiAuxTripWindow(&trips, &Limits, temp, DPTFAuxTripBand, &low, &high);
+        backoff = IdleBackoff::next(backoff, forced, cold, armed || trusted);
+        forced = false;
+        due = second + EvaluationPeriod * backoff;
+    }
+
+    return run;
+}
+
+static void testNext() {
+    CHECK(IdleBackoff::next(1, true, true, true) == 1);
+    CHECK(IdleBackoff::next(8, false, false, true) == 1);
+
+    CHECK(IdleBackoff::next(1, false, true, true) == 2);
+    CHECK(IdleBackoff::next(2, false, true, true) == 4);
+    CHECK(IdleBackoff::next(4, false, true, true) == 8);
+    CHECK(IdleBackoff::next(8, false, true, true) == DPTFIdleBackoffMax);
+
+    // A sensor that can't wake us holds the period to a couple of evaluations
+    CHECK(IdleBackoff::next(1, false, true, false) == DPTFIdleBackoffBlindMax);
+    CHECK(IdleBackoff::next(2, false, true, false) == DPTFIdleBackoffBlindMax);
+    CHECK(IdleBackoff::next(8, false, true, false) == DPTFIdleBackoffBlindMax);
+}
+
+static void testWindow() {
+    ActiveTrips trips = sensorTrips();
+    celsius_t low = 0, high = 0;
+
+    CHECK(acpiAuxTripWindow(&trips, &Limits, 420, 50, &low, &high));
+    CHECK(low == 370 && high == 470);
+
+    // Never past the coolest trip, whichever kind it is
+    CHECK(acpiAuxTripWindow(&trips, &Limits, 480, 50, &low, &high));
+    CHECK(low == 430 && high == 500);
+
+    LimitTrips passiveFirst = { 450, 1000 };
+    CHECK(acpiAuxTripWindow(&trips, &passiveFirst, 420, 50, &low, &high));
+    CHECK(high == 450);
+
+    ActiveTrips none {};
+    LimitTrips criticalOnly = { 0, 440 };
+    CHECK(acpiAuxTripWindow(&none, &criticalOnly, 420, 50, &low, &high));
+    CHECK(high == 440);
+
+    LimitTrips noLimits = { 0, 0 };
+    CHECK(acpiAuxTripWindow(&none, &noLimits, 420, 50, &low, &high));
+    CHECK(low == 370 && high == 470);
+
+    // Below freezing the lower trip is off
+    CHECK(acpiAuxTripWindow(&trips, &Limits, 30, 50, &low, &high));
+    CHECK(low == 0 && high == 80);
+
+    // Nothing to arm for at or past a trip
+    CHECK(!acpiAuxTripWindow(&trips, &Limits, 500, 50, &low, &high));
+    CHECK(!acpiAuxTripWindow(&trips, &Limits, 650, 50, &low, &high));
+}
+
+static void testWakeups() {
+    uint32_t normal = Hour / EvaluationPeriod;
+    Run armed = simulate(Hour, Hour, true, false);
+    Run blind = simulate(Hour, Hour, false, false);
+
+    printf("cold hour: %u evaluations with aux trips, %u without, %u at the normal rate\n", armed.evaluations, blind.evaluations,
+           normal);
+
+    CHECK(armed.notifications == 0);
+    CHECK(armed.evaluations <= Hour / (EvaluationPeriod * DPTFIdleBackoffMax) + 4);
+    CHECK(blind.evaluations <= Hour / (EvaluationPeriod * DPTFIdleBackoffBlindMax) + 1);
+    CHECK(blind.evaluations < normal);
+}
+
+//
+// Load starts at every second of a fully stretched period, so the worst
+// case is in there. Aux trips wake the core back to its normal rate as the
+// load leaves the band, before it reaches the trip. Without them it waits
+// out at most the capped period. Trusting a sensor that can't notify is
+// what the backoff used to do.
+//
+static void testLatency() {
+    uint32_t worstArmed = 0, worstBlind = 0, worstTrusted = 0;
+    uint32_t span = EvaluationPeriod * DPTFIdleBackoffMax;
+
+    for (uint32_t start = Hour / 2; start < Hour / 2 + span; start++) {
+        Run armed = simulate(Hour, start, true, false);
+        Run blind = simulate(Hour, start, false, false);
+        Run trusted = simulate(Hour, start, false, true);
+
+        CHECK(armed.notifications == 1);
+        CHECK(armed.seen && blind.seen && trusted.seen);
+        if (armed.latency > worstArmed) worstArmed = armed.latency;
+        if (blind.latency > worstBlind) worstBlind = blind.latency;
+        if (trusted.latency > worstTrusted) worstTrusted = trusted.latency;
+    }
+
+    printf("worst time to see a load: %u s with aux trips, %u s without, %u s backed off blind\n", worstArmed, worstBlind, worstTrusted);
+
+    CHECK(worstArmed <= EvaluationPeriod);
+    CHECK(worstBlind <= EvaluationPeriod * DPTFIdleBackoffBlindMax);
+    CHECK(worstTrusted > EvaluationPeriod * DPTFIdleBackoffBlindMax);
+}
+
+int main() {
+    testNext();
+    testWindow();
+    testWakeups();
+    testLatency();
+
+    return finish("idlebackoff");
+}
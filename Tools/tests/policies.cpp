@@ -0,0 +1,368 @@
+//
+//  policies.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for the policies. Runs them against mocked samples, fans,
+//  processors and chargers through a Policies::Io, the way the core's
+//  DPTFPolicyContext hands them its participants, and checks the requests
+//  they leave for the core to arbitrate:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o policies_test Tools/tests/policies.cpp ChultraDPTF/Policies.cpp ChultraDPTF/FanAllocator.cpp ChultraDPTF/PowerPlan.cpp
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Policies.hpp"
+#include "HostTest.h"
+
+using namespace Policies;
+using ChultraACPIUtils::AcpiActiveTripCount;
+
+constexpr uint32_t None = AcpiActiveTripCount;
+
+// Seconds between evaluations, DPTFPollingPeriodMS
+constexpr uint64_t EvaluationPeriodMS = 10000;
+
+// Fan level per tripped _ACx, hottest first like _ART has them
+static const uint32_t CpuCurve[AcpiActiveTripCount] = { 100, 80, 60, 40, 20 };
+static const uint32_t SkinCurve[AcpiActiveTripCount] = { 70, 50, 30 };
+
+//
+// Fan 0 cools the processor and the skin, fan 1 only the skin and not as
+// well. Both rules reading the skin share one sample. Passive 0 is the
+// processor, passive 1 a charger with three levels.
+//
+static const Rule Rules[] = {
+    { 0, 100, CpuCurve, 0 },
+    { 1, 100, SkinCurve, NoPassive },
+    { 1, 20, SkinCurve, NoPassive },
+};
+
+static const Fan Fans[] = {
+    { 0, 0, 2, 1, 3000, 0, 100 },
+    { 1, 2, 1, 1, 3000, 0, 100 },
+};
+
+// Same fans, sharing a zone
+static const Fan ZoneFans[] = {
+    { 0, 0, 2, 1, 3000, 0, 100 },
+    { 0, 2, 1, 1, 3000, 0, 100 },
+};
+
+static const Table Separate = { Fans, 2, Rules, 3, 2, 2, EvaluationPeriodMS };
+static const Table Shared = { ZoneFans, 2, Rules, 3, 2, 2, EvaluationPeriodMS };
+
+constexpr uint32_t PassiveTrip = 950;
+constexpr uint32_t MinLimit = 10000;
+constexpr uint32_t MaxLimit = 50000;
+constexpr uint32_t Ceiling = 60;
+
+struct Mock {
+    Sample samples[2] { { None, 600, 0 }, { None, 400, 0 } };
+    bool readable[2] { true, true };
+
+    uint32_t power {3000};      // mW the processor draws
+    uint32_t levels[2] { 0, 3 };
+    FanState fans[2] { { NoRequest, 0, false }, { NoRequest, 0, false } };
+
+    uint32_t requests[RequestMax][4];
+    uint64_t now {0};
+
+    Mock() {
+        memset(requests, 0xFF, sizeof(requests));
+    }
+
+    static bool readSample(void *context, uint32_t rule, Sample *sample) {
+        Mock *mock = static_cast<Mock *>(context);
+        uint32_t index = Rules[rule].sample;
+
+        if (!mock->readable[index]) return false;
+
+        *sample = mock->samples[index];
+        sample->timestampMS = mock->now;
+        return true;
+    }
+
+    // Only passive 0 is a processor, the charger doesn't answer
+    static bool readProcessor(void *context, uint32_t passive, const Sample *sample, Processor *processor) {
+        Mock *mock = static_cast<Mock *>(context);
+        if (passive != 0) return false;
+
+        processor->status = { sample != nullptr ? sample->temperature : 0, PassiveTrip, mock->power, MinLimit, MaxLimit, 0 };
+        processor->timeConstantMS = 0;
+        processor->timestampMS = mock->now;
+        return true;
+    }
+
+    static uint32_t throttleLevels(void *context, uint32_t passive) {
+        return static_cast<Mock *>(context)->levels[passive];
+    }
+
+    static void readFan(void *context, uint32_t fan, FanState *state) {
+        *state = static_cast<Mock *>(context)->fans[fan];
+    }
+
+    static void request(void *context, Request request, uint32_t index, uint32_t value) {
+        static_cast<Mock *>(context)->requests[request][index] = value;
+    }
+
+    Io io() {
+        return { this, readSample, readProcessor, throttleLevels, readFan, request, Ceiling };
+    }
+
+    // What the core would do with the fan levels, so the passive policy sees its fans running
+    void runFans() {
+        for (uint32_t i = 0; i < 2; i++) {
+            uint32_t level = requests[RequestFanLevel][i];
+            fans[i].command = level;
+            fans[i].achieved = level != NoRequest ? level : 0;
+        }
+    }
+};
+
+struct Active {
+    FanAllocator::Rule rules[3];
+    FanAllocator::Fan fans[2];
+    FanAllocator::Source sources[2];
+
+    void evaluate(const Table &table, Mock *mock) {
+        evaluateActive(table, mock->io(), { rules, fans, sources });
+    }
+};
+
+static void testCurves() {
+    Mock mock;
+    Active active;
+
+    // Nothing tripped, every fan off
+    active.evaluate(Separate, &mock);
+    CHECK(mock.requests[RequestFanLevel][0] == 0);
+    CHECK(mock.requests[RequestFanLevel][1] == 0);
+    CHECK(mock.requests[RequestRuleLevel][0] == 0);
+
+    // A fan runs at the fastest of its sources' curves
+    mock.samples[0].level = 3;
+    mock.samples[1].level = 1;
+    active.evaluate(Separate, &mock);
+    CHECK(mock.requests[RequestRuleLevel][0] == 40);
+    CHECK(mock.requests[RequestRuleLevel][1] == 50);
+    CHECK(mock.requests[RequestRuleLevel][2] == 50);
+    CHECK(mock.requests[RequestFanLevel][0] == 50);
+    CHECK(mock.requests[RequestFanLevel][1] == 50);
+
+    mock.samples[0].level = 0;
+    active.evaluate(Separate, &mock);
+    CHECK(mock.requests[RequestFanLevel][0] == 100);
+    CHECK(mock.requests[RequestFanLevel][1] == 50);
+
+    // Passive requests are the passive policy's, the active one leaves them alone
+    CHECK(mock.requests[RequestPowerLimit][0] == NoRequest);
+    CHECK(mock.requests[RequestFanFloor][0] == NoRequest);
+}
+
+static void testFailedRead() {
+    Mock mock;
+    Active active;
+
+    mock.samples[0].level = 0;
+    mock.samples[1].level = 0;
+    mock.readable[0] = false;
+    active.evaluate(Separate, &mock);
+
+    // A sensor that didn't answer asks for nothing, the others still count
+    CHECK(mock.requests[RequestRuleLevel][0] == 0);
+    CHECK(mock.requests[RequestRuleLevel][1] == 70);
+    CHECK(mock.requests[RequestFanLevel][0] == 70);
+
+    mock.readable[1] = false;
+    active.evaluate(Separate, &mock);
+    CHECK(mock.requests[RequestFanLevel][0] == 0);
+    CHECK(mock.requests[RequestFanLevel][1] == 0);
+}
+
+// Fans of a zone get FanAllocator's split, fans alone in theirs don't
+static void testZones() {
+    Mock mock;
+    Active active;
+
+    mock.samples[0].level = None;
+    mock.samples[1].level = 0;
+    active.evaluate(Shared, &mock);
+
+    FanAllocator::Fan fans[2] = {
+        { 1, 3000, 0, 100, 0, 2, 70, 70 },
+        { 1, 3000, 0, 100, 2, 1, 70, 70 },
+    };
+    FanAllocator::Rule rules[3] = { { 0, 100, 0 }, { 1, 100, 70 }, { 1, 20, 70 } };
+    FanAllocator::Source sources[2];
+    FanAllocator::allocate(fans, 2, rules, sources);
+
+    CHECK(mock.requests[RequestFanLevel][0] == fans[0].allocated);
+    CHECK(mock.requests[RequestFanLevel][1] == fans[1].allocated);
+    // The fan that cools the skin better carries more of it
+    CHECK(fans[0].allocated > 70 && fans[1].allocated < 70);
+
+    active.evaluate(Separate, &mock);
+    CHECK(mock.requests[RequestFanLevel][0] == 70);
+    CHECK(mock.requests[RequestFanLevel][1] == 70);
+}
+
+struct Passive {
+    PowerPlan::Model model {};
+    PowerPlan::Model *models[2] { &model, nullptr };
+    PassiveState state { models, 0, 0 };
+
+    void evaluate(Mock *mock) {
+        mock->now += EvaluationPeriodMS;
+        evaluatePassive(Separate, mock->io(), &state);
+    }
+};
+
+//
+// A processor drawing far more than its fans can carry quietly wants PL1
+// cut. The chargers step down first, one level per evaluation, and PL1
+// stays at firmware's until they are as slow as they go.
+//
+static void testChargersFirst() {
+    Mock mock;
+    Passive passive;
+    Active active;
+
+    mock.samples[0].level = 2;
+    mock.power = 40000;
+    active.evaluate(Separate, &mock);
+    mock.runFans();
+
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] == 0);
+    CHECK(mock.requests[RequestThrottle][1] == 1);
+
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] == 0);
+    CHECK(mock.requests[RequestThrottle][1] == 2);
+
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] != 0 && mock.requests[RequestPowerLimit][0] < MaxLimit);
+    CHECK(mock.requests[RequestPowerLimit][0] >= MinLimit);
+    CHECK(mock.requests[RequestThrottle][1] == 2);
+
+    // The plan bounds the processor's fan only, at the acoustic ceiling
+    CHECK(mock.requests[RequestFanFloor][0] == Ceiling);
+    CHECK(mock.requests[RequestFanCeiling][0] == Ceiling);
+    CHECK(mock.requests[RequestFanFloor][1] == NoRequest);
+    CHECK(mock.requests[RequestFanCeiling][1] == NoRequest);
+
+    // Neither a charger's PL1 nor a processor's throttle level is asked for
+    CHECK(mock.requests[RequestPowerLimit][1] == NoRequest);
+    CHECK(mock.requests[RequestThrottle][0] == NoRequest);
+
+    // A plan only holds for the evaluation that made it
+    passive.models[0] = nullptr;
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] == 0);
+    CHECK(mock.requests[RequestFanFloor][0] == NoRequest);
+    CHECK(mock.requests[RequestFanCeiling][0] == NoRequest);
+}
+
+// A light load keeps PL1 and the chargers where firmware has them
+static void testLightLoad() {
+    Mock mock;
+    Passive passive;
+    Active active;
+
+    mock.samples[0].level = 3;
+    active.evaluate(Separate, &mock);
+    mock.runFans();
+
+    for (int i = 0; i < 5; i++) {
+        passive.evaluate(&mock);
+        CHECK(mock.requests[RequestPowerLimit][0] == 0);
+        CHECK(mock.requests[RequestThrottle][1] == 0);
+    }
+
+    CHECK(mock.requests[RequestFanFloor][0] != NoRequest);
+    CHECK(mock.requests[RequestFanFloor][0] <= Ceiling);
+}
+
+// Without a model or a running fan there is nothing to trade, PL1 goes back to firmware
+static void testNothingToTrade() {
+    Mock mock;
+    Passive passive;
+
+    mock.power = 40000;
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] == 0);
+    CHECK(mock.requests[RequestFanFloor][0] == NoRequest);
+    CHECK(passive.state.chargerShed == 0);
+
+    Active active;
+    mock.samples[0].level = 2;
+    active.evaluate(Separate, &mock);
+    mock.runFans();
+    passive.models[0] = nullptr;
+
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestPowerLimit][0] == 0);
+    CHECK(mock.requests[RequestFanFloor][0] == NoRequest);
+}
+
+// Starved fans push the chargers down a level per evaluation, and let them back up the same way
+static void testStarved() {
+    Mock mock;
+    Passive passive;
+
+    mock.fans[1] = { 100, 80, true };
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 1);
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 2);
+
+    // Never deeper than the charger goes
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 2);
+    CHECK(passive.state.escalation == 2);
+
+    // Each device only as deep as it goes itself
+    Mock shallow;
+    Passive both;
+    shallow.levels[0] = 2;
+    shallow.fans[1] = { 100, 80, true };
+    for (int i = 0; i < 3; i++) both.evaluate(&shallow);
+    CHECK(shallow.requests[RequestThrottle][0] == 1);
+    CHECK(shallow.requests[RequestThrottle][1] == 2);
+
+    // A fan nobody commands isn't starved, whatever it last reported
+    mock.fans[1] = { NoRequest, 0, true };
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 1);
+
+    mock.fans[1] = { 100, 100, false };
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 0);
+    passive.evaluate(&mock);
+    CHECK(mock.requests[RequestThrottle][1] == 0);
+
+    // Nothing to throttle with, nothing asked for
+    Mock bare;
+    Passive none;
+    bare.levels[1] = 0;
+    bare.fans[1] = { 100, 80, true };
+    none.evaluate(&bare);
+    CHECK(bare.requests[RequestThrottle][1] == NoRequest);
+    CHECK(none.state.escalation == 0);
+}
+
+int main() {
+    testCurves();
+    testFailedRead();
+    testZones();
+    testChargersFirst();
+    testLightLoad();
+    testNothingToTrade();
+    testStarved();
+
+    return finish("policies");
+}
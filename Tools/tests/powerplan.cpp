@@ -0,0 +1,299 @@
+//
+//  powerplan.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for PowerPlan. Closes the loop around a simulated package,
+//  a first order heatsink whose resistance falls with fan speed, evaluated
+//  as often as the core does, through light, medium and heavy workloads,
+//  and prints how each one settles:
+//      c++ -std=c++17 -Wall -Wextra -IChultraDPTF
+//          -o powerplan_test Tools/tests/powerplan.cpp ChultraDPTF/PowerPlan.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "PowerPlan.hpp"
+#include "HostTest.h"
+
+constexpr uint32_t PassiveTrip = 950;
+constexpr uint32_t MinLimit = 10000;
+constexpr uint32_t MaxLimit = 50000;
+constexpr uint32_t Ceiling = 60;
+
+// Seconds between evaluations, DPTFPollingPeriodMS
+constexpr int EvaluationPeriod = 10;
+
+// The heatsink's, in seconds
+constexpr double PlantTau = 60.0;
+
+//
+// T' = (ambient + P * R0 * 100 / (100 + f) - T) / tau, one step per
+// second. The fan reaches its command within a step and the package
+// draws its demand up to whatever PL1 allows.
+//
+struct Plant {
+    double resistance;      // Degrees per W with the fan off
+    double tau;             // Seconds
+    double temperature;     // Degrees
+
+    void step(double watts, uint32_t fan) {
+        double target = DPTFArbiterAmbient / 10.0 + watts * resistance * 100 / (100 + fan);
+        temperature += (target - temperature) / tau;
+    }
+};
+
+struct Loop {
+    Plant plant;
+    uint32_t timeConstantMS {0};    // What the thermal fit knows, 0 for nothing yet
+    uint32_t resolution {1};        // Sensor steps, tenths of a degree
+    PowerPlan::Model model {};
+    PowerPlan::Plan plan {0, 100, 0, false};
+    uint32_t fan {0};
+    uint32_t limit {0};
+    uint32_t power {0};
+    uint32_t peak {0};
+    uint64_t now {0};
+
+    // What the active policy asks for on its own, a plain trip at 70 degrees
+    uint32_t request(uint32_t temperature) const {
+        return temperature >= 700 ? 30 : 0;
+    }
+
+    uint32_t temperature() const {
+        return static_cast<uint32_t>(plant.temperature * 10);
+    }
+
+    // The core evaluates once per period, the plant keeps moving in between
+    void run(uint32_t demand, int seconds) {
+        peak = 0;
+
+        for (int t = 0; t < seconds; t += EvaluationPeriod) {
+            PowerPlan::Processor cpu {};
+            cpu.temperature = temperature() / resolution * resolution;
+            cpu.passiveTrip = PassiveTrip;
+            cpu.power = power;
+            cpu.minLimit = MinLimit;
+            cpu.maxLimit = MaxLimit;
+            cpu.appliedLimit = limit;
+
+            PowerPlan::plan(&model, cpu, fan, Ceiling, timeConstantMS, now, &plan);
+            if (model.resistance != 0) {
+                fan = PowerPlan::fanLevel(plan, request(cpu.temperature), 0);
+                limit = plan.powerLimit;
+            } else {
+                fan = request(cpu.temperature);
+            }
+
+            uint32_t allowed = limit == 0 ? MaxLimit : limit;
+            power = demand < allowed ? demand : allowed;
+
+            for (int i = 0; i < EvaluationPeriod; i++) {
+                plant.step(power / 1000.0, fan);
+                if (temperature() > peak) peak = temperature();
+            }
+
+            now += EvaluationPeriod * 1000;
+        }
+    }
+};
+
+static Loop makeLoop(uint32_t timeConstantMS = static_cast<uint32_t>(PlantTau * 1000)) {
+    Loop loop;
+    loop.plant = {3.0, PlantTau, DPTFArbiterAmbient / 10.0};
+    loop.timeConstantMS = timeConstantMS;
+    loop.now = 1000;
+    return loop;
+}
+
+static void report(const char *name, const Loop &loop) {
+    printf("%-16s %5.1f C (peak %5.1f), fan %3u, PL1 %5u mW, R0 %4u mC/W, demand %5u mW, %s\n", name,
+           loop.temperature() / 10.0, loop.peak / 10.0, loop.fan, loop.limit, loop.model.resistance, loop.model.demand,
+           loop.plan.throttling ? "throttle first" : "fan first");
+}
+
+// 10 W sits well under _PSV with the fan off
+static void testLight() {
+    Loop loop = makeLoop();
+    loop.run(10000, 600);
+    report("light", loop);
+
+    CHECK(!loop.plan.throttling);
+    CHECK(loop.limit == 0);
+    CHECK(loop.plan.fanFloor == 0);
+    CHECK(loop.peak < PassiveTrip);
+}
+
+// 25 W needs the fan at about 25%, which the ceiling allows
+static void testMedium() {
+    Loop loop = makeLoop();
+    loop.run(25000, 600);
+    report("medium", loop);
+
+    CHECK(!loop.plan.throttling);
+    CHECK(loop.limit == 0);
+    CHECK(loop.plan.fanFloor >= 20 && loop.plan.fanFloor <= 30);
+    CHECK(loop.peak <= PassiveTrip + 30);
+
+    // The fit is of the real plant once it has settled
+    CHECK(loop.model.resistance >= 2850 && loop.model.resistance <= 3150);
+}
+
+//
+// 45 W needs more fan than the ceiling, PL1 makes up the rest. The
+// heatsink is still warming for minutes, which must not read as a low R0
+// whether the time constant is known, or not yet and the sensor only
+// reads whole degrees.
+//
+static void testHeavy() {
+    static const struct {
+        const char *name;
+        uint32_t timeConstantMS;
+        uint32_t resolution;
+    } cases[] = {
+        {"heavy", static_cast<uint32_t>(PlantTau * 1000), 1},
+        {"heavy, no tau", 0, 10},
+        {"heavy, tau short", static_cast<uint32_t>(PlantTau * 1000 / 2), 1},
+    };
+
+    for (const auto &c : cases) {
+        Loop loop = makeLoop(c.timeConstantMS);
+        loop.resolution = c.resolution;
+        loop.run(45000, 900);
+        report(c.name, loop);
+
+        // Sustainable at the ceiling is 60 degrees of rise / (3 C/W * 100 / 160)
+        CHECK(loop.plan.throttling);
+        CHECK(loop.fan == Ceiling);
+        CHECK(loop.limit >= 30000 && loop.limit <= 34000);
+        CHECK(loop.temperature() <= PassiveTrip + 10);
+        CHECK(loop.peak <= PassiveTrip + 30);
+
+        // Load goes away, the limit has to follow within half a minute
+        loop.run(10000, 30);
+        CHECK(!loop.plan.throttling);
+        CHECK(loop.limit == 0);
+    }
+}
+
+//
+// R0 starts at the prior, _PSV at the lowest PL1 with the fan off, and
+// idle packages, unknown temperatures and readings still on the move
+// without a time constant say nothing about it
+//
+static void testNoFit() {
+    constexpr uint32_t Prior = (PassiveTrip - DPTFArbiterAmbient) * 100 * 1000 / MinLimit;
+    PowerPlan::Model model {};
+    PowerPlan::Plan plan;
+    PowerPlan::Processor cpu {600, PassiveTrip, 1000, MinLimit, MaxLimit, 0};
+
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 1000, &plan);
+    CHECK(model.resistance == Prior);
+    CHECK(plan.fanFloor == 0 && plan.fanCeiling == Ceiling && plan.powerLimit == 0);
+
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 11000, &plan);
+    CHECK(model.resistance == Prior);
+
+    cpu.power = 20000;
+    cpu.temperature = 0;
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 21000, &plan);
+    CHECK(model.resistance == Prior);
+
+    // 2 degrees in 10 s is still warming
+    cpu.temperature = 620;
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 31000, &plan);
+    CHECK(model.resistance == Prior);
+
+    // Settled, and now it counts
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 41000, &plan);
+    CHECK(model.resistance < Prior);
+
+    // Too long since the last reading to tell a slope
+    model = {};
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 60000, 1000, &plan);
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 60000, 1000 + DPTFArbiterMaxGapMS + 1, &plan);
+    CHECK(model.resistance == Prior);
+
+    // No prior without a lowest PL1
+    model = {};
+    cpu.minLimit = 0;
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 1000, &plan);
+    CHECK(model.resistance == 0);
+    CHECK(plan.fanFloor == 0 && plan.fanCeiling == 100 && plan.powerLimit == 0);
+
+    cpu.minLimit = MinLimit;
+    cpu.temperature = 900;
+    cpu.passiveTrip = DPTFArbiterAmbient;
+    PowerPlan::plan(&model, cpu, 0, Ceiling, 0, 11000, &plan);
+    CHECK(model.resistance == 0);
+    CHECK(plan.fanCeiling == 100 && !plan.throttling);
+}
+
+// The ceiling holds the processor's share only
+static void testFanLevel() {
+    PowerPlan::Plan plan {20, 40, 0, false};
+
+    CHECK(PowerPlan::fanLevel(plan, 10, 0) == 20);
+    CHECK(PowerPlan::fanLevel(plan, 30, 0) == 30);
+    CHECK(PowerPlan::fanLevel(plan, 80, 0) == 40);
+    CHECK(PowerPlan::fanLevel(plan, 80, 80) == 80);
+    CHECK(PowerPlan::fanLevel(plan, 80, 50) == 50);
+    CHECK(PowerPlan::fanLevel(plan, 50, 90) == 50);
+    CHECK(PowerPlan::fanLevel(plan, 0, 0) == 20);
+
+    plan = {60, 60, 32000, true};
+    CHECK(PowerPlan::fanLevel(plan, 10, 0) == 60);
+    CHECK(PowerPlan::fanLevel(plan, 100, 100) == 100);
+}
+
+//
+// A load that wants PL1 cut for six evaluations. The chargers go down a
+// level at a time before PL1 is touched, and only come back up once PL1
+// is back at firmware's.
+//
+static void testChargersFirst() {
+    const uint32_t deepest = 3;
+    const bool wanted[] = { true, true, true, true, true, true, false, false, false, false };
+    const bool expectCut[] = { false, false, false, true, true, true, false, false, false, false };
+    const uint32_t expectChargers[] = { 1, 2, 3, 3, 3, 3, 2, 1, 0, 0 };
+    uint32_t chargers = 0;
+    bool limited = false;
+
+    for (uint32_t tick = 0; tick < sizeof(wanted) / sizeof(wanted[0]); tick++) {
+        bool cut = wanted[tick] && PowerPlan::mayCut(chargers, deepest, limited);
+        CHECK(cut == expectCut[tick]);
+        CHECK(!cut || chargers == deepest);
+
+        uint32_t before = chargers;
+        limited = cut;
+        chargers = PowerPlan::chargerLevel(chargers, deepest, wanted[tick], limited);
+        CHECK(chargers == expectChargers[tick]);
+        CHECK(!limited || chargers >= before);
+    }
+
+    // Nothing to shed, PL1 goes straight away
+    CHECK(PowerPlan::mayCut(0, 0, false));
+    CHECK(PowerPlan::chargerLevel(0, 0, true, true) == 0);
+
+    // A charger turning up doesn't lift a cut already in place
+    CHECK(PowerPlan::mayCut(0, 3, true));
+    CHECK(PowerPlan::chargerLevel(0, 3, true, true) == 1);
+
+    // Another processor still held keeps them down, one going away clamps them
+    CHECK(PowerPlan::chargerLevel(3, 3, false, true) == 3);
+    CHECK(PowerPlan::chargerLevel(3, 1, false, true) == 1);
+    CHECK(PowerPlan::chargerLevel(3, 1, true, false) == 1);
+}
+
+int main() {
+    testLight();
+    testMedium();
+    testHeavy();
+    testNoFit();
+    testFanLevel();
+    testChargersFirst();
+
+    return finish("powerplan");
+}
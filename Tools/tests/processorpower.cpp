@@ -0,0 +1,203 @@
+//
+//  processorpower.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for ProcessorPower against mocked PPCC, _PSS and _TSS packages
+//  and RAPL MSR values:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o processorpower_test Tools/tests/processorpower.cpp ChultraDPTF/ProcessorPower.cpp
+//
+
+#include <stdio.h>
+
+#include "ProcessorPower.hpp"
+#include "HostTest.h"
+
+using ProcessorPower::Count;
+
+//
+// An evaluated package. Each row is an integer or a package of integers,
+// bits in strings mark elements that are something else, e.g. a Buffer
+// firmware left in by mistake.
+//
+struct MockRow {
+    bool package;
+    uint32_t count;
+    uint32_t values[8];
+    uint32_t strings;
+};
+
+struct MockPackage {
+    uint32_t count;
+    MockRow rows[10];
+};
+
+static bool readMock(void *context, uint32_t row, uint32_t column, uint32_t *value) {
+    const MockPackage *package = static_cast<const MockPackage *>(context);
+    if (row == Count) {
+        *value = package->count;
+        return true;
+    }
+
+    if (row >= package->count || !package->rows[row].package) return false;
+
+    const MockRow *elements = &package->rows[row];
+    if (column == Count) {
+        *value = elements->count;
+        return true;
+    }
+
+    if (column >= elements->count || (elements->strings & (1u << column)) != 0) return false;
+
+    *value = elements->values[column];
+    return true;
+}
+
+static MockRow integer(uint32_t value) {
+    return { false, 0, { value }, 0 };
+}
+
+// A typical U-series part, PL1 4.5-15 W and PL2 at 25 W
+static const MockRow PL1 = { true, 6, { 0, 4500, 15000, 28000, 32000, 250 }, 0 };
+static const MockRow PL2 = { true, 6, { 1, 25000, 25000, 2000, 2000, 250 }, 0 };
+
+static void testPpcc() {
+    ProcessorPower::PowerLimitRange range {};
+
+    MockPackage plain = { 3, { integer(2), PL1, PL2 } };
+    CHECK(ProcessorPower::parsePpcc(readMock, &plain, &range));
+    CHECK(range.index == 0 && range.minPower == 4500 && range.maxPower == 15000);
+    CHECK(range.minWindow == 28000 && range.maxWindow == 32000 && range.step == 250);
+
+    // Firmware may list PL2 first
+    MockPackage swapped = { 3, { integer(2), PL2, PL1 } };
+    range = {};
+    CHECK(ProcessorPower::parsePpcc(readMock, &swapped, &range));
+    CHECK(range.index == 0 && range.maxPower == 15000);
+
+    // Broken PL1 rows are passed over for a later good one
+    MockRow shortRow = { true, 5, { 0, 4500, 15000, 28000, 32000 }, 0 };
+    MockRow buffer = { true, 6, { 0, 4500, 15000, 28000, 32000, 250 }, 1u << 2 };
+    MockRow inverted = { true, 6, { 0, 15000, 4500, 28000, 32000, 250 }, 0 };
+    MockRow good = { true, 7, { 0, 6000, 12000, 28000, 28000, 500, 99 }, 0 };
+    MockPackage broken = { 6, { integer(2), shortRow, buffer, inverted, integer(0), good } };
+    range = {};
+    CHECK(ProcessorPower::parsePpcc(readMock, &broken, &range));
+    CHECK(range.minPower == 6000 && range.maxPower == 12000 && range.step == 500);
+
+    // Nothing usable
+    MockPackage revisionOnly = { 1, { integer(2) } };
+    CHECK(!ProcessorPower::parsePpcc(readMock, &revisionOnly, &range));
+    MockPackage onlyPL2 = { 2, { integer(2), PL2 } };
+    CHECK(!ProcessorPower::parsePpcc(readMock, &onlyPL2, &range));
+    MockPackage onlyBroken = { 4, { integer(2), shortRow, buffer, inverted } };
+    CHECK(!ProcessorPower::parsePpcc(readMock, &onlyBroken, &range));
+
+    // The revision sits where a range would be, it isn't one
+    MockPackage noRevision = { 1, { PL1 } };
+    CHECK(!ProcessorPower::parsePpcc(readMock, &noRevision, &range));
+}
+
+static void testStates() {
+    // Package { CoreFreq, Power, Latency, BusMasterLatency, Control, Status }
+    MockPackage pss = { 6, {
+        { true, 6, { 2801, 15000, 10, 10, 0x1C00, 0x1C00 }, 0 },
+        { true, 6, { 2800, 15000, 10, 10, 0x1C00, 0x1C00 }, 0 },
+        { true, 6, { 2000, 9000, 10, 10, 0x1400, 0x1400 }, 0 },
+        { true, 6, { 800, 3000, 10, 10, 0x0800, 0x0800 }, 0 },
+        integer(0),
+        { true, 3, { 400, 1000, 10 }, 0 },
+    } };
+    CHECK(ProcessorPower::countStates(readMock, &pss, 6) == 4);
+
+    // Package { FreqPercent, Power, Latency, Control, Status }
+    MockPackage tss = { 8, {} };
+    for (uint32_t i = 0; i < 8; i++) {
+        tss.rows[i] = { true, 5, { 100 - i * 12, 0, 0, i == 0 ? 0 : 0x10 | (8 - i), 0 }, 0 };
+    }
+    CHECK(ProcessorPower::countStates(readMock, &tss, 5) == 8);
+
+    tss.rows[3].strings = 1u << 4;
+    CHECK(ProcessorPower::countStates(readMock, &tss, 5) == 7);
+
+    MockPackage empty = { 0, {} };
+    CHECK(ProcessorPower::countStates(readMock, &empty, 6) == 0);
+}
+
+static void testClamp() {
+    ProcessorPower::PowerLimitRange range = { 0, 4500, 15000, 28000, 32000, 250 };
+
+    CHECK(ProcessorPower::clampLimit(range, 1000) == 4500);
+    CHECK(ProcessorPower::clampLimit(range, 4500) == 4500);
+    CHECK(ProcessorPower::clampLimit(range, 7777) == 7750);
+    CHECK(ProcessorPower::clampLimit(range, 7999) == 7750);
+    CHECK(ProcessorPower::clampLimit(range, 15000) == 15000);
+    CHECK(ProcessorPower::clampLimit(range, 40000) == 15000);
+
+    // Steps count from the minimum, a max off the grid rounds under it
+    ProcessorPower::PowerLimitRange offGrid = { 0, 5100, 15000, 0, 0, 1000 };
+    CHECK(ProcessorPower::clampLimit(offGrid, 6000) == 5100);
+    CHECK(ProcessorPower::clampLimit(offGrid, 6100) == 6100);
+    CHECK(ProcessorPower::clampLimit(offGrid, 40000) == 14100);
+
+    ProcessorPower::PowerLimitRange anyStep = { 0, 4500, 15000, 0, 0, 0 };
+    CHECK(ProcessorPower::clampLimit(anyStep, 7777) == 7777);
+}
+
+static void testUnits() {
+    // What most client parts report, 1/8 W, 1/16384 J, 976 us
+    ProcessorPower::Units units = ProcessorPower::decodeUnits(0xA0E03);
+    CHECK(units.powerShift == 3 && units.energyShift == 14);
+
+    ProcessorPower::Units odd = ProcessorPower::decodeUnits(0xFFFFFFFFFFFFFFFFULL);
+    CHECK(odd.powerShift == 15 && odd.energyShift == 31);
+
+    // PL1 15 W and 28 s window, PL2 25 W enabled and clamped
+    uint64_t firmware = 0x00DD80C8005F8078ULL;
+
+    uint64_t limit = ProcessorPower::encodeLimit(firmware, 10000, units);
+    CHECK((limit & DPTFPackagePL1Mask) == 80);
+    CHECK((limit & DPTFPackagePL1Enable) != 0);
+    CHECK((limit & ~(DPTFPackagePL1Mask | DPTFPackagePL1Enable)) == (firmware & ~(DPTFPackagePL1Mask | DPTFPackagePL1Enable)));
+
+    // Under a unit rounds down, over the field saturates
+    CHECK((ProcessorPower::encodeLimit(0, 15100, units) & DPTFPackagePL1Mask) == 120);
+    CHECK((ProcessorPower::encodeLimit(0, 0xFFFFFFFF, units) & DPTFPackagePL1Mask) == DPTFPackagePL1Mask);
+    CHECK((ProcessorPower::encodeLimit(DPTFPackagePL1Mask, 1000, units) & DPTFPackagePL1Mask) == 8);
+
+    // The lock bit is left for the caller to check, never cleared
+    CHECK((ProcessorPower::encodeLimit(DPTFPackageLimitLock, 1000, units) & DPTFPackageLimitLock) != 0);
+}
+
+static void testEnergy() {
+    ProcessorPower::Units units = { 3, 14 };
+    ProcessorPower::EnergyCounter counter {};
+    uint64_t second = 1000000000ULL;
+
+    // 15 W for 10 s is 150 J
+    CHECK(ProcessorPower::measure(&counter, 1000, 5 * second, units) == 0);
+    CHECK(ProcessorPower::measure(&counter, 1000 + 150 * 16384, 15 * second, units) == 15000);
+
+    // Same instant again says nothing
+    CHECK(ProcessorPower::measure(&counter, 1000 + 150 * 16384, 15 * second, units) == 0);
+
+    // Across the 32 bit wrap
+    counter = { 0xFFFFFFFFu - 8192 + 1, 100 * second };
+    CHECK(ProcessorPower::measure(&counter, 16384 * 2 - 8192, 101 * second, units) == 2000);
+    CHECK(counter.lastEnergy == 16384 * 2 - 8192 && counter.lastTimeNs == 101 * second);
+
+    // Idle package, half a watt over 2.5 s
+    CHECK(ProcessorPower::measure(&counter, counter.lastEnergy + 16384 * 5 / 4, 101 * second + second * 5 / 2, units) == 500);
+}
+
+int main() {
+    testPpcc();
+    testStates();
+    testClamp();
+    testUnits();
+    testEnergy();
+
+    return finish("processorpower");
+}
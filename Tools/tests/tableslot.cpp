@@ -0,0 +1,209 @@
+//
+//  tableslot.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host stress test for DPTFTableSlot, the core's policy table publish and
+//  reclaim protocol. Registration threads keep publishing bigger and smaller
+//  tables under the lock while an evaluation thread walks whatever is current
+//  and reclaims with a try lock, like the timer does. Run it under ASan so any
+//  table freed while the reader can still hold it shows up:
+//      c++ -std=c++17 -Wall -Wextra -pthread -fsanitize=address,undefined -IChultraDPTF
+//          -o tableslot_test Tools/tests/tableslot.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TableSlot.hpp"
+#include "HostTest.h"
+
+constexpr uint32_t TableMagic = 0x44505446;
+constexpr uint32_t MaxEntries = 64;
+
+// Stands in for DPTFPolicyTable, every entry repeats the generation
+struct Table {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t count;
+    uint32_t entries[MaxEntries];
+    Table *retiredNext {nullptr};
+};
+
+static std::atomic<uint64_t> allocated {0};
+static std::atomic<uint64_t> released {0};
+static std::atomic<uint64_t> badReleases {0};
+
+struct Ops {
+    static void barrier() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    static void release(Table *table) {
+        if (table->magic != TableMagic) badReleases++;
+
+        memset(static_cast<void *>(table), 0xA5, sizeof(*table));
+        delete table;
+        released++;
+    }
+};
+
+typedef DPTFTableSlot<Table, Ops> Slot;
+
+static Table *makeTable(uint32_t generation, uint32_t count) {
+    Table *table = new Table;
+    table->magic = TableMagic;
+    table->generation = generation;
+    table->count = count;
+    for (uint32_t i = 0; i < count; i++) table->entries[i] = generation;
+
+    allocated++;
+    return table;
+}
+
+static void testSingleThreaded() {
+    Slot slot;
+    uint64_t before = released;
+
+    CHECK(slot.load() == nullptr);
+
+    Table *first = makeTable(1, 1);
+    CHECK(slot.publish(first) == nullptr);
+    CHECK(slot.load() == first);
+
+    Table *second = makeTable(2, 2);
+    CHECK(slot.publish(second) == first);
+    CHECK(slot.load() == second);
+
+    // Replaced tables stay alive until the reader reclaims
+    Table *third = makeTable(3, 3);
+    CHECK(slot.publish(third) == second);
+    CHECK(released == before);
+
+    slot.reclaim();
+    CHECK(released == before + 2);
+    CHECK(slot.load() == third && third->magic == TableMagic);
+
+    slot.reclaim();
+    CHECK(released == before + 2);
+
+    slot.clear();
+    CHECK(released == before + 3);
+    CHECK(slot.load() == nullptr);
+}
+
+struct Shared {
+    Slot slot;
+    std::mutex lock;
+    uint32_t generation {0};
+    std::atomic<int> writersLeft {0};
+};
+
+// Participants come and go, each change publishes a new table
+static void writer(Shared *shared, uint32_t seed, int changes) {
+    uint32_t count = 1;
+
+    for (int i = 0; i < changes; i++) {
+        seed = seed * 1664525 + 1013904223;
+        bool removal = (seed >> 16) % 3 == 0;
+
+        if (removal && count > 0) count--;
+        else if (!removal && count < MaxEntries) count++;
+
+        std::lock_guard<std::mutex> guard(shared->lock);
+        shared->slot.publish(makeTable(++shared->generation, count));
+    }
+
+    shared->writersLeft--;
+}
+
+struct ReaderStats {
+    uint64_t ticks;
+    uint64_t lostLock;
+    uint64_t emptyTicks;
+    uint64_t torn;
+    uint64_t backwards;
+};
+
+// The evaluation tick: reclaim if the lock is free, then walk one table
+static void reader(Shared *shared, ReaderStats *stats) {
+    uint32_t lastGeneration = 0;
+
+    while (shared->writersLeft > 0) {
+        stats->ticks++;
+
+        if (shared->lock.try_lock()) {
+            shared->slot.reclaim();
+            shared->lock.unlock();
+        } else {
+            stats->lostLock++;
+        }
+
+        Table *table = shared->slot.load();
+        if (table == nullptr) {
+            stats->emptyTicks++;
+            continue;
+        }
+
+        uint32_t generation = table->generation;
+        if (table->magic != TableMagic || table->count > MaxEntries) {
+            stats->torn++;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < table->count; i++) {
+            if (table->entries[i] != generation) {
+                stats->torn++;
+                break;
+            }
+        }
+
+        if (generation < lastGeneration) stats->backwards++;
+        lastGeneration = generation;
+    }
+}
+
+static void testStress() {
+    constexpr int Writers = 4;
+    constexpr int Changes = 20000;
+
+    Shared shared;
+    ReaderStats stats {};
+    uint64_t before = allocated;
+    std::vector<std::thread> threads;
+
+    shared.writersLeft = Writers;
+    std::thread evaluation(reader, &shared, &stats);
+    for (int i = 0; i < Writers; i++) threads.emplace_back(writer, &shared, 0x3400 + i, Changes);
+
+    for (std::thread &thread : threads) thread.join();
+    evaluation.join();
+
+    printf("stress: %llu ticks, %llu lost the lock, %u tables published\n",
+           static_cast<unsigned long long>(stats.ticks), static_cast<unsigned long long>(stats.lostLock), shared.generation);
+
+    CHECK(allocated - before == static_cast<uint64_t>(Writers) * Changes);
+    CHECK(shared.generation == static_cast<uint32_t>(Writers * Changes));
+    CHECK(stats.torn == 0);
+    CHECK(stats.backwards == 0);
+
+    // Whatever the last tick didn't get to goes with the core
+    shared.slot.clear();
+}
+
+int main() {
+    testSingleThreaded();
+    testStress();
+
+    CHECK(allocated == released);
+    CHECK(badReleases == 0);
+
+    return finish("tableslot");
+}
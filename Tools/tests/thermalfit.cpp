@@ -0,0 +1,345 @@
+//
+//  thermalfit.cpp
+//  ChultraDPTF
+//
+//  Created by Gwydien on 9/15/23.
+//
+//  Host test for ThermalFit. Feeds the fit traces from known first order
+//  plants, read by an ideal sensor and the way a participant reads them:
+//  whole degree _TMP, a little noise and the same smoothing filter. Checks
+//  the Q16 recursion against double precision, that it settles and that
+//  tau, K and T0 come back out:
+//      c++ -std=c++17 -Wall -Wextra -fsanitize=address,undefined -IChultraDPTF
+//          -o thermalfit_test Tools/tests/thermalfit.cpp ChultraDPTF/ThermalFit.cpp ChultraDPTF/AcpiTrips.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "ThermalFit.hpp"
+#include "AcpiTrips.hpp"
+#include "HostTest.h"
+
+constexpr uint32_t MaxPeriodMS = 10000;
+
+// Same sequence on every host, unlike <random>'s distributions
+struct Noise {
+    uint32_t state;
+
+    uint32_t next() {
+        state = state * 1664525 + 1013904223;
+        return state >> 8;
+    }
+
+    // Roughly normal, within +-amplitude
+    double sample(double amplitude) {
+        double sum = 0;
+        for (int i = 0; i < 4; i++) sum += next() / static_cast<double>(1 << 24);
+        return (sum / 2 - 1) * amplitude;
+    }
+};
+
+struct Plant {
+    const char *name;
+    double tau;     // Seconds
+    double gain;    // Tenths of a degree for the full input
+    double offset;  // Tenths of a degree with no input
+    uint32_t periodMS;
+};
+
+//
+// The same recursion in double precision, fed the same readings. Whatever
+// separates the two is the Q16 arithmetic rather than the data.
+//
+struct Reference {
+    double theta[3];
+    double covariance[3][3];
+    double lastTemperature;
+    uint64_t lastTimestamp;
+    double interval;
+
+    void reset() {
+        *this = {};
+        for (int i = 0; i < 3; i++) covariance[i][i] = 1000;
+    }
+
+    void update(uint32_t temperature, uint32_t input, uint64_t timestampMS) {
+        double previous = lastTemperature;
+        bool usable = lastTimestamp != 0;
+        double elapsed = static_cast<double>(timestampMS - lastTimestamp);
+
+        lastTemperature = temperature;
+        lastTimestamp = timestampMS;
+        if (!usable) return;
+
+        interval = interval == 0 ? elapsed : (interval * 3 + elapsed) / 4;
+
+        double x[3] = {previous / 1000, input / 100.0, 1};
+        double y = (temperature - previous) * 1000 / elapsed;
+        double px[3], xpx = 0, predicted = 0;
+
+        for (int i = 0; i < 3; i++) {
+            px[i] = 0;
+            for (int j = 0; j < 3; j++) px[i] += covariance[i][j] * x[j];
+            xpx += x[i] * px[i];
+            predicted += theta[i] * x[i];
+        }
+
+        double forgetting = static_cast<double>(DPTFModelForget) / DPTFModelOne;
+        double trace = 0;
+
+        for (int i = 0; i < 3; i++) theta[i] += px[i] / (forgetting + xpx) * (y - predicted);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) covariance[i][j] -= px[i] * px[j] / (forgetting + xpx);
+            trace += covariance[i][i];
+        }
+
+        if (trace < 3000) {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) covariance[i][j] /= forgetting;
+            }
+        }
+    }
+
+    double tauMS() const { return -1000.0 * 1000 / theta[0] - interval; }
+    double gain() const { return -1000 * theta[1] / theta[0]; }
+    double offset() const { return -1000 * theta[2] / theta[0]; }
+};
+
+// How the plant is read, an ideal sensor or a participant's _TMP
+struct Sensor {
+    uint32_t quantum;       // Tenths of a degree
+    double noise;           // Tenths of a degree, peak
+    bool smoothed;
+};
+
+constexpr Sensor Ideal {1, 0, false};
+constexpr Sensor Firmware {10, 5, true};
+
+struct Trace {
+    ThermalFit::Model model;
+    Reference reference;
+    double temperature;
+    uint64_t timestampMS;
+    uint32_t input;
+    ChultraACPIUtils::TempFilter filter;
+};
+
+static void startTrace(Trace *trace, const Plant &plant) {
+    ThermalFit::reset(&trace->model);
+    trace->reference.reset();
+    trace->temperature = plant.offset;
+    trace->timestampMS = 1000;
+    trace->input = 0;
+    trace->filter = {};
+}
+
+// Integrates in 100 ms steps, the fit only sees one reading per period
+static void runTrace(Trace *trace, const Plant &plant, const Sensor &sensor, Noise *noise, int samples) {
+    for (int k = 0; k < samples; k++) {
+        // A new input every 25 samples keeps every regressor excited
+        if (k % 25 == 0) trace->input = noise->next() % 101;
+
+        for (uint32_t s = 0; s < plant.periodMS / 100; s++) {
+            trace->temperature += 0.1 * (plant.gain * trace->input / 100.0 + plant.offset - trace->temperature) / plant.tau;
+        }
+
+        trace->timestampMS += plant.periodMS;
+
+        double reading = trace->temperature + noise->sample(sensor.noise);
+        uint32_t raw = static_cast<uint32_t>(lround(reading / sensor.quantum) * sensor.quantum);
+        if (sensor.smoothed) raw = ChultraACPIUtils::acpiFilterTemp(&trace->filter, raw);
+
+        ThermalFit::update(&trace->model, raw, trace->input, trace->timestampMS);
+        trace->reference.update(raw, trace->input, trace->timestampMS);
+    }
+}
+
+static bool within(double value, double expected, double tolerance) {
+    return fabs(value - expected) <= tolerance;
+}
+
+// Fans cool, so their gain is negative; a processor's package power heats
+static const Plant plants[] = {
+    {"fan 60s", 60, -150, 700, 2000},
+    {"fan 300s", 300, -250, 650, 10000},
+    {"cpu 20s", 20, 300, 450, 2000},
+    {"fan 120s", 120, -80, 550, 10000},
+    {"fan 600s", 600, -300, 800, 10000},
+};
+
+static bool runFit(const Plant &plant, const Sensor &sensor, uint32_t seed, Trace *trace, ThermalFit::Fit *fit) {
+    Noise noise {seed};
+
+    startTrace(trace, plant);
+    runTrace(trace, plant, sensor, &noise, 600);
+
+    *fit = {};
+    return ThermalFit::fit(trace->model, MaxPeriodMS, fit);
+}
+
+// Q16 lands where double precision does on the same readings
+static void testPrecision() {
+    static const Sensor sensors[] = {Ideal, Firmware};
+
+    for (const Sensor &sensor : sensors) {
+        for (const Plant &plant : plants) {
+            Trace trace;
+            ThermalFit::Fit fit;
+            CHECK(runFit(plant, sensor, 0x3404, &trace, &fit));
+
+            const Reference &reference = trace.reference;
+            CHECK(within(fit.timeConstantMS, reference.tauMS(), reference.tauMS() * 0.05));
+            CHECK(within(fit.gain, reference.gain(), fabs(reference.gain()) * 0.05));
+            CHECK(within(fit.offset, reference.offset(), 5));
+        }
+    }
+}
+
+// An ideal sensor gives the plant back, less the period the fit allows for smoothing
+static void testRecoveryIdeal() {
+    for (const Plant &plant : plants) {
+        Trace trace;
+        ThermalFit::Fit fit;
+        CHECK(runFit(plant, Ideal, 0x3404, &trace, &fit));
+
+        CHECK(within(fit.timeConstantMS, plant.tau * 1000, plant.tau * 1000 * 0.05 + plant.periodMS));
+        CHECK(within(fit.gain, plant.gain, fabs(plant.gain) * 0.05));
+        CHECK(within(fit.offset, plant.offset, 5));
+
+        // Derived tuning follows from the same fit
+        uint32_t period = fit.timeConstantMS / 10;
+        period = period < DPTFModelMinPeriodMS ? DPTFModelMinPeriodMS : period > MaxPeriodMS ? MaxPeriodMS : period;
+        CHECK(fit.samplingPeriodMS == period);
+        CHECK(fit.integralTimeMS == fit.timeConstantMS);
+        CHECK(fit.proportionalGain == static_cast<uint32_t>(100000 / labs(fit.gain)));
+    }
+}
+
+static double median(double *values, int count) {
+    std::sort(values, values + count);
+    return values[count / 2];
+}
+
+//
+// Whole degrees, noise and the filter cost accuracy. The fit only remembers
+// about a hundred readings, so any one fit wanders with the noise in them;
+// across runs it centres on the plant. tau reads slow on the fastest plant,
+// where the filter's lag is a tenth of tau.
+//
+static void testRecoveryFirmware() {
+    constexpr int Runs = 25;
+
+    for (const Plant &plant : plants) {
+        double tau[Runs], gain[Runs], offset[Runs];
+
+        for (int run = 0; run < Runs; run++) {
+            Trace trace;
+            ThermalFit::Fit fit;
+            CHECK(runFit(plant, Firmware, 0x3400 + run, &trace, &fit));
+
+            tau[run] = fit.timeConstantMS / 1000.0;
+            gain[run] = fit.gain;
+            offset[run] = fit.offset;
+
+            CHECK(within(tau[run], plant.tau, plant.tau * 0.4));
+            CHECK(within(gain[run], plant.gain, fabs(plant.gain) * 0.25));
+            CHECK(within(offset[run], plant.offset, 30));
+        }
+
+        double medianTau = median(tau, Runs), medianGain = median(gain, Runs), medianOffset = median(offset, Runs);
+        printf("%-9s tau %4.0f s -> %6.1f s [%6.1f, %6.1f], K %5.0f -> %5.0f, T0 %4.0f -> %4.0f\n", plant.name,
+               plant.tau, medianTau, tau[0], tau[Runs - 1], plant.gain, medianGain, plant.offset, medianOffset);
+
+        CHECK(within(medianTau, plant.tau, plant.tau * 0.2));
+        CHECK(within(medianGain, plant.gain, fabs(plant.gain) * 0.1));
+        CHECK(within(medianOffset, plant.offset, 10));
+    }
+}
+
+// Once settled on clean data, more of the same barely moves the parameters
+static void testConvergence() {
+    for (const Plant &plant : plants) {
+        Noise noise {0x3401};
+        Trace trace;
+        ThermalFit::Fit early {}, late {};
+
+        startTrace(&trace, plant);
+        runTrace(&trace, plant, Ideal, &noise, 400);
+        CHECK(ThermalFit::fit(trace.model, MaxPeriodMS, &early));
+
+        runTrace(&trace, plant, Ideal, &noise, 400);
+        CHECK(ThermalFit::fit(trace.model, MaxPeriodMS, &late));
+
+        CHECK(within(late.timeConstantMS, early.timeConstantMS, early.timeConstantMS * 0.05));
+        CHECK(within(late.gain, early.gain, labs(early.gain) * 0.05));
+        CHECK(within(late.offset, early.offset, 2));
+    }
+
+    // On noisy readings the covariance stays bounded and positive however long it runs
+    Noise noise {0x3402};
+    Trace trace;
+    startTrace(&trace, plants[0]);
+
+    for (int block = 0; block < 20; block++) {
+        runTrace(&trace, plants[0], Firmware, &noise, 500);
+
+        for (int i = 0; i < 3; i++) {
+            CHECK(trace.model.covariance[i][i] > 0);
+            CHECK(trace.model.covariance[i][i] <= DPTFModelCovariance * 3);
+        }
+    }
+}
+
+// The plant changes, e.g. a fan clogs with dust, and the fit follows it
+static void testTracking() {
+    Plant plant = plants[0];
+    Noise noise {0x3403};
+    Trace trace;
+    ThermalFit::Fit fit {};
+
+    startTrace(&trace, plant);
+    runTrace(&trace, plant, Firmware, &noise, 400);
+
+    plant.gain = -75;
+    runTrace(&trace, plant, Firmware, &noise, 600);
+
+    CHECK(ThermalFit::fit(trace.model, MaxPeriodMS, &fit));
+    CHECK(within(fit.gain, plant.gain, fabs(plant.gain) * 0.2));
+}
+
+static void testNoFit() {
+    ThermalFit::Model model;
+    ThermalFit::Fit fit;
+
+    // Too few updates
+    ThermalFit::reset(&model);
+    for (uint32_t k = 1; k < DPTFModelMinUpdates; k++) ThermalFit::update(&model, 500 + k, 50, 1000 + k * 2000ULL);
+    CHECK(!ThermalFit::fit(model, MaxPeriodMS, &fit));
+
+    // A sensor that never moves says nothing about tau
+    ThermalFit::reset(&model);
+    for (uint32_t k = 1; k <= 200; k++) ThermalFit::update(&model, 500, k % 2 == 0 ? 0 : 100, 1000 + k * 2000ULL);
+    CHECK(!ThermalFit::fit(model, MaxPeriodMS, &fit));
+
+    // Gaps across sleep and clocks going backwards aren't slopes
+    ThermalFit::reset(&model);
+    ThermalFit::update(&model, 500, 50, 1000);
+    ThermalFit::update(&model, 900, 50, 1000 + DPTFModelMaxGapMS + 1);
+    ThermalFit::update(&model, 400, 50, 500);
+    CHECK(model.updates == 0);
+}
+
+int main() {
+    testPrecision();
+    testRecoveryIdeal();
+    testRecoveryFirmware();
+    testConvergence();
+    testTracking();
+    testNoFit();
+
+    return finish("thermalfit");
+}